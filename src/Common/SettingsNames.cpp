@@ -62,6 +62,12 @@ const QString SettingsNames::imapSslPemPubKey = QLatin1String("imap.ssl.pemPubKe
 const QString SettingsNames::imapBlacklistedCapabilities = QLatin1String("imap.capabilities.blacklist");
 const QString SettingsNames::imapUseSystemProxy = QLatin1String("imap.proxy.system");
 const QString SettingsNames::imapNeedsNetwork = QLatin1String("imap.needsNetwork");
+const QString SettingsNames::imapWatchedMailboxes = QLatin1String("imap.watchedMailboxes");
+const QString SettingsNames::imapUseNotify = QLatin1String("imap.notify");
+const QString SettingsNames::imapPrewarmMailboxes = QLatin1String("imap.prewarmMailboxes");
+const QString SettingsNames::imapOfflineSync = QLatin1String("imap.offlineSync");
+const QString SettingsNames::imapOfflineSyncMailboxes = QLatin1String("imap.offlineSync.mailboxes");
+const QString SettingsNames::imapOfflineSyncPartSizeLimit = QLatin1String("imap.offlineSync.partSizeLimitKB");
 const QString SettingsNames::composerSaveToImapKey = QLatin1String("composer/saveToImapEnabled");
 const QString SettingsNames::composerImapSentKey = QLatin1String("composer/imapSentName");
 const QString SettingsNames::cacheMetadataKey = QLatin1String("offline.metadataCache");
@@ -71,6 +77,7 @@ const QString SettingsNames::cacheOfflineNone = QLatin1String("memory");
 const QString SettingsNames::cacheOfflineXDays = QLatin1String("days");
 const QString SettingsNames::cacheOfflineAll = QLatin1String("all");
 const QString SettingsNames::cacheOfflineNumberDaysKey = QLatin1String("offline.cache.numDays");
+const QString SettingsNames::cacheQuotaKey = QLatin1String("offline.cache.quotaMB");
 const QString SettingsNames::xtConnectCacheDirectory = QLatin1String("xtconnect.cachedir");
 const QString SettingsNames::xtSyncMailboxList = QLatin1String("xtconnect.listOfMailboxes");
 const QString SettingsNames::xtDbHost = QLatin1String("xtconnect.db.hostname");
@@ -35,10 +35,12 @@ struct SettingsNames {
     static const QString imapMethodKey, methodTCP, methodSSL, methodProcess, imapHostKey,
            imapPortKey, imapStartTlsKey, imapUserKey, imapProcessKey,
            imapStartOffline, imapEnableId, obsImapSslPemCertificate, imapSslPemPubKey,
-           imapBlacklistedCapabilities, imapUseSystemProxy, imapNeedsNetwork;
+           imapBlacklistedCapabilities, imapUseSystemProxy, imapNeedsNetwork, imapWatchedMailboxes, imapUseNotify,
+           imapPrewarmMailboxes, imapOfflineSync, imapOfflineSyncMailboxes, imapOfflineSyncPartSizeLimit;
     static const QString composerSaveToImapKey, composerImapSentKey, smtpUseBurlKey;
     static const QString cacheMetadataKey, cacheMetadataMemory,
-           cacheOfflineKey, cacheOfflineNone, cacheOfflineXDays, cacheOfflineAll, cacheOfflineNumberDaysKey;
+           cacheOfflineKey, cacheOfflineNone, cacheOfflineXDays, cacheOfflineAll, cacheOfflineNumberDaysKey,
+           cacheQuotaKey;
     static const QString xtConnectCacheDirectory, xtSyncMailboxList, xtDbHost, xtDbPort,
            xtDbDbName, xtDbUser;
     static const QString guiMsgListShowThreading;
@@ -244,6 +244,11 @@ void MessageView::setMessage(const QModelIndex &index)
 
         emit messageChanged();
 
+        // The index comes from the message list, so the read-ahead can follow the order in which the user sees the messages
+        Imap::Mailbox::Model *model = const_cast<Imap::Mailbox::Model *>(dynamic_cast<const Imap::Mailbox::Model *>(message.model()));
+        Q_ASSERT(model);
+        model->messageOpened(index);
+
         // We want to propagate the QWheelEvent to upper layers
         viewer->installEventFilter(this);
     }
@@ -29,11 +29,19 @@
 #include <QHeaderView>
 #include <QKeyEvent>
 #include <QPainter>
+#include <QScrollBar>
 #include <QSignalMapper>
 #include <QTimer>
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/PrettyMsgListModel.h"
 
+namespace {
+
+/** @short How many rows above and below the viewport are still considered to be close to it */
+const int nearbyRows = 150;
+
+}
+
 namespace Gui
 {
 
@@ -61,6 +69,15 @@ MsgListView::MsgListView(QWidget *parent): QTreeView(parent), m_autoActivateAfte
     m_naviActivationTimer = new QTimer(this);
     m_naviActivationTimer->setSingleShot(true);
     connect(m_naviActivationTimer, SIGNAL(timeout()), SLOT(slotCurrentActivated()));
+
+    // Let the IMAP model know what the user is looking at so that it can fetch these envelopes before any others.
+    // The range of the scrollbar changes when rows get added or removed.
+    m_visibleMessagesTimer = new QTimer(this);
+    m_visibleMessagesTimer->setSingleShot(true);
+    m_visibleMessagesTimer->setInterval(0);
+    connect(m_visibleMessagesTimer, SIGNAL(timeout()), this, SLOT(slotReportVisibleMessages()));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), m_visibleMessagesTimer, SLOT(start()));
+    connect(verticalScrollBar(), SIGNAL(rangeChanged(int,int)), m_visibleMessagesTimer, SLOT(start()));
 }
 
 // left might collapse a thread, question is whether ending there (on closing the thread) should be
@@ -103,6 +120,41 @@ bool MsgListView::event(QEvent *event)
     return QTreeView::event(event);
 }
 
+void MsgListView::resizeEvent(QResizeEvent *event)
+{
+    QTreeView::resizeEvent(event);
+    m_visibleMessagesTimer->start();
+}
+
+void MsgListView::slotReportVisibleMessages()
+{
+    if (!model())
+        return;
+
+    QModelIndexList messages;
+    const int bottom = viewport()->height();
+    QModelIndex index = indexAt(QPoint(0, 0));
+    QModelIndex last;
+    for (; index.isValid() && visualRect(index).top() < bottom; index = indexBelow(index)) {
+        messages << index;
+        last = index;
+    }
+
+    // The distance has to be measured in the order which the user sees, which is only known to the view
+    QModelIndexList nearby;
+    if (!messages.isEmpty()) {
+        index = indexAbove(messages.first());
+        for (int i = 0; i < nearbyRows && index.isValid(); ++i, index = indexAbove(index)) {
+            nearby << index;
+        }
+        index = indexBelow(last);
+        for (int i = 0; i < nearbyRows && index.isValid(); ++i, index = indexBelow(index)) {
+            nearby << index;
+        }
+    }
+    emit visibleMessagesChanged(messages, nearby);
+}
+
 void MsgListView::slotCurrentActivated()
 {
     if (currentIndex().isValid() && m_autoActivateAfterKeyNavigation) {
@@ -52,11 +52,18 @@ public:
     void updateActionsAfterRestoredState();
     virtual int sizeHintForColumn(int column) const;
     QHeaderView::ResizeMode resizeModeForColumn(const int column) const;
+signals:
+    /** @short The set of messages which are shown in the viewport might have changed
+
+    The @arg nearby messages are those which are not visible, but which are just a few rows away in the view's order.
+    */
+    void visibleMessagesChanged(const QModelIndexList &messages, const QModelIndexList &nearby);
 protected:
     void keyPressEvent(QKeyEvent *ke);
     void keyReleaseEvent(QKeyEvent *ke);
     virtual void startDrag(Qt::DropActions supportedActions);
     bool event(QEvent *event);
+    virtual void resizeEvent(QResizeEvent *event);
 private slots:
     void slotFixSize();
     /** @short Expand all items below current root index */
@@ -70,11 +77,14 @@ private slots:
     /** @short conditionally emits activated(currentIndex()) for keyboard events */
     void slotCurrentActivated();
     void slotHandleNewColumns(int oldCount, int newCount);
+    /** @short Find out what messages are visible and emit visibleMessagesChanged() */
+    void slotReportVisibleMessages();
 private:
     static Imap::Mailbox::PrettyMsgListModel *findPrettyMsgListModel(QAbstractItemModel *model);
 
     QSignalMapper *headerFieldsMapper;
     QTimer *m_naviActivationTimer;
+    QTimer *m_visibleMessagesTimer;
     bool m_autoActivateAfterKeyNavigation;
     bool m_autoResizeSections;
 };
@@ -50,6 +50,7 @@
 #include "Gui/Util.h"
 #include "Gui/Window.h"
 #include "Imap/Model/ImapAccess.h"
+#include "Imap/Model/Model.h"
 #include "MSA/Account.h"
 #include "Plugins/PasswordPlugin.h"
 #include "Plugins/PluginManager.h"
@@ -472,6 +473,9 @@ ImapPage::ImapPage(SettingsDialog *parent, QSettings &s): QScrollArea(parent), U
     processPath->setText(s.value(SettingsNames::imapProcessKey).toString());
     startOffline->setChecked(s.value(SettingsNames::imapStartOffline).toBool());
     imapEnableId->setChecked(s.value(SettingsNames::imapEnableId, true).toBool());
+    imapUseNotify->setChecked(s.value(SettingsNames::imapUseNotify, false).toBool());
+    imapPrewarmMailboxes->setChecked(s.value(SettingsNames::imapPrewarmMailboxes, false).toBool());
+    imapWatchedMailboxes->setText(s.value(SettingsNames::imapWatchedMailboxes).toStringList().join(QLatin1String(", ")));
     imapCapabilitiesBlacklist->setText(s.value(SettingsNames::imapBlacklistedCapabilities).toStringList().join(QLatin1String(" ")));
     imapUseSystemProxy->setChecked(s.value(SettingsNames::imapUseSystemProxy, true).toBool());
     imapNeedsNetwork->setChecked(s.value(SettingsNames::imapNeedsNetwork, true).toBool());
@@ -605,6 +609,15 @@ void ImapPage::save(QSettings &s)
     s.setValue(SettingsNames::imapUserKey, imapUser->text());
     s.setValue(SettingsNames::imapStartOffline, startOffline->isChecked());
     s.setValue(SettingsNames::imapEnableId, imapEnableId->isChecked());
+    s.setValue(SettingsNames::imapUseNotify, imapUseNotify->isChecked());
+    s.setValue(SettingsNames::imapPrewarmMailboxes, imapPrewarmMailboxes->isChecked());
+    QStringList watchedMailboxes;
+    // Unlike the capabilities, the mailbox names can contain spaces
+    Q_FOREACH(const QString &mailbox, imapWatchedMailboxes->text().split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        if (!mailbox.trimmed().isEmpty())
+            watchedMailboxes << mailbox.trimmed();
+    }
+    s.setValue(SettingsNames::imapWatchedMailboxes, watchedMailboxes);
     s.setValue(SettingsNames::imapBlacklistedCapabilities, imapCapabilitiesBlacklist->text().split(QLatin1String(" ")));
     s.setValue(SettingsNames::imapNeedsNetwork, imapNeedsNetwork->isChecked());
 
@@ -662,7 +675,7 @@ bool ImapPage::passwordFailures(QString &message) const
 }
 
 
-CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_CachePage()
+CachePage::CachePage(SettingsDialog *parent, QSettings &s): QScrollArea(parent), Ui_CachePage(), m_parent(parent)
 {
     Ui_CachePage::setupUi(this);
 
@@ -678,8 +691,10 @@ CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_Cac
     }
 
     offlineNumberOfDays->setValue(s.value(SettingsNames::cacheOfflineNumberDaysKey, QVariant(30)).toInt());
+    cacheQuota->setValue(s.value(SettingsNames::cacheQuotaKey, QVariant(0)).toInt());
 
     updateWidgets();
+    updateCacheUsage();
     connect(offlineNope, SIGNAL(clicked()), this, SLOT(updateWidgets()));
     connect(offlineXDays, SIGNAL(clicked()), this, SLOT(updateWidgets()));
     connect(offlineEverything, SIGNAL(clicked()), this, SLOT(updateWidgets()));
@@ -695,6 +710,40 @@ void CachePage::resizeEvent(QResizeEvent *event)
 void CachePage::updateWidgets()
 {
     offlineNumberOfDays->setEnabled(offlineXDays->isChecked());
+    // Keeping everything offline means that nothing gets evicted
+    cacheQuota->setEnabled(offlineXDays->isChecked());
+}
+
+/** @short Return the cache which is currently used by the IMAP model, if any */
+Imap::Mailbox::AbstractCache *CachePage::cache() const
+{
+    Imap::ImapAccess *imapAccess = m_parent->imapAccess();
+    Imap::Mailbox::Model *model = imapAccess ? qobject_cast<Imap::Mailbox::Model *>(imapAccess->imapModel()) : 0;
+    return model ? model->cache() : 0;
+}
+
+void CachePage::updateCacheUsage()
+{
+    Imap::Mailbox::AbstractCache *cache = this->cache();
+    if (!cache) {
+        cacheUsage->setText(tr("The cache is not available right now."));
+        return;
+    }
+    Imap::Mailbox::AbstractCache::Usage usage = cache->usage();
+    if (usage.diskBytes < 0) {
+        cacheUsage->setText(tr("The messages are only kept in memory."));
+        return;
+    }
+    const double megabyte = 1024 * 1024;
+    QString text = tr("Headers of %n message(s) and %1 MB of message data in %2 parts are cached, "
+                      "taking %3 MB of disk space in total.", "", usage.messages).arg(
+                QString::number(usage.partBytes / megabyte, 'f', 1), QString::number(usage.parts),
+                QString::number(usage.diskBytes / megabyte, 'f', 1));
+    if (qint64 lookups = usage.memoryHits + usage.memoryMisses) {
+        text += QLatin1Char(' ') + tr("%1% of the lookups were served from memory.").arg(
+                    QString::number(100 * usage.memoryHits / lookups));
+    }
+    cacheUsage->setText(text);
 }
 
 void CachePage::save(QSettings &s)
@@ -709,6 +758,11 @@ void CachePage::save(QSettings &s)
         s.setValue(SettingsNames::cacheOfflineKey, SettingsNames::cacheOfflineNone);
 
     s.setValue(SettingsNames::cacheOfflineNumberDaysKey, offlineNumberOfDays->value());
+    s.setValue(SettingsNames::cacheQuotaKey, cacheQuota->value());
+
+    // The new limit applies right away, there's no need to wait for a reconnect
+    if (Imap::Mailbox::AbstractCache *cache = this->cache())
+        cache->setQuota(offlineEverything->isChecked() ? 0 : static_cast<qint64>(cacheQuota->value()) * 1024 * 1024);
 
     emit saved();
 }
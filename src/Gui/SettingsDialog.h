@@ -57,6 +57,9 @@ class PasswordWatcher;
 
 namespace Imap {
 class ImapAccess;
+namespace Mailbox {
+class AbstractCache;
+}
 }
 
 namespace MSA {
@@ -212,7 +215,7 @@ class CachePage : public QScrollArea, Ui_CachePage, public ConfigurationWidgetIn
 {
     Q_OBJECT
 public:
-    CachePage(QWidget *parent, QSettings &s);
+    CachePage(SettingsDialog *parent, QSettings &s);
     virtual void save(QSettings &s);
     virtual QWidget *asWidget();
     virtual bool checkValidity() const;
@@ -222,10 +225,14 @@ protected:
     virtual void resizeEvent(QResizeEvent *event);
 
 private:
+    Imap::Mailbox::AbstractCache *cache() const;
+
+    SettingsDialog *m_parent;
     QCheckBox *startOffline;
 
 private slots:
     void updateWidgets();
+    void updateCacheUsage();
 
 private:
     CachePage(const CachePage &); // don't implement
@@ -62,6 +62,7 @@
 #include "Imap/Model/PrettyMailboxModel.h"
 #include "Imap/Model/PrettyMsgListModel.h"
 #include "Imap/Model/SpecialFlagNames.h"
+#include "Imap/Model/TaskStatistics.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
 #include "Imap/Model/Utils.h"
 #include "Imap/Network/FileDownloadManager.h"
@@ -283,6 +284,12 @@ void MainWindow::createActions()
     showImapCapabilities = new QAction(tr("IMAP Server In&formation..."), this);
     connect(showImapCapabilities, SIGNAL(triggered()), this, SLOT(slotShowImapInfo()));
 
+    showTaskStatistics = new QAction(tr("Task &Statistics..."), this);
+    connect(showTaskStatistics, SIGNAL(triggered()), this, SLOT(slotShowTaskStatistics()));
+
+    saveTaskStatistics = new QAction(tr("Save Task Statistics as &JSON..."), this);
+    connect(saveTaskStatistics, SIGNAL(triggered()), this, SLOT(slotSaveTaskStatistics()));
+
     showMenuBar = ShortcutHandler::instance()->createAction(QLatin1String("action_show_menubar"), this);
     showMenuBar->setCheckable(true);
     showMenuBar->setChecked(true);
@@ -540,6 +547,8 @@ void MainWindow::createMenus()
     ADD_ACTION(debugMenu, showImapLogger);
     ADD_ACTION(debugMenu, logPersistent);
     ADD_ACTION(debugMenu, showImapCapabilities);
+    ADD_ACTION(debugMenu, showTaskStatistics);
+    ADD_ACTION(debugMenu, saveTaskStatistics);
     imapMenu->addSeparator();
     ADD_ACTION(imapMenu, configSettings);
     ADD_ACTION(imapMenu, ShortcutHandler::instance()->shortcutConfigAction());
@@ -615,6 +624,11 @@ void MainWindow::createWidgets()
     connect(msgListWidget->tree, SIGNAL(activated(const QModelIndex &)), this, SLOT(msgListClicked(const QModelIndex &)));
     connect(msgListWidget->tree, SIGNAL(clicked(const QModelIndex &)), this, SLOT(msgListClicked(const QModelIndex &)));
     connect(msgListWidget->tree, SIGNAL(doubleClicked(const QModelIndex &)), this, SLOT(msgListDoubleClicked(const QModelIndex &)));
+    // The viewport-first loading of envelopes depends on this, and a typo in the signature would only show as a runtime warning
+    const bool visibleMessagesConnected = connect(msgListWidget->tree, SIGNAL(visibleMessagesChanged(QModelIndexList,QModelIndexList)),
+            this, SLOT(msgListVisibleMessagesChanged(QModelIndexList,QModelIndexList)));
+    Q_ASSERT(visibleMessagesConnected);
+    Q_UNUSED(visibleMessagesConnected);
     connect(msgListWidget, SIGNAL(requestingSearch(QStringList)), this, SLOT(slotSearchRequested(QStringList)));
     connect(msgListWidget->tree->header(), SIGNAL(sectionMoved(int,int,int)), m_delayedStateSaving, SLOT(start()));
     connect(msgListWidget->tree->header(), SIGNAL(sectionResized(int,int,int)), m_delayedStateSaving, SLOT(start()));
@@ -967,6 +981,11 @@ void MainWindow::msgListDoubleClicked(const QModelIndex &index)
     widget->show();
 }
 
+void MainWindow::msgListVisibleMessagesChanged(const QModelIndexList &messages, const QModelIndexList &nearby)
+{
+    imapModel()->setVisibleMessages(messages, nearby);
+}
+
 void MainWindow::showContextMenuMboxTree(const QPoint &position)
 {
     QList<QAction *> actionList;
@@ -2116,6 +2135,28 @@ void MainWindow::slotShowImapInfo()
                                 "<ul>\n%2</ul>").arg(idString, caps));
 }
 
+void MainWindow::slotShowTaskStatistics()
+{
+    QMessageBox::information(this, tr("IMAP Task Statistics"),
+                             tr("<p>Latencies are in milliseconds, the percentiles are rounded up to a power of two.</p>"
+                                "<pre>%1</pre>").arg(imapModel()->taskStatistics()->describe()));
+}
+
+void MainWindow::slotSaveTaskStatistics()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save Task Statistics"),
+                                                    QDir::homePath() + QLatin1String("/trojita-task-statistics.json"),
+                                                    tr("JSON files (*.json)"));
+    if (fileName.isEmpty())
+        return;
+
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) || f.write(imapModel()->taskStatistics()->toJson()) < 0) {
+        QMessageBox::critical(this, tr("Cannot Save Task Statistics"),
+                              tr("Cannot write to %1: %2").arg(fileName, f.errorString()));
+    }
+}
+
 QSize MainWindow::sizeHint() const
 {
     return QSize(1150, 980);
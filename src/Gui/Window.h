@@ -126,6 +126,8 @@ private slots:
     void networkPolicyOnline();
     void slotShowSettings();
     void slotShowImapInfo();
+    void slotShowTaskStatistics();
+    void slotSaveTaskStatistics();
     void slotExpunge();
     void imapError(const QString &message);
     void networkError(const QString &message);
@@ -153,6 +155,7 @@ private slots:
     void slotPreviousUnread();
     void msgListClicked(const QModelIndex &);
     void msgListDoubleClicked(const QModelIndex &);
+    void msgListVisibleMessagesChanged(const QModelIndexList &messages, const QModelIndexList &nearby);
     void slotCreateMailboxBelowCurrent();
     void slotMarkCurrentMailboxRead();
     void slotCreateTopMailbox();
@@ -271,6 +274,8 @@ private:
     QAction *showImapLogger;
     QAction *logPersistent;
     QAction *showImapCapabilities;
+    QAction *showTaskStatistics;
+    QAction *saveTaskStatistics;
     QAction *showMenuBar;
     QAction *showToolBar;
     QAction *configSettings;
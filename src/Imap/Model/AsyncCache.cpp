@@ -0,0 +1,352 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QThread>
+#include "AsyncCache.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Helper living in the worker thread which processes the queue of the AsyncCache */
+class AsyncCacheWorker : public QObject
+{
+public:
+    explicit AsyncCacheWorker(AsyncCache *cache): m_cache(cache)
+    {
+    }
+
+    virtual bool event(QEvent *e)
+    {
+        if (e->type() == QEvent::User) {
+            m_cache->runPendingJobs();
+            return true;
+        }
+        return QObject::event(e);
+    }
+
+private:
+    AsyncCache *m_cache;
+};
+
+AsyncCache::AsyncCache(QObject *parent, AbstractCache *backend):
+    AbstractCache(parent), m_backend(backend), m_thread(new QThread()), m_worker(new AsyncCacheWorker(this))
+{
+    Q_ASSERT(!m_backend->parent());
+    m_thread->setObjectName(QLatin1String("trojita-cache"));
+    connect(m_backend, SIGNAL(error(QString)), this, SIGNAL(error(QString)), Qt::QueuedConnection);
+    m_backend->moveToThread(m_thread);
+    m_worker->moveToThread(m_thread);
+    m_thread->start();
+}
+
+AsyncCache::~AsyncCache()
+{
+    // The backend has to be destroyed from its own thread, and only after all queued modifications were processed
+    AbstractCache *backend = m_backend;
+    runAndWait([backend]() {
+        delete backend;
+        return true;
+    });
+    // All lookups have finished by now. Their results would never get delivered once we are gone, and the callers would
+    // keep waiting for them forever, so deliver them right away.
+    runCompletions();
+    m_thread->quit();
+    m_thread->wait();
+    delete m_worker;
+    delete m_thread;
+}
+
+void AsyncCache::enqueue(const Job &job) const
+{
+    QMutexLocker locker(&m_mutex);
+    bool wakeUp = m_jobs.isEmpty();
+    m_jobs << job;
+    if (wakeUp) {
+        // Whatever gets queued before the worker wakes up is processed as a single batch
+        QCoreApplication::postEvent(m_worker, new QEvent(QEvent::User));
+    }
+}
+
+/** @short Process all queued operations; this is executed from the worker thread */
+void AsyncCache::runPendingJobs()
+{
+    QList<Job> jobs;
+    {
+        QMutexLocker locker(&m_mutex);
+        jobs = m_jobs;
+        m_jobs.clear();
+    }
+    Q_FOREACH(const Job &job, jobs) {
+        job();
+    }
+}
+
+/** @short Make sure that the @arg completion gets executed from the thread which owns this object */
+void AsyncCache::complete(const Job &completion) const
+{
+    QMutexLocker locker(&m_mutex);
+    bool wakeUp = m_completions.isEmpty();
+    m_completions << completion;
+    if (wakeUp) {
+        QMetaObject::invokeMethod(const_cast<AsyncCache *>(this), "runCompletions", Qt::QueuedConnection);
+    }
+}
+
+void AsyncCache::runCompletions()
+{
+    QList<Job> completions;
+    {
+        QMutexLocker locker(&m_mutex);
+        completions = m_completions;
+        m_completions.clear();
+    }
+    Q_FOREACH(const Job &completion, completions) {
+        completion();
+    }
+}
+
+QList<MailboxMetadata> AsyncCache::childMailboxes(const QString &mailbox) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox]() { return backend->childMailboxes(mailbox); });
+}
+
+bool AsyncCache::childMailboxesFresh(const QString &mailbox) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox]() { return backend->childMailboxesFresh(mailbox); });
+}
+
+void AsyncCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, data]() { backend->setChildMailboxes(mailbox, data); });
+}
+
+SyncState AsyncCache::mailboxSyncState(const QString &mailbox) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox]() { return backend->mailboxSyncState(mailbox); });
+}
+
+void AsyncCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, state]() { backend->setMailboxSyncState(mailbox, state); });
+}
+
+QList<uint> AsyncCache::uidMapping(const QString &mailbox) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox]() { return backend->uidMapping(mailbox); });
+}
+
+void AsyncCache::setUidMapping(const QString &mailbox, const QList<uint> &seqToUid)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, seqToUid]() { backend->setUidMapping(mailbox, seqToUid); });
+}
+
+void AsyncCache::clearUidMapping(const QString &mailbox)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox]() { backend->clearUidMapping(mailbox); });
+}
+
+void AsyncCache::clearAllMessages(const QString &mailbox)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox]() { backend->clearAllMessages(mailbox); });
+}
+
+void AsyncCache::clearMessage(const QString mailbox, const uint uid)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid]() { backend->clearMessage(mailbox, uid); });
+}
+
+AbstractCache::MessageDataBundle AsyncCache::messageMetadata(const QString &mailbox, const uint uid) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid]() { return backend->messageMetadata(mailbox, uid); });
+}
+
+QMap<uint, AbstractCache::MessageDataBundle> AsyncCache::messageMetadata(const QString &mailbox, const QList<uint> &uids) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uids]() { return backend->messageMetadata(mailbox, uids); });
+}
+
+void AsyncCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid, metadata]() { backend->setMessageMetadata(mailbox, uid, metadata); });
+}
+
+void AsyncCache::messageMetadataAsync(const QString &mailbox, const QList<uint> &uids, const MessageMetadataCallback &callback) const
+{
+    AbstractCache *backend = m_backend;
+    enqueue([this, backend, mailbox, uids, callback]() {
+        QMap<uint, MessageDataBundle> res = backend->messageMetadata(mailbox, uids);
+        complete([callback, res]() { callback(res); });
+    });
+}
+
+QStringList AsyncCache::msgFlags(const QString &mailbox, const uint uid) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid]() { return backend->msgFlags(mailbox, uid); });
+}
+
+QMap<uint, QStringList> AsyncCache::msgFlags(const QString &mailbox, const QList<uint> &uids) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uids]() { return backend->msgFlags(mailbox, uids); });
+}
+
+void AsyncCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid, flags]() { backend->setMsgFlags(mailbox, uid, flags); });
+}
+
+void AsyncCache::setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, flags]() { backend->setMsgFlags(mailbox, flags); });
+}
+
+QByteArray AsyncCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid, partId]() { return backend->messagePart(mailbox, uid, partId); });
+}
+
+bool AsyncCache::hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid, partId]() { return backend->hasMessagePart(mailbox, uid, partId); });
+}
+
+void AsyncCache::messagePartAsync(const QString &mailbox, const uint uid, const QList<QByteArray> &partIds,
+                                  const MessagePartCallback &callback) const
+{
+    AbstractCache *backend = m_backend;
+    enqueue([this, backend, mailbox, uid, partIds, callback]() {
+        // The backend is synchronous, so the callback is invoked right away, still from the worker thread
+        backend->messagePartAsync(mailbox, uid, partIds, [this, callback](const QByteArray &partId, const QByteArray &data) {
+            complete([callback, partId, data]() { callback(partId, data); });
+        });
+    });
+}
+
+void AsyncCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid, partId, data]() { backend->setMsgPart(mailbox, uid, partId, data); });
+}
+
+void AsyncCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid, partId]() { backend->forgetMessagePart(mailbox, uid, partId); });
+}
+
+QString AsyncCache::messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid, partId]() { return backend->messagePartFile(mailbox, uid, partId); });
+}
+
+QByteArray AsyncCache::partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid, partId]() { return backend->partialMessagePart(mailbox, uid, partId); });
+}
+
+qint64 AsyncCache::partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox, uid, partId]() { return backend->partialMessagePartSize(mailbox, uid, partId); });
+}
+
+void AsyncCache::appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid, partId, chunk]() { backend->appendPartialMessagePart(mailbox, uid, partId, chunk); });
+}
+
+void AsyncCache::forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, uid, partId]() { backend->forgetPartialMessagePart(mailbox, uid, partId); });
+}
+
+QVector<Imap::Responses::ThreadingNode> AsyncCache::messageThreading(const QString &mailbox)
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox]() { return backend->messageThreading(mailbox); });
+}
+
+void AsyncCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, threading]() { backend->setMessageThreading(mailbox, threading); });
+}
+
+OfflineSyncProgress AsyncCache::offlineSyncProgress(const QString &mailbox) const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend, mailbox]() { return backend->offlineSyncProgress(mailbox); });
+}
+
+void AsyncCache::setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, mailbox, progress]() { backend->setOfflineSyncProgress(mailbox, progress); });
+}
+
+void AsyncCache::setRenewalThreshold(const int days)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, days]() { backend->setRenewalThreshold(days); });
+}
+
+AbstractCache::Usage AsyncCache::usage() const
+{
+    AbstractCache *backend = m_backend;
+    return runAndWait([backend]() { return backend->usage(); });
+}
+
+void AsyncCache::setQuota(const qint64 bytes)
+{
+    AbstractCache *backend = m_backend;
+    enqueue([backend, bytes]() { backend->setQuota(bytes); });
+}
+
+}
+}
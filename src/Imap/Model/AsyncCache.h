@@ -0,0 +1,157 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_ASYNCCACHE_H
+#define IMAP_MODEL_ASYNCCACHE_H
+
+#include <QList>
+#include <QMutex>
+#include <QSemaphore>
+#include "Cache.h"
+
+class QThread;
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+class AsyncCacheWorker;
+
+/** @short A front-end which performs all I/O of another cache on a worker thread
+
+The backend is moved to a dedicated thread and never touched from anywhere else. All modifications are queued and return
+immediately; the queue is processed in batches, so a burst of updates results in a single wakeup of the worker and, with the
+SQLCache, in a single transaction.
+
+Reading through the regular AbstractCache interface waits for the worker to process the queued operations, which keeps the
+usual read-after-write semantics. The messageMetadataAsync() and messagePartAsync() do not block at all; their callbacks
+are invoked from the event loop of the thread which owns this object, or from the destructor for the lookups which are still
+pending when the cache gets deleted.
+*/
+class AsyncCache : public AbstractCache
+{
+    Q_OBJECT
+public:
+    /** @short Take ownership of the @arg backend and start serving it from a worker thread
+
+    The @arg backend must not have a parent.
+    */
+    AsyncCache(QObject *parent, AbstractCache *backend);
+    virtual ~AsyncCache();
+
+    /** @short Run the @arg job on the worker thread and wait for its result
+
+    This is how the backend shall be accessed for operations which are not a part of the AbstractCache interface, like
+    opening the database.
+    */
+    template <typename F>
+    auto runAndWait(F job) const -> decltype(job())
+    {
+        decltype(job()) res;
+        QSemaphore done;
+        enqueue([&res, &done, &job]() {
+            res = job();
+            done.release();
+        });
+        done.acquire();
+        return res;
+    }
+
+    virtual QList<MailboxMetadata> childMailboxes(const QString &mailbox) const;
+    virtual bool childMailboxesFresh(const QString &mailbox) const;
+    virtual void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data);
+
+    virtual SyncState mailboxSyncState(const QString &mailbox) const;
+    virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
+
+    virtual void setUidMapping(const QString &mailbox, const QList<uint> &seqToUid);
+    virtual void clearUidMapping(const QString &mailbox);
+    virtual QList<uint> uidMapping(const QString &mailbox) const;
+
+    virtual void clearAllMessages(const QString &mailbox);
+    virtual void clearMessage(const QString mailbox, const uint uid);
+
+    virtual MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, MessageDataBundle> messageMetadata(const QString &mailbox, const QList<uint> &uids) const;
+    virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata);
+    virtual void messageMetadataAsync(const QString &mailbox, const QList<uint> &uids, const MessageMetadataCallback &callback) const;
+
+    virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, QStringList> msgFlags(const QString &mailbox, const QList<uint> &uids) const;
+    virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags);
+    virtual void setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags);
+
+    virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual bool hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual void messagePartAsync(const QString &mailbox, const uint uid, const QList<QByteArray> &partIds,
+                                  const MessagePartCallback &callback) const;
+    virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
+    virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
+    virtual QString messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual QByteArray partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual qint64 partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual void appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk);
+    virtual void forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
+
+    virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
+    virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
+
+    virtual OfflineSyncProgress offlineSyncProgress(const QString &mailbox) const;
+    virtual void setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress);
+
+    virtual void setRenewalThreshold(const int days);
+
+    virtual Usage usage() const;
+    virtual void setQuota(const qint64 bytes);
+
+private slots:
+    void runCompletions();
+
+private:
+    typedef std::function<void ()> Job;
+
+    void enqueue(const Job &job) const;
+    void complete(const Job &completion) const;
+    void runPendingJobs();
+
+    friend class AsyncCacheWorker; // needs access to runPendingJobs()
+
+    /** @short The real cache, living in the m_thread */
+    AbstractCache *m_backend;
+    QThread *m_thread;
+    AsyncCacheWorker *m_worker;
+
+    /** @short Protects the m_jobs and m_completions */
+    mutable QMutex m_mutex;
+    /** @short Operations waiting for the worker thread */
+    mutable QList<Job> m_jobs;
+    /** @short Results of asynchronous lookups which shall be delivered from our own thread */
+    mutable QList<Job> m_completions;
+};
+
+}
+
+}
+
+#endif /* IMAP_MODEL_ASYNCCACHE_H */
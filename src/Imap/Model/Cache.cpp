@@ -22,6 +22,15 @@
 
 #include "Cache.h"
 
+namespace {
+
+QString partialPartKey(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    return mailbox + QLatin1Char('\n') + QString::number(uid) + QLatin1Char('\n') + QString::fromUtf8(partId);
+}
+
+}
+
 namespace Imap {
 namespace Mailbox {
 
@@ -33,5 +42,114 @@ AbstractCache::~AbstractCache()
 {
 }
 
+QMap<uint, AbstractCache::MessageDataBundle> AbstractCache::messageMetadata(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, MessageDataBundle> res;
+    Q_FOREACH(const uint uid, uids) {
+        MessageDataBundle data = messageMetadata(mailbox, uid);
+        if (data.uid == uid)
+            res[uid] = data;
+    }
+    return res;
+}
+
+QMap<uint, QStringList> AbstractCache::msgFlags(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, QStringList> res;
+    Q_FOREACH(const uint uid, uids) {
+        res[uid] = msgFlags(mailbox, uid);
+    }
+    return res;
+}
+
+bool AbstractCache::hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    return !messagePart(mailbox, uid, partId).isNull();
+}
+
+void AbstractCache::messageMetadataAsync(const QString &mailbox, const QList<uint> &uids, const MessageMetadataCallback &callback) const
+{
+    callback(messageMetadata(mailbox, uids));
+}
+
+void AbstractCache::messagePartAsync(const QString &mailbox, const uint uid, const QList<QByteArray> &partIds,
+                                     const MessagePartCallback &callback) const
+{
+    Q_FOREACH(const QByteArray &partId, partIds) {
+        QByteArray data = messagePart(mailbox, uid, partId);
+        if (!data.isNull()) {
+            callback(partId, data);
+            return;
+        }
+    }
+    callback(QByteArray(), QByteArray());
+}
+
+void AbstractCache::setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags)
+{
+    for (QMap<uint, QStringList>::const_iterator it = flags.constBegin(); it != flags.constEnd(); ++it) {
+        setMsgFlags(mailbox, it.key(), *it);
+    }
+}
+
+QString AbstractCache::messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(uid);
+    Q_UNUSED(partId);
+    return QString();
+}
+
+QByteArray AbstractCache::partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    return m_partialParts.value(partialPartKey(mailbox, uid, partId));
+}
+
+qint64 AbstractCache::partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    return partialMessagePart(mailbox, uid, partId).size();
+}
+
+void AbstractCache::appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk)
+{
+    m_partialParts[partialPartKey(mailbox, uid, partId)] += chunk;
+}
+
+void AbstractCache::forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    m_partialParts.remove(partialPartKey(mailbox, uid, partId));
+}
+
+void AbstractCache::forgetPartialMessageParts(const QString &mailbox)
+{
+    forgetPartialMessagePartsWithPrefix(mailbox + QLatin1Char('\n'));
+}
+
+void AbstractCache::forgetPartialMessageParts(const QString &mailbox, const uint uid)
+{
+    forgetPartialMessagePartsWithPrefix(mailbox + QLatin1Char('\n') + QString::number(uid) + QLatin1Char('\n'));
+}
+
+void AbstractCache::forgetPartialMessagePartsWithPrefix(const QString &prefix)
+{
+    QHash<QString, QByteArray>::iterator it = m_partialParts.begin();
+    while (it != m_partialParts.end()) {
+        if (it.key().startsWith(prefix))
+            it = m_partialParts.erase(it);
+        else
+            ++it;
+    }
+}
+
+AbstractCache::Usage AbstractCache::usage() const
+{
+    return Usage();
+}
+
+void AbstractCache::setQuota(const qint64 bytes)
+{
+    Q_UNUSED(bytes);
+}
+
 }
 }
@@ -23,6 +23,8 @@
 #ifndef IMAP_MODEL_CACHE_H
 #define IMAP_MODEL_CACHE_H
 
+#include <functional>
+#include <QHash>
 #include <QUrl>
 #include "MailboxMetadata.h"
 #include "../Parser/Message.h"
@@ -80,6 +82,31 @@ public:
         }
     };
 
+    /** @short How much is stored in the cache */
+    struct Usage {
+        /** @short Number of messages whose metadata are cached */
+        qint64 messages;
+        /** @short Number of cached message parts */
+        qint64 parts;
+        /** @short How many bytes do the message parts occupy, i.e. what counts towards the quota */
+        qint64 partBytes;
+        /** @short The total size of all files of the cache, or -1 when nothing is stored on disk */
+        qint64 diskBytes;
+        /** @short The limit for partBytes, zero if unlimited */
+        qint64 quota;
+        /** @short How many lookups were served from memory, for caches which put an in-memory tier in front of the disk */
+        qint64 memoryHits;
+        /** @short How many lookups had to go to the disk, see memoryHits */
+        qint64 memoryMisses;
+
+        Usage(): messages(0), parts(0), partBytes(0), diskBytes(-1), quota(0), memoryHits(0), memoryMisses(0) {}
+    };
+
+    /** @short Callback receiving the result of messageMetadataAsync() */
+    typedef std::function<void (const QMap<uint, MessageDataBundle> &)> MessageMetadataCallback;
+    /** @short Callback receiving the result of messagePartAsync(), i.e. the ID of the part which was found and its data */
+    typedef std::function<void (const QByteArray &, const QByteArray &)> MessagePartCallback;
+
     explicit AbstractCache(QObject *parent);
     virtual ~AbstractCache();
 
@@ -109,31 +136,113 @@ public:
 
     /** @short Returns all known data for a message in the given mailbox (except real parts data) */
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const = 0;
+    /** @short Return the metadata of all of the @arg uids which are available in the cache, indexed by their UID
+
+    This is an optimization for looking up many messages at once; the default implementation simply calls the
+    single-message version repeatedly. Messages which are not in the cache are not present in the result.
+    */
+    virtual QMap<uint, MessageDataBundle> messageMetadata(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata) = 0;
+    /** @short Look up the metadata of the @arg uids and pass them to the @arg callback once they are available
+
+    The callback is always invoked from the thread which owns the cache. The default implementation performs a regular
+    lookup and invokes the callback before returning; caches which do their I/O elsewhere call it later.
+    */
+    virtual void messageMetadataAsync(const QString &mailbox, const QList<uint> &uids, const MessageMetadataCallback &callback) const;
 
     /** @short Retrieve flags for one message in a mailbox */
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const = 0;
+    /** @short Retrieve flags of all of the @arg uids at once, indexed by their UID
+
+    This saves a round trip per message when populating a whole mailbox. The default implementation calls the
+    single-message version repeatedly. Messages whose flags are not in the cache might be missing from the result.
+    */
+    virtual QMap<uint, QStringList> msgFlags(const QString &mailbox, const QList<uint> &uids) const;
     /** @short Save flags for one message in mailbox */
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags) = 0;
+    /** @short Save flags of many messages in a mailbox at once, the @arg flags are indexed by UID
+
+    Use this when updating the whole mailbox. The default implementation calls the single-message version repeatedly.
+    */
+    virtual void setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags);
 
     /** @short Return part data or a null QByteArray if none available */
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const = 0;
+    /** @short Is there anything stored for the given message part?
+
+    The default implementation reads the data; caches which can tell without doing that shall override this.
+    */
+    virtual bool hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Find the first of the @arg partIds which is available in the cache and pass it to the @arg callback
+
+    If none of them are cached, the callback receives null QByteArrays. See messageMetadataAsync() for when the callback
+    gets invoked.
+    */
+    virtual void messagePartAsync(const QString &mailbox, const uint uid, const QList<QByteArray> &partIds,
+                                  const MessagePartCallback &callback) const;
     /** @short Save data for one message part */
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data) = 0;
     /** @short Drop the data for a message part which is no longer needed */
     virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) = 0;
+    /** @short Return the name of a file which contains exactly the data of a message part, or a null QString
+
+    This lets the big parts be read straight from the disk, e.g. through a memory mapping, without loading them first. The
+    file must be treated as read-only and it might get removed once the part is evicted. Caches which do not keep the
+    data in plain files simply return nothing, and so do the other caches when the data are not stored that way.
+    */
+    virtual QString messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+
+    /** @short Return the data of a message part whose download is still in progress, or an empty QByteArray
+
+    The partial data are kept so that an interrupted download of a large part can resume where it stopped. The chunked
+    download relies on getting all the appended data back, so the default implementation keeps them in memory; caches
+    which can store them persistently shall override all of these functions.
+    */
+    virtual QByteArray partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Return the size of the partialMessagePart() without reading it */
+    virtual qint64 partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Append a freshly downloaded chunk to the partial data of a message part */
+    virtual void appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk);
+    /** @short Drop the partial data of a message part */
+    virtual void forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
 
     /** @short Return cached threading info for a given mailbox */
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox) = 0;
     /** @short Save information about how messages are threaded */
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) = 0;
 
+    /** @short Return how far has the offline synchronization of a mailbox got */
+    virtual OfflineSyncProgress offlineSyncProgress(const QString &mailbox) const = 0;
+    /** @short Remember the progress of the offline synchronization */
+    virtual void setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress) = 0;
+
     /** @short How many days is it OK not to mark entries as accessed? */
     virtual void setRenewalThreshold(const int days) = 0;
 
+    /** @short Report how much data is kept in the cache */
+    virtual Usage usage() const;
+    /** @short Limit the size of the cached message parts to @arg bytes, zero means no limit
+
+    The caches which support this evict the least recently used parts once the limit is exceeded; the message metadata are
+    never affected. The default implementation ignores the limit.
+    */
+    virtual void setQuota(const qint64 bytes);
+
 signals:
     /** @short Some cache error has occurred */
     void error(const QString &error) const;
+
+protected:
+    /** @short Drop the partial data of all parts of all messages in the @arg mailbox kept by the default implementation */
+    void forgetPartialMessageParts(const QString &mailbox);
+    /** @short Drop the partial data of all parts of the message @arg uid kept by the default implementation */
+    void forgetPartialMessageParts(const QString &mailbox, const uint uid);
+
+private:
+    void forgetPartialMessagePartsWithPrefix(const QString &prefix);
+
+    /** @short The partial message parts for the default implementation, see partialMessagePart() */
+    QHash<QString, QByteArray> m_partialParts;
 };
 
 }
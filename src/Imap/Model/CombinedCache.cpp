@@ -21,21 +21,77 @@
 */
 
 #include "CombinedCache.h"
+#include <QTimer>
 #include "DiskPartCache.h"
+#include "MemoryCache.h"
 #include "SQLCache.h"
 
+namespace
+{
+/** @short How often to check whether the cache is over its quota */
+const int garbageCheckInterval = 5 * 60 * 1000;
+
+/** @short Delay between the steps of an eviction which is in progress */
+const int garbageStepInterval = 1000;
+
+/** @short How many parts to evict at most in one step, so that the regular cache operations do not wait for too long */
+const int garbageStepSize = 64;
+
+/** @short How many parts to evict from the SQL cache at once */
+const int garbageSqlBatch = 16;
+
+/** @short Memory limits of the in-memory tier, in bytes */
+const int hotMailboxStateBytes = 64 * 1024;
+const int hotUidMappingBytes = 4 * 1024 * 1024;
+const int hotThreadingBytes = 4 * 1024 * 1024;
+const int hotMessagesBytes = 18 * 1024 * 1024;
+
+/** @short Bigger parts are never kept in memory */
+const int hotPartMaxSize = 256 * 1024;
+
+/** @short Rough overhead of an entry in the QCache */
+const int hotEntryOverhead = 64;
+
+int syncStateCost()
+{
+    return sizeof(Imap::Mailbox::SyncState) + hotEntryOverhead;
+}
+
+int uidMappingCost(const QList<uint> &uids)
+{
+    return uids.size() * sizeof(uint) + hotEntryOverhead;
+}
+
+int threadingCost(const QVector<Imap::Responses::ThreadingNode> &nodes)
+{
+    int res = hotEntryOverhead;
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, nodes) {
+        res += sizeof(node) + threadingCost(node.children);
+    }
+    return res;
+}
+}
+
 namespace Imap
 {
 namespace Mailbox
 {
 
 CombinedCache::CombinedCache(QObject *parent, const QString &name, const QString &cacheDir):
-    AbstractCache(parent), name(name), cacheDir(cacheDir)
+    AbstractCache(parent), name(name), cacheDir(cacheDir), m_quota(0), m_collectingGarbage(false),
+    m_hotSyncStates(hotMailboxStateBytes), m_hotUidMappings(hotUidMappingBytes), m_hotThreading(hotThreadingBytes),
+    m_hotHits(0), m_hotMisses(0)
 {
+    m_hotMessages = new MemoryCache(this);
+    m_hotMessages->setQuota(hotMessagesBytes);
     sqlCache = new SQLCache(this);
     connect(sqlCache, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
     diskPartCache = new DiskPartCache(this, cacheDir);
     connect(diskPartCache, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+
+    m_garbageTimer = new QTimer(this);
+    m_garbageTimer->setSingleShot(true);
+    connect(m_garbageTimer, SIGNAL(timeout()), this, SLOT(collectGarbage()));
 }
 
 CombinedCache::~CombinedCache()
@@ -44,7 +100,8 @@ CombinedCache::~CombinedCache()
 
 bool CombinedCache::open()
 {
-    return sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite"));
+    return sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite")) &&
+            diskPartCache->open(name + QLatin1String("-parts"));
 }
 
 QList<MailboxMetadata> CombinedCache::childMailboxes(const QString &mailbox) const
@@ -62,72 +119,189 @@ void CombinedCache::setChildMailboxes(const QString &mailbox, const QList<Mailbo
     sqlCache->setChildMailboxes(mailbox, data);
 }
 
+/** @short Copy the entry for the @arg key from the in-memory @arg cache into the @arg value, if it's there */
+template <typename Key, typename T>
+bool CombinedCache::lookupHot(QCache<Key, T> &cache, const Key &key, T &value) const
+{
+    if (T *hot = cache.object(key)) {
+        ++m_hotHits;
+        value = *hot;
+        return true;
+    }
+    ++m_hotMisses;
+    return false;
+}
+
+/** @short Record the result of a lookup in the m_hotMessages and pass it through */
+bool CombinedCache::countHot(const bool hit) const
+{
+    if (hit)
+        ++m_hotHits;
+    else
+        ++m_hotMisses;
+    return hit;
+}
+
 SyncState CombinedCache::mailboxSyncState(const QString &mailbox) const
 {
-    return sqlCache->mailboxSyncState(mailbox);
+    SyncState res;
+    if (!lookupHot(m_hotSyncStates, mailbox, res)) {
+        res = sqlCache->mailboxSyncState(mailbox);
+        m_hotSyncStates.insert(mailbox, new SyncState(res), syncStateCost());
+    }
+    return res;
 }
 
 void CombinedCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
 {
     sqlCache->setMailboxSyncState(mailbox, state);
+    m_hotSyncStates.insert(mailbox, new SyncState(state), syncStateCost());
 }
 
 QList<uint> CombinedCache::uidMapping(const QString &mailbox) const
 {
-    return sqlCache->uidMapping(mailbox);
+    QList<uint> res;
+    if (!lookupHot(m_hotUidMappings, mailbox, res)) {
+        res = sqlCache->uidMapping(mailbox);
+        m_hotUidMappings.insert(mailbox, new QList<uint>(res), uidMappingCost(res));
+    }
+    return res;
 }
 
 void CombinedCache::setUidMapping(const QString &mailbox, const QList<uint> &seqToUid)
 {
     sqlCache->setUidMapping(mailbox, seqToUid);
+    m_hotUidMappings.insert(mailbox, new QList<uint>(seqToUid), uidMappingCost(seqToUid));
 }
 
 void CombinedCache::clearUidMapping(const QString &mailbox)
 {
     sqlCache->clearUidMapping(mailbox);
+    m_hotUidMappings.remove(mailbox);
 }
 
 void CombinedCache::clearAllMessages(const QString &mailbox)
 {
     sqlCache->clearAllMessages(mailbox);
     diskPartCache->clearAllMessages(mailbox);
+    m_hotUidMappings.remove(mailbox);
+    m_hotThreading.remove(mailbox);
+    m_hotMessages->clearAllMessages(mailbox);
 }
 
 void CombinedCache::clearMessage(const QString mailbox, const uint uid)
 {
     sqlCache->clearMessage(mailbox, uid);
     diskPartCache->clearMessage(mailbox, uid);
+    m_hotMessages->clearMessage(mailbox, uid);
 }
 
 QStringList CombinedCache::msgFlags(const QString &mailbox, const uint uid) const
 {
-    return sqlCache->msgFlags(mailbox, uid);
+    QStringList res;
+    if (!countHot(m_hotMessages->findMsgFlags(mailbox, uid, res))) {
+        res = sqlCache->msgFlags(mailbox, uid);
+        m_hotMessages->setMsgFlags(mailbox, uid, res);
+    }
+    return res;
+}
+
+QMap<uint, QStringList> CombinedCache::msgFlags(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, QStringList> res;
+    QList<uint> missing;
+    Q_FOREACH(const uint uid, uids) {
+        QStringList flags;
+        if (countHot(m_hotMessages->findMsgFlags(mailbox, uid, flags)))
+            res[uid] = flags;
+        else
+            missing << uid;
+    }
+    if (missing.isEmpty())
+        return res;
+
+    QMap<uint, QStringList> loaded = sqlCache->msgFlags(mailbox, missing);
+    Q_FOREACH(const uint uid, missing) {
+        const QStringList flags = loaded.value(uid);
+        m_hotMessages->setMsgFlags(mailbox, uid, flags);
+        res[uid] = flags;
+    }
+    return res;
 }
 
 void CombinedCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
 {
     sqlCache->setMsgFlags(mailbox, uid, flags);
+    m_hotMessages->setMsgFlags(mailbox, uid, flags);
+}
+
+void CombinedCache::setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags)
+{
+    sqlCache->setMsgFlags(mailbox, flags);
+    m_hotMessages->setMsgFlags(mailbox, flags);
 }
 
 AbstractCache::MessageDataBundle CombinedCache::messageMetadata(const QString &mailbox, const uint uid) const
 {
-    return sqlCache->messageMetadata(mailbox, uid);
+    MessageDataBundle res = m_hotMessages->messageMetadata(mailbox, uid);
+    if (!countHot(res.uid == uid)) {
+        res = sqlCache->messageMetadata(mailbox, uid);
+        if (res.uid == uid)
+            m_hotMessages->setMessageMetadata(mailbox, uid, res);
+    }
+    return res;
+}
+
+QMap<uint, AbstractCache::MessageDataBundle> CombinedCache::messageMetadata(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, MessageDataBundle> res = m_hotMessages->messageMetadata(mailbox, uids);
+    m_hotHits += res.size();
+    QList<uint> missing;
+    Q_FOREACH(const uint uid, uids) {
+        if (!res.contains(uid)) {
+            ++m_hotMisses;
+            missing << uid;
+        }
+    }
+    if (missing.isEmpty())
+        return res;
+
+    QMap<uint, MessageDataBundle> loaded = sqlCache->messageMetadata(mailbox, missing);
+    for (QMap<uint, MessageDataBundle>::const_iterator it = loaded.constBegin(); it != loaded.constEnd(); ++it) {
+        m_hotMessages->setMessageMetadata(mailbox, it.key(), *it);
+        res[it.key()] = *it;
+    }
+    return res;
 }
 
 void CombinedCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
 {
     sqlCache->setMessageMetadata(mailbox, uid, metadata);
+    m_hotMessages->setMessageMetadata(mailbox, uid, metadata);
 }
 
 QByteArray CombinedCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
-    QByteArray res = sqlCache->messagePart(mailbox, uid, partId);
+    QByteArray res;
+    if (countHot(m_hotMessages->findMessagePart(mailbox, uid, partId, res)))
+        return res;
+
+    res = sqlCache->messagePart(mailbox, uid, partId);
     if (res.isEmpty()) {
         res = diskPartCache->messagePart(mailbox, uid, partId);
     }
+    if (!res.isNull() && res.size() <= hotPartMaxSize)
+        m_hotMessages->setMsgPart(mailbox, uid, partId, res);
     return res;
 }
 
+bool CombinedCache::hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    QByteArray data;
+    return m_hotMessages->findMessagePart(mailbox, uid, partId, data) || sqlCache->hasMessagePart(mailbox, uid, partId) ||
+            diskPartCache->hasMessagePart(mailbox, uid, partId);
+}
+
 void CombinedCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
 {
     if (data.size() < 1024 * 1024) {
@@ -135,22 +309,70 @@ void CombinedCache::setMsgPart(const QString &mailbox, const uint uid, const QBy
     } else {
         diskPartCache->setMsgPart(mailbox, uid, partId, data);
     }
+    if (data.size() <= hotPartMaxSize) {
+        m_hotMessages->setMsgPart(mailbox, uid, partId, data);
+    } else {
+        m_hotMessages->forgetMessagePart(mailbox, uid, partId);
+    }
 }
 
 void CombinedCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
 {
     sqlCache->forgetMessagePart(mailbox, uid, partId);
     diskPartCache->forgetMessagePart(mailbox, uid, partId);
+    m_hotMessages->forgetMessagePart(mailbox, uid, partId);
+}
+
+QString CombinedCache::messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    // The SQL cache only has the smaller parts, and those are not worth it
+    return diskPartCache->messagePartFile(mailbox, uid, partId);
+}
+
+QByteArray CombinedCache::partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    return diskPartCache->partialMessagePart(mailbox, uid, partId);
+}
+
+qint64 CombinedCache::partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    return diskPartCache->partialMessagePartSize(mailbox, uid, partId);
+}
+
+void CombinedCache::appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk)
+{
+    diskPartCache->appendPartialMessagePart(mailbox, uid, partId, chunk);
+}
+
+void CombinedCache::forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    diskPartCache->forgetPartialMessagePart(mailbox, uid, partId);
 }
 
 QVector<Imap::Responses::ThreadingNode> CombinedCache::messageThreading(const QString &mailbox)
 {
-    return sqlCache->messageThreading(mailbox);
+    QVector<Imap::Responses::ThreadingNode> res;
+    if (!lookupHot(m_hotThreading, mailbox, res)) {
+        res = sqlCache->messageThreading(mailbox);
+        m_hotThreading.insert(mailbox, new QVector<Imap::Responses::ThreadingNode>(res), threadingCost(res));
+    }
+    return res;
 }
 
 void CombinedCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
 {
     sqlCache->setMessageThreading(mailbox, threading);
+    m_hotThreading.insert(mailbox, new QVector<Imap::Responses::ThreadingNode>(threading), threadingCost(threading));
+}
+
+OfflineSyncProgress CombinedCache::offlineSyncProgress(const QString &mailbox) const
+{
+    return sqlCache->offlineSyncProgress(mailbox);
+}
+
+void CombinedCache::setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress)
+{
+    sqlCache->setOfflineSyncProgress(mailbox, progress);
 }
 
 void CombinedCache::setRenewalThreshold(const int days)
@@ -158,5 +380,80 @@ void CombinedCache::setRenewalThreshold(const int days)
     sqlCache->setRenewalThreshold(days);
 }
 
+AbstractCache::Usage CombinedCache::usage() const
+{
+    Usage res = sqlCache->usage();
+    res.parts += diskPartCache->partCount();
+    res.partBytes += diskPartCache->size();
+    res.diskBytes += diskPartCache->diskUsage();
+    res.quota = m_quota;
+    res.memoryHits = m_hotHits;
+    res.memoryMisses = m_hotMisses;
+    return res;
+}
+
+void CombinedCache::setQuota(const qint64 bytes)
+{
+    m_quota = bytes;
+    if (m_quota) {
+        m_garbageTimer->start(0);
+    } else {
+        m_garbageTimer->stop();
+        m_collectingGarbage = false;
+    }
+}
+
+/** @short Evict the least recently used message parts if the cache is over its quota
+
+The parts are removed in small steps with a pause between them, until the size drops to 90% of the quota; this way, the
+regular cache operations can proceed while a big cleanup is running, and the eviction does not restart each time a single
+part gets added. The metadata of the messages stay in the cache.
+*/
+void CombinedCache::collectGarbage()
+{
+    if (!m_quota)
+        return;
+
+    const qint64 target = m_quota - m_quota / 10;
+    qint64 used = sqlCache->partsSize() + diskPartCache->size();
+    if (used <= (m_collectingGarbage ? target : m_quota)) {
+        m_collectingGarbage = false;
+        m_garbageTimer->start(garbageCheckInterval);
+        return;
+    }
+
+    m_collectingGarbage = true;
+    int evicted = 0;
+    while (evicted < garbageStepSize && used > target) {
+        qint64 sqlOldest = sqlCache->oldestPartAccess();
+        qint64 diskOldest = diskPartCache->oldestAccess();
+        if (sqlOldest == -1 && diskOldest == -1)
+            break;
+        // Whichever store has the older data gives them up first
+        qint64 freed;
+        int evictedNow = 0;
+        if (diskOldest == -1 || (sqlOldest != -1 && sqlOldest <= diskOldest)) {
+            freed = sqlCache->evictLeastRecentlyUsedParts(garbageSqlBatch, &evictedNow);
+        } else {
+            freed = diskPartCache->evictLeastRecentlyUsed(1);
+            if (freed)
+                evictedNow = 1;
+        }
+        if (!evictedNow) {
+            // The store failed to give up anything, so there's no point in asking it again right now
+            break;
+        }
+        used -= freed;
+        evicted += evictedNow;
+    }
+
+    if (used > target && evicted >= garbageStepSize) {
+        m_garbageTimer->start(garbageStepInterval);
+    } else {
+        m_collectingGarbage = false;
+        m_garbageTimer->start(garbageCheckInterval);
+    }
+}
+
 }
 }
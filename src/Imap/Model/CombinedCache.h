@@ -23,8 +23,11 @@
 #ifndef IMAP_MODEL_COMBINEDCACHE_H
 #define IMAP_MODEL_COMBINEDCACHE_H
 
+#include <QCache>
 #include "Cache.h"
 
+class QTimer;
+
 namespace Imap
 {
 
@@ -33,6 +36,7 @@ namespace Mailbox
 
 class SQLCache;
 class DiskPartCache;
+class MemoryCache;
 
 
 /** @short A hybrid cache, using both SQLite and on-disk format
@@ -41,10 +45,15 @@ This cache servers as a thin wrapper around the SQLCache. It uses
 the SQL facilities for most of the actual caching, but changes to
 a file-based cache when items are bigger than a certain threshold.
 
-In future, this should be extended with an in-memory cache (but
-only after the MemoryCache rework) which should only speed-up certain
-operations. This will likely be implemented when we will switch from
-storing the actual data in the various TreeItem* instances.
+The total size of the message parts can be limited through setQuota(); a background garbage collector then evicts the
+least recently used parts from both stores while keeping the message metadata.
+
+The recently used data are also kept in memory, so that re-entering a mailbox or
+looking at the same messages again does not touch the disk at all. This in-memory
+tier is bounded by an estimate of the occupied memory and evicts the least recently
+used entries; all writes go through it to the persistent caches immediately.
+The per-message data live in a MemoryCache with a size limit; only the small
+message parts are kept in memory.
 */
 class CombinedCache : public AbstractCache
 {
@@ -75,24 +84,45 @@ public:
     virtual void clearMessage(const QString mailbox, const uint uid);
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, MessageDataBundle> messageMetadata(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata);
 
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, QStringList> msgFlags(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags);
+    virtual void setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags);
 
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual bool hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
     virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
+    virtual QString messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual QByteArray partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual qint64 partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual void appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk);
+    virtual void forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
 
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual OfflineSyncProgress offlineSyncProgress(const QString &mailbox) const;
+    virtual void setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress);
+
     virtual void setRenewalThreshold(const int days);
 
+    virtual Usage usage() const;
+    virtual void setQuota(const qint64 bytes);
+
     /** @short Open a connection to the cache */
     bool open();
 
+private slots:
+    void collectGarbage();
+
 private:
+    template <typename Key, typename T> bool lookupHot(QCache<Key, T> &cache, const Key &key, T &value) const;
+    bool countHot(const bool hit) const;
+
     /** @short The SQL-based cache */
     SQLCache *sqlCache;
     /** @short Cache for bigger message parts */
@@ -101,6 +131,21 @@ private:
     QString name;
     /** @short Directory to serve as a cache root */
     QString cacheDir;
+    /** @short Maximal size of the message parts in bytes, zero if unlimited */
+    qint64 m_quota;
+    /** @short Is an eviction in progress, i.e. shall the parts be evicted even when under the quota? */
+    bool m_collectingGarbage;
+    QTimer *m_garbageTimer;
+
+    mutable QCache<QString, SyncState> m_hotSyncStates;
+    mutable QCache<QString, QList<uint> > m_hotUidMappings;
+    mutable QCache<QString, QVector<Imap::Responses::ThreadingNode> > m_hotThreading;
+    /** @short The metadata, flags and small parts of the recently used messages */
+    MemoryCache *m_hotMessages;
+    /** @short Number of lookups which were served by the in-memory tier */
+    mutable qint64 m_hotHits;
+    /** @short Number of lookups which had to go to the disk */
+    mutable qint64 m_hotMisses;
 };
 
 }
@@ -21,8 +21,16 @@
 */
 
 #include "DiskPartCache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QTimer>
+#include "Common/SqlTransactionAutoAborter.h"
+#include "PartCompression.h"
 
 namespace
 {
@@ -63,6 +71,24 @@ QString fileErrorToString(const QFile::FileError e)
     }
     return QObject::tr("Unrecognized QFile error");
 }
+
+/** @short Stored blobs up to this size are appended to the pack files, the bigger ones get a file of their own */
+const int maxPackedBlobSize = 256 * 1024;
+
+/** @short Start a new pack file once the current one grows over this size */
+const qint64 maxPackSize = 64 * 1024 * 1024;
+
+/** @short How long to wait after releasing some packed data before compacting the packs */
+const int compactionDelay = 60 * 1000;
+
+/** @short How long to wait between compacting the individual packs, so that the cache thread gets to serve the reads */
+const int compactionStepInterval = 1000;
+
+/** @short The ID of a "pack" which stands for a blob stored in a file of its own */
+const qint64 standaloneBlob = -1;
+
+/** @short Reading a blob only updates its last access time when the recorded one is older than this many seconds */
+const uint blobAccessGranularity = 3600;
 }
 
 namespace Imap
@@ -74,54 +100,760 @@ DiskPartCache::DiskPartCache(QObject *parent, const QString &cacheDir_): QObject
 {
     if (!cacheDir.endsWith(QLatin1Char('/')))
         cacheDir.append(QLatin1Char('/'));
+    storeDir = cacheDir + QLatin1String("parts/");
+
+    m_compactionTimer = new QTimer(this);
+    m_compactionTimer->setSingleShot(true);
+    connect(m_compactionTimer, SIGNAL(timeout()), this, SLOT(compact()));
 }
 
-void DiskPartCache::clearAllMessages(const QString &mailbox)
+DiskPartCache::~DiskPartCache()
 {
-    QDir dir(dirForMailbox(mailbox));
-    Q_FOREACH(const QString& fname, dir.entryList(QStringList() << QLatin1String("*.cache"))) {
-        if (! dir.remove(fname)) {
-            emit error(tr("Couldn't remove file %1 for mailbox %2").arg(fname, mailbox));
+    db.close();
+    QSqlDatabase::removeDatabase(db.connectionName());
+}
+
+bool DiskPartCache::open(const QString &name)
+{
+    if (!QDir().mkpath(storeDir)) {
+        emitError(tr("Couldn't create directory %1").arg(storeDir));
+        return false;
+    }
+    db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), name);
+    db.setDatabaseName(storeDir + QLatin1String("index.sqlite"));
+    if (!db.open()) {
+        emitError(tr("Can't open the index of the part store: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QSqlQuery q(QString(), db);
+    q.exec(QLatin1String("PRAGMA journal_mode = WAL"));
+    q.exec(QLatin1String("PRAGMA synchronous = NORMAL"));
+    return createTables() && prepareQueries();
+}
+
+#define TROJITA_DISK_CACHE_EXEC(QUERY, ERROR) \
+    if (!q.exec(QLatin1String(QUERY))) { \
+        emitError(ERROR, q); \
+        return false; \
+    }
+
+bool DiskPartCache::createTables()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_DISK_CACHE_EXEC("CREATE TABLE IF NOT EXISTS blobs ( "
+                            "hash BINARY NOT NULL PRIMARY KEY, "
+                            "pack INT NOT NULL, "
+                            "offset INT NOT NULL, "
+                            "length INT NOT NULL, "
+                            "refcount INT NOT NULL"
+                            ")",
+                            tr("Can't create table blobs"));
+    TROJITA_DISK_CACHE_EXEC("CREATE TABLE IF NOT EXISTS parts ( "
+                            "mailbox STRING NOT NULL, "
+                            "uid INT NOT NULL, "
+                            "part_id BINARY NOT NULL, "
+                            "hash BINARY NOT NULL, "
+                            "PRIMARY KEY (mailbox, uid, part_id)"
+                            ")",
+                            tr("Can't create table parts"));
+    TROJITA_DISK_CACHE_EXEC("CREATE TABLE IF NOT EXISTS packs ( "
+                            "id INTEGER PRIMARY KEY, "
+                            "size INT NOT NULL, "
+                            "live INT NOT NULL"
+                            ")",
+                            tr("Can't create table packs"));
+
+    TROJITA_DISK_CACHE_EXEC("PRAGMA user_version", tr("Can't determine the layout of the part store"));
+    int layout = q.first() ? q.value(0).toInt() : 0;
+    if (layout < 1) {
+        // Layout 1 remembers when each blob was used for the last time
+        Common::SqlTransactionAutoAborter txn(&db);
+        TROJITA_DISK_CACHE_EXEC("ALTER TABLE blobs ADD COLUMN lastAccess INT NOT NULL DEFAULT 0",
+                                tr("Can't add the last access time of blobs"));
+        TROJITA_DISK_CACHE_EXEC("CREATE INDEX blobs_lru ON blobs (lastAccess)", tr("Can't create index blobs_lru"));
+        TROJITA_DISK_CACHE_EXEC("CREATE INDEX parts_hash ON parts (hash)", tr("Can't create index parts_hash"));
+        TROJITA_DISK_CACHE_EXEC("PRAGMA user_version = 1", tr("Can't update the layout of the part store"));
+        if (!txn.commit()) {
+            emitError(tr("Can't update the layout of the part store: %1").arg(db.lastError().text()));
+            return false;
+        }
+    }
+    if (layout < 2) {
+        // Layout 2 does not compress the blobs which wouldn't get any smaller
+        Common::SqlTransactionAutoAborter txn(&db);
+        TROJITA_DISK_CACHE_EXEC("ALTER TABLE blobs ADD COLUMN format INT NOT NULL DEFAULT 1",
+                                tr("Can't add the storage format of blobs"));
+        TROJITA_DISK_CACHE_EXEC("PRAGMA user_version = 2", tr("Can't update the layout of the part store"));
+        if (!txn.commit()) {
+            emitError(tr("Can't update the layout of the part store: %1").arg(db.lastError().text()));
+            return false;
         }
     }
+    return true;
+}
+
+#undef TROJITA_DISK_CACHE_EXEC
+
+#define TROJITA_DISK_CACHE_PREPARE(QUERY, SQL) \
+    QUERY = QSqlQuery(db); \
+    if (!QUERY.prepare(QLatin1String(SQL))) { \
+        emitError(tr("Failed to prepare " #QUERY), QUERY); \
+        return false; \
+    }
+
+bool DiskPartCache::prepareQueries()
+{
+    TROJITA_DISK_CACHE_PREPARE(queryPartHash, "SELECT hash FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryBlobLocation, "SELECT pack, offset, length, lastAccess, format FROM blobs WHERE hash = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryAccessBlob, "UPDATE blobs SET lastAccess = ? WHERE hash = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryBlobExists, "SELECT 1 FROM blobs WHERE hash = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryInsertBlob,
+                               "INSERT INTO blobs (hash, pack, offset, length, refcount, lastAccess, format) "
+                               "VALUES (?, ?, ?, ?, 1, ?, ?)");
+    TROJITA_DISK_CACHE_PREPARE(queryAddBlobReference, "UPDATE blobs SET refcount = refcount + 1, lastAccess = ? WHERE hash = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryReleaseBlob, "UPDATE blobs SET refcount = refcount - 1 WHERE hash = ?");
+    TROJITA_DISK_CACHE_PREPARE(querySetPartHash, "INSERT OR REPLACE INTO parts (mailbox, uid, part_id, hash) VALUES (?, ?, ?, ?)");
+    TROJITA_DISK_CACHE_PREPARE(queryRemovePart, "DELETE FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryMessageHashes, "SELECT hash FROM parts WHERE mailbox = ? AND uid = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryRemoveMessage, "DELETE FROM parts WHERE mailbox = ? AND uid = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryMailboxHashes, "SELECT hash FROM parts WHERE mailbox = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryRemoveMailbox, "DELETE FROM parts WHERE mailbox = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryUnreferencedBlobs, "SELECT hash, pack, length FROM blobs WHERE refcount <= 0");
+    TROJITA_DISK_CACHE_PREPARE(queryRemoveUnreferencedBlobs, "DELETE FROM blobs WHERE refcount <= 0");
+    TROJITA_DISK_CACHE_PREPARE(queryCurrentPack, "SELECT id, size FROM packs ORDER BY id DESC LIMIT 1");
+    TROJITA_DISK_CACHE_PREPARE(queryCreatePack, "INSERT INTO packs (size, live) VALUES (0, 0)");
+    TROJITA_DISK_CACHE_PREPARE(queryPackAppended, "UPDATE packs SET size = ?, live = live + ? WHERE id = ?");
+    TROJITA_DISK_CACHE_PREPARE(queryPackReleased, "UPDATE packs SET live = live - ? WHERE id = ?");
+    return true;
+}
+
+#undef TROJITA_DISK_CACHE_PREPARE
+
+void DiskPartCache::emitError(const QString &message, const QSqlQuery &query) const
+{
+    emitError(QString::fromUtf8("DiskPartCache: Query Error: %1: %2").arg(message, query.lastError().text()));
+}
+
+void DiskPartCache::emitError(const QString &message) const
+{
+    qDebug() << message;
+    emit error(message);
+}
+
+void DiskPartCache::clearAllMessages(const QString &mailbox)
+{
+    Common::SqlTransactionAutoAborter txn(&db);
+    queryMailboxHashes.bindValue(0, mailbox);
+    if (!queryMailboxHashes.exec()) {
+        emitError(tr("Query queryMailboxHashes failed"), queryMailboxHashes);
+        return;
+    }
+    QList<QByteArray> hashes;
+    while (queryMailboxHashes.next()) {
+        hashes << queryMailboxHashes.value(0).toByteArray();
+    }
+    queryRemoveMailbox.bindValue(0, mailbox);
+    if (!queryRemoveMailbox.exec()) {
+        emitError(tr("Query queryRemoveMailbox failed"), queryRemoveMailbox);
+        return;
+    }
+    QStringList obsoleteFiles = releaseBlobs(hashes);
+    if (txn.commit()) {
+        removeFiles(obsoleteFiles);
+    } else {
+        emitError(tr("Couldn't forget the message parts of mailbox %1").arg(mailbox));
+    }
+    removeLegacyFiles(mailbox, QStringList() << QLatin1String("*.cache") << QLatin1String("*.partial"));
 }
 
 void DiskPartCache::clearMessage(const QString mailbox, const uint uid)
 {
-    QDir dir(dirForMailbox(mailbox));
-    Q_FOREACH(const QString& fname, dir.entryList(QStringList() << QString::fromUtf8("%1_*.cache").arg(QString::number(uid)))) {
-        if (! dir.remove(fname)) {
-            emit error(tr("Couldn't remove file %1 for message %2, mailbox %3").arg(fname, QString::number(uid), mailbox));
-        }
+    Common::SqlTransactionAutoAborter txn(&db);
+    queryMessageHashes.bindValue(0, mailbox);
+    queryMessageHashes.bindValue(1, uid);
+    if (!queryMessageHashes.exec()) {
+        emitError(tr("Query queryMessageHashes failed"), queryMessageHashes);
+        return;
+    }
+    QList<QByteArray> hashes;
+    while (queryMessageHashes.next()) {
+        hashes << queryMessageHashes.value(0).toByteArray();
     }
+    queryRemoveMessage.bindValue(0, mailbox);
+    queryRemoveMessage.bindValue(1, uid);
+    if (!queryRemoveMessage.exec()) {
+        emitError(tr("Query queryRemoveMessage failed"), queryRemoveMessage);
+        return;
+    }
+    QStringList obsoleteFiles = releaseBlobs(hashes);
+    if (txn.commit()) {
+        removeFiles(obsoleteFiles);
+    } else {
+        emitError(tr("Couldn't forget the parts of message %1, mailbox %2").arg(QString::number(uid), mailbox));
+    }
+    removeLegacyFiles(mailbox, QStringList() << QString::fromUtf8("%1_*.cache").arg(QString::number(uid))
+                      << QString::fromUtf8("%1_*.partial").arg(QString::number(uid)));
 }
 
 QByteArray DiskPartCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
-    QFile buf(fileForPart(mailbox, uid, partId));
-    if (! buf.open(QIODevice::ReadOnly)) {
+    queryPartHash.bindValue(0, mailbox);
+    queryPartHash.bindValue(1, uid);
+    queryPartHash.bindValue(2, partId);
+    if (!queryPartHash.exec()) {
+        emitError(tr("Query queryPartHash failed"), queryPartHash);
+        return QByteArray();
+    }
+    if (queryPartHash.first()) {
+        QByteArray hash = queryPartHash.value(0).toByteArray();
+        queryPartHash.finish();
+        return readBlob(hash);
+    }
+
+    // The data stored by the older versions are moved into the store when they are needed for the first time
+    QFile legacy(fileForPart(mailbox, uid, partId));
+    if (!legacy.open(QIODevice::ReadOnly)) {
         return QByteArray();
     }
-    return qUncompress(buf.readAll());
+    QByteArray data = qUncompress(legacy.readAll());
+    legacy.close();
+    if (!data.isNull()) {
+        const_cast<DiskPartCache *>(this)->setMsgPart(mailbox, uid, partId, data);
+    }
+    return data;
+}
+
+/** @short Only the parts which have a file of their own and which are not compressed can be read directly
+
+The data stored by the older versions are always compressed, so they are not considered at all.
+*/
+bool DiskPartCache::hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    queryPartHash.bindValue(0, mailbox);
+    queryPartHash.bindValue(1, uid);
+    queryPartHash.bindValue(2, partId);
+    if (!queryPartHash.exec()) {
+        emitError(tr("Query queryPartHash failed"), queryPartHash);
+        return false;
+    }
+    bool res = queryPartHash.first();
+    queryPartHash.finish();
+    return res || QFile::exists(fileForPart(mailbox, uid, partId));
+}
+
+QString DiskPartCache::messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    queryPartHash.bindValue(0, mailbox);
+    queryPartHash.bindValue(1, uid);
+    queryPartHash.bindValue(2, partId);
+    if (!queryPartHash.exec()) {
+        emitError(tr("Query queryPartHash failed"), queryPartHash);
+        return QString();
+    }
+    if (!queryPartHash.first())
+        return QString();
+    QByteArray hash = queryPartHash.value(0).toByteArray();
+    queryPartHash.finish();
+
+    qint64 pack, offset;
+    int length, format;
+    if (!locateBlob(hash, pack, offset, length, format) || pack != standaloneBlob || format != PartCompression::FORMAT_RAW)
+        return QString();
+    return fileForBlob(hash);
 }
 
 void DiskPartCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
+{
+    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    Common::SqlTransactionAutoAborter txn(&db);
+
+    QList<QByteArray> replaced;
+    queryPartHash.bindValue(0, mailbox);
+    queryPartHash.bindValue(1, uid);
+    queryPartHash.bindValue(2, partId);
+    if (!queryPartHash.exec()) {
+        emitError(tr("Query queryPartHash failed"), queryPartHash);
+        return;
+    }
+    if (queryPartHash.first()) {
+        QByteArray oldHash = queryPartHash.value(0).toByteArray();
+        queryPartHash.finish();
+        if (oldHash == hash)
+            return;
+        replaced << oldHash;
+    }
+
+    queryBlobExists.bindValue(0, hash);
+    if (!queryBlobExists.exec()) {
+        emitError(tr("Query queryBlobExists failed"), queryBlobExists);
+        return;
+    }
+    if (queryBlobExists.first()) {
+        // The very same data are stored already, so it's enough to refer to them
+        queryBlobExists.finish();
+        queryAddBlobReference.bindValue(0, QDateTime::currentDateTime().toTime_t());
+        queryAddBlobReference.bindValue(1, hash);
+        if (!queryAddBlobReference.exec()) {
+            emitError(tr("Query queryAddBlobReference failed"), queryAddBlobReference);
+            return;
+        }
+    } else {
+        queryBlobExists.finish();
+        if (!storeBlob(hash, data)) {
+            emitError(tr("Couldn't save the part %1 of message %2 (mailbox %3)").arg(
+                          QString::fromUtf8(partId), QString::number(uid), mailbox));
+            return;
+        }
+    }
+
+    querySetPartHash.bindValue(0, mailbox);
+    querySetPartHash.bindValue(1, uid);
+    querySetPartHash.bindValue(2, partId);
+    querySetPartHash.bindValue(3, hash);
+    if (!querySetPartHash.exec()) {
+        emitError(tr("Query querySetPartHash failed"), querySetPartHash);
+        return;
+    }
+
+    QStringList obsoleteFiles = releaseBlobs(replaced);
+    if (!txn.commit()) {
+        emitError(tr("Couldn't save the part %1 of message %2 (mailbox %3): %4").arg(
+                      QString::fromUtf8(partId), QString::number(uid), mailbox, db.lastError().text()));
+        return;
+    }
+    removeFiles(obsoleteFiles);
+    QFile::remove(fileForPart(mailbox, uid, partId));
+}
+
+void DiskPartCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+{
+    Common::SqlTransactionAutoAborter txn(&db);
+    queryPartHash.bindValue(0, mailbox);
+    queryPartHash.bindValue(1, uid);
+    queryPartHash.bindValue(2, partId);
+    if (!queryPartHash.exec()) {
+        emitError(tr("Query queryPartHash failed"), queryPartHash);
+        return;
+    }
+    if (queryPartHash.first()) {
+        QByteArray hash = queryPartHash.value(0).toByteArray();
+        queryPartHash.finish();
+        queryRemovePart.bindValue(0, mailbox);
+        queryRemovePart.bindValue(1, uid);
+        queryRemovePart.bindValue(2, partId);
+        if (!queryRemovePart.exec()) {
+            emitError(tr("Query queryRemovePart failed"), queryRemovePart);
+            return;
+        }
+        QStringList obsoleteFiles = releaseBlobs(QList<QByteArray>() << hash);
+        if (txn.commit())
+            removeFiles(obsoleteFiles);
+    }
+    QFile(fileForPart(mailbox, uid, partId)).remove();
+}
+
+QByteArray DiskPartCache::partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    QFile buf(fileForPartialPart(mailbox, uid, partId));
+    if (! buf.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return buf.readAll();
+}
+
+qint64 DiskPartCache::partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    QFileInfo info(fileForPartialPart(mailbox, uid, partId));
+    return info.exists() ? info.size() : 0;
+}
+
+void DiskPartCache::appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk)
 {
     QString myPath = dirForMailbox(mailbox);
     QDir dir(myPath);
     dir.mkpath(myPath);
-    QString fileName(fileForPart(mailbox, uid, partId));
+    QString fileName(fileForPartialPart(mailbox, uid, partId));
     QFile buf(fileName);
-    if (! buf.open(QIODevice::WriteOnly)) {
-        emit error(tr("Couldn't save the part %1 of message %2 (mailbox %3) into file %4: %5 (%6)").arg(
-                       QString::fromUtf8(partId), QString::number(uid), mailbox, fileName, buf.errorString(), fileErrorToString(buf.error())));
+    if (! buf.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        emitError(tr("Couldn't save the partial data of part %1 of message %2 (mailbox %3) into file %4: %5 (%6)").arg(
+                      QString::fromUtf8(partId), QString::number(uid), mailbox, fileName, buf.errorString(), fileErrorToString(buf.error())));
+        return;
     }
-    buf.write(qCompress(data));
+    buf.write(chunk);
 }
 
-void DiskPartCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
+void DiskPartCache::forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
 {
-    QFile(fileForPart(mailbox, uid, partId)).remove();
+    QFile(fileForPartialPart(mailbox, uid, partId)).remove();
+}
+
+/** @short Find where the blob with the @arg hash is stored, and record the access to it */
+bool DiskPartCache::locateBlob(const QByteArray &hash, qint64 &pack, qint64 &offset, int &length, int &format) const
+{
+    queryBlobLocation.bindValue(0, hash);
+    if (!queryBlobLocation.exec()) {
+        emitError(tr("Query queryBlobLocation failed"), queryBlobLocation);
+        return false;
+    }
+    if (!queryBlobLocation.first()) {
+        emitError(tr("The part store refers to a blob which does not exist"));
+        return false;
+    }
+    pack = queryBlobLocation.value(0).toLongLong();
+    offset = queryBlobLocation.value(1).toLongLong();
+    length = queryBlobLocation.value(2).toInt();
+    uint lastAccess = queryBlobLocation.value(3).toUInt();
+    format = queryBlobLocation.value(4).toInt();
+    queryBlobLocation.finish();
+
+    uint now = QDateTime::currentDateTime().toTime_t();
+    if (lastAccess + blobAccessGranularity < now) {
+        queryAccessBlob.bindValue(0, now);
+        queryAccessBlob.bindValue(1, hash);
+        if (!queryAccessBlob.exec()) {
+            emitError(tr("Query queryAccessBlob failed"), queryAccessBlob);
+        }
+    }
+    return true;
+}
+
+/** @short Return the original data of the blob identified by the @arg hash */
+QByteArray DiskPartCache::readBlob(const QByteArray &hash) const
+{
+    qint64 pack, offset;
+    int length, format;
+    if (!locateBlob(hash, pack, offset, length, format))
+        return QByteArray();
+
+    QFile file(pack == standaloneBlob ? fileForBlob(hash) : fileForPack(pack));
+    if (!file.open(QIODevice::ReadOnly)) {
+        emitError(tr("Couldn't open file %1: %2 (%3)").arg(file.fileName(), file.errorString(), fileErrorToString(file.error())));
+        return QByteArray();
+    }
+    if (!file.seek(offset)) {
+        emitError(tr("Couldn't seek in file %1: %2").arg(file.fileName(), file.errorString()));
+        return QByteArray();
+    }
+    QByteArray stored = file.read(length);
+    if (stored.size() != length) {
+        emitError(tr("File %1 is truncated").arg(file.fileName()));
+        return QByteArray();
+    }
+    return PartCompression::decode(stored, static_cast<PartCompression::Format>(format));
+}
+
+/** @short Put the @arg data into the store under the @arg hash and record them in the index with one reference */
+bool DiskPartCache::storeBlob(const QByteArray &hash, const QByteArray &data)
+{
+    PartCompression::Format format;
+    QByteArray stored = PartCompression::encode(data, format);
+
+    qint64 pack = standaloneBlob;
+    qint64 offset = 0;
+    if (stored.size() <= maxPackedBlobSize) {
+        if (!appendToPack(stored, pack, offset))
+            return false;
+    } else {
+        QFile file(fileForBlob(hash));
+        if (!file.open(QIODevice::WriteOnly) || file.write(stored) != stored.size()) {
+            emitError(tr("Couldn't write file %1: %2 (%3)").arg(file.fileName(), file.errorString(), fileErrorToString(file.error())));
+            return false;
+        }
+    }
+
+    queryInsertBlob.bindValue(0, hash);
+    queryInsertBlob.bindValue(1, pack);
+    queryInsertBlob.bindValue(2, offset);
+    queryInsertBlob.bindValue(3, stored.size());
+    queryInsertBlob.bindValue(4, QDateTime::currentDateTime().toTime_t());
+    queryInsertBlob.bindValue(5, format);
+    if (!queryInsertBlob.exec()) {
+        emitError(tr("Query queryInsertBlob failed"), queryInsertBlob);
+        return false;
+    }
+    return true;
+}
+
+/** @short Append the @arg stored data of a blob to the current pack file and report where they ended up */
+bool DiskPartCache::appendToPack(const QByteArray &stored, qint64 &pack, qint64 &offset)
+{
+    if (!queryCurrentPack.exec()) {
+        emitError(tr("Query queryCurrentPack failed"), queryCurrentPack);
+        return false;
+    }
+    bool haveCurrent = queryCurrentPack.first() && queryCurrentPack.value(1).toLongLong() + stored.size() <= maxPackSize;
+    if (haveCurrent)
+        pack = queryCurrentPack.value(0).toLongLong();
+    queryCurrentPack.finish();
+    if (!haveCurrent) {
+        if (!queryCreatePack.exec()) {
+            emitError(tr("Query queryCreatePack failed"), queryCreatePack);
+            return false;
+        }
+        pack = queryCreatePack.lastInsertId().toLongLong();
+    }
+
+    QFile file(fileForPack(pack));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        emitError(tr("Couldn't open file %1: %2 (%3)").arg(file.fileName(), file.errorString(), fileErrorToString(file.error())));
+        return false;
+    }
+    // The actual size of the file is used because the pack might contain garbage left behind by a transaction which failed
+    offset = file.size();
+    if (file.write(stored) != stored.size()) {
+        emitError(tr("Couldn't write file %1: %2 (%3)").arg(file.fileName(), file.errorString(), fileErrorToString(file.error())));
+        return false;
+    }
+
+    queryPackAppended.bindValue(0, offset + stored.size());
+    queryPackAppended.bindValue(1, stored.size());
+    queryPackAppended.bindValue(2, pack);
+    if (!queryPackAppended.exec()) {
+        emitError(tr("Query queryPackAppended failed"), queryPackAppended);
+        return false;
+    }
+    return true;
+}
+
+/** @short Drop a reference to each of the @arg hashes and forget about the blobs which are no longer used
+
+Returns the files which shall be removed once the transaction gets committed.
+*/
+QStringList DiskPartCache::releaseBlobs(const QList<QByteArray> &hashes)
+{
+    if (hashes.isEmpty())
+        return QStringList();
+
+    Q_FOREACH(const QByteArray &hash, hashes) {
+        queryReleaseBlob.bindValue(0, hash);
+        if (!queryReleaseBlob.exec()) {
+            emitError(tr("Query queryReleaseBlob failed"), queryReleaseBlob);
+        }
+    }
+    return dropUnreferencedBlobs();
+}
+
+/** @short Forget about all blobs with no references and return the files which shall be removed after the commit */
+QStringList DiskPartCache::dropUnreferencedBlobs()
+{
+    QStringList obsoleteFiles;
+    if (!queryUnreferencedBlobs.exec()) {
+        emitError(tr("Query queryUnreferencedBlobs failed"), queryUnreferencedBlobs);
+        return obsoleteFiles;
+    }
+    QList<QPair<qint64, qint64> > releasedSpace;
+    while (queryUnreferencedBlobs.next()) {
+        qint64 pack = queryUnreferencedBlobs.value(1).toLongLong();
+        if (pack == standaloneBlob) {
+            obsoleteFiles << fileForBlob(queryUnreferencedBlobs.value(0).toByteArray());
+        } else {
+            releasedSpace << qMakePair(pack, queryUnreferencedBlobs.value(2).toLongLong());
+        }
+    }
+
+    for (QList<QPair<qint64, qint64> >::const_iterator it = releasedSpace.constBegin(); it != releasedSpace.constEnd(); ++it) {
+        queryPackReleased.bindValue(0, it->second);
+        queryPackReleased.bindValue(1, it->first);
+        if (!queryPackReleased.exec()) {
+            emitError(tr("Query queryPackReleased failed"), queryPackReleased);
+        }
+    }
+    if (!queryRemoveUnreferencedBlobs.exec()) {
+        emitError(tr("Query queryRemoveUnreferencedBlobs failed"), queryRemoveUnreferencedBlobs);
+    }
+
+    if (!releasedSpace.isEmpty() && !m_compactionTimer->isActive())
+        m_compactionTimer->start(compactionDelay);
+    return obsoleteFiles;
+}
+
+/** @short Remove at most @arg count blobs which haven't been accessed for the longest time, along with all parts using them
+
+Returns the number of bytes which got freed.
+*/
+qint64 DiskPartCache::evictLeastRecentlyUsed(const int count)
+{
+    Common::SqlTransactionAutoAborter txn(&db);
+    QSqlQuery q(QString(), db);
+    q.prepare(QLatin1String("SELECT hash, length FROM blobs ORDER BY lastAccess, rowid LIMIT ?"));
+    q.bindValue(0, count);
+    if (!q.exec()) {
+        emitError(tr("Can't find the least recently used blobs"), q);
+        return 0;
+    }
+    QVariantList hashes;
+    qint64 freed = 0;
+    while (q.next()) {
+        hashes << q.value(0);
+        freed += q.value(1).toLongLong();
+    }
+    if (hashes.isEmpty())
+        return 0;
+
+    q.prepare(QLatin1String("DELETE FROM parts WHERE hash = ?"));
+    q.bindValue(0, hashes);
+    if (!q.execBatch()) {
+        emitError(tr("Can't forget the least recently used parts"), q);
+        return 0;
+    }
+    q.prepare(QLatin1String("UPDATE blobs SET refcount = 0 WHERE hash = ?"));
+    q.bindValue(0, hashes);
+    if (!q.execBatch()) {
+        emitError(tr("Can't release the least recently used blobs"), q);
+        return 0;
+    }
+    QStringList obsoleteFiles = dropUnreferencedBlobs();
+    if (!txn.commit()) {
+        emitError(tr("Couldn't evict the least recently used parts: %1").arg(db.lastError().text()));
+        return 0;
+    }
+    removeFiles(obsoleteFiles);
+    return freed;
+}
+
+/** @short Return the number of bytes taken by the stored blobs; each of them is counted once, no matter how often it is used */
+qint64 DiskPartCache::size() const
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT SUM(length) FROM blobs"))) {
+        emitError(tr("Can't compute the size of the part store"), q);
+        return 0;
+    }
+    return q.first() ? q.value(0).toLongLong() : 0;
+}
+
+/** @short Return when has the least recently used blob been accessed, or -1 if the store is empty */
+qint64 DiskPartCache::oldestAccess() const
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT MIN(lastAccess) FROM blobs"))) {
+        emitError(tr("Can't find the least recently used blob"), q);
+        return -1;
+    }
+    if (!q.first() || q.value(0).isNull())
+        return -1;
+    return q.value(0).toLongLong();
+}
+
+/** @short Return the number of message parts in the store */
+qint64 DiskPartCache::partCount() const
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT COUNT(*) FROM parts"))) {
+        emitError(tr("Can't count the stored parts"), q);
+        return 0;
+    }
+    return q.first() ? q.value(0).toLongLong() : 0;
+}
+
+/** @short Return the space occupied by the files of the store, including the garbage which hasn't been compacted yet */
+qint64 DiskPartCache::diskUsage() const
+{
+    qint64 res = 0;
+    QSqlQuery q(QString(), db);
+    if (q.exec(QLatin1String("SELECT SUM(size) FROM packs")) && q.first())
+        res += q.value(0).toLongLong();
+    if (q.exec(QLatin1String("SELECT SUM(length) FROM blobs WHERE pack = -1")) && q.first())
+        res += q.value(0).toLongLong();
+    res += QFileInfo(db.databaseName()).size() + QFileInfo(db.databaseName() + QLatin1String("-wal")).size();
+    return res;
+}
+
+void DiskPartCache::compact()
+{
+    // Each pack can be up to maxPackSize big, so only a single one is copied at a time
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT id FROM packs WHERE live * 2 < size ORDER BY id LIMIT 2"))) {
+        emitError(tr("Can't find the packs to compact"), q);
+        return;
+    }
+    if (!q.next())
+        return;
+    const qint64 pack = q.value(0).toLongLong();
+    const bool morePacks = q.next();
+
+    // Make sure that the pack is never copied into itself
+    if (!queryCurrentPack.exec()) {
+        emitError(tr("Query queryCurrentPack failed"), queryCurrentPack);
+        return;
+    }
+    const bool isCurrent = queryCurrentPack.first() && queryCurrentPack.value(0).toLongLong() == pack;
+    queryCurrentPack.finish();
+    if (isCurrent && !queryCreatePack.exec()) {
+        emitError(tr("Query queryCreatePack failed"), queryCreatePack);
+        return;
+    }
+
+    Common::SqlTransactionAutoAborter txn(&db);
+    q.prepare(QLatin1String("SELECT hash, offset, length FROM blobs WHERE pack = ?"));
+    q.bindValue(0, pack);
+    if (!q.exec()) {
+        emitError(tr("Can't read the contents of a pack"), q);
+        return;
+    }
+    QList<QPair<QByteArray, QPair<qint64, int> > > blobs;
+    while (q.next()) {
+        blobs << qMakePair(q.value(0).toByteArray(), qMakePair(q.value(1).toLongLong(), q.value(2).toInt()));
+    }
+
+    QFile source(fileForPack(pack));
+    if (!blobs.isEmpty() && !source.open(QIODevice::ReadOnly)) {
+        emitError(tr("Couldn't open file %1: %2 (%3)").arg(source.fileName(), source.errorString(), fileErrorToString(source.error())));
+        return;
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < blobs.size(); ++i) {
+        QByteArray stored;
+        if (source.seek(blobs[i].second.first))
+            stored = source.read(blobs[i].second.second);
+        qint64 newPack, newOffset;
+        ok = stored.size() == blobs[i].second.second && appendToPack(stored, newPack, newOffset);
+        if (!ok)
+            break;
+        q.prepare(QLatin1String("UPDATE blobs SET pack = ?, offset = ? WHERE hash = ?"));
+        q.bindValue(0, newPack);
+        q.bindValue(1, newOffset);
+        q.bindValue(2, blobs[i].first);
+        ok = q.exec();
+    }
+    source.close();
+    if (ok) {
+        q.prepare(QLatin1String("DELETE FROM packs WHERE id = ?"));
+        q.bindValue(0, pack);
+        ok = q.exec();
+    }
+    if (ok && txn.commit()) {
+        QFile::remove(fileForPack(pack));
+    } else {
+        emitError(tr("Couldn't compact file %1").arg(fileForPack(pack)));
+        return;
+    }
+
+    // The rest is left for the next round, in the same way as the CombinedCache collects its garbage
+    if (morePacks)
+        m_compactionTimer->start(compactionStepInterval);
+}
+
+void DiskPartCache::removeFiles(const QStringList &fileNames)
+{
+    Q_FOREACH(const QString &fileName, fileNames) {
+        QFile file(fileName);
+        if (!file.remove()) {
+            emitError(tr("Couldn't remove file %1: %2").arg(fileName, file.errorString()));
+        }
+    }
+}
+
+/** @short Remove the files stored by the older versions and the partial data which match the @arg patterns */
+void DiskPartCache::removeLegacyFiles(const QString &mailbox, const QStringList &patterns)
+{
+    QDir dir(dirForMailbox(mailbox));
+    Q_FOREACH(const QString& fname, dir.entryList(patterns)) {
+        if (! dir.remove(fname)) {
+            emitError(tr("Couldn't remove file %1 for mailbox %2").arg(fname, mailbox));
+        }
+    }
 }
 
 QString DiskPartCache::dirForMailbox(const QString &mailbox) const
@@ -134,6 +866,20 @@ QString DiskPartCache::fileForPart(const QString &mailbox, const uint uid, const
     return QString::fromUtf8("%1/%2_%3.cache").arg(dirForMailbox(mailbox), QString::number(uid), QString::fromUtf8(partId));
 }
 
+QString DiskPartCache::fileForPartialPart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    return QString::fromUtf8("%1/%2_%3.partial").arg(dirForMailbox(mailbox), QString::number(uid), QString::fromUtf8(partId));
 }
+
+QString DiskPartCache::fileForBlob(const QByteArray &hash) const
+{
+    return storeDir + QString::fromUtf8(hash.toHex()) + QLatin1String(".blob");
+}
+
+QString DiskPartCache::fileForPack(const qint64 pack) const
+{
+    return storeDir + QString::fromUtf8("pack-%1.pack").arg(QString::number(pack));
 }
 
+}
+}
@@ -24,6 +24,10 @@
 #define IMAP_MODEL_DISKPARTCACHE_H
 
 #include <QObject>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+class QTimer;
 
 namespace Imap
 {
@@ -36,6 +40,17 @@ namespace Mailbox
 The API is designed to be "similar" to the AbstractCache, but because certain
 operations do not really make much sense (like working with a list of mailboxes),
 we do not inherit from that abstract base class.
+
+The data are stored by their content. Each distinct part is kept only once, no matter how many messages refer to it, and
+an index in a small SQLite database maps the (mailbox, UID, part ID) to the SHA-1 of the part's data and counts the
+references. The blobs are compressed unless that would be a waste of time, see PartCompression. The small blobs are
+appended to shared pack files in order not to litter the disk with lots of tiny files; the bigger ones get a file of their
+own. The space occupied by the packed blobs which are no longer referenced is reclaimed by compact(), which is scheduled
+automatically. Each blob also remembers roughly when it was
+used for the last time, so that the least recently used data can be evicted once the cache grows too big.
+
+The data of the parts whose download hasn't finished yet are kept in per-part files, as is any data written by the older
+versions, which get moved into the store once they are accessed.
 */
 class DiskPartCache : public QObject
 {
@@ -43,6 +58,10 @@ class DiskPartCache : public QObject
 public:
     /** @short Create the cache occupying the @arg cacheDir directory */
     DiskPartCache(QObject *parent, const QString &cacheDir);
+    virtual ~DiskPartCache();
+
+    /** @short Open the index of the store using the @arg name as the name of the DB connection */
+    bool open(const QString &name);
 
     /** @short Delete all data of message parts which belongs to that particular mailbox */
     virtual void clearAllMessages(const QString &mailbox);
@@ -51,22 +70,90 @@ public:
 
     /** @short Return data for some message part, or a null QByteArray if not found */
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Check whether the data of a message part are stored here without reading them */
+    virtual bool hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     /** @short Store the data for a specified message part */
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
     virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
+    /** @short Return the file which holds the uncompressed data of a big part and nothing else, see AbstractCache */
+    virtual QString messagePartFile(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+
+    /** @short Return the data of a part whose download hasn't finished yet */
+    virtual QByteArray partialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual qint64 partialMessagePartSize(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Append a downloaded chunk to the partial data; these are stored uncompressed so that appending is cheap */
+    virtual void appendPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &chunk);
+    virtual void forgetPartialMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
+
+    qint64 evictLeastRecentlyUsed(const int count);
+    qint64 size() const;
+    qint64 oldestAccess() const;
+    qint64 partCount() const;
+    qint64 diskUsage() const;
+
+public slots:
+    /** @short Rewrite one of the pack files which consist mostly of unreferenced data
+
+    When there are more of them, the next one gets compacted after a short pause.
+    */
+    void compact();
 
 signals:
     /** @short An error has occurred while performing cache operations */
-    void error(const QString &message);
+    void error(const QString &message) const;
 
 private:
     /** @short Return the directory which should be used as a storage dir for a particular mailbox */
     QString dirForMailbox(const QString &mailbox) const;
 
     QString fileForPart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    QString fileForPartialPart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    QString fileForBlob(const QByteArray &hash) const;
+    QString fileForPack(const qint64 pack) const;
+
+    bool createTables();
+    bool prepareQueries();
+
+    bool locateBlob(const QByteArray &hash, qint64 &pack, qint64 &offset, int &length, int &format) const;
+    QByteArray readBlob(const QByteArray &hash) const;
+    bool storeBlob(const QByteArray &hash, const QByteArray &data);
+    bool appendToPack(const QByteArray &stored, qint64 &pack, qint64 &offset);
+    QStringList releaseBlobs(const QList<QByteArray> &hashes);
+    QStringList dropUnreferencedBlobs();
+    void removeFiles(const QStringList &fileNames);
+    void removeLegacyFiles(const QString &mailbox, const QStringList &patterns);
+
+    void emitError(const QString &message, const QSqlQuery &query) const;
+    void emitError(const QString &message) const;
 
     /** @short The root directory for all caching */
     QString cacheDir;
+    /** @short Where the content-addressed store lives */
+    QString storeDir;
+
+    QSqlDatabase db;
+    /** @short Rewrites the sparse pack files after a while */
+    QTimer *m_compactionTimer;
+
+    mutable QSqlQuery queryPartHash;
+    mutable QSqlQuery queryBlobLocation;
+    mutable QSqlQuery queryAccessBlob;
+    QSqlQuery queryBlobExists;
+    QSqlQuery queryInsertBlob;
+    QSqlQuery queryAddBlobReference;
+    QSqlQuery queryReleaseBlob;
+    QSqlQuery querySetPartHash;
+    QSqlQuery queryRemovePart;
+    QSqlQuery queryMessageHashes;
+    QSqlQuery queryRemoveMessage;
+    QSqlQuery queryMailboxHashes;
+    QSqlQuery queryRemoveMailbox;
+    QSqlQuery queryUnreferencedBlobs;
+    QSqlQuery queryRemoveUnreferencedBlobs;
+    QSqlQuery queryCurrentPack;
+    QSqlQuery queryCreatePack;
+    QSqlQuery queryPackAppended;
+    QSqlQuery queryPackReleased;
 };
 
 }
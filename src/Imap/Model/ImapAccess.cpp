@@ -29,9 +29,11 @@
 #include "Common/Paths.h"
 #include "Common/PortNumbers.h"
 #include "Common/SettingsNames.h"
+#include "Imap/Model/AsyncCache.h"
 #include "Imap/Model/CombinedCache.h"
 #include "Imap/Model/DummyNetworkWatcher.h"
 #include "Imap/Model/MemoryCache.h"
+#include "Imap/Model/OfflineSyncer.h"
 #include "Imap/Model/SystemNetworkWatcher.h"
 #include "Imap/Network/MsgPartNetAccessManager.h"
 #include "Streams/SocketFactory.h"
@@ -40,7 +42,8 @@ namespace Imap {
 
 ImapAccess::ImapAccess(QObject *parent, QSettings *settings, Plugins::PluginManager *pluginManager, const QString &accountName) :
     QObject(parent), m_settings(settings), m_imapModel(0), m_mailboxModel(0), m_mailboxSubtreeModel(0), m_msgListModel(0),
-    m_threadingMsgListModel(0), m_visibleTasksModel(0), m_oneMessageModel(0), m_netWatcher(0), m_msgQNAM(0),
+    m_threadingMsgListModel(0), m_visibleTasksModel(0), m_oneMessageModel(0), m_netWatcher(0), m_offlineSyncer(0),
+    m_msgQNAM(0),
     m_pluginManager(pluginManager), m_passwordWatcher(0), m_port(0),
     m_connectionMethod(Common::ConnectionMethod::Invalid),
     m_sslInfoIcon(UiUtils::Formatting::IconType::NoIcon),
@@ -218,6 +221,8 @@ void ImapAccess::doConnect()
     if (m_imapModel) {
         // Disconnect from network, nuke the models
         qobject_cast<Imap::Mailbox::NetworkWatcher *>(networkWatcher())->setNetworkOffline();
+        delete m_offlineSyncer;
+        m_offlineSyncer = 0;
         delete m_threadingMsgListModel;
         m_threadingMsgListModel = 0;
         delete m_msgQNAM;
@@ -296,10 +301,13 @@ void ImapAccess::doConnect()
     if (!shouldUsePersistentCache) {
         cache = new Imap::Mailbox::MemoryCache(this);
     } else {
-        cache = new Imap::Mailbox::CombinedCache(this, QLatin1String("trojita-imap-cache"), m_cacheDir);
+        // The disk I/O of the persistent cache is performed from a dedicated thread
+        auto combinedCache = new Imap::Mailbox::CombinedCache(0, QLatin1String("trojita-imap-cache"), m_cacheDir);
+        auto asyncCache = new Imap::Mailbox::AsyncCache(this, combinedCache);
+        cache = asyncCache;
         connect(cache, SIGNAL(error(QString)), this, SLOT(onCacheError(QString)));
-        if (! static_cast<Imap::Mailbox::CombinedCache *>(cache)->open()) {
-            // Error message was already shown by the cacheError() slot
+        if (!asyncCache->runAndWait([combinedCache]() { return combinedCache->open(); })) {
+            // Error message gets shown by the cacheError() slot
             cache->deleteLater();
             cache = new Imap::Mailbox::MemoryCache(this);
         } else {
@@ -313,6 +321,18 @@ void ImapAccess::doConnect()
                     num = defaultCacheLifetime;
                 cache->setRenewalThreshold(num);
             }
+
+            // The quota is in MB, zero stands for an unlimited cache. Nothing gets evicted unless the user asked for a limit,
+            // and never when everything shall be kept offline.
+            qint64 quota = 0;
+            if (m_settings->value(Common::SettingsNames::cacheOfflineKey).toString() != Common::SettingsNames::cacheOfflineAll
+                    && m_settings->contains(Common::SettingsNames::cacheQuotaKey)) {
+                bool ok;
+                quota = m_settings->value(Common::SettingsNames::cacheQuotaKey).toLongLong(&ok);
+                if (!ok || quota < 0)
+                    quota = 0;
+            }
+            cache->setQuota(quota * 1024 * 1024);
         }
     }
 
@@ -320,6 +340,11 @@ void ImapAccess::doConnect()
     m_imapModel->setObjectName(QString::fromUtf8("imapModel-%1").arg(m_accountName));
     m_imapModel->setCapabilitiesBlacklist(m_settings->value(Common::SettingsNames::imapBlacklistedCapabilities).toStringList());
     m_imapModel->setProperty("trojita-imap-enable-id", m_settings->value(Common::SettingsNames::imapEnableId, true).toBool());
+    m_imapModel->setProperty("trojita-imap-notify", m_settings->value(Common::SettingsNames::imapUseNotify, false).toBool());
+    // Refresh the two most likely mailboxes after each switch, but only when asked to
+    m_imapModel->setProperty("trojita-imap-prewarm-mailboxes",
+                             m_settings->value(Common::SettingsNames::imapPrewarmMailboxes, false).toBool() ? 2 : 0);
+    m_imapModel->setWatchedMailboxes(m_settings->value(Common::SettingsNames::imapWatchedMailboxes).toStringList());
     connect(m_imapModel, SIGNAL(alertReceived(QString)), this, SLOT(alertReceived(QString)));
     connect(m_imapModel, SIGNAL(imapError(QString)), this, SLOT(imapError(QString)));
     connect(m_imapModel, SIGNAL(networkError(QString)), this, SLOT(networkError(QString)));
@@ -337,6 +362,21 @@ void ImapAccess::doConnect()
                                   "setNetworkOffline" : "setNetworkOnline",
                               Qt::QueuedConnection);
 
+    if (shouldUsePersistentCache && m_settings->value(Common::SettingsNames::imapOfflineSync, false).toBool()) {
+        m_offlineSyncer = new Imap::Mailbox::OfflineSyncer(m_imapModel, this);
+        m_offlineSyncer->setMailboxes(m_settings->value(Common::SettingsNames::imapOfflineSyncMailboxes,
+                                                        QStringList() << QLatin1String("INBOX")).toStringList());
+        // The limit is in kB, zero stands for downloading everything
+        const uint defaultPartSizeLimit = 1024;
+        bool ok;
+        uint partSizeLimit = m_settings->value(Common::SettingsNames::imapOfflineSyncPartSizeLimit, defaultPartSizeLimit).toUInt(&ok);
+        if (!ok)
+            partSizeLimit = defaultPartSizeLimit;
+        m_offlineSyncer->setPartSizeLimit(partSizeLimit * 1024);
+        // It waits for the network on its own
+        QMetaObject::invokeMethod(m_offlineSyncer, "start", Qt::QueuedConnection);
+    }
+
     m_imapModel->setImapUser(username());
     if (!m_password.isNull()) {
         // Really; the idea is to wait before it has been set for the first time
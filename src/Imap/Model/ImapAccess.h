@@ -48,6 +48,10 @@ class PluginManager;
 
 namespace Imap {
 
+namespace Mailbox {
+class OfflineSyncer;
+}
+
 class ImapAccess : public QObject
 {
     Q_OBJECT
@@ -142,6 +146,7 @@ private:
     Imap::Mailbox::VisibleTasksModel *m_visibleTasksModel;
     Imap::Mailbox::OneMessageModel *m_oneMessageModel;
     Imap::Mailbox::NetworkWatcher *m_netWatcher;
+    Imap::Mailbox::OfflineSyncer *m_offlineSyncer;
     QNetworkAccessManager *m_msgQNAM;
     Plugins::PluginManager *m_pluginManager;
     UiUtils::PasswordWatcher *m_passwordWatcher;
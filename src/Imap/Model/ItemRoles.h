@@ -126,6 +126,8 @@ enum {
     The returned value might be a bit fuzzy.
     */
     RoleMessageHasAttachments,
+    /** @short Is this message still waiting for its UID and flags to arrive from a windowed mailbox sync? */
+    RoleMessageIsPlaceholder,
 
     /** @short Contents of a message part */
     RolePartData,
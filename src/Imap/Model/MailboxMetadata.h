@@ -104,6 +104,25 @@ public:
 
 QDebug operator<<(QDebug dbg, const Imap::Mailbox::SyncState &state);
 
+/** @short How far has the offline synchronization of a mailbox progressed
+
+Messages are downloaded in an ascending order of their UIDs, so all messages up to and including the highestSyncedUid
+are known to be fully available in the cache, provided that the mailbox's UIDVALIDITY still matches.
+*/
+struct OfflineSyncProgress {
+    uint uidValidity;
+    uint highestSyncedUid;
+
+    OfflineSyncProgress(): uidValidity(0), highestSyncedUid(0) {}
+    OfflineSyncProgress(const uint uidValidity, const uint highestSyncedUid):
+        uidValidity(uidValidity), highestSyncedUid(highestSyncedUid) {}
+};
+
+inline bool operator==(const OfflineSyncProgress &a, const OfflineSyncProgress &b)
+{
+    return a.uidValidity == b.uidValidity && a.highestSyncedUid == b.highestSyncedUid;
+}
+
 }
 }
 
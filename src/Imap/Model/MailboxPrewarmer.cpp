@@ -0,0 +1,253 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QTimer>
+#include <QtAlgorithms>
+#include "MailboxPrewarmer.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/TaskFactory.h"
+#include "Imap/Tasks/PrewarmMailboxTask.h"
+
+namespace {
+
+/** @short For how long is a refreshed mailbox considered to be warm */
+const qint64 warmFor = 5 * 60 * 1000;
+
+/** @short How many recently visited mailboxes to remember */
+const int recentLimit = 10;
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+MailboxPrewarmer::MailboxPrewarmer(Model *model):
+    QObject(model), m_model(model), m_hits(0), m_misses(0), m_syncingWasWarm(false), m_syncStarted(0)
+{
+    m_syncMsecs[0] = m_syncMsecs[1] = 0;
+    m_timedSyncs[0] = m_timedSyncs[1] = 0;
+    m_delayTimer = new QTimer(this);
+    m_delayTimer->setSingleShot(true);
+    connect(m_delayTimer, SIGNAL(timeout()), this, SLOT(startWarming()));
+    connect(m_model, SIGNAL(messageCountPossiblyChanged(QModelIndex)), this, SLOT(slotMessageCountPossiblyChanged(QModelIndex)));
+    connect(m_model, SIGNAL(mailboxSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)),
+            this, SLOT(slotSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)));
+    m_clock.start();
+}
+
+void MailboxPrewarmer::mailboxSwitched(const QString &mailbox)
+{
+    if (mailbox.isEmpty() || mailbox == m_current)
+        return;
+
+    // The prewarming costs an extra connection and traffic for mailboxes which might never get opened, hence it's opt-in
+    const int count = m_model->property("trojita-imap-prewarm-mailboxes").toInt();
+
+    m_syncing.clear();
+    if (isWarm(mailbox)) {
+        ++m_hits;
+        log(QString::fromUtf8("Switched to a prewarmed mailbox %1").arg(mailbox));
+        m_syncing = mailbox;
+        m_syncingWasWarm = true;
+    } else if (count > 0 && m_warm.size() + m_hits + m_misses > 0) {
+        // Don't count the very first switch which nobody could have predicted
+        ++m_misses;
+        m_syncing = mailbox;
+        m_syncingWasWarm = false;
+    }
+    m_syncStarted = m_clock.elapsed();
+    // Once opened, the mailbox is kept up-to-date by its KeepMailboxOpenTask
+    m_warm.remove(mailbox);
+    logHitRate();
+
+    if (!m_current.isEmpty())
+        ++m_transitions[m_current][mailbox];
+    m_recent.removeAll(mailbox);
+    m_recent.prepend(mailbox);
+    while (m_recent.size() > recentLimit)
+        m_recent.removeLast();
+    m_withNewMail.remove(mailbox);
+    m_current = mailbox;
+
+    if (count <= 0)
+        return;
+
+    m_queue = predictNext(mailbox, count);
+    if (m_queue.isEmpty())
+        return;
+
+    // Let the SELECT of the current mailbox go first
+    bool ok;
+    int delay = m_model->property("trojita-imap-prewarm-delay").toInt(&ok);
+    if (!ok)
+        delay = 2000;
+    m_delayTimer->start(delay);
+}
+
+QStringList MailboxPrewarmer::predictNext(const QString &current, const int count) const
+{
+    QHash<QString, int> scores;
+    const QHash<QString, uint> transitions = m_transitions.value(current);
+    for (QHash<QString, uint>::const_iterator it = transitions.constBegin(); it != transitions.constEnd(); ++it) {
+        scores[it.key()] += 4 * it.value();
+    }
+    Q_FOREACH(const QString &mailbox, m_withNewMail) {
+        scores[mailbox] += 3;
+    }
+    for (int i = 0; i < m_recent.size() && i < 3; ++i) {
+        scores[m_recent[i]] += 3 - i;
+    }
+    scores.remove(current);
+
+    QList<QPair<int, QString> > ranked;
+    for (QHash<QString, int>::const_iterator it = scores.constBegin(); it != scores.constEnd(); ++it) {
+        if (!isWarm(it.key()) && isEligible(it.key()))
+            ranked << qMakePair(-it.value(), it.key());
+    }
+    qSort(ranked);
+
+    QStringList res;
+    for (int i = 0; i < ranked.size() && res.size() < count; ++i) {
+        res << ranked[i].second;
+    }
+    return res;
+}
+
+bool MailboxPrewarmer::isEligible(const QString &mailbox) const
+{
+    TreeItemMailbox *mailboxPtr = m_model->findMailboxByName(mailbox);
+    if (!mailboxPtr || !mailboxPtr->isSelectable() || mailboxPtr->maintainingTask)
+        return false;
+    // Mailboxes which got loaded already keep their state in the tree, see the class documentation
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailboxPtr->m_children[0]);
+    Q_ASSERT(list);
+    return list->accessFetchStatus() == TreeItem::NONE;
+}
+
+bool MailboxPrewarmer::isWarm(const QString &mailbox) const
+{
+    QHash<QString, qint64>::const_iterator it = m_warm.constFind(mailbox);
+    return it != m_warm.constEnd() && m_clock.elapsed() - *it < warmFor;
+}
+
+void MailboxPrewarmer::slotMessageCountPossiblyChanged(const QModelIndex &mailbox)
+{
+    // Only look at the numbers which are already known; asking for the others would trigger a STATUS
+    if (!mailbox.data(RoleMailboxNumbersFetched).toBool())
+        return;
+    const QString name = mailbox.data(RoleMailboxName).toString();
+    if (name.isEmpty() || name == m_current)
+        return;
+
+    const int unread = mailbox.data(RoleUnreadMessageCount).toInt();
+    QHash<QString, int>::iterator it = m_lastUnread.find(name);
+    if ((it != m_lastUnread.end() && unread > *it) || mailbox.data(RoleRecentMessageCount).toInt() > 0) {
+        m_withNewMail.insert(name);
+        // Whatever we have cached about it is stale now
+        m_warm.remove(name);
+    }
+    m_lastUnread[name] = unread;
+}
+
+void MailboxPrewarmer::startWarming()
+{
+    if (m_queue.isEmpty() || m_task || m_model->networkPolicy() != NETWORK_ONLINE)
+        return;
+
+    int usedConnections = 0;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_model->m_parsers.constBegin(); it != m_model->m_parsers.constEnd(); ++it) {
+        if (it->connState != CONN_STATE_LOGOUT)
+            ++usedConnections;
+    }
+    if (usedConnections == 0 || usedConnections >= m_model->m_maxParsers) {
+        // Either we aren't connected at all, or there's no room for one more connection
+        return;
+    }
+
+    log(QString::fromUtf8("Prewarming %1").arg(m_queue.join(QLatin1String(", "))));
+    m_task = m_model->m_taskFactory->createPrewarmMailboxTask(m_model, this);
+}
+
+QString MailboxPrewarmer::takeNextMailbox()
+{
+    while (!m_queue.isEmpty()) {
+        QString mailbox = m_queue.takeFirst();
+        if (!isWarm(mailbox) && isEligible(mailbox))
+            return mailbox;
+    }
+    return QString();
+}
+
+void MailboxPrewarmer::mailboxWarmed(const QString &mailbox, const qint64 msecs)
+{
+    m_warm[mailbox] = m_clock.elapsed();
+    m_withNewMail.remove(mailbox);
+    log(QString::fromUtf8("Mailbox %1 prewarmed in %2 ms").arg(mailbox, QString::number(msecs)));
+}
+
+void MailboxPrewarmer::slotSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state)
+{
+    if (state != STATE_DONE || m_syncing.isEmpty() || mailbox.data(RoleMailboxName).toString() != m_syncing)
+        return;
+
+    const qint64 msecs = m_clock.elapsed() - m_syncStarted;
+    m_syncMsecs[m_syncingWasWarm] += msecs;
+    ++m_timedSyncs[m_syncingWasWarm];
+    log(QString::fromUtf8("Foreground sync of %1 mailbox %2 took %3 ms").arg(
+            m_syncingWasWarm ? QLatin1String("prewarmed") : QLatin1String("cold"), m_syncing, QString::number(msecs)));
+    // Only the first sync after the switch says something about the prewarming, the later ones are resyncs
+    m_syncing.clear();
+    logHitRate();
+}
+
+qint64 MailboxPrewarmer::averageSyncMsecs(const bool prewarmed) const
+{
+    return m_timedSyncs[prewarmed] ? m_syncMsecs[prewarmed] / m_timedSyncs[prewarmed] : -1;
+}
+
+void MailboxPrewarmer::logHitRate()
+{
+    if (!(m_hits + m_misses))
+        return;
+
+    QString message = QString::fromUtf8("Prewarming hit rate %1/%2").arg(QString::number(m_hits), QString::number(m_hits + m_misses));
+    const qint64 warm = averageSyncMsecs(true);
+    const qint64 cold = averageSyncMsecs(false);
+    if (warm >= 0 && cold >= 0) {
+        message += QString::fromUtf8(", saving %1 ms per prewarmed switch (%2 ms cold, %3 ms prewarmed)").arg(
+                    QString::number(cold - warm), QString::number(cold), QString::number(warm));
+    }
+    log(message);
+}
+
+void MailboxPrewarmer::log(const QString &message)
+{
+    m_model->logTrace(0, Common::LOG_OTHER, QLatin1String("MailboxPrewarmer"), message);
+}
+
+}
+}
@@ -0,0 +1,131 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_MAILBOXPREWARMER_H
+#define IMAP_MODEL_MAILBOXPREWARMER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include "Imap/Model/Model.h"
+
+class QTimer;
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class PrewarmMailboxTask;
+
+/** @short Predict which mailbox the user is going to open next and refresh its cached state in advance
+
+Each switch to another mailbox is recorded. The candidates for the next switch are scored by how often the user went from
+the current mailbox to them, by whether new mail has arrived there and by how recently they were visited. The best of them
+are handed to a PrewarmMailboxTask which EXAMINEs them on an extra connection and brings the cached sync state, UID map and
+flags up to date. When the user actually opens such a mailbox, the message list is populated from the cache right away and
+the SELECT only has to deal with a small delta.
+
+Only mailboxes which have not been loaded in this session are refreshed this way; the others have their state in the tree
+already, and rewriting the cache under their feet would make it inconsistent with the tree.
+
+The feature is opt-in; the number of mailboxes to refresh after each switch is controlled by the
+trojita-imap-prewarm-mailboxes property, and a missing property or zero turns the whole feature off. The prewarming only
+happens on a free (NETWORK_ONLINE) network and while there's room for one more connection. Every switch logs the hit rate.
+
+To tell whether the prewarming is worth it, the foreground sync which follows each counted switch is timed until its
+STATE_DONE. The average time of the syncs of prewarmed mailboxes is compared to the average of the cold ones, and the
+difference is logged next to the hit rate as the time saved per prewarmed switch.
+*/
+class MailboxPrewarmer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MailboxPrewarmer(Model *model);
+
+    /** @short The user has switched to the @arg mailbox */
+    void mailboxSwitched(const QString &mailbox);
+
+    /** @short Return the mailboxes which are most likely to be opened after the @arg current one, best first */
+    QStringList predictNext(const QString &current, const int count) const;
+
+    /** @short How many switches went to a mailbox which was prewarmed */
+    uint hits() const { return m_hits; }
+    /** @short How many switches went to a mailbox which was not prewarmed while the prewarming was active */
+    uint misses() const { return m_misses; }
+    /** @short Average duration of the foreground syncs after switching to a prewarmed (@arg prewarmed) or a cold mailbox
+
+    Returns -1 when no such sync has been timed yet.
+    */
+    qint64 averageSyncMsecs(const bool prewarmed) const;
+
+    /** @short Return the next mailbox which shall be refreshed, or a null QString if there's nothing to do */
+    QString takeNextMailbox();
+    /** @short The @arg mailbox has been refreshed, which took @arg msecs */
+    void mailboxWarmed(const QString &mailbox, const qint64 msecs);
+    /** @short Is the @arg mailbox a candidate for prewarming at all? */
+    bool isEligible(const QString &mailbox) const;
+
+private slots:
+    void slotMessageCountPossiblyChanged(const QModelIndex &mailbox);
+    void startWarming();
+    void slotSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state);
+
+private:
+    bool isWarm(const QString &mailbox) const;
+    void logHitRate();
+    void log(const QString &message);
+
+    Model *m_model;
+    QString m_current;
+    /** @short How many times did the user go from one mailbox (the key) to another one (the key of the inner hash) */
+    QHash<QString, QHash<QString, uint> > m_transitions;
+    /** @short Recently visited mailboxes, the most recent first */
+    QStringList m_recent;
+    /** @short Mailboxes where new mail has arrived since they were last visited */
+    QSet<QString> m_withNewMail;
+    QHash<QString, int> m_lastUnread;
+    /** @short Mailboxes waiting for the PrewarmMailboxTask */
+    QStringList m_queue;
+    /** @short Value of the m_clock when each of the prewarmed mailboxes got refreshed */
+    QHash<QString, qint64> m_warm;
+    QPointer<PrewarmMailboxTask> m_task;
+    QTimer *m_delayTimer;
+    QElapsedTimer m_clock;
+    uint m_hits;
+    uint m_misses;
+    /** @short The mailbox whose foreground sync is being timed, if any */
+    QString m_syncing;
+    bool m_syncingWasWarm;
+    /** @short Value of the m_clock when the switch to m_syncing happened */
+    qint64 m_syncStarted;
+    /** @short Total time and number of the timed syncs, prewarmed ones at index 1 and cold ones at index 0 */
+    qint64 m_syncMsecs[2];
+    uint m_timedSyncs[2];
+};
+
+}
+}
+
+#endif // IMAP_MODEL_MAILBOXPREWARMER_H
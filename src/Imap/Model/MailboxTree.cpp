@@ -367,7 +367,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
             // That's what we expect -> do nothing
         } else if (message->uid() == 0) {
             // This is the first time we see the UID, so let's take a note
-            message->m_uid = receivedUid;
+            message->setUid(receivedUid);
             changedMessage = message;
             if (message->loading()) {
                 // The Model tried to ask for data for this message. That couldn't succeeded because the UID
@@ -509,7 +509,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                     part->setFetchStatus(DONE);
                     changedParts.append(part);
                     if (message->uid()
-                            && model->cache()->messagePart(mailbox(), message->uid(), part->partId() + ".X-RAW").isNull()) {
+                            && !model->cache()->hasMessagePart(mailbox(), message->uid(), part->partId() + ".X-RAW")) {
                         // Do not store the data into cache if the raw data are already there
                         model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
                     }
@@ -564,6 +564,12 @@ old state any longer. But the old state is not important anyway because it's alr
 void TreeItemMailbox::saveSyncStateAndUids(Model * model)
 {
     TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(m_children[0]);
+    if (list->m_placeholderCount) {
+        // A windowed sync is still backfilling the older messages, so there are zero UIDs in the list. Saving them would
+        // break the invariants documented above; the cache will be updated when the backfill completes.
+        list->setFetchStatus(DONE);
+        return;
+    }
     if (list->m_unreadMessageCount != -1) {
         syncState.setUnSeenCount(list->m_unreadMessageCount);
     }
@@ -585,6 +591,8 @@ void TreeItemMailbox::handleExpunge(Model *const model, const Responses::NumberR
         throw UnknownMessageIndex("EXPUNGE references message number which is out-of-bounds");
     }
     uint offset = resp.number - 1;
+    if (offset < static_cast<uint>(list->m_placeholderCount))
+        --list->m_placeholderCount;
 
     model->beginRemoveRows(list->toIndex(model), offset, offset);
     auto it = list->m_children.begin() + offset;
@@ -692,6 +700,8 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
 
         int row = msgCandidate->row();
         Q_ASSERT(row == it - list->m_children.begin());
+        if (row < list->m_placeholderCount)
+            --list->m_placeholderCount;
         model->beginRemoveRows(listIndex, row, row);
         it = list->m_children.erase(it);
         for (auto furtherMessage = it; furtherMessage != list->m_children.end(); ++furtherMessage) {
@@ -836,12 +846,19 @@ bool TreeItemMailbox::isSelectable() const
 
 TreeItemMsgList::TreeItemMsgList(TreeItem *parent):
     TreeItem(parent), m_numberFetchingStatus(NONE), m_totalMessageCount(-1),
-    m_unreadMessageCount(-1), m_recentMessageCount(-1)
+    m_unreadMessageCount(-1), m_recentMessageCount(-1), m_placeholderCount(0)
 {
     if (!parent->parent())
         setFetchStatus(DONE);
 }
 
+TreeItemMsgList::~TreeItemMsgList()
+{
+    // The children have to be gone before the m_uidIndex is destroyed because their destructors access it
+    qDeleteAll(m_children);
+    m_children.clear();
+}
+
 void TreeItemMsgList::fetch(Model *const model)
 {
     if (fetched() || isUnavailable(model))
@@ -886,6 +903,10 @@ QVariant TreeItemMsgList::data(Model *const model, int role)
     if (isUnavailable(model))
         return QLatin1String("[offline]");
 
+    if (fetched() && m_placeholderCount)
+        return QString::fromUtf8("[%1 messages, %2 still syncing]").arg(QString::number(childrenCount(model)),
+                                                                        QString::number(m_placeholderCount));
+
     if (fetched())
         return hasChildren(model) ? QString::fromUtf8("[%1 messages]").arg(childrenCount(model)) : QLatin1String("[no messages]");
 
@@ -927,7 +948,8 @@ void TreeItemMsgList::recalcVariousMessageCounts(Model *model)
 {
     m_unreadMessageCount = 0;
     m_recentMessageCount = 0;
-    for (int i = 0; i < m_children.size(); ++i) {
+    // The placeholders have no flags yet; they get accounted for by setFlags() once the backfill reaches them
+    for (int i = m_placeholderCount; i < m_children.size(); ++i) {
         TreeItemMessage *message = static_cast<TreeItemMessage *>(m_children[i]);
         if (!message->m_flagsHandled)
             message->m_wasUnread = ! message->isMarkedAsRead();
@@ -955,6 +977,18 @@ bool TreeItemMsgList::numbersFetched() const
     return m_numberFetchingStatus == DONE;
 }
 
+/** @short Return a message with the specified UID, or 0 if there's no such message with an already known UID */
+TreeItemMessage *TreeItemMsgList::findMessageByUid(const uint uid) const
+{
+    return m_uidIndex.value(uid, 0);
+}
+
+/** @short How many messages at the beginning of the list are still waiting for their UID and flags to be backfilled */
+int TreeItemMsgList::placeholderCount() const
+{
+    return m_placeholderCount;
+}
+
 
 
 MessageDataPayload::MessageDataPayload():
@@ -975,9 +1009,24 @@ TreeItemMessage::TreeItemMessage(TreeItem *parent):
 
 TreeItemMessage::~TreeItemMessage()
 {
+    if (m_uid && parent()) {
+        QHash<uint, TreeItemMessage *> &index = static_cast<TreeItemMsgList *>(parent())->m_uidIndex;
+        QHash<uint, TreeItemMessage *>::iterator it = index.find(m_uid);
+        if (it != index.end() && *it == this)
+            index.erase(it);
+    }
     delete m_data;
 }
 
+void TreeItemMessage::setUid(const uint uid)
+{
+    Q_ASSERT(!m_uid || m_uid == uid);
+    m_uid = uid;
+    if (uid && parent()) {
+        static_cast<TreeItemMsgList *>(parent())->m_uidIndex[uid] = this;
+    }
+}
+
 void TreeItemMessage::fetch(Model *const model)
 {
     if (fetched() || loading() || isUnavailable(model))
@@ -1057,6 +1106,8 @@ QVariant TreeItemMessage::data(Model *const model, int role)
     switch (role) {
     case RoleMessageUid:
         return m_uid ? QVariant(m_uid) : QVariant();
+    case RoleMessageIsPlaceholder:
+        return m_offset < static_cast<TreeItemMsgList *>(parent())->m_placeholderCount;
     case RoleIsFetched:
         return fetched();
     case RoleIsUnavailable:
@@ -23,6 +23,7 @@
 #ifndef IMAP_MAILBOXTREE_H
 #define IMAP_MAILBOXTREE_H
 
+#include <QHash>
 #include <QList>
 #include <QModelIndex>
 #include <QPointer>
@@ -49,6 +50,10 @@ class TreeItem
     friend class DeleteMailboxTask; // for direct access to m_children
     friend class ObtainSynchronizedMailboxTask;
     friend class KeepMailboxOpenTask; // for direct access to m_children
+    friend class ParallelFetchTask; // for direct access to m_children
+    friend class FetchMsgPartInChunksTask; // for direct access to m_children and to the fetching status
+    friend class OfflineSyncer; // for direct access to m_children and to the fetching status
+    friend class MailboxPrewarmer; // for direct access to m_children and to the fetching status
     friend class MsgListModel; // for direct access to m_children
     friend class ThreadingMsgListModel; // for direct access to m_children
     friend class UpdateFlagsOfAllMessagesTask; // for direct access to m_children
@@ -136,6 +141,11 @@ class TreeItemMailbox: public TreeItem
     friend class MailboxModel;
     friend class DeleteMailboxTask; // for direct access to maintainingTask
     friend class KeepMailboxOpenTask; // needs access to maintainingTask
+    friend class ParallelFetchTask; // needs access to partIdToPtr()
+    friend class FetchMsgPartInChunksTask; // needs access to partIdToPtr()
+    friend class MailboxPrewarmer; // needs access to maintainingTask
+    friend class MailboxWatcher; // needs access to maintainingTask
+    friend class OfflineSyncer; // needs access to maintainingTask
     friend class SubscribeUnsubscribeTask; // needs access to m_metadata.flags
     static QLatin1String flagNoInferiors;
     static QLatin1String flagHasNoChildren;
@@ -208,8 +218,22 @@ class TreeItemMsgList: public TreeItem
     int m_totalMessageCount;
     int m_unreadMessageCount;
     int m_recentMessageCount;
+    /** @short Messages with an already known UID, indexed by that UID
+
+    The index is kept up-to-date by TreeItemMessage::setUid() and by the TreeItemMessage's destructor, which means that
+    it never contains messages with UID zero.  The message's position in the list is available through its m_offset.
+    */
+    QHash<uint, TreeItemMessage *> m_uidIndex;
+    /** @short Number of leading messages whose UIDs and flags have not been synced yet
+
+    A windowed sync of a large mailbox only asks for the newest messages at first and leaves the older ones as placeholders
+    which get backfilled by the KeepMailboxOpenTask later on.  These placeholders always form a contiguous range at the
+    beginning of the list.  As long as there are any, the UID map is incomplete and must not be saved into the cache.
+    */
+    int m_placeholderCount;
 public:
     explicit TreeItemMsgList(TreeItem *parent);
+    ~TreeItemMsgList();
 
     virtual void fetch(Model *const model);
     virtual unsigned int rowCount(Model *const model);
@@ -223,6 +247,8 @@ public:
     void recalcVariousMessageCounts(Model *model);
     void resetWasUnreadState();
     bool numbersFetched() const;
+    TreeItemMessage *findMessageByUid(const uint uid) const;
+    int placeholderCount() const;
 };
 
 class MessageDataPayload
@@ -250,6 +276,8 @@ class TreeItemMessage: public TreeItem
     friend class Model;
     friend class ObtainSynchronizedMailboxTask; // needs access to m_offset
     friend class KeepMailboxOpenTask; // needs access to m_offset
+    friend class ParallelFetchTask; // needs access to m_offset
+    friend class FetchMsgPartInChunksTask; // needs access to m_offset
     friend class UpdateFlagsTask; // needs access to m_flags
     friend class UpdateFlagsOfAllMessagesTask; // needs access to m_flags
     int m_offset;
@@ -260,6 +288,8 @@ class TreeItemMessage: public TreeItem
     bool m_wasUnread;
     /** @short Set FLAGS and maintain the unread message counter */
     void setFlags(TreeItemMsgList *list, const QStringList &flags);
+    /** @short Set the UID and maintain the parent's UID index */
+    void setUid(const uint uid);
     void processAdditionalHeaders(Model *model, const QByteArray &rawHeaders);
     static bool hasNestedAttachments(Model *const model, TreeItemPart *part);
 
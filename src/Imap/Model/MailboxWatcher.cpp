@@ -0,0 +1,182 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QSet>
+#include <QTimer>
+#include "MailboxWatcher.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/TaskFactory.h"
+#include "Imap/Tasks/NumberOfMessagesTask.h"
+#include "Imap/Tasks/WatchMailboxTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+MailboxWatcher::MailboxWatcher(Model *model):
+    QObject(model), m_model(model), m_pollPosition(0)
+{
+    m_pollTimer = new QTimer(this);
+    connect(m_pollTimer, SIGNAL(timeout()), this, SLOT(slotTick()));
+    connect(m_model, SIGNAL(networkPolicyChanged()), this, SLOT(slotNetworkPolicyChanged()));
+}
+
+void MailboxWatcher::setWatchedMailboxes(const QStringList &mailboxes)
+{
+    m_mailboxes = mailboxes;
+    m_mailboxes.removeDuplicates();
+    m_pollPosition = 0;
+    if (m_mailboxes.isEmpty()) {
+        m_pollTimer->stop();
+        stopAll();
+        return;
+    }
+
+    bool ok;
+    int interval = m_model->property("trojita-imap-watch-poll-interval").toInt(&ok);
+    if (!ok)
+        interval = 60 * 1000;
+    m_pollTimer->start(interval);
+    // The mailbox list might not be available yet; the next tick will take care of the rest
+    reconcile();
+}
+
+bool MailboxWatcher::shouldWatch(const QString &mailbox) const
+{
+    if (!m_mailboxes.contains(mailbox))
+        return false;
+    TreeItemMailbox *mailboxPtr = m_model->findMailboxByName(mailbox);
+    // The KeepMailboxOpenTask has a much better idea about what is going on in an opened mailbox
+    return mailboxPtr && mailboxPtr->isSelectable() && !mailboxPtr->maintainingTask;
+}
+
+void MailboxWatcher::slotTick()
+{
+    reconcile();
+    pollNext();
+}
+
+void MailboxWatcher::slotNetworkPolicyChanged()
+{
+    if (!m_mailboxes.isEmpty())
+        reconcile();
+}
+
+void MailboxWatcher::reconcile()
+{
+    if (!m_model->isNetworkOnline()) {
+        stopAll();
+        return;
+    }
+
+    QSet<Parser *> ownConnections;
+    for (QMap<QString, QPointer<WatchMailboxTask> >::const_iterator it = m_watchers.constBegin(); it != m_watchers.constEnd(); ++it) {
+        if (*it)
+            ownConnections.insert((*it)->parser);
+    }
+
+    // The connections of the parallel downloads, the offline sync and the prewarming count as well, only our own don't
+    int otherConnections = 0;
+    int regularConnections = 0;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_model->m_parsers.constBegin(); it != m_model->m_parsers.constEnd(); ++it) {
+        if (it->connState == CONN_STATE_LOGOUT)
+            continue;
+        if (it->notifyActive) {
+            // The server pushes the changes in all mailboxes via NOTIFY already
+            stopAll();
+            return;
+        }
+        if (ownConnections.contains(it.key()))
+            continue;
+        ++otherConnections;
+        if (!it->isDedicated)
+            ++regularConnections;
+    }
+
+    QStringList candidates;
+    Q_FOREACH(const QString &mailbox, m_mailboxes) {
+        if (shouldWatch(mailbox))
+            candidates << mailbox;
+    }
+
+    bool ok;
+    int budget = m_model->property("trojita-imap-watch-connections").toInt(&ok);
+    if (!ok)
+        budget = 2;
+    // Leave room for one more regular connection, and don't connect on our own when the user hasn't done so yet
+    budget = regularConnections ? qBound(0, qMin(budget, m_model->m_maxParsers - otherConnections - 1), candidates.size()) : 0;
+
+    const QStringList idling = candidates.mid(0, budget);
+    for (QMap<QString, QPointer<WatchMailboxTask> >::iterator it = m_watchers.begin(); it != m_watchers.end(); /* nothing */) {
+        if (!*it) {
+            it = m_watchers.erase(it);
+        } else if (!idling.contains(it.key())) {
+            log(QString::fromUtf8("Not watching %1 over IDLE anymore").arg(it.key()));
+            (*it)->stop();
+            it = m_watchers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    Q_FOREACH(const QString &mailbox, idling) {
+        if (m_watchers.contains(mailbox))
+            continue;
+        log(QString::fromUtf8("Watching %1 over IDLE").arg(mailbox));
+        m_watchers[mailbox] = m_model->m_taskFactory->createWatchMailboxTask(m_model, mailbox, this);
+    }
+
+    m_polled = candidates.mid(budget);
+}
+
+void MailboxWatcher::pollNext()
+{
+    if (m_polled.isEmpty() || !m_model->isNetworkOnline())
+        return;
+
+    m_pollPosition %= m_polled.size();
+    TreeItemMailbox *mailboxPtr = m_model->findMailboxByName(m_polled[m_pollPosition++]);
+    if (!mailboxPtr)
+        return;
+    m_model->m_taskFactory->createNumberOfMessagesTask(m_model, mailboxPtr->toIndex(m_model));
+}
+
+void MailboxWatcher::stopAll()
+{
+    Q_FOREACH(const QPointer<WatchMailboxTask> &task, m_watchers) {
+        if (task)
+            task->stop();
+    }
+    m_watchers.clear();
+    m_polled.clear();
+}
+
+void MailboxWatcher::log(const QString &message)
+{
+    m_model->logTrace(0, Common::LOG_OTHER, QLatin1String("MailboxWatcher"), message);
+}
+
+}
+}
@@ -0,0 +1,89 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_MAILBOXWATCHER_H
+#define IMAP_MODEL_MAILBOXWATCHER_H
+
+#include <QMap>
+#include <QPointer>
+#include <QStringList>
+
+class QTimer;
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class Model;
+class WatchMailboxTask;
+
+/** @short Watch for new mail in a set of mailboxes which are not open
+
+The IDLE launched by the KeepMailboxOpenTask only covers the mailbox which the user is looking at. For each of the watched
+mailboxes, this class maintains a WatchMailboxTask which keeps its own lightweight connection EXAMINEd to that mailbox and
+IDLEs there. The changes are reported as updated message counts and stored into the cache, without syncing the mailbox.
+
+The number of such connections is limited by the trojita-imap-watch-connections property and by the overall limit of
+connections; one connection is always left free for the regular work. The mailboxes which do not get their own connection
+are polled through STATUS in a round-robin manner, one of them per each trojita-imap-watch-poll-interval milliseconds.
+Mailboxes which are currently open are skipped as they are taken care of by their KeepMailboxOpenTask already.
+
+All of this only happens when the network is NETWORK_ONLINE.
+*/
+class MailboxWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MailboxWatcher(Model *model);
+
+    void setWatchedMailboxes(const QStringList &mailboxes);
+    QStringList watchedMailboxes() const { return m_mailboxes; }
+
+    /** @short Is the @arg mailbox being watched, and not currently open? */
+    bool shouldWatch(const QString &mailbox) const;
+
+private slots:
+    /** @short Distribute the connections among the watched mailboxes and poll the next one of the rest */
+    void slotTick();
+    void slotNetworkPolicyChanged();
+
+private:
+    void reconcile();
+    void pollNext();
+    void stopAll();
+    void log(const QString &message);
+
+    Model *m_model;
+    QStringList m_mailboxes;
+    /** @short Mailboxes which have their own IDLE connection */
+    QMap<QString, QPointer<WatchMailboxTask> > m_watchers;
+    /** @short Mailboxes which have to be polled */
+    QStringList m_polled;
+    int m_pollPosition;
+    QTimer *m_pollTimer;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_MAILBOXWATCHER_H
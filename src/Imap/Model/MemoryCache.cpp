@@ -22,27 +22,181 @@
 
 #include "MemoryCache.h"
 #include <QDebug>
-#include <QFile>
 
 //#define CACHE_DEBUG
 
+namespace
+{
+
+/** @short Rough overhead of a record, and of a small string in it */
+const int entryOverhead = 64;
+
+/** @short Estimate the memory occupied by the metadata; the envelope consists of lots of short strings */
+qint64 metadataCost(const Imap::Mailbox::AbstractCache::MessageDataBundle &metadata)
+{
+    const Imap::Message::Envelope &envelope = metadata.envelope;
+    int addresses = envelope.from.size() + envelope.sender.size() + envelope.replyTo.size() + envelope.to.size() +
+            envelope.cc.size() + envelope.bcc.size();
+    return sizeof(metadata) + metadata.serializedBodyStructure.size() + envelope.subject.size() * 2 +
+            envelope.messageId.size() + (addresses + metadata.hdrReferences.size() + envelope.inReplyTo.size() +
+                                         metadata.hdrListPost.size()) * entryOverhead;
+}
+
+qint64 flagsCost(const QStringList &flags)
+{
+    qint64 res = entryOverhead;
+    Q_FOREACH(const QString &flag, flags) {
+        res += flag.size() * 2 + entryOverhead;
+    }
+    return res;
+}
+
+/** @short The key of a message, with the mailbox ID in the upper half */
+inline quint64 messageKey(const int mailboxId, const uint uid)
+{
+    return (quint64(mailboxId) << 32) | uid;
+}
+
+inline int mailboxIdOfKey(const quint64 key)
+{
+    return int(key >> 32);
+}
+
+}
+
 namespace Imap
 {
 namespace Mailbox
 {
 
-MemoryCache::MemoryCache(QObject *parent): AbstractCache(parent)
+MemoryCache::MemoryCache(QObject *parent): AbstractCache(parent), m_bytes(0), m_quota(0)
+{
+}
+
+int MemoryCache::mailboxId(const QString &mailbox) const
+{
+    return m_mailboxIds.value(mailbox, -1);
+}
+
+MemoryCache::MailboxEntry &MemoryCache::ensureMailbox(const QString &mailbox)
+{
+    QHash<QString, int>::const_iterator it = m_mailboxIds.constFind(mailbox);
+    if (it != m_mailboxIds.constEnd())
+        return m_mailboxes[*it];
+    m_mailboxIds.insert(mailbox, m_mailboxes.size());
+    m_mailboxes.append(MailboxEntry());
+    return m_mailboxes.last();
+}
+
+/** @short Return the index of the message in the m_messages, or -1 if it isn't known */
+int MemoryCache::messageIndex(const QString &mailbox, const uint uid) const
+{
+    int id = mailboxId(mailbox);
+    if (id == -1)
+        return -1;
+    return m_messageIndex.value(messageKey(id, uid), -1);
+}
+
+/** @short Find the record of a message and mark it as recently used */
+const MemoryCache::MessageEntry *MemoryCache::findMessage(const QString &mailbox, const uint uid) const
+{
+    int index = messageIndex(mailbox, uid);
+    if (index == -1)
+        return 0;
+    const MessageEntry &message = m_messages[index];
+    m_lru.splice(m_lru.end(), m_lru, message.lru);
+    return &message;
+}
+
+/** @short Find or create the record of a message and mark it as recently used */
+MemoryCache::MessageEntry &MemoryCache::ensureMessage(const QString &mailbox, const uint uid)
+{
+    ensureMailbox(mailbox);
+    quint64 key = messageKey(mailboxId(mailbox), uid);
+    QHash<quint64, int>::const_iterator it = m_messageIndex.constFind(key);
+    if (it != m_messageIndex.constEnd()) {
+        MessageEntry &message = m_messages[*it];
+        m_lru.splice(m_lru.end(), m_lru, message.lru);
+        return message;
+    }
+
+    int index;
+    if (m_freeMessages.isEmpty()) {
+        index = m_messages.size();
+        m_messages.append(MessageEntry());
+    } else {
+        index = m_freeMessages.last();
+        m_freeMessages.removeLast();
+    }
+    m_messageIndex.insert(key, index);
+    MessageEntry &message = m_messages[index];
+    message.lru = m_lru.insert(m_lru.end(), key);
+    return message;
+}
+
+/** @short Update the size estimate after the @arg message got modified, and drop it if it's empty or over the quota */
+void MemoryCache::messageChanged(MessageEntry &message)
+{
+    if (!message.metadata.uid && !message.hasFlags && message.parts.isEmpty()) {
+        removeMessage(*message.lru);
+        return;
+    }
+
+    qint64 bytes = sizeof(MessageEntry) + entryOverhead;
+    if (message.metadata.uid)
+        bytes += metadataCost(message.metadata);
+    if (message.hasFlags)
+        bytes += flagsCost(message.flags);
+    Q_FOREACH(const PartEntry &part, message.parts) {
+        bytes += part.partId.size() + part.data.size() + entryOverhead;
+    }
+    m_bytes += bytes - message.bytes;
+    message.bytes = bytes;
+    enforceQuota();
+}
+
+void MemoryCache::removeMessage(const quint64 key)
+{
+    QHash<quint64, int>::iterator it = m_messageIndex.find(key);
+    Q_ASSERT(it != m_messageIndex.end());
+    int index = *it;
+    m_messageIndex.erase(it);
+    MessageEntry &message = m_messages[index];
+    m_bytes -= message.bytes;
+    m_lru.erase(message.lru);
+    message = MessageEntry();
+    m_freeMessages.append(index);
+}
+
+/** @short Drop the least recently used messages until the memory occupied by them fits into the quota
+
+Once the flags or the metadata of a message are gone, the mailbox cannot be synced incrementally anymore, so its sync state
+is forgotten, too. That makes the next sync fetch everything again instead of trusting the incomplete data. Missing parts
+do not need that, they are simply downloaded again when needed.
+*/
+void MemoryCache::enforceQuota()
 {
+    if (!m_quota)
+        return;
+    while (m_bytes > m_quota && !m_lru.empty()) {
+        const quint64 key = m_lru.front();
+        const MessageEntry &message = m_messages[m_messageIndex.value(key)];
+        if (message.hasFlags || message.metadata.uid)
+            m_mailboxes[mailboxIdOfKey(key)].syncState = SyncState();
+        removeMessage(key);
+    }
 }
 
 QList<MailboxMetadata> MemoryCache::childMailboxes(const QString &mailbox) const
 {
-    return mailboxes[ mailbox ];
+    int id = mailboxId(mailbox);
+    return id == -1 ? QList<MailboxMetadata>() : m_mailboxes[id].childMailboxes;
 }
 
 bool MemoryCache::childMailboxesFresh(const QString &mailbox) const
 {
-    return mailboxes.contains(mailbox);
+    int id = mailboxId(mailbox);
+    return id != -1 && m_mailboxes[id].childMailboxesFresh;
 }
 
 void MemoryCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data)
@@ -50,12 +204,15 @@ void MemoryCache::setChildMailboxes(const QString &mailbox, const QList<MailboxM
 #ifdef CACHE_DEBUG
     qDebug() << "setting child mailboxes for" << mailbox << "to" << data;
 #endif
-    mailboxes[mailbox] = data;
+    MailboxEntry &entry = ensureMailbox(mailbox);
+    entry.childMailboxes = data;
+    entry.childMailboxesFresh = true;
 }
 
 SyncState MemoryCache::mailboxSyncState(const QString &mailbox) const
 {
-    return syncState[mailbox];
+    int id = mailboxId(mailbox);
+    return id == -1 ? SyncState() : m_mailboxes[id].syncState;
 }
 
 void MemoryCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
@@ -63,7 +220,7 @@ void MemoryCache::setMailboxSyncState(const QString &mailbox, const SyncState &s
 #ifdef CACHE_DEBUG
     qDebug() << "setting mailbox sync state of" << mailbox << "to" << state;
 #endif
-    syncState[mailbox] = state;
+    ensureMailbox(mailbox).syncState = state;
 }
 
 void MemoryCache::setUidMapping(const QString &mailbox, const QList<uint> &mapping)
@@ -71,7 +228,7 @@ void MemoryCache::setUidMapping(const QString &mailbox, const QList<uint> &mappi
 #ifdef CACHE_DEBUG
     qDebug() << "saving UID mapping for" << mailbox << "to" << mapping;
 #endif
-    seqToUid[mailbox] = mapping;
+    ensureMailbox(mailbox).uidMapping = mapping;
 }
 
 void MemoryCache::clearUidMapping(const QString &mailbox)
@@ -79,7 +236,9 @@ void MemoryCache::clearUidMapping(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "clearing UID mapping for" << mailbox;
 #endif
-    seqToUid.remove(mailbox);
+    int id = mailboxId(mailbox);
+    if (id != -1)
+        m_mailboxes[id].uidMapping.clear();
 }
 
 void MemoryCache::clearAllMessages(const QString &mailbox)
@@ -87,10 +246,22 @@ void MemoryCache::clearAllMessages(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "pruging all info for mailbox" << mailbox;
 #endif
-    flags.remove(mailbox);
-    msgMetadata.remove(mailbox);
-    parts.remove(mailbox);
-    threads.remove(mailbox);
+    forgetPartialMessageParts(mailbox);
+    int id = mailboxId(mailbox);
+    if (id == -1)
+        return;
+    MailboxEntry &entry = m_mailboxes[id];
+    entry.threading.clear();
+    entry.offlineProgress = OfflineSyncProgress();
+
+    QList<quint64> keys;
+    for (QHash<quint64, int>::const_iterator it = m_messageIndex.constBegin(); it != m_messageIndex.constEnd(); ++it) {
+        if (mailboxIdOfKey(it.key()) == id)
+            keys << it.key();
+    }
+    Q_FOREACH(const quint64 key, keys) {
+        removeMessage(key);
+    }
 }
 
 void MemoryCache::clearMessage(const QString mailbox, const uint uid)
@@ -98,12 +269,10 @@ void MemoryCache::clearMessage(const QString mailbox, const uint uid)
 #ifdef CACHE_DEBUG
     qDebug() << "pruging all info for message" << mailbox << uid;
 #endif
-    if (flags.contains(mailbox))
-        flags[mailbox].remove(uid);
-    if (msgMetadata.contains(mailbox))
-        msgMetadata[mailbox].remove(uid);
-    if (parts.contains(mailbox))
-        parts[mailbox].remove(uid);
+    forgetPartialMessageParts(mailbox, uid);
+    int index = messageIndex(mailbox, uid);
+    if (index != -1)
+        removeMessage(*m_messages[index].lru);
 }
 
 void MemoryCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
@@ -111,7 +280,19 @@ void MemoryCache::setMsgPart(const QString &mailbox, const uint uid, const QByte
 #ifdef CACHE_DEBUG
     qDebug() << "set message part" << mailbox << uid << partId << data.size();
 #endif
-    parts[mailbox][uid][partId] = data;
+    MessageEntry &message = ensureMessage(mailbox, uid);
+    for (QVector<PartEntry>::iterator it = message.parts.begin(); it != message.parts.end(); ++it) {
+        if (it->partId == partId) {
+            it->data = data;
+            messageChanged(message);
+            return;
+        }
+    }
+    PartEntry part;
+    part.partId = partId;
+    part.data = data;
+    message.parts.append(part);
+    messageChanged(message);
 }
 
 void MemoryCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
@@ -119,8 +300,17 @@ void MemoryCache::forgetMessagePart(const QString &mailbox, const uint uid, cons
 #ifdef CACHE_DEBUG
     qDebug() << "forget message part" << mailbox << uid << partId;
 #endif
-    parts[mailbox][uid].remove(partId);
-
+    int index = messageIndex(mailbox, uid);
+    if (index == -1)
+        return;
+    MessageEntry &message = m_messages[index];
+    for (int i = 0; i < message.parts.size(); ++i) {
+        if (message.parts[i].partId == partId) {
+            message.parts.remove(i);
+            messageChanged(message);
+            return;
+        }
+    }
 }
 
 void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringList &newFlags)
@@ -128,55 +318,117 @@ void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringLis
 #ifdef CACHE_DEBUG
     qDebug() << "set FLAGS for" << mailbox << uid << newFlags;
 #endif
-    flags[mailbox][uid] = newFlags;
+    MessageEntry &message = ensureMessage(mailbox, uid);
+    message.flags = newFlags;
+    message.hasFlags = true;
+    messageChanged(message);
 }
 
 QStringList MemoryCache::msgFlags(const QString &mailbox, const uint uid) const
 {
-    return flags[mailbox][uid];
+    QStringList res;
+    findMsgFlags(mailbox, uid, res);
+    return res;
+}
+
+QMap<uint, QStringList> MemoryCache::msgFlags(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, QStringList> res;
+    Q_FOREACH(const uint uid, uids) {
+        QStringList flags;
+        if (findMsgFlags(mailbox, uid, flags))
+            res[uid] = flags;
+    }
+    return res;
+}
+
+bool MemoryCache::findMsgFlags(const QString &mailbox, const uint uid, QStringList &flags) const
+{
+    const MessageEntry *message = findMessage(mailbox, uid);
+    if (!message || !message->hasFlags)
+        return false;
+    flags = message->flags;
+    return true;
 }
 
 QList<uint> MemoryCache::uidMapping(const QString &mailbox) const
 {
-    return seqToUid[ mailbox ];
+    int id = mailboxId(mailbox);
+    return id == -1 ? QList<uint>() : m_mailboxes[id].uidMapping;
 }
 
 void MemoryCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
 {
-    msgMetadata[mailbox][uid] = metadata;
+    MessageEntry &message = ensureMessage(mailbox, uid);
+    message.metadata = metadata;
+    messageChanged(message);
 }
 
 MemoryCache::MessageDataBundle MemoryCache::messageMetadata(const QString &mailbox, const uint uid) const
 {
-    const QMap<uint, MessageDataBundle> &firstLevel = msgMetadata[ mailbox ];
-    QMap<uint, MessageDataBundle>::const_iterator it = firstLevel.find(uid);
-    if (it == firstLevel.end()) {
-        return MessageDataBundle();
+    const MessageEntry *message = findMessage(mailbox, uid);
+    return message ? message->metadata : MessageDataBundle();
+}
+
+QMap<uint, MemoryCache::MessageDataBundle> MemoryCache::messageMetadata(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, MessageDataBundle> res;
+    int id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    Q_FOREACH(const uint uid, uids) {
+        int index = m_messageIndex.value(messageKey(id, uid), -1);
+        if (index == -1)
+            continue;
+        const MessageEntry &message = m_messages[index];
+        m_lru.splice(m_lru.end(), m_lru, message.lru);
+        if (message.metadata.uid)
+            res[uid] = message.metadata;
     }
-    return *it;
+    return res;
 }
 
 QByteArray MemoryCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
-    if (! parts.contains(mailbox))
-        return QByteArray();
-    const auto & mailboxParts = parts[mailbox];
-    if (! mailboxParts.contains(uid))
-        return QByteArray();
-    const auto & messageParts = mailboxParts[uid];
-    if (! messageParts.contains(partId))
-        return QByteArray();
-    return messageParts[ partId ];
+    QByteArray res;
+    findMessagePart(mailbox, uid, partId, res);
+    return res;
+}
+
+bool MemoryCache::findMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, QByteArray &data) const
+{
+    const MessageEntry *message = findMessage(mailbox, uid);
+    if (!message)
+        return false;
+    Q_FOREACH(const PartEntry &part, message->parts) {
+        if (part.partId == partId) {
+            data = part.data;
+            return true;
+        }
+    }
+    return false;
 }
 
 QVector<Imap::Responses::ThreadingNode> MemoryCache::messageThreading(const QString &mailbox)
 {
-    return threads[mailbox];
+    int id = mailboxId(mailbox);
+    return id == -1 ? QVector<Imap::Responses::ThreadingNode>() : m_mailboxes[id].threading;
 }
 
 void MemoryCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
 {
-    threads[mailbox] = threading;
+    ensureMailbox(mailbox).threading = threading;
+}
+
+OfflineSyncProgress MemoryCache::offlineSyncProgress(const QString &mailbox) const
+{
+    int id = mailboxId(mailbox);
+    return id == -1 ? OfflineSyncProgress() : m_mailboxes[id].offlineProgress;
+}
+
+void MemoryCache::setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress)
+{
+    ensureMailbox(mailbox).offlineProgress = progress;
 }
 
 void MemoryCache::setRenewalThreshold(const int days)
@@ -184,5 +436,27 @@ void MemoryCache::setRenewalThreshold(const int days)
     Q_UNUSED(days);
 }
 
+AbstractCache::Usage MemoryCache::usage() const
+{
+    Usage res;
+    Q_FOREACH(const int index, m_messageIndex) {
+        const MessageEntry &message = m_messages[index];
+        if (message.metadata.uid)
+            ++res.messages;
+        res.parts += message.parts.size();
+        Q_FOREACH(const PartEntry &part, message.parts) {
+            res.partBytes += part.data.size();
+        }
+    }
+    res.quota = m_quota;
+    return res;
+}
+
+void MemoryCache::setQuota(const qint64 bytes)
+{
+    m_quota = bytes;
+    enforceQuota();
+}
+
 }
 }
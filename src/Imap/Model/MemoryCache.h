@@ -23,8 +23,10 @@
 #ifndef IMAP_MODEL_MEMORYCACHE_H
 #define IMAP_MODEL_MEMORYCACHE_H
 
+#include <list>
+#include <QHash>
+#include <QVector>
 #include "Cache.h"
-#include <QMap>
 
 /** @short Namespace for IMAP interaction */
 namespace Imap
@@ -36,8 +38,15 @@ namespace Mailbox
 
 /** @short A cache implementation that uses in-memory cache
 
-    It also has an optional feature to dump the data to a local file and read
-    it back in. Is isn't suitable for real production use, but it's a good start.
+The mailboxes are assigned small integer IDs, and everything known about a message -- its metadata, flags and parts -- is
+kept together in a single record, which is found through a hash of the mailbox ID and the UID. The records live in a
+contiguous array, the slots of the removed ones get reused.
+
+The memory occupied by the messages can be limited through setQuota(). The least recently used messages are dropped as a
+whole once the limit is exceeded; the rest of the per-mailbox state is kept, except that losing the flags or the metadata of
+a message invalidates the sync state of its mailbox. This makes the class suitable both as the only
+cache of an instance which shall not store anything on the disk and as an in-memory tier in front of another cache. For the
+latter, the find*() functions tell an unknown entry apart from an empty one.
  */
 class MemoryCache : public AbstractCache
 {
@@ -60,10 +69,13 @@ public:
     virtual void clearMessage(const QString mailbox, const uint uid);
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, MessageDataBundle> messageMetadata(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata);
 
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, QStringList> msgFlags(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &newFlags);
+    using AbstractCache::setMsgFlags;
 
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
@@ -72,16 +84,78 @@ public:
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual OfflineSyncProgress offlineSyncProgress(const QString &mailbox) const;
+    virtual void setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress);
+
     virtual void setRenewalThreshold(const int days);
 
+    virtual Usage usage() const;
+    /** @short Limit the memory occupied by the messages to roughly @arg bytes, zero means no limit */
+    virtual void setQuota(const qint64 bytes);
+
+    /** @short Copy the flags of a message into @arg flags and return true if they are known */
+    bool findMsgFlags(const QString &mailbox, const uint uid, QStringList &flags) const;
+    /** @short Copy the data of a message part into @arg data and return true if they are known */
+    bool findMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId, QByteArray &data) const;
+
 private:
-    QMap<QString, QList<MailboxMetadata> > mailboxes;
-    QMap<QString, SyncState> syncState;
-    QMap<QString, QList<uint> > seqToUid;
-    QMap<QString, QMap<uint,QStringList> > flags;
-    QMap<QString, QMap<uint, MessageDataBundle> > msgMetadata;
-    QMap<QString, QMap<uint, QMap<QByteArray, QByteArray> > > parts;
-    QMap<QString, QVector<Imap::Responses::ThreadingNode> > threads;
+    struct PartEntry {
+        QByteArray partId;
+        QByteArray data;
+    };
+
+    /** @short Everything about a single message */
+    struct MessageEntry {
+        /** @short The metadata; their uid is zero when they are not known */
+        MessageDataBundle metadata;
+        bool hasFlags;
+        QStringList flags;
+        /** @short There are just a few parts per message, a linear search is the fastest option */
+        QVector<PartEntry> parts;
+        /** @short Estimate of the occupied memory */
+        qint64 bytes;
+        /** @short Position in the m_lru */
+        std::list<quint64>::iterator lru;
+
+        MessageEntry(): hasFlags(false), bytes(0) {}
+    };
+
+    struct MailboxEntry {
+        bool childMailboxesFresh;
+        QList<MailboxMetadata> childMailboxes;
+        SyncState syncState;
+        QList<uint> uidMapping;
+        QVector<Imap::Responses::ThreadingNode> threading;
+        OfflineSyncProgress offlineProgress;
+
+        MailboxEntry(): childMailboxesFresh(false) {}
+    };
+
+    int mailboxId(const QString &mailbox) const;
+    MailboxEntry &ensureMailbox(const QString &mailbox);
+    int messageIndex(const QString &mailbox, const uint uid) const;
+    const MessageEntry *findMessage(const QString &mailbox, const uint uid) const;
+    MessageEntry &ensureMessage(const QString &mailbox, const uint uid);
+    void messageChanged(MessageEntry &message);
+    void removeMessage(const quint64 key);
+    void enforceQuota();
+
+    /** @short The IDs of mailboxes are the indexes into the m_mailboxes */
+    QHash<QString, int> m_mailboxIds;
+    QVector<MailboxEntry> m_mailboxes;
+
+    /** @short Maps the mailbox ID in the upper half and the UID in the lower one to an index into the m_messages */
+    QHash<quint64, int> m_messageIndex;
+    QVector<MessageEntry> m_messages;
+    /** @short Indexes of the unused slots in the m_messages */
+    QVector<int> m_freeMessages;
+
+    /** @short Keys of the messages, the least recently used ones go first */
+    mutable std::list<quint64> m_lru;
+    /** @short The memory occupied by all messages */
+    qint64 m_bytes;
+    /** @short Limit for the m_bytes, zero if unlimited */
+    qint64 m_quota;
 };
 
 }
@@ -0,0 +1,173 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "MessageReadAhead.h"
+#include "Imap/Model/FindInterestingPart.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+
+namespace {
+
+/** @short How many messages to walk through at most while looking for the unread ones */
+const int scanLimit = 50;
+
+/** @short Return the message which follows the @arg index in a depth-first walk through the (possibly threaded) list */
+QModelIndex nextInTree(const QModelIndex &index)
+{
+    QModelIndex child = index.child(0, 0);
+    if (child.isValid())
+        return child;
+
+    QModelIndex current = index;
+    while (current.isValid()) {
+        QModelIndex sibling = current.sibling(current.row() + 1, 0);
+        if (sibling.isValid())
+            return sibling;
+        current = current.parent();
+    }
+    return QModelIndex();
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+MessageReadAhead::MessageReadAhead(Model *model):
+    QObject(model), m_model(model), m_hits(0), m_lateHits(0), m_misses(0), m_wastedBytes(0)
+{
+}
+
+void MessageReadAhead::messageOpened(const QModelIndex &message)
+{
+    const Model *realModel = 0;
+    QModelIndex realIndex;
+    TreeItemMessage *msg = dynamic_cast<TreeItemMessage *>(Model::realTreeItem(message, &realModel, &realIndex));
+    if (!msg || realModel != m_model || !msg->uid())
+        return;
+
+    bool ok;
+    int count = m_model->property("trojita-imap-readahead-messages").toInt(&ok);
+    if (!ok)
+        count = 3;
+    if (count <= 0)
+        return;
+
+    const QString mailbox = static_cast<TreeItemMailbox *>(msg->parent()->parent())->mailbox();
+    QModelIndex mainPart;
+    QString partMessage;
+    recordOpened(mailbox, msg->uid(), FindInterestingPart::findMainPartOfMessage(realIndex, mainPart, partMessage, 0) ==
+                 FindInterestingPart::MAINPART_FOUND);
+
+    // Whatever was prefetched in another mailbox is not going to be read now
+    if (!m_prefetched.isEmpty() && m_prefetched.first().mailbox != mailbox)
+        forgetPrefetched(0);
+
+    if (m_model->networkPolicy() != NETWORK_ONLINE)
+        return;
+
+    prefetchFollowing(message, count);
+    forgetPrefetched(4 * count);
+}
+
+void MessageReadAhead::recordOpened(const QString &mailbox, const uint uid, const bool isAvailable)
+{
+    for (QList<Prefetched>::iterator it = m_prefetched.begin(); it != m_prefetched.end(); ++it) {
+        if (it->uid == uid && it->mailbox == mailbox) {
+            if (isAvailable)
+                ++m_hits;
+            else
+                ++m_lateHits;
+            m_prefetched.erase(it);
+            log(QString::fromUtf8("Read-ahead: %1 hits, %2 late, %3 misses, %4 bytes wasted").arg(
+                    QString::number(m_hits), QString::number(m_lateHits), QString::number(m_misses),
+                    QString::number(m_wastedBytes)));
+            return;
+        }
+    }
+    if (!isAvailable)
+        ++m_misses;
+}
+
+void MessageReadAhead::prefetchFollowing(const QModelIndex &message, const int count)
+{
+    QModelIndex current = message.sibling(message.row(), 0);
+    int found = 0;
+    for (int scanned = 0; scanned < scanLimit && found < count; ++scanned) {
+        current = nextInTree(current);
+        if (!current.isValid())
+            break;
+        if (current.data(RoleMessageIsMarkedRead).toBool())
+            continue;
+
+        const Model *realModel = 0;
+        QModelIndex realIndex;
+        TreeItemMessage *msg = dynamic_cast<TreeItemMessage *>(Model::realTreeItem(current, &realModel, &realIndex));
+        if (!msg || realModel != m_model || !msg->uid())
+            continue;
+        ++found;
+        // Learning the structure would need a FETCH which nobody could tell from the one the user is waiting for
+        if (!msg->fetched())
+            continue;
+
+        QModelIndex mainPart;
+        QString partMessage;
+        if (FindInterestingPart::findMainPartOfMessage(realIndex, mainPart, partMessage, 0) != FindInterestingPart::MAINPART_PART_LOADING)
+            continue;
+
+        const QString mailbox = static_cast<TreeItemMailbox *>(msg->parent()->parent())->mailbox();
+        bool alreadyThere = false;
+        Q_FOREACH(const Prefetched &item, m_prefetched) {
+            if (item.uid == msg->uid() && item.mailbox == mailbox) {
+                alreadyThere = true;
+                break;
+            }
+        }
+        if (alreadyThere || !m_model->prefetchMessagePart(mainPart))
+            continue;
+
+        Prefetched item;
+        item.mailbox = mailbox;
+        item.uid = msg->uid();
+        item.bytes = mainPart.data(RolePartOctets).toUInt();
+        m_prefetched << item;
+    }
+}
+
+void MessageReadAhead::forgetPrefetched(const int keep)
+{
+    while (m_prefetched.size() > keep) {
+        m_wastedBytes += m_prefetched.takeFirst().bytes;
+    }
+}
+
+void MessageReadAhead::log(const QString &message)
+{
+    m_model->logTrace(0, Common::LOG_OTHER, QLatin1String("MessageReadAhead"), message);
+}
+
+}
+}
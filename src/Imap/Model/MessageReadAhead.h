@@ -0,0 +1,94 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_MESSAGEREADAHEAD_H
+#define IMAP_MODEL_MESSAGEREADAHEAD_H
+
+#include <QList>
+#include <QObject>
+#include <QString>
+
+class QModelIndex;
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class Model;
+
+/** @short Prefetch the text of the messages which the user is likely to read next
+
+Whenever a message is opened, the next few unread messages which follow it in the order in which the user sees them (i.e.
+after sorting and threading, as long as the caller passes an index from the view's own model) are looked at, and the main
+text part of each of them, as determined by FindInterestingPart, is queued for a low-priority download. Moving on to the
+next message can then show its content straight from the tree. Messages whose structure is not known yet are skipped.
+
+The number of messages to look ahead is controlled by the trojita-imap-readahead-messages property; zero turns the feature
+off. Nothing is prefetched unless the network is NETWORK_ONLINE. The read-ahead keeps track of how many of the prefetched
+parts were actually opened ("hits"), how many were opened before their download completed, and how many bytes were
+downloaded for messages which the user has never opened.
+*/
+class MessageReadAhead : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MessageReadAhead(Model *model);
+
+    /** @short The user has opened the @arg message; the index may come from any proxy model on top of the Model */
+    void messageOpened(const QModelIndex &message);
+
+    /** @short How many opened messages had their main part prefetched already */
+    uint hits() const { return m_hits; }
+    /** @short How many opened messages had their main part requested, but not downloaded yet */
+    uint lateHits() const { return m_lateHits; }
+    /** @short How many opened messages had to wait for their main part although the read-ahead was active */
+    uint misses() const { return m_misses; }
+    /** @short Estimated number of bytes prefetched for messages which have never been opened */
+    quint64 wastedBytes() const { return m_wastedBytes; }
+
+private:
+    struct Prefetched {
+        QString mailbox;
+        uint uid;
+        uint bytes;
+    };
+
+    void prefetchFollowing(const QModelIndex &message, const int count);
+    /** @short Update the statistics with a message which has just been opened */
+    void recordOpened(const QString &mailbox, const uint uid, const bool isAvailable);
+    void forgetPrefetched(const int keep);
+    void log(const QString &message);
+
+    Model *m_model;
+    /** @short Prefetched messages which have not been opened yet, the oldest first */
+    QList<Prefetched> m_prefetched;
+    uint m_hits;
+    uint m_lateHits;
+    uint m_misses;
+    quint64 m_wastedBytes;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_MESSAGEREADAHEAD_H
@@ -26,10 +26,16 @@
 #include <QDebug>
 #include <QtAlgorithms>
 #include "Model.h"
+#include "ItemRoles.h"
+#include "MailboxPrewarmer.h"
 #include "MailboxTree.h"
+#include "MailboxWatcher.h"
+#include "MessageReadAhead.h"
+#include "ParallelFetchJob.h"
 #include "QAIM_reset.h"
 #include "SpecialFlagNames.h"
 #include "TaskPresentationModel.h"
+#include "TaskStatistics.h"
 #include "Utils.h"
 #include "Common/FindWithUnknown.h"
 #include "Common/InvokeMethod.h"
@@ -37,7 +43,9 @@
 #include "Imap/Tasks/AppendTask.h"
 #include "Imap/Tasks/GetAnyConnectionTask.h"
 #include "Imap/Tasks/KeepMailboxOpenTask.h"
+#include "Imap/Tasks/ListStatusTask.h"
 #include "Imap/Tasks/OpenConnectionTask.h"
+#include "Imap/Tasks/ParallelFetchTask.h"
 #include "Imap/Tasks/UpdateFlagsTask.h"
 #include "Streams/SocketFactory.h"
 
@@ -79,6 +87,21 @@ bool MailboxNameComparator(const TreeItem *const a, const TreeItem *const b)
     return mailboxA->mailbox().compare(mailboxB->mailbox(), Qt::CaseInsensitive) < 1;
 }
 
+/** @short Return the part which has to be fetched in order to obtain the data of the @arg item
+
+That's the item itself except for the special part representing the raw contents, which is fetched through its parent.
+*/
+TreeItemPart *partForFetchOperation(TreeItemPart *item)
+{
+    TreeItemModifiedPart *modifiedPart = dynamic_cast<TreeItemModifiedPart*>(item);
+    if (modifiedPart && modifiedPart->kind() == TreeItem::OFFSET_RAW_CONTENTS) {
+        TreeItemPart *parent = dynamic_cast<TreeItemPart*>(item->parent());
+        Q_ASSERT(parent);
+        return parent;
+    }
+    return item;
+}
+
 bool uidComparator(const TreeItem *const item, const uint uid)
 {
     const TreeItemMessage *const message = static_cast<const TreeItemMessage *const>(item);
@@ -105,7 +128,8 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     QAbstractItemModel(parent),
     // our tools
     m_cache(cache), m_socketFactory(std::move(socketFactory)), m_taskFactory(std::move(taskFactory)), m_maxParsers(4), m_mailboxes(0),
-    m_netPolicy(NETWORK_OFFLINE),  m_taskModel(0), m_hasImapPassword(false)
+    m_netPolicy(NETWORK_OFFLINE),  m_taskModel(0), m_hasImapPassword(false), m_prewarmer(0), m_watcher(0), m_readAhead(0),
+    m_taskStatistics(0)
 {
     m_cache->setParent(this);
     m_startTls = m_socketFactory->startTlsRequired();
@@ -138,7 +162,12 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     m_periodicMailboxNumbersRefresh = new QTimer(this);
     // polling every five minutes
     m_periodicMailboxNumbersRefresh->setInterval(5 * 60 * 1000);
-    connect(m_periodicMailboxNumbersRefresh, SIGNAL(timeout()), this, SLOT(invalidateAllMessageCounts()));
+    connect(m_periodicMailboxNumbersRefresh, SIGNAL(timeout()), this, SLOT(slotPeriodicMailboxNumbersRefresh()));
+
+    m_prewarmer = new MailboxPrewarmer(this);
+    m_watcher = new MailboxWatcher(this);
+    m_readAhead = new MessageReadAhead(this);
+    m_taskStatistics = new TaskStatistics(this);
 }
 
 Model::~Model()
@@ -239,6 +268,12 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
 
             removeDeletedTasks(deletedTasks, it->activeTasks);
 
+            // The tasks have had their chance to look at the traffic of a completed command by now
+            Responses::State *stateResponse = dynamic_cast<Responses::State *>(resp.data());
+            if (stateResponse && !stateResponse->tag.isEmpty() && it->parser) {
+                it->parser->forgetCommandStatistics(stateResponse->tag);
+            }
+
             runReadyTasks();
 
             if (! handled) {
@@ -578,21 +613,33 @@ void Model::handleStatus(Imap::Parser *ptr, const Imap::Responses::Status *const
         qDebug() << "Couldn't find out which mailbox is" << resp->mailbox << "when parsing a STATUS reply";
         return;
     }
+    Imap::Responses::Status::stateDataType::const_iterator it = resp->states.constEnd();
+    int total = -1, unread = -1, recent = -1;
+    if ((it = resp->states.constFind(Imap::Responses::Status::MESSAGES)) != resp->states.constEnd())
+        total = it.value();
+    if ((it = resp->states.constFind(Imap::Responses::Status::UNSEEN)) != resp->states.constEnd())
+        unread = it.value();
+    if ((it = resp->states.constFind(Imap::Responses::Status::RECENT)) != resp->states.constEnd())
+        recent = it.value();
+    updateMessageCounts(mailbox, total, unread, recent);
+}
+
+void Model::updateMessageCounts(TreeItemMailbox *mailbox, const int total, const int unread, const int recent)
+{
     TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
     Q_ASSERT(list);
     bool updateCache = false;
-    Imap::Responses::Status::stateDataType::const_iterator it = resp->states.constEnd();
-    if ((it = resp->states.constFind(Imap::Responses::Status::MESSAGES)) != resp->states.constEnd()) {
-        updateCache |= list->m_totalMessageCount != static_cast<const int>(it.value());
-        list->m_totalMessageCount = it.value();
+    if (total != -1) {
+        updateCache |= list->m_totalMessageCount != total;
+        list->m_totalMessageCount = total;
     }
-    if ((it = resp->states.constFind(Imap::Responses::Status::UNSEEN)) != resp->states.constEnd()) {
-        updateCache |= list->m_unreadMessageCount != static_cast<const int>(it.value());
-        list->m_unreadMessageCount = it.value();
+    if (unread != -1) {
+        updateCache |= list->m_unreadMessageCount != unread;
+        list->m_unreadMessageCount = unread;
     }
-    if ((it = resp->states.constFind(Imap::Responses::Status::RECENT)) != resp->states.constEnd()) {
-        updateCache |= list->m_recentMessageCount != static_cast<const int>(it.value());
-        list->m_recentMessageCount = it.value();
+    if (recent != -1) {
+        updateCache |= list->m_recentMessageCount != recent;
+        list->m_recentMessageCount = recent;
     }
     list->m_numberFetchingStatus = TreeItem::DONE;
     emitMessageCountChanged(mailbox);
@@ -864,13 +911,14 @@ void Model::askForMessagesInMailbox(TreeItemMsgList *item)
         Q_ASSERT(item->accessFetchStatus() == TreeItem::LOADING);
         QModelIndex listIndex = item->toIndex(this);
         if (uidMapping.size()) {
+            const QMap<uint, QStringList> cachedFlags = cache()->msgFlags(mailbox, uidMapping);
             beginInsertRows(listIndex, 0, uidMapping.size() - 1);
             for (uint seq = 0; seq < static_cast<uint>(uidMapping.size()); ++seq) {
                 TreeItemMessage *message = new TreeItemMessage(item);
                 message->m_offset = seq;
-                message->m_uid = uidMapping[seq];
+                message->setUid(uidMapping[seq]);
                 item->m_children << message;
-                QStringList flags = cache()->msgFlags(mailbox, message->m_uid);
+                QStringList flags = cachedFlags.value(message->m_uid);
                 flags.removeOne(QLatin1String("\\Recent"));
                 message->m_flags = normalizeFlags(flags);
             }
@@ -905,6 +953,12 @@ void Model::askForNumberOfMessages(TreeItemMsgList *item)
         } else {
             item->m_numberFetchingStatus = TreeItem::UNAVAILABLE;
         }
+    } else if (capabilities().contains(QLatin1String("LIST-STATUS"))) {
+        // Requests from the same round of the event loop get merged into a single LIST-STATUS
+        if (!m_pendingListStatus || !m_pendingListStatus->addMailbox(mailboxPtr->toIndex(this))) {
+            m_pendingListStatus = m_taskFactory->createListStatusTask(this);
+            m_pendingListStatus->addMailbox(mailboxPtr->toIndex(this));
+        }
     } else {
         m_taskFactory->createNumberOfMessagesTask(this, mailboxPtr->toIndex(this));
     }
@@ -919,64 +973,10 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(list->parent());
     Q_ASSERT(mailboxPtr);
 
-    if (item->uid()) {
-        AbstractCache::MessageDataBundle data = cache()->messageMetadata(mailboxPtr->mailbox(), item->uid());
-        if (data.uid == item->uid()) {
-            item->data()->m_envelope = data.envelope;
-            item->data()->m_size = data.size;
-            item->data()->m_hdrReferences = data.hdrReferences;
-            item->data()->m_hdrListPost = data.hdrListPost;
-            item->data()->m_hdrListPostNo = data.hdrListPostNo;
-            QDataStream stream(&data.serializedBodyStructure, QIODevice::ReadOnly);
-            stream.setVersion(QDataStream::Qt_4_6);
-            QVariantList unserialized;
-            stream >> unserialized;
-            QSharedPointer<Message::AbstractMessage> abstractMessage;
-            try {
-                abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
-            } catch (Imap::ParserException &e) {
-                qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
-            }
-            if (! abstractMessage) {
-                item->setFetchStatus(TreeItem::UNAVAILABLE);
-            } else {
-                auto newChildren = abstractMessage->createTreeItems(item);
-                if (item->m_children.isEmpty()) {
-                    TreeItemChildrenList oldChildren = item->setChildren(newChildren);
-                    Q_ASSERT(oldChildren.size() == 0);
-                } else {
-                    // The following assert guards against that crazy signal emitting we had when various askFor*()
-                    // functions were not delayed. If it gets hit, it means that someone tried to call this function
-                    // on an item which was already loaded.
-                    Q_ASSERT(item->m_children.isEmpty());
-                    item->setChildren(newChildren);
-                }
-                item->setFetchStatus(TreeItem::DONE);
-            }
-        }
-    }
+    QList<TreeItemMessage *> messages;
+    messages << item;
 
-    switch (networkPolicy()) {
-    case NETWORK_OFFLINE:
-        if (item->accessFetchStatus() != TreeItem::DONE)
-            item->setFetchStatus(TreeItem::UNAVAILABLE);
-        break;
-    case NETWORK_EXPENSIVE:
-        if (item->accessFetchStatus() != TreeItem::DONE) {
-            item->setFetchStatus(TreeItem::LOADING);
-            findTaskResponsibleFor(mailboxPtr)->requestEnvelopeDownload(item->uid());
-        }
-        break;
-    case NETWORK_ONLINE:
-    {
-        if (item->accessFetchStatus() != TreeItem::DONE) {
-            item->setFetchStatus(TreeItem::LOADING);
-            findTaskResponsibleFor(mailboxPtr)->requestEnvelopeDownload(item->uid());
-        }
-
-        // preload
-        if (preloadMode != PRELOAD_PER_POLICY)
-            break;
+    if (networkPolicy() == NETWORK_ONLINE && preloadMode == PRELOAD_PER_POLICY) {
         bool ok;
         int preload = property("trojita-imap-preload-msg-metadata").toInt(&ok);
         if (! ok)
@@ -986,18 +986,123 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
             TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(list->m_children[i]);
             Q_ASSERT(message);
             if (item != message && !message->fetched() && !message->loading() && message->uid()) {
-                message->setFetchStatus(TreeItem::LOADING);
                 // cannot ask the KeepTask directly, that'd completely ignore the cache
-                // but we absolutely have to block the preload :)
-                askForMsgMetadata(message, PRELOAD_DISABLED);
+                messages << message;
             }
         }
     }
-    break;
+
+    loadMsgMetadata(mailboxPtr, messages);
+}
+
+/** @short Fill the @arg item with the metadata from the cache and mark it as fetched */
+void Model::applyCachedMsgMetadata(TreeItemMessage *item, AbstractCache::MessageDataBundle &data)
+{
+    item->data()->m_envelope = data.envelope;
+    item->data()->m_size = data.size;
+    item->data()->m_hdrReferences = data.hdrReferences;
+    item->data()->m_hdrListPost = data.hdrListPost;
+    item->data()->m_hdrListPostNo = data.hdrListPostNo;
+    QDataStream stream(&data.serializedBodyStructure, QIODevice::ReadOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    QVariantList unserialized;
+    stream >> unserialized;
+    QSharedPointer<Message::AbstractMessage> abstractMessage;
+    try {
+        abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
+    } catch (Imap::ParserException &e) {
+        qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
+    }
+    if (! abstractMessage) {
+        item->setFetchStatus(TreeItem::UNAVAILABLE);
+    } else {
+        auto newChildren = abstractMessage->createTreeItems(item);
+        if (item->m_children.isEmpty()) {
+            TreeItemChildrenList oldChildren = item->setChildren(newChildren);
+            Q_ASSERT(oldChildren.size() == 0);
+        } else {
+            // The following assert guards against that crazy signal emitting we had when various askFor*()
+            // functions were not delayed. If it gets hit, it means that someone tried to call this function
+            // on an item which was already loaded.
+            Q_ASSERT(item->m_children.isEmpty());
+            item->setChildren(newChildren);
+        }
+        item->setFetchStatus(TreeItem::DONE);
     }
-    EMIT_LATER(this, dataChanged, Q_ARG(QModelIndex, item->toIndex(this)), Q_ARG(QModelIndex, item->toIndex(this)));
 }
 
+/** @short Look up the metadata of the @arg messages in the cache and request the rest from the server
+
+All of them are looked up through a single call which doesn't wait for the cache I/O. The messages are marked as loading,
+which also blocks any further requests for them, until the cache responds.
+*/
+void Model::loadMsgMetadata(TreeItemMailbox *mailboxPtr, const QList<TreeItemMessage *> &messages)
+{
+    QList<uint> uids;
+    Q_FOREACH(TreeItemMessage *message, messages) {
+        message->setFetchStatus(TreeItem::LOADING);
+        uids << message->uid();
+    }
+    QPersistentModelIndex mailboxIndex = mailboxPtr->toIndex(this);
+    // The cache delivers the pending results when it gets deleted, which might happen as a part of our own destruction
+    QPointer<Model> guard(this);
+    cache()->messageMetadataAsync(mailboxPtr->mailbox(), uids,
+                                  [this, guard, mailboxIndex, uids](const QMap<uint, AbstractCache::MessageDataBundle> &cached) {
+        if (!guard)
+            return;
+        cachedMsgMetadataLoaded(mailboxIndex, uids, cached);
+    });
+}
+
+/** @short The cache has finished looking up the metadata requested through loadMsgMetadata()
+
+The messages could have been changed or deleted in the meanwhile, which is why they are looked up again.
+*/
+void Model::cachedMsgMetadataLoaded(const QPersistentModelIndex &mailboxIndex, const QList<uint> &uids,
+                                    QMap<uint, AbstractCache::MessageDataBundle> cached)
+{
+    if (!mailboxIndex.isValid())
+        return;
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+    Q_ASSERT(mailboxPtr);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailboxPtr->m_children[0]);
+    Q_ASSERT(list);
+
+    KeepMailboxOpenTask *keepTask = 0;
+    // The first message is the one which was asked for, the rest is preloading around it
+    bool fromViewport = false;
+    Q_FOREACH(const uint uid, uids) {
+        TreeItemMessage *message = list->findMessageByUid(uid);
+        if (!message || !message->loading()) {
+            // This one is either gone, or somebody else has already taken care of it
+            continue;
+        }
+        QMap<uint, AbstractCache::MessageDataBundle>::iterator it = cached.find(uid);
+        if (it != cached.end()) {
+            applyCachedMsgMetadata(message, *it);
+        }
+        if (message->accessFetchStatus() != TreeItem::DONE) {
+            if (networkPolicy() == NETWORK_OFFLINE) {
+                message->setFetchStatus(TreeItem::UNAVAILABLE);
+            } else {
+                message->setFetchStatus(TreeItem::LOADING);
+                if (!keepTask) {
+                    keepTask = findTaskResponsibleFor(mailboxPtr);
+                    fromViewport = keepTask->isInViewport(uids.first());
+                }
+                keepTask->requestEnvelopeDownload(uid, fromViewport);
+            }
+        }
+        QModelIndex index = message->toIndex(this);
+        EMIT_LATER(this, dataChanged, Q_ARG(QModelIndex, index), Q_ARG(QModelIndex, index));
+    }
+}
+
+/** @short Load the data of a message part, either from the cache or from the server
+
+Unless the request is @arg onlyFromCache, the item is already marked as loading, and the cache lookup doesn't wait for the
+I/O. The lookups which are @arg onlyFromCache are synchronous because their callers check the result right away.
+*/
 void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
 {
     Q_ASSERT(item->message());   // TreeItemMessage
@@ -1012,58 +1117,153 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     Q_ASSERT(uid);
 
     // Check whether this is a request for fetching the special item representing the raw contents prior to any CTE undoing
-    TreeItemPart *itemForFetchOperation = item;
-    TreeItemModifiedPart *modifiedPart = dynamic_cast<TreeItemModifiedPart*>(item);
-    bool isSpecialRawPart = modifiedPart && modifiedPart->kind() == TreeItem::OFFSET_RAW_CONTENTS;
-    if (isSpecialRawPart) {
-        itemForFetchOperation = dynamic_cast<TreeItemPart*>(item->parent());
-        Q_ASSERT(itemForFetchOperation);
-    }
-
-    const QByteArray &data = cache()->messagePart(mailboxPtr->mailbox(), uid,
-                                                  isSpecialRawPart ?
-                                                      itemForFetchOperation->partId() + ".X-RAW"
-                                                    : item->partId());
-    if (! data.isNull()) {
-        item->m_data = data;
-        item->setFetchStatus(TreeItem::DONE);
-        return;
+    TreeItemPart *itemForFetchOperation = partForFetchOperation(item);
+    bool isSpecialRawPart = itemForFetchOperation != item;
+
+    // The data might be available as-is, or as the raw data which just have to be decoded
+    QList<QByteArray> partIds;
+    partIds << itemForFetchOperation->partId() + ".X-RAW";
+    if (!isSpecialRawPart)
+        partIds.prepend(item->partId());
+
+    if (onlyFromCache) {
+        cache()->AbstractCache::messagePartAsync(mailboxPtr->mailbox(), uid, partIds,
+                                                 [this, item](const QByteArray &partId, const QByteArray &data) {
+            cachedMsgPartLoaded(item, partId, data, true);
+        });
+    } else {
+        QPersistentModelIndex index = item->toIndex(this);
+        QPointer<Model> guard(this);
+        cache()->messagePartAsync(mailboxPtr->mailbox(), uid, partIds,
+                                  [this, guard, index](const QByteArray &partId, const QByteArray &data) {
+            if (!guard || !index.isValid())
+                return;
+            TreeItemPart *part = dynamic_cast<TreeItemPart *>(static_cast<TreeItem *>(index.internalPointer()));
+            if (!part || !part->loading())
+                return;
+            cachedMsgPartLoaded(part, partId, data, false);
+            if (!part->loading())
+                EMIT_LATER(this, dataChanged, Q_ARG(QModelIndex, index), Q_ARG(QModelIndex, index));
+        });
     }
+}
 
-    if (!isSpecialRawPart) {
-        const QByteArray &data = cache()->messagePart(mailboxPtr->mailbox(), uid,
-                                                      itemForFetchOperation->partId() + ".X-RAW");
+/** @short Use the @arg data of a message part found in the cache, or request them from the server if there's nothing */
+void Model::cachedMsgPartLoaded(TreeItemPart *item, const QByteArray &partId, const QByteArray &data, const bool onlyFromCache)
+{
+    TreeItemPart *itemForFetchOperation = partForFetchOperation(item);
+    bool isSpecialRawPart = itemForFetchOperation != item;
 
-        if (!data.isNull()) {
+    if (!data.isNull()) {
+        if (isSpecialRawPart || partId == item->partId()) {
+            item->m_data = data;
+        } else {
             Imap::decodeContentTransferEncoding(data, item->encoding(), item->dataPtr());
-            item->setFetchStatus(TreeItem::DONE);
-            return;
         }
+        item->setFetchStatus(TreeItem::DONE);
+        return;
+    }
 
-        if (item->m_partRaw && item->m_partRaw->loading()) {
-            // There's already a request for the raw data. Let's use it and don't queue an extra fetch here.
-            item->setFetchStatus(TreeItem::LOADING);
-            return;
-        }
+    if (!isSpecialRawPart && item->m_partRaw && item->m_partRaw->loading()) {
+        // There's already a request for the raw data. Let's use it and don't queue an extra fetch here.
+        item->setFetchStatus(TreeItem::LOADING);
+        return;
     }
 
     if (networkPolicy() == NETWORK_OFFLINE) {
         if (item->accessFetchStatus() != TreeItem::DONE)
             item->setFetchStatus(TreeItem::UNAVAILABLE);
     } else if (! onlyFromCache) {
+        TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->message()->parent()->parent());
+        Q_ASSERT(mailboxPtr);
         KeepMailboxOpenTask *keepTask = findTaskResponsibleFor(mailboxPtr);
-        TreeItemPart::PartFetchingMode fetchingMode = TreeItemPart::FETCH_PART_IMAP;
-        if (!isSpecialRawPart && keepTask->parser && accessParser(keepTask->parser).capabilitiesFresh &&
-                accessParser(keepTask->parser).capabilities.contains(QLatin1String("BINARY"))) {
-            if (!item->hasChildren(0)) {
-                // The BINARY only actually makes sense on leaf MIME nodes
-                fetchingMode = TreeItemPart::FETCH_PART_BINARY;
-            }
-        }
+        TreeItemPart::PartFetchingMode fetchingMode = shouldFetchViaBinary(keepTask, item, isSpecialRawPart) ?
+                    TreeItemPart::FETCH_PART_BINARY : TreeItemPart::FETCH_PART_IMAP;
         keepTask->requestPartDownload(item->message()->m_uid, itemForFetchOperation->partIdForFetch(fetchingMode), item->octets());
     }
 }
 
+bool Model::shouldFetchViaBinary(KeepMailboxOpenTask *keepTask, TreeItemPart *item, const bool isSpecialRawPart)
+{
+    // The BINARY only actually makes sense on leaf MIME nodes
+    return !isSpecialRawPart && keepTask->parser && accessParser(keepTask->parser).capabilitiesFresh &&
+            accessParser(keepTask->parser).capabilities.contains(QLatin1String("BINARY")) && !item->hasChildren(0);
+}
+
+void Model::messageOpened(const QModelIndex &message)
+{
+    m_readAhead->messageOpened(message);
+}
+
+bool Model::prefetchMessagePart(const QModelIndex &part)
+{
+    const Model *whichModel = 0;
+    TreeItemPart *item = dynamic_cast<TreeItemPart *>(realTreeItem(part, &whichModel));
+    if (!item || whichModel != this || dynamic_cast<TreeItemModifiedPart*>(item) || item->fetched() || item->loading())
+        return false;
+
+    if (networkPolicy() != NETWORK_ONLINE)
+        return false;
+
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->message()->parent()->parent());
+    Q_ASSERT(mailboxPtr);
+    // Opening another mailbox just because of a guess would be way too expensive
+    if (!mailboxPtr->maintainingTask)
+        return false;
+
+    // The data might have been cached already
+    askForMsgPart(item, true);
+    if (item->fetched() || item->loading())
+        return false;
+
+    KeepMailboxOpenTask *keepTask = mailboxPtr->maintainingTask;
+    TreeItemPart::PartFetchingMode fetchingMode = shouldFetchViaBinary(keepTask, item, false) ?
+                TreeItemPart::FETCH_PART_BINARY : TreeItemPart::FETCH_PART_IMAP;
+    keepTask->requestPartPrefetch(item->message()->m_uid, item->partIdForFetch(fetchingMode), item->octets());
+    return true;
+}
+
+void Model::cancelPartDownload(const QModelIndex &part)
+{
+    const Model *whichModel = 0;
+    TreeItemPart *item = dynamic_cast<TreeItemPart *>(realTreeItem(part, &whichModel));
+    if (!item || whichModel != this || !item->loading())
+        return;
+
+    TreeItemPart *itemForFetchOperation = item;
+    TreeItemModifiedPart *modifiedPart = dynamic_cast<TreeItemModifiedPart*>(item);
+    if (modifiedPart && modifiedPart->kind() == TreeItem::OFFSET_RAW_CONTENTS) {
+        itemForFetchOperation = dynamic_cast<TreeItemPart*>(item->parent());
+        Q_ASSERT(itemForFetchOperation);
+    }
+
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->message()->parent()->parent());
+    Q_ASSERT(mailboxPtr);
+    if (mailboxPtr->maintainingTask) {
+        // We don't remember which of these got requested, so let's just try both
+        const uint uid = static_cast<TreeItemMessage *>(item->message())->uid();
+        mailboxPtr->maintainingTask->cancelPartDownload(uid, itemForFetchOperation->partIdForFetch(TreeItemPart::FETCH_PART_IMAP));
+        mailboxPtr->maintainingTask->cancelPartDownload(uid, itemForFetchOperation->partIdForFetch(TreeItemPart::FETCH_PART_BINARY));
+    }
+    item->setFetchStatus(TreeItem::NONE);
+}
+
+QString Model::cachedMessagePartFile(const QModelIndex &part) const
+{
+    const Model *whichModel = 0;
+    TreeItemPart *item = dynamic_cast<TreeItemPart *>(realTreeItem(part, &whichModel));
+    // The special parts are not stored under their own ID, and those are small anyway
+    if (!item || whichModel != this || dynamic_cast<TreeItemModifiedPart*>(item) || item->fetched())
+        return QString();
+
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->message()->parent()->parent());
+    Q_ASSERT(mailboxPtr);
+    const uint uid = static_cast<TreeItemMessage *>(item->message())->uid();
+    if (!uid)
+        return QString();
+    return cache()->messagePartFile(mailboxPtr->mailbox(), uid, item->partId());
+}
+
 void Model::resyncMailbox(const QModelIndex &mbox)
 {
     findTaskResponsibleFor(mbox)->resynchronizeMailbox();
@@ -1187,6 +1387,8 @@ void Model::switchToMailbox(const QModelIndex &mbox)
     if (! mbox.isValid())
         return;
 
+    m_prewarmer->mailboxSwitched(mbox.data(RoleMailboxName).toString());
+
     if (m_netPolicy == NETWORK_OFFLINE)
         return;
 
@@ -1277,13 +1479,15 @@ void Model::copyMoveMessages(TreeItemMailbox *sourceMbox, const QString &destMai
     m_taskFactory->createCopyMoveMessagesTask(this, messages, destMailboxName, op);
 }
 
-/** @short Convert a list of UIDs to a list of pointers to the relevant message nodes */
+/** @short Convert a list of UIDs to a list of pointers to the relevant message nodes
+
+The lookup goes through the TreeItemMsgList's UID index, so it doesn't have to touch any other TreeItemMessage.
+*/
 QList<TreeItemMessage *> Model::findMessagesByUids(const TreeItemMailbox *const mailbox, const QList<uint> &uids)
 {
     const TreeItemMsgList *const list = dynamic_cast<const TreeItemMsgList *const>(mailbox->m_children[0]);
     Q_ASSERT(list);
     QList<TreeItemMessage *> res;
-    auto it = list->m_children.constBegin();
     uint lastUid = 0;
     Q_FOREACH(const uint& uid, uids) {
         if (lastUid == uid) {
@@ -1291,9 +1495,8 @@ QList<TreeItemMessage *> Model::findMessagesByUids(const TreeItemMailbox *const
             continue;
         }
         lastUid = uid;
-        it = Common::lowerBoundWithUnknownElements(it, list->m_children.constEnd(), uid, messageHasUidZero, uidComparator);
-        if (it != list->m_children.end() && static_cast<TreeItemMessage *>(*it)->uid() == uid) {
-            res << static_cast<TreeItemMessage *>(*it);
+        if (TreeItemMessage *message = list->findMessageByUid(uid)) {
+            res << message;
         } else {
             qDebug() << "Can't find UID" << uid;
         }
@@ -1305,9 +1508,17 @@ QList<TreeItemMessage *> Model::findMessagesByUids(const TreeItemMailbox *const
 
 If there's no such message, the next message with a valid UID is returned instead. If there are no such messages, the iterator can
 point to a message with UID zero or to the end of the list.
+
+Exact matches are resolved through the UID index; only a miss has to fall back to bisection over the list of messages.
 */
 TreeItemChildrenList::iterator Model::findMessageOrNextOneByUid(TreeItemMsgList *list, const uint uid)
 {
+    // The m_offset is lagging behind during the UID syncing in ObtainSynchronizedMailboxTask::applyUids(), so it has to be verified
+    TreeItemMessage *message = list->findMessageByUid(uid);
+    if (message && message->m_offset >= 0 && message->m_offset < list->m_children.size()
+            && list->m_children[message->m_offset] == message) {
+        return list->m_children.begin() + message->m_offset;
+    }
     return Common::lowerBoundWithUnknownElements(list->m_children.begin(), list->m_children.end(), uid, messageHasUidZero, uidComparator);
 }
 
@@ -1495,6 +1706,9 @@ void Model::killParser(Parser *parser, ParserKillingMethod method)
 void Model::slotParserLineReceived(Parser *parser, const QByteArray &line)
 {
     logTrace(parser->parserId(), Common::LOG_IO_READ, QString(), QString::fromUtf8(line));
+    // The Parser credits the untagged data to the command in flight when there's just one of them
+    if (line.startsWith("* ") && !parser->hasSingleCommandInFlight())
+        m_taskStatistics->untaggedDataReceived(parser->parserId(), line.size());
 }
 
 void Model::slotParserLineSent(Parser *parser, const QByteArray &line)
@@ -1519,6 +1733,8 @@ void Model::runReadyTasks()
             // See responseReceived() for more details about why we do need to iterate over a copy here.
             // Basically, calls to ImapTask::perform could invalidate our precious iterators.
             QList<ImapTask *> origList = parserIt->activeTasks;
+            // The commands of the more urgent tasks shall go first; the order of the activeTasks is left intact
+            qStableSort(origList.begin(), origList.end(), ImapTask::morePressingThan);
             QList<ImapTask *> deletedList;
             QList<ImapTask *>::const_iterator taskEnd = origList.constEnd();
             for (QList<ImapTask *>::const_iterator taskIt = origList.constBegin(); taskIt != taskEnd; ++taskIt) {
@@ -1562,7 +1778,13 @@ KeepMailboxOpenTask *Model::findTaskResponsibleFor(const QModelIndex &mailbox)
 KeepMailboxOpenTask *Model::findTaskResponsibleFor(TreeItemMailbox *mailboxPtr)
 {
     Q_ASSERT(mailboxPtr);
-    bool canCreateParallelConn = m_parsers.isEmpty(); // FIXME: multiple connections
+    bool canCreateParallelConn = true; // FIXME: multiple connections
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (!it->isDedicated) {
+            canCreateParallelConn = false;
+            break;
+        }
+    }
 
     if (mailboxPtr->maintainingTask) {
         // The requested mailbox already has the maintaining task associated
@@ -1582,7 +1804,7 @@ KeepMailboxOpenTask *Model::findTaskResponsibleFor(TreeItemMailbox *mailboxPtr)
         Q_ASSERT(!m_parsers.isEmpty());
 
         for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
-            if (it->connState == CONN_STATE_LOGOUT) {
+            if (it->connState == CONN_STATE_LOGOUT || it->isDedicated) {
                 // this one is not usable
                 continue;
             }
@@ -1726,6 +1948,39 @@ void Model::releaseMessageData(const QModelIndex &message)
 #endif
 }
 
+void Model::setVisibleMessages(const QModelIndexList &visible, const QModelIndexList &nearby)
+{
+    TreeItemMsgList *list = 0;
+    QSet<uint> visibleUids;
+    QSet<uint> nearbyUids;
+
+    for (int i = 0; i < visible.size() + nearby.size(); ++i) {
+        const QModelIndex &index = i < visible.size() ? visible[i] : nearby[i - visible.size()];
+        const Model *whichModel = 0;
+        TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(realTreeItem(index, &whichModel));
+        if (!message || whichModel != this || !message->uid())
+            continue;
+        if (!list) {
+            list = static_cast<TreeItemMsgList *>(message->parent());
+        } else if (list != message->parent()) {
+            continue;
+        }
+        if (i < visible.size())
+            visibleUids.insert(message->uid());
+        else
+            nearbyUids.insert(message->uid());
+    }
+
+    if (!list)
+        return;
+
+    TreeItemMailbox *mailbox = static_cast<TreeItemMailbox *>(list->parent());
+    Q_ASSERT(mailbox);
+    // Don't open the mailbox just because of this; without a KeepMailboxOpenTask, there are no pending requests anyway
+    if (mailbox->maintainingTask)
+        mailbox->maintainingTask->setViewport(visibleUids, nearbyUids);
+}
+
 QStringList Model::capabilities() const
 {
     if (m_parsers.isEmpty())
@@ -1941,6 +2196,17 @@ void Model::invalidateAllMessageCounts()
     }
 }
 
+void Model::slotPeriodicMailboxNumbersRefresh()
+{
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (it->notifyActive && it->connState != CONN_STATE_LOGOUT) {
+            // The server sends STATUS updates via NOTIFY, there's no need for polling
+            return;
+        }
+    }
+    invalidateAllMessageCounts();
+}
+
 AppendTask *Model::appendIntoMailbox(const QString &mailbox, const QByteArray &rawMessageData, const QStringList &flags,
                                      const QDateTime &timestamp)
 {
@@ -1965,6 +2231,65 @@ UidSubmitTask *Model::sendMailViaUidSubmit(const QString &mailbox, const uint ui
     return m_taskFactory->createUidSubmitTask(this, mailbox, uidValidity, uid, options);
 }
 
+int Model::freeConnections() const
+{
+    int used = 0;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (it->connState != CONN_STATE_LOGOUT)
+            ++used;
+    }
+    return m_maxParsers - used;
+}
+
+ParallelFetchJob *Model::fetchInParallel(const QModelIndex &mailbox, const QList<uint> &uids, const QList<QByteArray> &items,
+                                         const int connections)
+{
+    QMap<uint, QList<QByteArray> > requests;
+    Q_FOREACH(const uint uid, uids) {
+        requests[uid] = items;
+    }
+    return fetchInParallel(mailbox, requests, connections);
+}
+
+ParallelFetchJob *Model::fetchInParallel(const QModelIndex &mailbox, const QMap<uint, QList<QByteArray> > &items,
+                                         const int connections)
+{
+    if (!isNetworkAvailable() || items.isEmpty())
+        return 0;
+
+    QModelIndex translatedIndex;
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(realTreeItem(mailbox, 0, &translatedIndex));
+    if (!mailboxPtr || !mailboxPtr->syncState.uidValidity())
+        return 0;
+
+    const int count = qMin(qMax(1, connections), freeConnections());
+    if (count <= 0) {
+        logTrace(translatedIndex, Common::LOG_TASKS, QLatin1String("Model"),
+                 QLatin1String("Not downloading in parallel, all connections are in use"));
+        return 0;
+    }
+
+    bool ok;
+    int chunkSize = property("trojita-imap-parallel-fetch-chunk").toInt(&ok);
+    if (!ok || chunkSize <= 0)
+        chunkSize = 100;
+    // Small downloads shall still get spread over all connections
+    chunkSize = qMin(chunkSize, (items.size() + count - 1) / count);
+
+    ParallelFetchJob *job = new ParallelFetchJob(this, translatedIndex, items, chunkSize);
+    if (!job->totalMessages()) {
+        delete job;
+        return 0;
+    }
+    for (int i = 0; i < count; ++i) {
+        m_taskFactory->createParallelFetchTask(this, translatedIndex, job);
+    }
+    logTrace(translatedIndex, Common::LOG_TASKS, QLatin1String("Model"),
+             QString::fromUtf8("Downloading %1 messages over %2 extra connections").arg(QString::number(job->totalMessages()),
+                                                                                       QString::number(count)));
+    return job;
+}
+
 #ifdef TROJITA_DEBUG_TASK_TREE
 #define TROJITA_DEBUG_TASK_TREE_VERBOSE
 void Model::checkTaskTreeConsistency()
@@ -2029,6 +2354,16 @@ void Model::setCapabilitiesBlacklist(const QStringList &blacklist)
     m_capabilitiesBlacklist = blacklist;
 }
 
+void Model::setWatchedMailboxes(const QStringList &mailboxes)
+{
+    m_watcher->setWatchedMailboxes(mailboxes);
+}
+
+QStringList Model::watchedMailboxes() const
+{
+    return m_watcher->watchedMailboxes();
+}
+
 bool Model::isCatenateSupported() const
 {
     return capabilities().contains(QLatin1String("CATENATE"));
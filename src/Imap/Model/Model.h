@@ -78,7 +78,12 @@ class SystemNetworkWatcher;
 
 class ImapTask;
 class KeepMailboxOpenTask;
+class ListStatusTask;
+class MailboxPrewarmer;
+class MailboxWatcher;
+class MessageReadAhead;
 class TaskPresentationModel;
+class TaskStatistics;
 template <typename SourceModel> class SubtreeClassSpecificItem;
 typedef std::unique_ptr<Streams::SocketFactory> SocketFactoryPtr;
 
@@ -207,6 +212,42 @@ public:
     UidSubmitTask *sendMailViaUidSubmit(const QString &mailbox, const uint uidValidity, const uint uid,
                                         const UidSubmitOptionsList &options);
 
+    /** @short Download data of many messages in a mailbox over several additional connections
+
+    The @arg items are passed to each UID FETCH verbatim; these could be the message metadata or the BODY.PEEK[...] of
+    parts of messages whose structure is already known. At most @arg connections new connections are opened, subject to the
+    overall limit on the number of connections. The mailbox has to be synced already. Returns 0 if the download cannot be
+    started, which includes the case of all connections being in use already. See ParallelFetchJob for details.
+    */
+    ParallelFetchJob *fetchInParallel(const QModelIndex &mailbox, const QList<uint> &uids, const QList<QByteArray> &items,
+                                      const int connections);
+    /** @short Download different data @arg items for each UID over several additional connections
+
+    This is an overloaded function; messages which need the same items get fetched together.
+    */
+    ParallelFetchJob *fetchInParallel(const QModelIndex &mailbox, const QMap<uint, QList<QByteArray> > &items,
+                                      const int connections);
+
+    /** @short Access the predictor which refreshes the likely-next mailboxes in advance */
+    MailboxPrewarmer *mailboxPrewarmer() const { return m_prewarmer; }
+
+    /** @short The user has opened the @arg message
+
+    The index shall come from the model which the user actually looks at, so that the MessageReadAhead can follow the same
+    sorting and threading while prefetching the messages which are likely to be read next.
+    */
+    void messageOpened(const QModelIndex &message);
+    /** @short Access the helper which prefetches the likely-next messages */
+    MessageReadAhead *messageReadAhead() const { return m_readAhead; }
+
+    /** @short Access the latency and traffic figures aggregated over all finished tasks */
+    TaskStatistics *taskStatistics() const { return m_taskStatistics; }
+
+    /** @short Queue a low-priority download of the message @arg part unless its data are available already
+
+    Returns true if the download has been queued. Only parts of messages in the currently opened mailbox can be prefetched.
+    */
+    bool prefetchMessagePart(const QModelIndex &part);
 
     /** @short Returns true if we are allowed to access the network */
     bool isNetworkAvailable() const { return m_netPolicy != NETWORK_OFFLINE; }
@@ -242,6 +283,30 @@ public:
     */
     void releaseMessageData(const QModelIndex &message);
 
+    /** @short Inform the model about which messages are currently visible to the user
+
+    Pending requests for envelopes of the @arg visible messages will be served before those which were issued as a part of
+    the preloading. Requests for messages which are neither visible nor @arg nearby have been scrolled far away, so they
+    will be dropped before they hit the network. Only the view knows what is near in the order which the user sees,
+    which is why it has to provide both lists. The indexes can come from any proxy model on top of this one, but they
+    all have to refer to a single mailbox.
+    */
+    void setVisibleMessages(const QModelIndexList &visible, const QModelIndexList &nearby);
+
+    /** @short The user is no longer interested in the data of the given message part
+
+    A queued request for the part is dropped and a running download of a large part is interrupted at the next chunk
+    boundary. Whatever has been received so far stays in the cache, so asking for the part again resumes the download.
+    */
+    void cancelPartDownload(const QModelIndex &part);
+
+    /** @short Return the name of a cache file which holds the data of a message part which has not been loaded yet
+
+    Big parts can be read from such a file directly, so that their data never have to be kept in the model. A null
+    QString is returned when the data are already available in the model or when the cache does not have such a file.
+    */
+    QString cachedMessagePartFile(const QModelIndex &part) const;
+
     /** @short Return a list of capabilities which are supported by the server */
     QStringList capabilities() const;
 
@@ -279,6 +344,13 @@ public:
     */
     void setCapabilitiesBlacklist(const QStringList &blacklist);
 
+    /** @short Keep an eye on new mail in these mailboxes even when they aren't opened
+
+    See MailboxWatcher for details.
+    */
+    void setWatchedMailboxes(const QStringList &mailboxes);
+    QStringList watchedMailboxes() const;
+
     bool isCatenateSupported() const;
     bool isGenUrlAuthSupported() const;
     bool isImapSubmissionSupported() const;
@@ -322,6 +394,9 @@ private slots:
     /** @short A maintaining task is about to die */
     void slotTaskDying(QObject *obj);
 
+    /** @short Ask for updated message counts, unless the server is pushing them to us already */
+    void slotPeriodicMailboxNumbersRefresh();
+
 signals:
     /** @short This signal is emitted then the server sent us an ALERT response code */
     void alertReceived(const QString &message);
@@ -399,6 +474,12 @@ signals:
 
     void mailboxFirstUnseenMessage(const QModelIndex &maillbox, const QModelIndex &message);
 
+    /** @short Another chunk of a large message part has arrived
+
+    The @arg total is the size of the part as reported by the BODYSTRUCTURE, so it need not match the final size exactly.
+    */
+    void messagePartDownloadProgress(const QModelIndex &part, qint64 received, qint64 total);
+
     /** @short Threading has arrived */
     void threadingAvailable(const QModelIndex &mailbox, const QByteArray &algorithm,
                             const QStringList &searchCriteria, const QVector<Imap::Responses::ThreadingNode> &mapping);
@@ -430,6 +511,7 @@ private:
 
     friend class ImapTask;
     friend class FetchMsgPartTask;
+    friend class FetchMsgPartInChunksTask;
     friend class UpdateFlagsTask;
     friend class UpdateFlagsOfAllMessagesTask;
     friend class ListChildMailboxesTask;
@@ -456,6 +538,15 @@ private:
     friend class SubscribeUnsubscribeTask;
     friend class GenUrlAuthTask;
     friend class UidSubmitTask;
+    friend class ParallelFetchTask;
+    friend class ListStatusTask;
+    friend class NotifyTask;
+    friend class OfflineSyncer;
+    friend class MailboxPrewarmer;
+    friend class PrewarmMailboxTask;
+    friend class MailboxWatcher;
+    friend class MessageReadAhead;
+    friend class WatchMailboxTask;
 
     friend class TestingTaskFactory; // needs access to socketFactory
     friend class DummyNetworkWatcher; // needs access to the network policy manipulation
@@ -478,7 +569,14 @@ private:
     typedef enum {PRELOAD_PER_POLICY, PRELOAD_DISABLED} PreloadingMode;
 
     void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode);
+    void applyCachedMsgMetadata(TreeItemMessage *item, AbstractCache::MessageDataBundle &data);
+    void loadMsgMetadata(TreeItemMailbox *mailboxPtr, const QList<TreeItemMessage *> &messages);
+    void cachedMsgMetadataLoaded(const QPersistentModelIndex &mailboxIndex, const QList<uint> &uids,
+                                 QMap<uint, AbstractCache::MessageDataBundle> cached);
     void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false);
+    void cachedMsgPartLoaded(TreeItemPart *item, const QByteArray &partId, const QByteArray &data, const bool onlyFromCache);
+    /** @short Shall the @arg item be fetched through BINARY instead of the plain old BODY? */
+    bool shouldFetchViaBinary(KeepMailboxOpenTask *keepTask, TreeItemPart *item, const bool isSpecialRawPart);
 
     void finalizeList(Parser *parser, TreeItemMailbox *const mailboxPtr);
     void finalizeIncrementalList(Parser *parser, const QString &parentMailboxName);
@@ -487,10 +585,20 @@ private:
 
     void replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChildrenList &mailboxes);
     void updateCapabilities(Parser *parser, const QStringList capabilities);
+    /** @short How many more connections can be opened without going over the m_maxParsers
+
+    All connections which are not being closed count, including those which are dedicated to some background work.
+    */
+    int freeConnections() const;
 
     TreeItem *translatePtr(const QModelIndex &index) const;
 
     void emitMessageCountChanged(TreeItemMailbox *const mailbox);
+    /** @short Update the message counts of a mailbox which is not synced, as obtained by STATUS or similar means
+
+    The -1 means that the corresponding number is not known.
+    */
+    void updateMessageCounts(TreeItemMailbox *mailbox, const int total, const int unread, const int recent);
 
     TreeItemMailbox *findMailboxByName(const QString &name) const;
     TreeItemMailbox *findMailboxByName(const QString &name, const TreeItemMailbox *const root) const;
@@ -561,6 +669,13 @@ private:
     bool m_hasImapPassword;
 
     QTimer *m_periodicMailboxNumbersRefresh;
+    /** @short A LIST-STATUS which has not been sent yet and can therefore take more mailboxes */
+    QPointer<ListStatusTask> m_pendingListStatus;
+
+    MailboxPrewarmer *m_prewarmer;
+    MailboxWatcher *m_watcher;
+    MessageReadAhead *m_readAhead;
+    TaskStatistics *m_taskStatistics;
 
     QStringList m_capabilitiesBlacklist;
 
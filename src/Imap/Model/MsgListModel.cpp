@@ -101,6 +101,7 @@ QHash<int, QByteArray> MsgListModel::roleNames() const
         roleNames[RoleMessageSize] = "size";
         roleNames[RoleMessageFuzzyDate] = "fuzzyDate";
         roleNames[RoleMessageHasAttachments] = "hasAttachments";
+        roleNames[RoleMessageIsPlaceholder] = "isPlaceholder";
     }
     return roleNames;
 }
@@ -275,6 +276,7 @@ QVariant MsgListModel::data(const QModelIndex &proxyIndex, int role) const
     case RoleMessageHeaderListPost:
     case RoleMessageHeaderListPostNo:
     case RoleMessageHasAttachments:
+    case RoleMessageIsPlaceholder:
         return dynamic_cast<TreeItemMessage *>(Model::realTreeItem(
                 proxyIndex))->data(static_cast<Model *>(sourceModel()), role);
     default:
@@ -0,0 +1,622 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTimer>
+#include "OfflineSyncer.h"
+#include "Imap/Model/Cache.h"
+#include "Imap/Model/MailboxFinder.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/ParallelFetchJob.h"
+#include "Imap/Model/TaskFactory.h"
+#include "Imap/Tasks/KeepMailboxOpenTask.h"
+
+namespace {
+
+/** @short Give up on a batch which has not moved forward for this long */
+const int stallTimeout = 120 * 1000;
+
+/** @short Delay between subsequent batches when the network connection is expensive */
+const int expensiveBatchDelay = 5 * 1000;
+
+/** @short Give up on the current mailbox when the download of a single batch fails this many times */
+const int maxFailedDownloads = 2;
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+OfflineSyncer::OfflineSyncer(Model *model, QObject *parent):
+    QObject(parent), m_model(model), m_currentMailbox(0), m_state(STATE_IDLE), m_partSizeLimit(0), m_batchDone(0),
+    m_failedDownloads(0)
+{
+    m_checkTimer = new QTimer(this);
+    m_checkTimer->setSingleShot(true);
+    m_checkTimer->setInterval(0);
+    connect(m_checkTimer, SIGNAL(timeout()), this, SLOT(checkBatch()));
+
+    m_stallTimer = new QTimer(this);
+    m_stallTimer->setSingleShot(true);
+    m_stallTimer->setInterval(stallTimeout);
+    connect(m_stallTimer, SIGNAL(timeout()), this, SLOT(slotStalled()));
+
+    m_throttleTimer = new QTimer(this);
+    m_throttleTimer->setSingleShot(true);
+    m_throttleTimer->setInterval(expensiveBatchDelay);
+    connect(m_throttleTimer, SIGNAL(timeout()), this, SLOT(queueNextBatch()));
+
+    connect(m_model, SIGNAL(networkPolicyChanged()), this, SLOT(slotNetworkPolicyChanged()));
+    connect(m_model, SIGNAL(mailboxSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)),
+            this, SLOT(slotSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)));
+    connect(m_model, SIGNAL(mailboxSyncFailed(QString,QString)), this, SLOT(slotMailboxSyncFailed(QString,QString)));
+    connect(m_model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), this, SLOT(slotDataChanged(QModelIndex,QModelIndex)));
+    connect(m_model, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(slotRowsRemoved(QModelIndex,int,int)));
+
+    m_finder = new MailboxFinder(this, m_model);
+    connect(m_finder, SIGNAL(mailboxFound(QString,QModelIndex)), this, SLOT(slotMailboxFound(QString,QModelIndex)));
+}
+
+void OfflineSyncer::setMailboxes(const QStringList &mailboxes)
+{
+    m_mailboxes = mailboxes;
+}
+
+void OfflineSyncer::setPartSizeLimit(const uint bytes)
+{
+    m_partSizeLimit = bytes;
+}
+
+void OfflineSyncer::start()
+{
+    if (isRunning())
+        return;
+
+    m_currentMailbox = 0;
+    if (m_mailboxes.isEmpty()) {
+        emit finished();
+        return;
+    }
+
+    if (!m_model->isNetworkAvailable()) {
+        // We will get going as soon as the network comes back
+        m_state = STATE_PAUSED;
+        return;
+    }
+
+    openMailbox();
+}
+
+void OfflineSyncer::stop()
+{
+    m_checkTimer->stop();
+    m_stallTimer->stop();
+    m_throttleTimer->stop();
+    abandonDownload();
+    m_batch.clear();
+    m_retried.clear();
+    m_mailboxIndex = QPersistentModelIndex();
+    m_state = STATE_IDLE;
+    releaseConnection();
+}
+
+void OfflineSyncer::openMailbox()
+{
+    Q_ASSERT(m_currentMailbox < m_mailboxes.size());
+    m_state = STATE_OPENING;
+
+    m_stallTimer->start();
+    TreeItemMailbox *mailbox = m_model->findMailboxByName(m_mailboxes[m_currentMailbox]);
+    if (!mailbox) {
+        // The list of mailboxes might not have been loaded that deep yet; the stall timer takes care of mailboxes which
+        // do not exist at all
+        m_finder->addMailbox(m_mailboxes[m_currentMailbox]);
+        return;
+    }
+    if (!mailbox->isSelectable()) {
+        finishMailbox(tr("The mailbox cannot be selected"));
+        return;
+    }
+    m_mailboxIndex = mailbox->toIndex(m_model);
+
+    // Make sure that the list of messages is available and that the mailbox gets synchronized with the server
+    TreeItemMsgList *list = currentList();
+    Q_ASSERT(list);
+    list->fetch(m_model);
+    KeepMailboxOpenTask *keepTask = keepMailboxOpen(mailbox);
+
+    if (list->fetched() && keepTask->isRunning) {
+        beginMailbox();
+    }
+    // ...otherwise we will wait for the mailboxSyncingProgress() from the ObtainSynchronizedMailboxTask
+}
+
+/** @short Find or create the task which keeps the @arg mailbox synchronized, without stealing anybody's connection */
+KeepMailboxOpenTask *OfflineSyncer::keepMailboxOpen(TreeItemMailbox *mailbox)
+{
+    if (mailbox->maintainingTask && m_model->accessParser(mailbox->maintainingTask->parser).connState != CONN_STATE_LOGOUT) {
+        // It's open already, either by us or by the user
+        return mailbox->maintainingTask;
+    }
+
+    Parser *parser = 0;
+    if (m_parser && m_model->m_parsers.contains(m_parser) && m_model->accessParser(m_parser).connState != CONN_STATE_LOGOUT)
+        parser = m_parser;
+    if (!parser && m_model->freeConnections() <= 0) {
+        // Another connection would go over the limit, so the mailbox gets opened over one of the regular connections
+        log(QString::fromUtf8("No free connection for synchronizing %1, sharing a regular one").arg(mailbox->mailbox()));
+        return m_model->findTaskResponsibleFor(mailbox);
+    }
+    KeepMailboxOpenTask *keepTask = m_model->m_taskFactory->createKeepMailboxOpenTask(m_model, mailbox->toIndex(m_model),
+                                                                                      parser);
+    if (!parser) {
+        log(QString::fromUtf8("Opening a connection for synchronizing %1").arg(mailbox->mailbox()));
+        m_parser = keepTask->parser;
+        // Keep the regular mailbox switching away from this connection
+        m_model->accessParser(m_parser).isDedicated = true;
+    }
+    return keepTask;
+}
+
+/** @short Let the Model use our connection for anything it needs */
+void OfflineSyncer::releaseConnection()
+{
+    if (m_parser && m_model->m_parsers.contains(m_parser))
+        m_model->accessParser(m_parser).isDedicated = false;
+    m_parser = 0;
+}
+
+void OfflineSyncer::beginMailbox()
+{
+    TreeItemMailbox *mailbox = currentMailbox();
+    if (!mailbox) {
+        finishMailbox(tr("The mailbox is no longer available"));
+        return;
+    }
+
+    const uint uidValidity = mailbox->syncState.uidValidity();
+    m_progress = m_model->cache()->offlineSyncProgress(mailbox->mailbox());
+    if (m_progress.uidValidity != uidValidity) {
+        if (m_progress.highestSyncedUid) {
+            log(QString::fromUtf8("UIDVALIDITY of %1 has changed, starting from scratch").arg(mailbox->mailbox()));
+        }
+        m_progress = OfflineSyncProgress(uidValidity, 0);
+        saveProgress();
+    } else if (m_progress.highestSyncedUid) {
+        log(QString::fromUtf8("Resuming synchronization of %1 after UID %2").arg(mailbox->mailbox(),
+                                                                                  QString::number(m_progress.highestSyncedUid)));
+    }
+
+    m_state = STATE_DOWNLOADING;
+    queueNextBatch();
+}
+
+void OfflineSyncer::queueNextBatch()
+{
+    if (m_state != STATE_DOWNLOADING && m_state != STATE_THROTTLED)
+        return;
+
+    if (!m_model->isNetworkAvailable()) {
+        pause();
+        return;
+    }
+
+    TreeItemMsgList *list = currentList();
+    if (!list) {
+        finishMailbox(tr("The mailbox is no longer available"));
+        return;
+    }
+
+    m_batch.clear();
+    m_retried.clear();
+    m_batchDone = 0;
+    m_failedDownloads = 0;
+    const int size = batchSize();
+    // The messages are sorted by their UIDs, which means that the batch will be sorted, too. Everything up to the last
+    // synced message is done, so the scan starts right after it instead of walking the whole mailbox for each batch.
+    int start = 0;
+    if (m_progress.highestSyncedUid) {
+        TreeItemMessage *lastSynced = list->findMessageByUid(m_progress.highestSyncedUid);
+        // The message might have been expunged, in which case we have to look for its successor the slow way
+        if (lastSynced && lastSynced->row() < list->m_children.size() && list->m_children[lastSynced->row()] == lastSynced)
+            start = lastSynced->row() + 1;
+    }
+    int done = start;
+    for (int i = start; i < list->m_children.size() && m_batch.size() < size; ++i) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(list->m_children[i]);
+        const uint uid = message->uid();
+        if (!uid) {
+            // The UID will arrive later; the message will get picked up by the next start()
+            continue;
+        }
+        if (uid <= m_progress.highestSyncedUid) {
+            ++done;
+        } else {
+            m_batch << uid;
+        }
+    }
+    emit progress(m_mailboxes[m_currentMailbox], done, list->m_children.size());
+
+    if (m_batch.isEmpty()) {
+        finishMailbox(QString());
+        return;
+    }
+
+    m_state = STATE_DOWNLOADING;
+    m_stallTimer->start();
+    checkBatch();
+}
+
+void OfflineSyncer::checkBatch()
+{
+    if (m_state != STATE_DOWNLOADING)
+        return;
+
+    if (!m_model->isNetworkAvailable()) {
+        pause();
+        return;
+    }
+
+    TreeItemMsgList *list = currentList();
+    if (!list) {
+        finishMailbox(tr("The mailbox is no longer available"));
+        return;
+    }
+
+    int done = 0;
+    bool pending = false;
+    bool failed = false;
+    bool contiguous = true;
+    uint highestSyncedUid = m_progress.highestSyncedUid;
+    QMap<uint, QList<QByteArray> > download;
+    QList<TreeItemPart *> downloadParts;
+    Q_FOREACH(const uint uid, m_batch) {
+        TreeItemMessage *message = list->findMessageByUid(uid);
+        // Messages which got expunged in the meanwhile need no further work
+        ItemState state = message ? checkMessage(message, download, downloadParts) : ITEM_DONE;
+        switch (state) {
+        case ITEM_DONE:
+            ++done;
+            if (contiguous)
+                highestSyncedUid = uid;
+            break;
+        case ITEM_PENDING:
+            pending = true;
+            contiguous = false;
+            break;
+        case ITEM_FAILED:
+            failed = true;
+            contiguous = false;
+            break;
+        }
+    }
+
+    if (highestSyncedUid != m_progress.highestSyncedUid) {
+        m_progress.highestSyncedUid = highestSyncedUid;
+        saveProgress();
+    }
+
+    if (done > m_batchDone) {
+        m_batchDone = done;
+        m_stallTimer->start();
+    }
+
+    if (!download.isEmpty()) {
+        Q_ASSERT(!m_job);
+        bool ok;
+        int connections = m_model->property("trojita-imap-offline-sync-connections").toInt(&ok);
+        if (!ok || connections < 1)
+            connections = 2;
+        m_job = m_model->fetchInParallel(m_mailboxIndex, download, connections);
+        if (m_job) {
+            connect(m_job, SIGNAL(finished()), this, SLOT(slotDownloadFinished()));
+            connect(m_job, SIGNAL(failed(QString)), this, SLOT(slotDownloadFailed(QString)));
+        } else {
+            // All connections are taken, so the parts go over the one which keeps the mailbox open
+            Q_FOREACH(TreeItemPart *part, downloadParts) {
+                part->fetch(m_model);
+            }
+        }
+    }
+
+    if (pending)
+        return;
+
+    m_stallTimer->stop();
+    if (failed) {
+        finishMailbox(tr("Some messages could not be downloaded"));
+        return;
+    }
+
+    if (m_model->networkPolicy() == NETWORK_EXPENSIVE) {
+        m_state = STATE_THROTTLED;
+        m_throttleTimer->start();
+    } else {
+        queueNextBatch();
+    }
+}
+
+OfflineSyncer::ItemState OfflineSyncer::checkMessage(TreeItemMessage *message, QMap<uint, QList<QByteArray> > &download,
+                                                   QList<TreeItemPart *> &downloadParts)
+{
+    if (!message->fetched()) {
+        if (message->loading())
+            return ITEM_PENDING;
+        if (message->accessFetchStatus() == TreeItem::UNAVAILABLE && !shouldRetry(message->uid(), QByteArray()))
+            return ITEM_FAILED;
+
+        // We are walking the whole mailbox anyway, so there's no point in preloading the neighbors
+        message->setFetchStatus(TreeItem::LOADING);
+        m_model->askForMsgMetadata(message, Model::PRELOAD_DISABLED);
+        if (!message->fetched())
+            return ITEM_PENDING;
+    }
+
+    QList<QByteArray> parts;
+    ItemState state = checkParts(message, message->uid(), parts, downloadParts);
+    if (!parts.isEmpty())
+        download[message->uid()] = parts;
+    return state;
+}
+
+OfflineSyncer::ItemState OfflineSyncer::checkParts(TreeItem *item, const uint uid, QList<QByteArray> &download,
+                                                 QList<TreeItemPart *> &downloadParts)
+{
+    bool pending = false;
+    bool failed = false;
+    Q_FOREACH(TreeItem *child, item->m_children) {
+        TreeItemPart *part = static_cast<TreeItemPart *>(child);
+        ItemState state = ITEM_DONE;
+        if (!part->m_children.isEmpty()) {
+            // Multiparts and embedded messages carry no data on their own
+            state = checkParts(part, uid, download, downloadParts);
+        } else if (m_partSizeLimit && part->octets() > m_partSizeLimit) {
+            // Too big, skip it
+        } else if (part->fetched()) {
+            // nothing to do
+        } else if (part->loading()) {
+            state = ITEM_PENDING;
+        } else if (m_job) {
+            // The running download has not got to this part yet, or it will be requested once that one finishes
+            state = ITEM_PENDING;
+        } else if (part->accessFetchStatus() == TreeItem::UNAVAILABLE && !shouldRetry(uid, part->partId())) {
+            state = ITEM_FAILED;
+        } else {
+            // The data might have been cached already
+            m_model->askForMsgPart(part, true);
+            if (!part->fetched()) {
+                download << part->partIdForFetch(TreeItemPart::FETCH_PART_IMAP);
+                downloadParts << part;
+                state = ITEM_PENDING;
+            }
+        }
+
+        if (state == ITEM_PENDING)
+            pending = true;
+        else if (state == ITEM_FAILED)
+            failed = true;
+    }
+    return pending ? ITEM_PENDING : (failed ? ITEM_FAILED : ITEM_DONE);
+}
+
+/** @short Items which became unavailable while we were offline get one more chance within each batch */
+bool OfflineSyncer::shouldRetry(const uint uid, const QByteArray &partId)
+{
+    const QPair<uint, QByteArray> key = qMakePair(uid, partId);
+    if (m_retried.contains(key))
+        return false;
+    m_retried.insert(key);
+    return true;
+}
+
+void OfflineSyncer::finishMailbox(const QString &errorMessage)
+{
+    m_checkTimer->stop();
+    m_stallTimer->stop();
+    m_throttleTimer->stop();
+    abandonDownload();
+    m_batch.clear();
+    m_retried.clear();
+
+    const QString mailbox = m_mailboxes[m_currentMailbox];
+    if (errorMessage.isEmpty()) {
+        log(QString::fromUtf8("Mailbox %1 is synchronized").arg(mailbox));
+    } else {
+        log(QString::fromUtf8("Synchronization of %1 failed: %2").arg(mailbox, errorMessage));
+        emit mailboxFailed(mailbox, errorMessage);
+        if (m_state == STATE_IDLE) {
+            // Somebody has called stop() from a slot
+            return;
+        }
+    }
+
+    m_mailboxIndex = QPersistentModelIndex();
+    ++m_currentMailbox;
+    if (m_currentMailbox >= m_mailboxes.size()) {
+        m_state = STATE_IDLE;
+        releaseConnection();
+        emit finished();
+        return;
+    }
+    openMailbox();
+}
+
+void OfflineSyncer::pause()
+{
+    if (m_state == STATE_IDLE || m_state == STATE_PAUSED)
+        return;
+
+    log(QLatin1String("Network is not available, pausing"));
+    m_checkTimer->stop();
+    m_stallTimer->stop();
+    m_throttleTimer->stop();
+    abandonDownload();
+    m_batch.clear();
+    m_retried.clear();
+    m_state = STATE_PAUSED;
+}
+
+/** @short Stop caring about the running download; whatever it still delivers ends up in the cache anyway */
+void OfflineSyncer::abandonDownload()
+{
+    if (m_job)
+        disconnect(m_job, 0, this, 0);
+    m_job = 0;
+}
+
+void OfflineSyncer::saveProgress()
+{
+    TreeItemMailbox *mailbox = currentMailbox();
+    if (!mailbox)
+        return;
+    m_model->cache()->setOfflineSyncProgress(mailbox->mailbox(), m_progress);
+}
+
+int OfflineSyncer::batchSize() const
+{
+    bool ok;
+    int size = m_model->property("trojita-imap-offline-sync-batch").toInt(&ok);
+    if (!ok || size < 1)
+        size = 50;
+    if (m_model->networkPolicy() == NETWORK_EXPENSIVE)
+        size = qMax(1, size / 5);
+    return size;
+}
+
+TreeItemMailbox *OfflineSyncer::currentMailbox() const
+{
+    if (!m_mailboxIndex.isValid())
+        return 0;
+    return dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(m_mailboxIndex.internalPointer()));
+}
+
+TreeItemMsgList *OfflineSyncer::currentList() const
+{
+    TreeItemMailbox *mailbox = currentMailbox();
+    if (!mailbox)
+        return 0;
+    Q_ASSERT(!mailbox->m_children.isEmpty());
+    return dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+}
+
+void OfflineSyncer::slotNetworkPolicyChanged()
+{
+    if (m_state == STATE_IDLE)
+        return;
+
+    if (!m_model->isNetworkAvailable()) {
+        pause();
+    } else if (m_state == STATE_PAUSED) {
+        // The connection might have been lost in the meanwhile, so we have to wait for the mailbox to get synced again.
+        // Whatever has been downloaded so far is already accounted for in the saved progress.
+        log(QLatin1String("Network is back, resuming"));
+        openMailbox();
+    }
+}
+
+void OfflineSyncer::slotSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state)
+{
+    if (state != STATE_DONE || m_mailboxIndex != mailbox)
+        return;
+
+    if (m_state == STATE_OPENING) {
+        beginMailbox();
+    } else if (m_state == STATE_DOWNLOADING) {
+        // The mailbox got re-synced, perhaps after a reconnect. Pending requests might have been lost.
+        m_checkTimer->start();
+    }
+}
+
+void OfflineSyncer::slotMailboxSyncFailed(const QString &mailbox, const QString &message)
+{
+    if ((m_state != STATE_OPENING && m_state != STATE_DOWNLOADING) || mailbox != m_mailboxes[m_currentMailbox])
+        return;
+    finishMailbox(message);
+}
+
+void OfflineSyncer::slotDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    Q_UNUSED(topLeft);
+    Q_UNUSED(bottomRight);
+    if (m_state == STATE_DOWNLOADING)
+        m_checkTimer->start();
+}
+
+void OfflineSyncer::slotStalled()
+{
+    if (m_state != STATE_OPENING && m_state != STATE_DOWNLOADING)
+        return;
+    finishMailbox(tr("The synchronization has stalled"));
+}
+
+void OfflineSyncer::slotMailboxFound(const QString &mailbox, const QModelIndex &index)
+{
+    Q_UNUSED(index);
+    if (m_state == STATE_OPENING && !m_mailboxIndex.isValid() && mailbox == m_mailboxes[m_currentMailbox])
+        openMailbox();
+}
+
+void OfflineSyncer::slotRowsRemoved(const QModelIndex &parent, int start, int end)
+{
+    Q_UNUSED(parent);
+    Q_UNUSED(start);
+    Q_UNUSED(end);
+    if (m_mailboxIndex.isValid())
+        return;
+    if (m_state != STATE_OPENING && m_state != STATE_DOWNLOADING && m_state != STATE_THROTTLED)
+        return;
+
+    // The list of mailboxes gets reloaded after a reconnect, so we have to look for the new instance of our mailbox
+    m_checkTimer->stop();
+    m_throttleTimer->stop();
+    abandonDownload();
+    m_batch.clear();
+    m_retried.clear();
+    openMailbox();
+}
+
+void OfflineSyncer::slotDownloadFinished()
+{
+    m_job = 0;
+    m_checkTimer->start();
+}
+
+void OfflineSyncer::slotDownloadFailed(const QString &message)
+{
+    m_job = 0;
+    log(QString::fromUtf8("Download of message parts failed: %1").arg(message));
+    if (++m_failedDownloads >= maxFailedDownloads) {
+        finishMailbox(message);
+        return;
+    }
+    // The parts which have not arrived get one more chance
+    m_checkTimer->start();
+}
+
+void OfflineSyncer::log(const QString &message)
+{
+    m_model->logTrace(0, Common::LOG_OTHER, QLatin1String("OfflineSyncer"), message);
+}
+
+}
+}
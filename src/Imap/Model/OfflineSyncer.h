@@ -0,0 +1,181 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_OFFLINESYNCER_H
+#define IMAP_MODEL_OFFLINESYNCER_H
+
+#include <QPersistentModelIndex>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include "Imap/Model/MailboxMetadata.h"
+#include "Imap/Model/Model.h"
+
+class QTimer;
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class KeepMailboxOpenTask;
+class MailboxFinder;
+class ParallelFetchJob;
+class TreeItem;
+class TreeItemMailbox;
+class TreeItemMessage;
+class TreeItemMsgList;
+class TreeItemPart;
+
+/** @short Download whole mailboxes into the cache for later offline use
+
+The OfflineSyncer walks through a list of mailboxes, one after another, and makes sure that the envelope, BODYSTRUCTURE
+and the body parts of each message end up in the model's cache. Parts which are bigger than the configured limit are
+skipped. The metadata are requested through the mailbox's KeepMailboxOpenTask, while the body parts of each batch are
+downloaded over a few extra connections via Model::fetchInParallel(). When there's no room for more connections, they are
+requested through the KeepMailboxOpenTask as well. Either way, the data end up in the same tree, so they are shared with
+the GUI.
+
+Unless the mailbox is open already, it is synchronized over a connection of the OfflineSyncer's own, so that the mailbox
+which the user works with is not switched away. That connection is reused for the subsequent mailboxes and handed back to
+the Model once the synchronization finishes or gets stopped. It counts against the Model's connection limit like any other;
+when there's no room for it, the mailbox is opened over one of the regular connections instead.
+
+Messages are processed in batches in an ascending order of their UIDs. After each batch, the highest UID below which all
+messages are fully downloaded is saved via AbstractCache::setOfflineSyncProgress() along with the mailbox' UIDVALIDITY.
+A subsequent start(), be it after a reconnect or after an application restart, continues from that point.
+
+The network policy is respected; the synchronization pauses while the model is offline and resumes automatically once
+the network gets back. Under the expensive policy, the batches are made smaller and spaced out in time.
+*/
+class OfflineSyncer : public QObject
+{
+    Q_OBJECT
+public:
+    OfflineSyncer(Model *model, QObject *parent);
+
+    /** @short Specify which mailboxes to synchronize; takes effect on the next start() */
+    void setMailboxes(const QStringList &mailboxes);
+    /** @short Do not download body parts larger than @arg bytes; zero means no limit */
+    void setPartSizeLimit(const uint bytes);
+
+    bool isRunning() const { return m_state != STATE_IDLE; }
+
+public slots:
+    /** @short Start walking the mailboxes, resuming from the saved progress */
+    void start();
+    /** @short Stop the synchronization; the progress made so far is kept */
+    void stop();
+
+signals:
+    /** @short The @arg done messages out of @arg total in a mailbox have been fully downloaded */
+    void progress(const QString &mailbox, int done, int total);
+    /** @short Synchronization of a mailbox was not completed; it will be retried on the next start() */
+    void mailboxFailed(const QString &mailbox, const QString &message);
+    /** @short All mailboxes were processed */
+    void finished();
+
+private slots:
+    void slotNetworkPolicyChanged();
+    void slotSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state);
+    void slotMailboxSyncFailed(const QString &mailbox, const QString &message);
+    void slotDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void slotStalled();
+    void slotMailboxFound(const QString &mailbox, const QModelIndex &index);
+    void slotRowsRemoved(const QModelIndex &parent, int start, int end);
+    void slotDownloadFinished();
+    void slotDownloadFailed(const QString &message);
+    void checkBatch();
+    void queueNextBatch();
+
+private:
+    typedef enum {
+        /** @short Not doing anything */
+        STATE_IDLE,
+        /** @short Waiting for the current mailbox to get synchronized */
+        STATE_OPENING,
+        /** @short Waiting for a batch of messages to get downloaded */
+        STATE_DOWNLOADING,
+        /** @short Waiting before the next batch is started */
+        STATE_THROTTLED,
+        /** @short The network is not available */
+        STATE_PAUSED
+    } State;
+
+    /** @short Outcome of a check whether an item is available */
+    typedef enum {
+        ITEM_DONE,
+        ITEM_PENDING,
+        ITEM_FAILED
+    } ItemState;
+
+    void openMailbox();
+    KeepMailboxOpenTask *keepMailboxOpen(TreeItemMailbox *mailbox);
+    void releaseConnection();
+    void beginMailbox();
+    void finishMailbox(const QString &errorMessage);
+    void pause();
+    void abandonDownload();
+    void saveProgress();
+    int batchSize() const;
+
+    TreeItemMailbox *currentMailbox() const;
+    TreeItemMsgList *currentList() const;
+    ItemState checkMessage(TreeItemMessage *message, QMap<uint, QList<QByteArray> > &download,
+                           QList<TreeItemPart *> &downloadParts);
+    ItemState checkParts(TreeItem *item, const uint uid, QList<QByteArray> &download, QList<TreeItemPart *> &downloadParts);
+    bool shouldRetry(const uint uid, const QByteArray &partId);
+
+    void log(const QString &message);
+
+    Model *m_model;
+    MailboxFinder *m_finder;
+    /** @short The connection which was opened for the synchronization */
+    QPointer<Parser> m_parser;
+    QStringList m_mailboxes;
+    int m_currentMailbox;
+    QPersistentModelIndex m_mailboxIndex;
+    State m_state;
+    uint m_partSizeLimit;
+    OfflineSyncProgress m_progress;
+    /** @short UIDs of messages in the batch which is currently being downloaded, sorted */
+    QList<uint> m_batch;
+    /** @short How many messages of the current batch were complete during the last check */
+    int m_batchDone;
+    /** @short Items of the current batch which were marked as unavailable and have been requested once again */
+    QSet<QPair<uint, QByteArray> > m_retried;
+    /** @short Download of the body parts of the current batch */
+    QPointer<ParallelFetchJob> m_job;
+    /** @short How many downloads have failed within the current batch */
+    int m_failedDownloads;
+    /** @short Coalesces the model's change notifications into a single check of the current batch */
+    QTimer *m_checkTimer;
+    /** @short Gives up on a batch which did not make any progress for too long */
+    QTimer *m_stallTimer;
+    /** @short Spaces out the batches when the network is expensive */
+    QTimer *m_throttleTimer;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_OFFLINESYNCER_H
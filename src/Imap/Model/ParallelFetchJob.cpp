@@ -0,0 +1,131 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ParallelFetchJob.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Tasks/ParallelFetchTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+ParallelFetchJob::ParallelFetchJob(Model *model, const QModelIndex &mailbox, const QMap<uint, QList<QByteArray> > &requests,
+                                   const int chunkSize):
+    QObject(model), m_model(model), m_mailbox(mailbox), m_connections(0), m_total(0), m_completed(0), m_failed(0),
+    m_done(false)
+{
+    Q_ASSERT(chunkSize > 0);
+    // There are usually just a few distinct combinations of the data items, so a linear lookup is good enough.
+    // The QMap is sorted, which means that the UIDs in each chunk are sorted as well.
+    QList<Chunk> groups;
+    for (QMap<uint, QList<QByteArray> >::const_iterator it = requests.constBegin(); it != requests.constEnd(); ++it) {
+        if (!it.key() || it->isEmpty())
+            continue;
+        ++m_total;
+        int i = 0;
+        while (i < groups.size() && groups[i].items != *it)
+            ++i;
+        if (i == groups.size()) {
+            Chunk chunk;
+            chunk.items = *it;
+            groups << chunk;
+        }
+        groups[i].uids << it.key();
+        if (groups[i].uids.size() == chunkSize) {
+            m_pendingChunks << groups.takeAt(i);
+        }
+    }
+    m_pendingChunks << groups;
+    m_timer.start();
+}
+
+void ParallelFetchJob::addWorker(ParallelFetchTask *task)
+{
+    m_workers << task;
+    ++m_connections;
+    connect(task, SIGNAL(destroyed(QObject*)), this, SLOT(slotWorkerGone(QObject*)));
+}
+
+ParallelFetchJob::Chunk ParallelFetchJob::takeChunk()
+{
+    if (m_done || m_pendingChunks.isEmpty())
+        return Chunk();
+    return m_pendingChunks.takeFirst();
+}
+
+void ParallelFetchJob::chunkCompleted(const Chunk &chunk)
+{
+    m_completed += chunk.uids.size();
+    emit progress(m_completed, m_total);
+    checkFinished();
+}
+
+void ParallelFetchJob::chunkFailed(const Chunk &chunk, const QString &message)
+{
+    m_failed += chunk.uids.size();
+    if (!m_errors.contains(message))
+        m_errors << message;
+    checkFinished();
+}
+
+void ParallelFetchJob::returnChunk(const Chunk &chunk)
+{
+    if (!chunk.uids.isEmpty())
+        m_pendingChunks.prepend(chunk);
+}
+
+void ParallelFetchJob::slotWorkerGone(QObject *task)
+{
+    m_workers.removeOne(task);
+    checkFinished();
+}
+
+void ParallelFetchJob::checkFinished()
+{
+    if (m_done)
+        return;
+
+    if (m_completed + m_failed == m_total) {
+        m_done = true;
+        const qint64 elapsed = qMax<qint64>(m_timer.elapsed(), 1);
+        m_model->logTrace(m_mailbox, Common::LOG_TASKS, QLatin1String("ParallelFetchJob"),
+                          QString::fromUtf8("Fetched %1 messages over %2 connections in %3 ms (%4 messages/s)")
+                          .arg(QString::number(m_completed), QString::number(m_connections), QString::number(elapsed),
+                               QString::number(m_completed * 1000 / elapsed)));
+        if (m_failed) {
+            emit failed(m_errors.join(QLatin1String("\n")));
+        } else {
+            emit finished();
+        }
+        deleteLater();
+    } else if (m_workers.isEmpty()) {
+        // All connections are gone, yet some chunks haven't been processed
+        m_done = true;
+        m_errors << tr("All connections used for the download have been closed");
+        emit failed(m_errors.join(QLatin1String("\n")));
+        deleteLater();
+    }
+}
+
+}
+}
@@ -0,0 +1,109 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_PARALLELFETCHJOB_H
+#define IMAP_MODEL_PARALLELFETCHJOB_H
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QPersistentModelIndex>
+#include <QStringList>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class Model;
+class ParallelFetchTask;
+
+/** @short Download data for many messages of a single mailbox over several connections at once
+
+The regular way of fetching message data funnels everything through the connection which is maintained by the mailbox's
+KeepMailboxOpenTask. That is fine for the interactive use, but when a whole mailbox shall be downloaded (saving a folder,
+offline prefetch, archiving), a single connection is limited by the RTT and by the server's per-connection throughput.
+
+A ParallelFetchJob splits the requested UIDs into disjoint chunks. The messages which shall be asked for the same data
+items are grouped together, so that each chunk translates into a single UID FETCH. A couple of ParallelFetchTask instances, each of them
+having its own connection to the IMAP server with the mailbox EXAMINEd, keep taking chunks from the job until there is
+nothing left. The data is merged into the same tree and cache as if it came through the usual means.
+
+Use Model::fetchInParallel() to create a job. It deletes itself after emitting finished() or failed().
+*/
+class ParallelFetchJob : public QObject
+{
+    Q_OBJECT
+public:
+    /** @short A piece of work for a single UID FETCH */
+    struct Chunk {
+        QList<uint> uids;
+        QList<QByteArray> items;
+    };
+
+    /** @short Prepare the download of the data @arg items requested for each UID */
+    ParallelFetchJob(Model *model, const QModelIndex &mailbox, const QMap<uint, QList<QByteArray> > &requests,
+                     const int chunkSize);
+
+    /** @short Register a task which will be taking the chunks */
+    void addWorker(ParallelFetchTask *task);
+
+    /** @short Hand over the next chunk to process, or a chunk without any UIDs if there's nothing left */
+    Chunk takeChunk();
+    /** @short The chunk has been processed */
+    void chunkCompleted(const Chunk &chunk);
+    /** @short The chunk could not be processed; it will not be retried */
+    void chunkFailed(const Chunk &chunk, const QString &message);
+    /** @short Give back a chunk which has not been processed, so that another connection can pick it up */
+    void returnChunk(const Chunk &chunk);
+
+    int totalMessages() const { return m_total; }
+    int completedMessages() const { return m_completed; }
+
+signals:
+    /** @short Reports the number of messages whose data have been fetched so far */
+    void progress(int completed, int total);
+    void finished();
+    void failed(const QString &message);
+
+private slots:
+    void slotWorkerGone(QObject *task);
+
+private:
+    void checkFinished();
+
+    Model *m_model;
+    QPersistentModelIndex m_mailbox;
+    QList<Chunk> m_pendingChunks;
+    QList<QObject *> m_workers;
+    int m_connections;
+    int m_total;
+    int m_completed;
+    int m_failed;
+    QStringList m_errors;
+    QElapsedTimer m_timer;
+    bool m_done;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_PARALLELFETCHJOB_H
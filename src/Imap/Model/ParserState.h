@@ -55,6 +55,12 @@ struct ParserState {
     /** @short Is the connection currently being processed? */
     int processingDepth;
 
+    /** @short Does this connection belong to a ParallelFetchJob, the MailboxPrewarmer, the MailboxWatcher or the OfflineSyncer and therefore cannot be used for anything else? */
+    bool isDedicated;
+
+    /** @short Has the server accepted our NOTIFY, i.e. are the changes in other mailboxes being pushed to us? */
+    bool notifyActive;
+
     ParserState(Parser *parser);
     ParserState();
 };
@@ -0,0 +1,126 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PartCompression.h"
+
+namespace
+{
+
+/** @short Parts smaller than this are not worth compressing at all */
+const int minCompressedSize = 128;
+
+/** @short How much of a big part to compress in order to estimate whether compressing the whole part is worthwhile */
+const int sampleSize = 64 * 1024;
+
+/** @short Parts bigger than this are compressed with the fastCompressionLevel */
+const int fastCompressionThreshold = 256 * 1024;
+
+/** @short Level of zlib which is several times faster than the default one, and not much worse on the usual text */
+const int fastCompressionLevel = 1;
+
+/** @short The compressed data have to be at most this fraction of the original size, otherwise the raw data are kept */
+const double maxCompressionRatio = 0.9;
+
+/** @short Signatures of the formats which contain compressed data */
+struct Signature {
+    int offset;
+    const char *magic;
+    int length;
+};
+
+const Signature compressedSignatures[] = {
+    {0, "\xff\xd8\xff", 3}, // JPEG
+    {0, "\x89PNG", 4},
+    {0, "GIF8", 4},
+    {0, "PK\x03\x04", 4}, // ZIP, and therefore also the OOXML and ODF documents, JARs, EPUBs,...
+    {0, "\x1f\x8b", 2}, // gzip
+    {0, "BZh", 3},
+    {0, "\xfd" "7zXZ", 5},
+    {0, "7z\xbc\xaf\x27\x1c", 6},
+    {0, "Rar!", 4},
+    {0, "\x28\xb5\x2f\xfd", 4}, // zstd
+    {0, "ID3", 3}, // MP3
+    {0, "OggS", 4},
+    {0, "fLaC", 4},
+    {4, "ftyp", 4}, // MP4, QuickTime, HEIF
+    {8, "WEBP", 4},
+    {0, "\x1a\x45\xdf\xa3", 4} // Matroska, WebM
+};
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+namespace PartCompression
+{
+
+bool looksCompressed(const QByteArray &data)
+{
+    for (size_t i = 0; i < sizeof(compressedSignatures) / sizeof(compressedSignatures[0]); ++i) {
+        const Signature &sig = compressedSignatures[i];
+        if (data.size() >= sig.offset + sig.length &&
+                qstrncmp(data.constData() + sig.offset, sig.magic, static_cast<uint>(sig.length)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QByteArray encode(const QByteArray &data, Format &format)
+{
+    format = FORMAT_RAW;
+    if (data.size() < minCompressedSize || looksCompressed(data))
+        return data;
+
+    if (data.size() > sampleSize) {
+        // Compressing a sample is cheap compared to compressing all of the data in vain
+        QByteArray sample = qCompress(data.left(sampleSize), fastCompressionLevel);
+        if (sample.size() > sampleSize * maxCompressionRatio)
+            return data;
+    }
+
+    QByteArray compressed = qCompress(data, data.size() > fastCompressionThreshold ? fastCompressionLevel : -1);
+    if (compressed.size() > data.size() * maxCompressionRatio) {
+        // Not worth the decompression each time the part is read
+        return data;
+    }
+    format = FORMAT_ZLIB;
+    return compressed;
+}
+
+QByteArray decode(const QByteArray &stored, const Format format)
+{
+    switch (format) {
+    case FORMAT_RAW:
+        return stored;
+    case FORMAT_ZLIB:
+        return qUncompress(stored);
+    }
+    return QByteArray();
+}
+
+}
+}
+}
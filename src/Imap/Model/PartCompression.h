@@ -0,0 +1,66 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_PARTCOMPRESSION_H
+#define IMAP_MODEL_PARTCOMPRESSION_H
+
+#include <QByteArray>
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Choosing how the data of message parts are stored in the caches
+
+Lots of the message parts are already compressed -- pictures, archives, office documents -- and running them through zlib
+once again only burns CPU time, both when storing and when reading them. The format is therefore chosen for each part
+separately from its content: the well-known compressed formats are recognized by their magic numbers, and the bigger
+parts are probed by compressing a sample of them first. The text which is worth compressing uses a faster compression
+level when there's a lot of it.
+*/
+namespace PartCompression
+{
+
+/** @short The storage format of the data; the values are persisted in the caches, so they must never change */
+enum Format {
+    /** @short The data are stored as they are */
+    FORMAT_RAW = 0,
+    /** @short The data are compressed by qCompress() */
+    FORMAT_ZLIB = 1
+};
+
+/** @short Convert the @arg data into a form suitable for storing and report which @arg format got used */
+QByteArray encode(const QByteArray &data, Format &format);
+/** @short Return the original data from the @arg stored ones */
+QByteArray decode(const QByteArray &stored, const Format format);
+/** @short Do the @arg data start with a signature of a format which is compressed already? */
+bool looksCompressed(const QByteArray &data);
+
+}
+
+}
+
+}
+
+#endif /* IMAP_MODEL_PARTCOMPRESSION_H */
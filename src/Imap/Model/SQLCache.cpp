@@ -21,16 +21,204 @@
 */
 
 #include "SQLCache.h"
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSet>
 #include <QSqlError>
 #include <QSqlRecord>
 #include <QTimer>
 #include "Common/SqlTransactionAutoAborter.h"
+#include "PartCompression.h"
 
 //#define CACHE_DEBUG
 
 namespace
 {
 static int streamVersion = QDataStream::Qt_4_6;
+
+/** @short Unpack the compressed blob with message metadata as stored in the messages table */
+void unserializeMessageMetadata(const QByteArray &blob, Imap::Mailbox::AbstractCache::MessageDataBundle &res)
+{
+    QDataStream stream(qUncompress(blob));
+    stream.setVersion(streamVersion);
+    stream >> res.envelope >> res.internalDate >> res.size >> res.serializedBodyStructure >> res.hdrReferences
+              >> res.hdrListPost >> res.hdrListPostNo;
+}
+
+/** @short The UID mapping is stored in buckets of UIDs which share everything but these lowest bits */
+const int uidBucketBits = 12;
+
+void appendVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+/** @short Split the sorted @arg uids into buckets and encode each of them as a sequence of varint-encoded deltas
+
+The first delta in each bucket is relative to the lowest UID which could possibly be stored in that bucket. Because the
+buckets are keyed by the UID, rather than by the sequence number, an arrival of a new message touches just the last bucket,
+and an expunge only changes the bucket which held the expunged message. Returns false if the UIDs are not strictly
+increasing.
+*/
+bool encodeUidBuckets(const QList<uint> &uids, QMap<uint, QByteArray> &buckets)
+{
+    QByteArray current;
+    uint currentBucket = 0;
+    uint previous = 0;
+    bool isFirst = true;
+    Q_FOREACH(const uint uid, uids) {
+        if (!isFirst && uid <= previous)
+            return false;
+        uint bucket = uid >> uidBucketBits;
+        if (isFirst || bucket != currentBucket) {
+            if (!isFirst)
+                buckets[currentBucket] = current;
+            current.clear();
+            currentBucket = bucket;
+            previous = bucket << uidBucketBits;
+        }
+        appendVarint(current, uid - previous);
+        previous = uid;
+        isFirst = false;
+    }
+    if (!isFirst)
+        buckets[currentBucket] = current;
+    return true;
+}
+
+/** @short Decode a single bucket as produced by encodeUidBuckets() and append the UIDs to @arg out */
+bool decodeUidBucket(const uint bucket, const QByteArray &data, QList<uint> &out)
+{
+    uint value = bucket << uidBucketBits;
+    quint32 delta = 0;
+    int shift = 0;
+    for (int i = 0; i < data.size(); ++i) {
+        quint8 byte = static_cast<quint8>(data[i]);
+        delta |= static_cast<quint32>(byte & 0x7f) << shift;
+        if (byte & 0x80) {
+            shift += 7;
+            if (shift > 28)
+                return false;
+        } else {
+            value += delta;
+            out << value;
+            delta = 0;
+            shift = 0;
+        }
+    }
+    return shift == 0;
+}
+
+/** @short Flush the buffered flag updates once there are this many of them */
+const int maxPendingFlags = 10000;
+
+/** @short When the requested UIDs are this sparse, a single range query would read too many rows which nobody wants */
+const uint maxRangeOverhead = 4;
+
+/** @short The last access to a part is only recorded when the stored one is older than this many seconds
+
+The exact order of the accesses within this window does not matter for the LRU eviction, and this saves a write on each read.
+*/
+const uint partAccessGranularity = 3600;
+
+/** @short How the threading snapshot in the msg_threading table is serialized */
+enum ThreadingFormat {
+    /** @short A QDataStream of the whole tree, as written by the older versions */
+    THREADING_DATASTREAM = 0,
+    /** @short A pre-order walk through the tree with varint-encoded numbers, see encodeThreading() */
+    THREADING_VARINT = 1
+};
+
+/** @short Rewrite the threading snapshot once the log of changes contains this many entries */
+const int maxThreadingLogEntries = 64;
+
+/** @short Rewrite the threading snapshot once the log of changes is bigger than this fraction of it */
+const int threadingLogSizeDivisor = 2;
+
+bool readVarint(const QByteArray &data, int &pos, quint32 &value)
+{
+    value = 0;
+    for (int shift = 0; shift <= 28 && pos < data.size(); shift += 7) {
+        quint8 byte = static_cast<quint8>(data[pos++]);
+        value |= static_cast<quint32>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/** @short Append the number of @arg nodes and then each node's number followed by its own children */
+void encodeThreading(QByteArray &out, const QVector<Imap::Responses::ThreadingNode> &nodes)
+{
+    appendVarint(out, nodes.size());
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, nodes) {
+        appendVarint(out, node.num);
+        encodeThreading(out, node.children);
+    }
+}
+
+/** @short Read the nodes which were written by encodeThreading() */
+bool decodeThreading(const QByteArray &data, int &pos, QVector<Imap::Responses::ThreadingNode> &nodes)
+{
+    quint32 count;
+    if (!readVarint(data, pos, count))
+        return false;
+    // Each node takes at least two bytes, do not let a corrupted count allocate the whole memory
+    if (count > static_cast<quint32>(data.size() - pos) / 2)
+        return false;
+    nodes.resize(count);
+    for (quint32 i = 0; i < count; ++i) {
+        if (!readVarint(data, pos, nodes[i].num) || !decodeThreading(data, pos, nodes[i].children))
+            return false;
+    }
+    return true;
+}
+
+/** @short Describe how to get from the @arg previous threading to the @arg current one
+
+Only the top-level threads are compared. A change is a number of threads to keep at the beginning, a number of threads to keep
+at the end, and the new threads to put in between; that is enough for a new message which starts or joins a single thread.
+Returns an empty array if there is no change at all.
+*/
+QByteArray threadingDelta(const QVector<Imap::Responses::ThreadingNode> &previous,
+                          const QVector<Imap::Responses::ThreadingNode> &current)
+{
+    int common = qMin(previous.size(), current.size());
+    int prefix = 0;
+    while (prefix < common && previous[prefix] == current[prefix])
+        ++prefix;
+    if (prefix == previous.size() && prefix == current.size())
+        return QByteArray();
+    int suffix = 0;
+    while (suffix < common - prefix && previous[previous.size() - 1 - suffix] == current[current.size() - 1 - suffix])
+        ++suffix;
+
+    QByteArray res;
+    appendVarint(res, prefix);
+    appendVarint(res, suffix);
+    encodeThreading(res, current.mid(prefix, current.size() - prefix - suffix));
+    return res;
+}
+
+/** @short Apply a change produced by threadingDelta() to the @arg threading */
+bool applyThreadingDelta(QVector<Imap::Responses::ThreadingNode> &threading, const QByteArray &delta)
+{
+    int pos = 0;
+    quint32 prefix, suffix;
+    QVector<Imap::Responses::ThreadingNode> middle;
+    if (!readVarint(delta, pos, prefix) || !readVarint(delta, pos, suffix) || !decodeThreading(delta, pos, middle) ||
+            pos != delta.size() || prefix + suffix > static_cast<quint32>(threading.size()))
+        return false;
+    QVector<Imap::Responses::ThreadingNode> res;
+    res.reserve(prefix + middle.size() + suffix);
+    res << threading.mid(0, prefix) << middle << threading.mid(threading.size() - suffix);
+    threading = res;
+    return true;
+}
 }
 
 namespace Imap
@@ -60,7 +248,9 @@ namespace Mailbox
 QDate SQLCache::accessingThresholdDate = QDate(2012, 11, 1);
 
 SQLCache::SQLCache(QObject *parent):
-    AbstractCache(parent), delayedCommit(0), tooMuchTimeWithoutCommit(0), inTransaction(false), m_updateAccessIfOlder(0)
+    AbstractCache(parent), delayedCommit(0), tooMuchTimeWithoutCommit(0), m_flushFlags(0), inTransaction(false),
+    m_updateAccessIfOlder(0), m_pendingFlagsCount(0), m_threadingLogEntries(0), m_threadingLogBytes(0),
+    m_threadingSnapshotBytes(0)
 {
 }
 
@@ -90,6 +280,16 @@ void SQLCache::init()
     tooMuchTimeWithoutCommit->setInterval(num);
     tooMuchTimeWithoutCommit->setObjectName(QString::fromUtf8("tooMuchTimeWithoutCommit-%1").arg(objectName()));
     connect(tooMuchTimeWithoutCommit, SIGNAL(timeout()), this, SLOT(timeToCommit()));
+    if (m_flushFlags)
+        m_flushFlags->deleteLater();
+    m_flushFlags = new QTimer(this);
+    num = parent()->property("trojita-sqlcache-flags-delay").toInt(&ok);
+    if (! ok)
+        num = 1000;
+    m_flushFlags->setInterval(num);
+    m_flushFlags->setSingleShot(true);
+    m_flushFlags->setObjectName(QString::fromUtf8("flushFlags-%1").arg(objectName()));
+    connect(m_flushFlags, SIGNAL(timeout()), this, SLOT(flushPendingFlags()));
 }
 
 SQLCache::~SQLCache()
@@ -129,6 +329,22 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
         return false; \
     }
 
+#define TROJITA_SQL_CACHE_CREATE_OFFLINE_SYNC \
+    if (! q.exec(QLatin1String("CREATE TABLE offline_sync (" \
+                               "mailbox STRING NOT NULL PRIMARY KEY, " \
+                               "uidvalidity INT NOT NULL, " \
+                               "highest_uid INT NOT NULL" \
+                               ")"))) { \
+        emitError(SQLCache::tr("Can't create table offline_sync"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_EXEC(QUERY, ERROR) \
+    if (!q.exec(QLatin1String(QUERY))) { \
+        emitError(ERROR, q); \
+        return false; \
+    }
+
 bool SQLCache::open(const QString &name, const QString &fileName)
 {
 #ifdef CACHE_DEBUG
@@ -143,6 +359,8 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         return false;
     }
 
+    tuneDatabase();
+
     Common::SqlTransactionAutoAborter txn(&db);
 
     QSqlRecord trojitaNames = db.record(QLatin1String("trojita"));
@@ -207,7 +425,72 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         }
     }
 
-    if (version != 6) {
+    if (version == 6) {
+        // V7 remembers how far the offline synchronization of each mailbox has progressed
+        TROJITA_SQL_CACHE_CREATE_OFFLINE_SYNC;
+        version = 7;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 7;"))) {
+            emitError(tr("Failed to update cache DB scheme from v6 to v7"), q);
+            return false;
+        }
+    }
+
+    if (version == 7) {
+        // V8 refers to mailboxes through integer IDs and merges the tables which are always accessed together
+        if (!migrateToV8())
+            return false;
+        version = 8;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 8;"))) {
+            emitError(tr("Failed to update cache DB scheme from v7 to v8"), q);
+            return false;
+        }
+    }
+
+    if (version == 8) {
+        // V9 stores the UID mapping in delta-encoded buckets which can be updated individually
+        if (!migrateToV9())
+            return false;
+        version = 9;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 9;"))) {
+            emitError(tr("Failed to update cache DB scheme from v8 to v9"), q);
+            return false;
+        }
+    }
+
+    if (version == 9) {
+        // V10 tracks the size and the last access of each part so that the least recently used ones can be evicted
+        if (!addPartAccessTracking())
+            return false;
+        version = 10;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 10;"))) {
+            emitError(tr("Failed to update cache DB scheme from v9 to v10"), q);
+            return false;
+        }
+    }
+
+    if (version == 10) {
+        // V11 does not compress the parts which wouldn't get any smaller
+        if (!addPartFormat())
+            return false;
+        version = 11;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 11;"))) {
+            emitError(tr("Failed to update cache DB scheme from v10 to v11"), q);
+            return false;
+        }
+    }
+
+    if (version == 11) {
+        // V12 stores the changes to threading as a log of deltas against a snapshot in a more compact format
+        if (!addThreadingLog())
+            return false;
+        version = 12;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 12;"))) {
+            emitError(tr("Failed to update cache DB scheme from v11 to v12"), q);
+            return false;
+        }
+    }
+
+    if (version != 12) {
         emitError(tr("Unknown version"));
         return false;
     }
@@ -217,6 +500,9 @@ bool SQLCache::open(const QString &name, const QString &fileName)
     if (! prepareQueries()) {
         return false;
     }
+    if (!loadMailboxIds()) {
+        return false;
+    }
     init();
 #ifdef CACHE_DEBUG
     qDebug() << "SQLCache::open() succeeded";
@@ -224,6 +510,30 @@ bool SQLCache::open(const QString &name, const QString &fileName)
     return true;
 }
 
+/** @short Set up the journaling and the in-memory caching of the DB
+
+None of these settings is essential, so the failures are silently ignored. The page size only has effect when the DB is
+being created, and the mmap_size is simply not recognized by older versions of SQLite. The write-ahead log lets the
+readers proceed while a transaction is open and turns each commit into a sequential append, which is exactly what the
+delayed commits of this class need. Finally, as this is only a cache, losing the last transaction after a power failure is
+acceptable, which is why the synchronous writes are relaxed.
+*/
+void SQLCache::tuneDatabase()
+{
+    QSqlQuery q(QString(), db);
+    q.exec(QLatin1String("PRAGMA page_size = 4096"));
+    q.exec(QLatin1String("PRAGMA journal_mode = WAL"));
+#ifdef CACHE_DEBUG
+    if (q.first())
+        qDebug() << "SQLCache: journal mode" << q.value(0).toString();
+#endif
+    q.exec(QLatin1String("PRAGMA synchronous = NORMAL"));
+    // A negative number is the size in kB
+    q.exec(QLatin1String("PRAGMA cache_size = -8192"));
+    q.exec(QLatin1String("PRAGMA mmap_size = 67108864"));
+    q.exec(QLatin1String("PRAGMA temp_store = MEMORY"));
+}
+
 bool SQLCache::createTables()
 {
     QSqlQuery q(QString(), db);
@@ -232,216 +542,393 @@ bool SQLCache::createTables()
         emitError(tr("Failed to prepare table structures"), q);
         return false;
     }
-    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 6 )"))) {
+    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 12 )"))) {
         emitError(tr("Can't store version info"), q);
         return false;
     }
-    if (! q.exec(QLatin1String(
-                     "CREATE TABLE child_mailboxes ( "
-                     "mailbox STRING NOT NULL PRIMARY KEY, "
-                     "parent STRING NOT NULL, "
-                     "separator STRING, "
-                     "flags BINARY"
-                     ")"
-                 ))) {
-        emitError(tr("Can't create table child_mailboxes"));
-        return false;
-    }
-
-    if (! q.exec(QLatin1String("CREATE TABLE uid_mapping ( "
-                               "mailbox STRING NOT NULL PRIMARY KEY, "
-                               "mapping BINARY"
-                               " )"))) {
-        emitError(tr("Can't create table uid_mapping"), q);
-        return false;
-    }
-
-    TROJITA_SQL_CACHE_CREATE_MSG_METADATA;
+    return createDataTables() && createUidMappingTable() && addPartAccessTracking() && addPartFormat() &&
+            addThreadingLog();
+}
 
-    if (! q.exec(QLatin1String("CREATE TABLE flags ("
-                               "mailbox STRING NOT NULL, "
-                               "uid INT NOT NULL, "
-                               "flags BINARY, "
-                               "PRIMARY KEY (mailbox, uid)"
-                               ")"))) {
-        emitError(tr("Can't create table flags"), q);
-    }
+/** @short Create the tables of the v8 layout except for the version information
 
-    if (! q.exec(QLatin1String("CREATE TABLE parts ("
-                               "mailbox STRING NOT NULL, "
-                               "uid INT NOT NULL, "
-                               "part_id BINARY, "
-                               "data BINARY, "
-                               "PRIMARY KEY (mailbox, uid, part_id)"
-                               ")"))) {
-        emitError(tr("Can't create table parts"), q);
-    }
+The uid_mapping column of the mailbox_state is not used since v9; see createUidMappingTable().
+*/
+bool SQLCache::createDataTables()
+{
+    QSqlQuery q(QString(), db);
 
-    TROJITA_SQL_CACHE_CREATE_THREADING;
-    TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE mailboxes ( "
+                           "id INTEGER PRIMARY KEY, "
+                           "name STRING NOT NULL UNIQUE"
+                           ")",
+                           tr("Can't create table mailboxes"));
+
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE child_mailboxes ( "
+                           "parent_id INT NOT NULL, "
+                           "mailbox STRING NOT NULL, "
+                           "separator STRING, "
+                           "flags BINARY, "
+                           "PRIMARY KEY (parent_id, mailbox)"
+                           ")",
+                           tr("Can't create table child_mailboxes"));
+
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE mailbox_state ( "
+                           "mailbox_id INTEGER PRIMARY KEY, "
+                           "sync_state BINARY, "
+                           "uid_mapping BINARY"
+                           ")",
+                           tr("Can't create table mailbox_state"));
+
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE messages ( "
+                           "mailbox_id INT NOT NULL, "
+                           "uid INT NOT NULL, "
+                           "data BINARY, "
+                           "flags BINARY, "
+                           "lastAccessDate INT, "
+                           "PRIMARY KEY (mailbox_id, uid)"
+                           ")",
+                           tr("Can't create table messages"));
+
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE parts ( "
+                           "mailbox_id INT NOT NULL, "
+                           "uid INT NOT NULL, "
+                           "part_id BINARY, "
+                           "data BINARY, "
+                           "PRIMARY KEY (mailbox_id, uid, part_id)"
+                           ")",
+                           tr("Can't create table parts"));
+
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE msg_threading ( "
+                           "mailbox_id INTEGER PRIMARY KEY, "
+                           "threading BINARY"
+                           ")",
+                           tr("Can't create table msg_threading"));
+
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE offline_sync ( "
+                           "mailbox_id INTEGER PRIMARY KEY, "
+                           "uidvalidity INT NOT NULL, "
+                           "highest_uid INT NOT NULL"
+                           ")",
+                           tr("Can't create table offline_sync"));
 
     return true;
 }
 
-bool SQLCache::prepareQueries()
-{
-    queryChildMailboxes = QSqlQuery(db);
-    if (! queryChildMailboxes.prepare(QLatin1String("SELECT mailbox, separator, flags FROM child_mailboxes WHERE parent = ?"))) {
-        emitError(tr("Failed to prepare queryChildMailboxes"), queryChildMailboxes);
-        return false;
-    }
+/** @short Convert the v7 tables which are keyed by the mailbox names to the v8 layout
 
-    queryChildMailboxesFresh = QSqlQuery(db);
-    if (! queryChildMailboxesFresh.prepare(QLatin1String("SELECT mailbox FROM child_mailboxes WHERE parent = ? LIMIT 1"))) {
-        emitError(tr("Failed to prepare queryChildMailboxesFresh"), queryChildMailboxesFresh);
-        return false;
-    }
-
-    queryRemoveChildMailboxes = QSqlQuery(db);
-    if (!queryRemoveChildMailboxes.prepare(QLatin1String("DELETE FROM child_mailboxes WHERE parent = ?"))) {
-        emitError(tr("Failed to prepare queryRemoveChildMailboxes"), queryRemoveChildMailboxes);
-        return false;
-    }
+All mailbox names which appear anywhere are assigned an ID first. The tables whose names are reused are renamed out of the
+way, the new tables are created and populated through a join with the mailbox names, and the old tables are dropped.
+*/
+bool SQLCache::migrateToV8()
+{
+    QSqlQuery q(QString(), db);
 
-    querySetChildMailboxes = QSqlQuery(db);
-    if (! querySetChildMailboxes.prepare(QLatin1String("INSERT OR REPLACE INTO child_mailboxes ( mailbox, parent, separator, flags ) VALUES (?, ?, ?, ?)"))) {
-        emitError(tr("Failed to prepare querySetChildMailboxes"), querySetChildMailboxes);
-        return false;
-    }
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE child_mailboxes RENAME TO v7_child_mailboxes",
+                           tr("Failed to rename table child_mailboxes"));
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE parts RENAME TO v7_parts", tr("Failed to rename table parts"));
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE msg_threading RENAME TO v7_msg_threading",
+                           tr("Failed to rename table msg_threading"));
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE offline_sync RENAME TO v7_offline_sync",
+                           tr("Failed to rename table offline_sync"));
 
-    queryMailboxSyncState = QSqlQuery(db);
-    if (! queryMailboxSyncState.prepare(QLatin1String("SELECT sync_state FROM mailbox_sync_state WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryMailboxSyncState"), queryMailboxSyncState);
+    if (!createDataTables())
         return false;
-    }
 
-    querySetMailboxSyncState = QSqlQuery(db);
-    if (! querySetMailboxSyncState.prepare(QLatin1String("INSERT OR REPLACE INTO mailbox_sync_state "
-                                           "( mailbox, sync_state ) "
-                                           "VALUES ( ?, ? )"))) {
-        emitError(tr("Failed to prepare querySetMailboxSyncState"), querySetMailboxSyncState);
-        return false;
+    TROJITA_SQL_CACHE_EXEC("INSERT OR IGNORE INTO mailboxes (name) "
+                           "SELECT parent FROM v7_child_mailboxes "
+                           "UNION SELECT mailbox FROM mailbox_sync_state "
+                           "UNION SELECT mailbox FROM uid_mapping "
+                           "UNION SELECT mailbox FROM msg_metadata "
+                           "UNION SELECT mailbox FROM flags "
+                           "UNION SELECT mailbox FROM v7_parts "
+                           "UNION SELECT mailbox FROM v7_msg_threading "
+                           "UNION SELECT mailbox FROM v7_offline_sync",
+                           tr("Failed to assign mailbox IDs"));
+
+    TROJITA_SQL_CACHE_EXEC("INSERT INTO child_mailboxes (parent_id, mailbox, separator, flags) "
+                           "SELECT m.id, c.mailbox, c.separator, c.flags "
+                           "FROM v7_child_mailboxes c JOIN mailboxes m ON m.name = c.parent",
+                           tr("Failed to migrate table child_mailboxes"));
+
+    TROJITA_SQL_CACHE_EXEC("INSERT INTO mailbox_state (mailbox_id, sync_state, uid_mapping) "
+                           "SELECT m.id, s.sync_state, u.mapping FROM mailboxes m "
+                           "LEFT JOIN mailbox_sync_state s ON s.mailbox = m.name "
+                           "LEFT JOIN uid_mapping u ON u.mailbox = m.name "
+                           "WHERE s.mailbox IS NOT NULL OR u.mailbox IS NOT NULL",
+                           tr("Failed to migrate tables mailbox_sync_state and uid_mapping"));
+
+    TROJITA_SQL_CACHE_EXEC("INSERT INTO messages (mailbox_id, uid, data, flags, lastAccessDate) "
+                           "SELECT m.id, md.uid, md.data, f.flags, md.lastAccessDate "
+                           "FROM msg_metadata md JOIN mailboxes m ON m.name = md.mailbox "
+                           "LEFT JOIN flags f ON f.mailbox = md.mailbox AND f.uid = md.uid",
+                           tr("Failed to migrate table msg_metadata"));
+    // Flags of the messages whose metadata are not cached
+    TROJITA_SQL_CACHE_EXEC("INSERT OR IGNORE INTO messages (mailbox_id, uid, flags) "
+                           "SELECT m.id, f.uid, f.flags FROM flags f JOIN mailboxes m ON m.name = f.mailbox",
+                           tr("Failed to migrate table flags"));
+
+    TROJITA_SQL_CACHE_EXEC("INSERT INTO parts (mailbox_id, uid, part_id, data) "
+                           "SELECT m.id, p.uid, p.part_id, p.data FROM v7_parts p JOIN mailboxes m ON m.name = p.mailbox",
+                           tr("Failed to migrate table parts"));
+
+    TROJITA_SQL_CACHE_EXEC("INSERT INTO msg_threading (mailbox_id, threading) "
+                           "SELECT m.id, t.threading FROM v7_msg_threading t JOIN mailboxes m ON m.name = t.mailbox",
+                           tr("Failed to migrate table msg_threading"));
+
+    TROJITA_SQL_CACHE_EXEC("INSERT INTO offline_sync (mailbox_id, uidvalidity, highest_uid) "
+                           "SELECT m.id, o.uidvalidity, o.highest_uid FROM v7_offline_sync o JOIN mailboxes m ON m.name = o.mailbox",
+                           tr("Failed to migrate table offline_sync"));
+
+    const char *obsoleteTables[] = {"v7_child_mailboxes", "mailbox_sync_state", "uid_mapping", "msg_metadata", "flags",
+                                    "v7_parts", "v7_msg_threading", "v7_offline_sync"};
+    for (size_t i = 0; i < sizeof(obsoleteTables) / sizeof(obsoleteTables[0]); ++i) {
+        if (!q.exec(QString::fromUtf8("DROP TABLE %1").arg(QLatin1String(obsoleteTables[i])))) {
+            emitError(tr("Failed to drop old table %1").arg(QLatin1String(obsoleteTables[i])), q);
+            return false;
+        }
     }
+    return true;
+}
 
-    queryUidMapping = QSqlQuery(db);
-    if (! queryUidMapping.prepare(QLatin1String("SELECT mapping FROM uid_mapping WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryUidMapping"), queryUidMapping);
-        return false;
-    }
+bool SQLCache::createUidMappingTable()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE uid_mapping ( "
+                           "mailbox_id INT NOT NULL, "
+                           "bucket INT NOT NULL, "
+                           "uids BINARY, "
+                           "PRIMARY KEY (mailbox_id, bucket)"
+                           ")",
+                           tr("Can't create table uid_mapping"));
+    return true;
+}
 
-    querySetUidMapping = QSqlQuery(db);
-    if (! querySetUidMapping.prepare(QLatin1String("INSERT OR REPLACE INTO uid_mapping (mailbox, mapping) VALUES  ( ?, ? )"))) {
-        emitError(tr("Failed to prepare querySetUidMapping"), querySetUidMapping);
+/** @short Re-encode the UID mappings from the monolithic blobs in mailbox_state into the uid_mapping buckets */
+bool SQLCache::migrateToV9()
+{
+    if (!createUidMappingTable())
         return false;
-    }
 
-    queryClearUidMapping = QSqlQuery(db);
-    if (! queryClearUidMapping.prepare(QLatin1String("DELETE FROM uid_mapping WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryClearUidMapping"), queryClearUidMapping);
-        return false;
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_EXEC("SELECT mailbox_id, uid_mapping FROM mailbox_state WHERE uid_mapping IS NOT NULL",
+                           tr("Failed to read the old UID mappings"));
+    QVariantList ids, buckets, blobs;
+    while (q.next()) {
+        QList<uint> uids;
+        QDataStream stream(qUncompress(q.value(1).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> uids;
+        QMap<uint, QByteArray> encoded;
+        if (stream.status() != QDataStream::Ok || !encodeUidBuckets(uids, encoded)) {
+            // Not fatal, this mailbox will simply get fully resynced next time
+            continue;
+        }
+        for (QMap<uint, QByteArray>::const_iterator it = encoded.constBegin(); it != encoded.constEnd(); ++it) {
+            ids << q.value(0);
+            buckets << it.key();
+            blobs << *it;
+        }
     }
 
-    queryMessageMetadata = QSqlQuery(db);
-    if (! queryMessageMetadata.prepare(QLatin1String("SELECT data, lastAccessDate FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
-        emitError(tr("Failed to prepare queryMessageMetadata"), queryMessageMetadata);
-        return false;
+    if (!ids.isEmpty()) {
+        QSqlQuery insert(QString(), db);
+        if (!insert.prepare(QLatin1String("INSERT INTO uid_mapping (mailbox_id, bucket, uids) VALUES (?, ?, ?)"))) {
+            emitError(tr("Failed to prepare the UID mapping migration"), insert);
+            return false;
+        }
+        insert.bindValue(0, ids);
+        insert.bindValue(1, buckets);
+        insert.bindValue(2, blobs);
+        if (!insert.execBatch()) {
+            emitError(tr("Failed to migrate the UID mappings"), insert);
+            return false;
+        }
     }
 
-    queryAccessMessageMetadata = QSqlQuery(db);
-    if (!queryAccessMessageMetadata.prepare(QLatin1String("UPDATE msg_metadata SET lastAccessDate = ? WHERE mailbox = ? AND uid = ?"))) {
-        emitError(tr("Failed to prepare queryAccssMessageMetadata"), queryAccessMessageMetadata);
-        return false;
-    }
+    TROJITA_SQL_CACHE_EXEC("UPDATE mailbox_state SET uid_mapping = NULL", tr("Failed to drop the old UID mappings"));
+    return true;
+}
 
-    querySetMessageMetadata = QSqlQuery(db);
-    if (! querySetMessageMetadata.prepare(QLatin1String("INSERT OR REPLACE INTO msg_metadata ( mailbox, uid, data, lastAccessDate ) VALUES ( ?, ?, ?, ? )"))) {
-        emitError(tr("Failed to prepare querySetMessageMetadata"), querySetMessageMetadata);
-        return false;
-    }
+/** @short Add the size and the time of the last access to the parts table
 
-    queryMessageFlags = QSqlQuery(db);
-    if (! queryMessageFlags.prepare(QLatin1String("SELECT flags FROM flags WHERE mailbox = ? AND uid = ?"))) {
-        emitError(tr("Failed to prepare queryMessageFlags"), queryMessageFlags);
-        return false;
-    }
+The parts which are already present are considered to have never been accessed, so they are the first ones to go.
+*/
+bool SQLCache::addPartAccessTracking()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE parts ADD COLUMN size INT NOT NULL DEFAULT 0",
+                           tr("Failed to add the size of parts"));
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE parts ADD COLUMN lastAccess INT NOT NULL DEFAULT 0",
+                           tr("Failed to add the last access time of parts"));
+    TROJITA_SQL_CACHE_EXEC("UPDATE parts SET size = length(data)", tr("Failed to compute the size of parts"));
+    TROJITA_SQL_CACHE_EXEC("CREATE INDEX parts_lru ON parts (lastAccess)", tr("Can't create index parts_lru"));
+    return true;
+}
 
-    querySetMessageFlags = QSqlQuery(db);
-    if (! querySetMessageFlags.prepare(QLatin1String("INSERT OR REPLACE INTO flags ( mailbox, uid, flags ) VALUES ( ?, ?, ? )"))) {
-        emitError(tr("Failed to prepare querySetMessageFlags"), querySetMessageFlags);
-        return false;
-    }
+/** @short Remember how the data of each part are stored; everything written by the older versions has been compressed */
+bool SQLCache::addPartFormat()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE parts ADD COLUMN format INT NOT NULL DEFAULT 1",
+                           tr("Failed to add the storage format of parts"));
+    return true;
+}
 
-    queryClearAllMessages1 = QSqlQuery(db);
-    if (! queryClearAllMessages1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryClearAllMessages1"), queryClearAllMessages1);
-        return false;
-    }
+/** @short Add the log of changes to threading and remember the format of the threading snapshots
 
-    queryClearAllMessages2 = QSqlQuery(db);
-    if (! queryClearAllMessages2.prepare(QLatin1String("DELETE FROM flags WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryClearAllMessages2"), queryClearAllMessages2);
-        return false;
-    }
+Everything written by the older versions is a QDataStream.
+*/
+bool SQLCache::addThreadingLog()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_EXEC("ALTER TABLE msg_threading ADD COLUMN format INT NOT NULL DEFAULT 0",
+                           tr("Failed to add the storage format of threading"));
+    TROJITA_SQL_CACHE_EXEC("CREATE TABLE msg_threading_log ( "
+                           "id INTEGER PRIMARY KEY, "
+                           "mailbox_id INT NOT NULL, "
+                           "delta BINARY"
+                           " )",
+                           tr("Can't create table msg_threading_log"));
+    TROJITA_SQL_CACHE_EXEC("CREATE INDEX msg_threading_log_mailbox ON msg_threading_log (mailbox_id, id)",
+                           tr("Can't create index msg_threading_log_mailbox"));
+    return true;
+}
 
-    queryClearAllMessages3 = QSqlQuery(db);
-    if (! queryClearAllMessages3.prepare(QLatin1String("DELETE FROM parts WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryClearAllMessages3"), queryClearAllMessages3);
-        return false;
-    }
+#undef TROJITA_SQL_CACHE_EXEC
 
-    queryClearAllMessages4 = QSqlQuery(db);
-    if (! queryClearAllMessages4.prepare(QLatin1String("DELETE FROM msg_threading WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryClearAllMessages4"), queryClearAllMessages4);
+/** @short Read the IDs of all known mailboxes so that the lookups need not go through the DB */
+bool SQLCache::loadMailboxIds()
+{
+    m_mailboxIds.clear();
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT id, name FROM mailboxes"))) {
+        emitError(tr("Failed to load mailbox IDs"), q);
         return false;
     }
-
-    queryClearMessage1 = QSqlQuery(db);
-    if (! queryClearMessage1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
-        emitError(tr("Failed to prepare queryClearMessage1"), queryClearMessage1);
-        return false;
+    while (q.next()) {
+        m_mailboxIds[q.value(1).toString()] = q.value(0).toLongLong();
     }
+    return true;
+}
 
-    queryClearMessage2 = QSqlQuery(db);
-    if (! queryClearMessage2.prepare(QLatin1String("DELETE FROM flags WHERE mailbox = ? AND uid = ?"))) {
-        emitError(tr("Failed to prepare queryClearMessage2"), queryClearMessage2);
-        return false;
-    }
+/** @short Return the ID of the given mailbox, or -1 if nothing has been stored for it yet */
+qint64 SQLCache::mailboxId(const QString &mailbox) const
+{
+    return m_mailboxIds.value(mailboxName(mailbox), -1);
+}
 
-    queryClearMessage3 = QSqlQuery(db);
-    if (! queryClearMessage3.prepare(QLatin1String("DELETE FROM parts WHERE mailbox = ? AND uid = ?"))) {
-        emitError(tr("Failed to prepare queryClearMessage3"), queryClearMessage3);
-        return false;
-    }
+/** @short Return the ID of the given mailbox, assigning a new one when needed
 
-    queryMessagePart = QSqlQuery(db);
-    if (! queryMessagePart.prepare(QLatin1String("SELECT data FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
-        emitError(tr("Failed to prepare queryMessagePart"), queryMessagePart);
-        return false;
-    }
+Returns -1 on error. Has to be called from within a transaction, i.e. after touchingDB().
+*/
+qint64 SQLCache::ensureMailboxId(const QString &mailbox)
+{
+    qint64 id = mailboxId(mailbox);
+    if (id != -1)
+        return id;
+
+    queryCreateMailboxId.bindValue(0, mailboxName(mailbox));
+    if (!queryCreateMailboxId.exec()) {
+        emitError(tr("Query queryCreateMailboxId failed"), queryCreateMailboxId);
+        return -1;
+    }
+    id = queryCreateMailboxId.lastInsertId().toLongLong();
+    m_mailboxIds[mailboxName(mailbox)] = id;
+    return id;
+}
 
-    querySetMessagePart = QSqlQuery(db);
-    if (! querySetMessagePart.prepare(QLatin1String("INSERT OR REPLACE INTO parts ( mailbox, uid, part_id, data ) VALUES (?, ?, ?, ?)"))) {
-        emitError(tr("Failed to prepare querySetMessagePart"), querySetMessagePart);
+/** @short Make sure that the row which holds the per-mailbox state exists */
+bool SQLCache::ensureMailboxState(const qint64 id)
+{
+    queryEnsureMailboxState.bindValue(0, id);
+    if (!queryEnsureMailboxState.exec()) {
+        emitError(tr("Query queryEnsureMailboxState failed"), queryEnsureMailboxState);
         return false;
     }
+    return true;
+}
 
-    queryForgetMessagePart = QSqlQuery(db);
-    if (! queryForgetMessagePart.prepare(QLatin1String("DELETE FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
-        emitError(tr("Failed to prepare queryForgetMessagePart"), queryForgetMessagePart);
+/** @short Make sure that the row which holds both the metadata and the flags of a message exists */
+bool SQLCache::ensureMessage(const qint64 id, const uint uid)
+{
+    queryEnsureMessage.bindValue(0, id);
+    queryEnsureMessage.bindValue(1, uid);
+    if (!queryEnsureMessage.exec()) {
+        emitError(tr("Query queryEnsureMessage failed"), queryEnsureMessage);
         return false;
     }
+    return true;
+}
 
-    queryMessageThreading = QSqlQuery(db);
-    if (! queryMessageThreading.prepare(QLatin1String("SELECT threading FROM msg_threading WHERE mailbox = ?"))) {
-        emitError(tr("Failed to prepare queryMessageThreading"), queryMessageThreading);
-        return false;
+#define TROJITA_SQL_CACHE_PREPARE(QUERY, SQL) \
+    QUERY = QSqlQuery(db); \
+    if (!QUERY.prepare(QLatin1String(SQL))) { \
+        emitError(tr("Failed to prepare " #QUERY), QUERY); \
+        return false; \
     }
 
-    querySetMessageThreading = QSqlQuery(db);
-    if (! querySetMessageThreading.prepare(QLatin1String("INSERT OR REPLACE INTO msg_threading (mailbox, threading) VALUES  ( ?, ? )"))) {
-        emitError(tr("Failed to prepare querySetMessageThreading"), querySetMessageThreading);
-        return false;
-    }
+bool SQLCache::prepareQueries()
+{
+    TROJITA_SQL_CACHE_PREPARE(queryCreateMailboxId, "INSERT INTO mailboxes (name) VALUES (?)");
+
+    TROJITA_SQL_CACHE_PREPARE(queryChildMailboxes, "SELECT mailbox, separator, flags FROM child_mailboxes WHERE parent_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryChildMailboxesFresh, "SELECT mailbox FROM child_mailboxes WHERE parent_id = ? LIMIT 1");
+    TROJITA_SQL_CACHE_PREPARE(queryRemoveChildMailboxes, "DELETE FROM child_mailboxes WHERE parent_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetChildMailboxes,
+                              "INSERT OR REPLACE INTO child_mailboxes ( mailbox, parent_id, separator, flags ) VALUES (?, ?, ?, ?)");
+
+    TROJITA_SQL_CACHE_PREPARE(queryEnsureMailboxState, "INSERT OR IGNORE INTO mailbox_state (mailbox_id) VALUES (?)");
+    TROJITA_SQL_CACHE_PREPARE(queryMailboxSyncState, "SELECT sync_state FROM mailbox_state WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetMailboxSyncState, "UPDATE mailbox_state SET sync_state = ? WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryUidMapping, "SELECT bucket, uids FROM uid_mapping WHERE mailbox_id = ? ORDER BY bucket");
+    TROJITA_SQL_CACHE_PREPARE(querySetUidMapping,
+                              "INSERT OR REPLACE INTO uid_mapping (mailbox_id, bucket, uids) VALUES (?, ?, ?)");
+    TROJITA_SQL_CACHE_PREPARE(queryRemoveUidBucket, "DELETE FROM uid_mapping WHERE mailbox_id = ? AND bucket = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryClearUidMapping, "DELETE FROM uid_mapping WHERE mailbox_id = ?");
+
+    TROJITA_SQL_CACHE_PREPARE(queryEnsureMessage, "INSERT OR IGNORE INTO messages (mailbox_id, uid) VALUES (?, ?)");
+    TROJITA_SQL_CACHE_PREPARE(queryMessageMetadata, "SELECT data, lastAccessDate FROM messages WHERE mailbox_id = ? AND uid = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryMessageMetadataRange,
+                              "SELECT uid, data, lastAccessDate FROM messages WHERE mailbox_id = ? AND uid BETWEEN ? AND ?");
+    TROJITA_SQL_CACHE_PREPARE(queryAccessMessageMetadata,
+                              "UPDATE messages SET lastAccessDate = ? WHERE mailbox_id = ? AND uid = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetMessageMetadata,
+                              "UPDATE messages SET data = ?, lastAccessDate = ? WHERE mailbox_id = ? AND uid = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryMessageFlags, "SELECT flags FROM messages WHERE mailbox_id = ? AND uid = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetMessageFlags, "UPDATE messages SET flags = ? WHERE mailbox_id = ? AND uid = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryMessageFlagsRange,
+                              "SELECT uid, flags FROM messages WHERE mailbox_id = ? AND uid BETWEEN ? AND ?");
+    TROJITA_SQL_CACHE_PREPARE(queryInsertMessageFlags, "INSERT INTO messages (mailbox_id, uid, flags) VALUES (?, ?, ?)");
+
+    TROJITA_SQL_CACHE_PREPARE(queryClearAllMessages1, "DELETE FROM messages WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryClearAllMessages2, "DELETE FROM parts WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryClearAllMessages3, "DELETE FROM msg_threading WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryClearMessage1, "DELETE FROM messages WHERE mailbox_id = ? AND uid = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryClearMessage2, "DELETE FROM parts WHERE mailbox_id = ? AND uid = ?");
+
+    TROJITA_SQL_CACHE_PREPARE(queryMessagePart,
+                              "SELECT data, lastAccess, format FROM parts WHERE mailbox_id = ? AND uid = ? AND part_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryHasMessagePart, "SELECT 1 FROM parts WHERE mailbox_id = ? AND uid = ? AND part_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(queryAccessMessagePart,
+                              "UPDATE parts SET lastAccess = ? WHERE mailbox_id = ? AND uid = ? AND part_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetMessagePart,
+                              "INSERT OR REPLACE INTO parts ( mailbox_id, uid, part_id, data, size, lastAccess, format ) "
+                              "VALUES (?, ?, ?, ?, ?, ?, ?)");
+    TROJITA_SQL_CACHE_PREPARE(queryForgetMessagePart, "DELETE FROM parts WHERE mailbox_id = ? AND uid = ? AND part_id = ?");
+
+    TROJITA_SQL_CACHE_PREPARE(queryMessageThreading, "SELECT threading, format FROM msg_threading WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetMessageThreading,
+                              "INSERT OR REPLACE INTO msg_threading (mailbox_id, threading, format) VALUES ( ?, ?, ? )");
+    TROJITA_SQL_CACHE_PREPARE(queryThreadingLog, "SELECT delta FROM msg_threading_log WHERE mailbox_id = ? ORDER BY id");
+    TROJITA_SQL_CACHE_PREPARE(queryAppendThreadingLog, "INSERT INTO msg_threading_log (mailbox_id, delta) VALUES (?, ?)");
+    TROJITA_SQL_CACHE_PREPARE(queryClearThreadingLog, "DELETE FROM msg_threading_log WHERE mailbox_id = ?");
+
+    TROJITA_SQL_CACHE_PREPARE(queryOfflineSyncProgress,
+                              "SELECT uidvalidity, highest_uid FROM offline_sync WHERE mailbox_id = ?");
+    TROJITA_SQL_CACHE_PREPARE(querySetOfflineSyncProgress,
+                              "INSERT OR REPLACE INTO offline_sync (mailbox_id, uidvalidity, highest_uid) VALUES ( ?, ?, ? )");
+    TROJITA_SQL_CACHE_PREPARE(queryClearOfflineSyncProgress, "DELETE FROM offline_sync WHERE mailbox_id = ?");
 
 #ifdef CACHE_DEBUG
     qDebug() << "SQLCache::_prepareQueries() succeeded";
@@ -449,6 +936,8 @@ bool SQLCache::prepareQueries()
     return true;
 }
 
+#undef TROJITA_SQL_CACHE_PREPARE
+
 void SQLCache::emitError(const QString &message, const QSqlQuery &query) const
 {
     emitError(QString::fromUtf8("SQLCache: Query Error: %1: %2").arg(message, query.lastError().text()));
@@ -468,7 +957,10 @@ void SQLCache::emitError(const QString &message) const
 QList<MailboxMetadata> SQLCache::childMailboxes(const QString &mailbox) const
 {
     QList<MailboxMetadata> res;
-    queryChildMailboxes.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryChildMailboxes.bindValue(0, id);
     if (! queryChildMailboxes.exec()) {
         emitError(tr("Query queryChildMailboxes failed"), queryChildMailboxes);
         return res;
@@ -491,7 +983,10 @@ QList<MailboxMetadata> SQLCache::childMailboxes(const QString &mailbox) const
 
 bool SQLCache::childMailboxesFresh(const QString &mailbox) const
 {
-    queryChildMailboxesFresh.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return false;
+    queryChildMailboxesFresh.bindValue(0, id);
     if (! queryChildMailboxesFresh.exec()) {
         emitError(tr("Query queryChildMailboxesFresh failed"), queryChildMailboxesFresh);
         return false;
@@ -505,10 +1000,13 @@ void SQLCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMeta
     qDebug() << "Setting child mailboxes for" << mailbox;
 #endif
     touchingDB();
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1)
+        return;
     QVariantList mailboxFields, parentFields, separatorFields, flagsFelds;
     Q_FOREACH(const MailboxMetadata& item, data) {
         mailboxFields << item.mailbox;
-        parentFields << mailboxName(mailbox);
+        parentFields << id;
         separatorFields << item.separator;
         QByteArray buf;
         QDataStream stream(&buf, QIODevice::ReadWrite);
@@ -516,7 +1014,7 @@ void SQLCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMeta
         stream << item.flags;
         flagsFelds << buf;
     }
-    queryRemoveChildMailboxes.bindValue(0, mailboxName(mailbox));
+    queryRemoveChildMailboxes.bindValue(0, id);
     if (!queryRemoveChildMailboxes.exec()) {
         emitError(tr("Query queryRemoveChildMailboxes failed"), queryRemoveChildMailboxes);
         return;
@@ -534,12 +1032,15 @@ void SQLCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMeta
 SyncState SQLCache::mailboxSyncState(const QString &mailbox) const
 {
     SyncState res;
-    queryMailboxSyncState.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryMailboxSyncState.bindValue(0, id);
     if (! queryMailboxSyncState.exec()) {
         emitError(tr("Query queryMailboxSyncState failed"), queryMailboxSyncState);
         return res;
     }
-    if (queryMailboxSyncState.first()) {
+    if (queryMailboxSyncState.first() && !queryMailboxSyncState.value(0).isNull()) {
         QDataStream stream(queryMailboxSyncState.value(0).toByteArray());
         stream.setVersion(streamVersion);
         stream >> res;
@@ -554,12 +1055,15 @@ void SQLCache::setMailboxSyncState(const QString &mailbox, const SyncState &stat
     qDebug() << "Setting sync state for" << mailbox;
 #endif
     touchingDB();
-    querySetMailboxSyncState.bindValue(0, mailboxName(mailbox));
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1 || !ensureMailboxState(id))
+        return;
     QByteArray buf;
     QDataStream stream(&buf, QIODevice::ReadWrite);
     stream.setVersion(streamVersion);
     stream << state;
-    querySetMailboxSyncState.bindValue(1, buf);
+    querySetMailboxSyncState.bindValue(0, buf);
+    querySetMailboxSyncState.bindValue(1, id);
     if (! querySetMailboxSyncState.exec()) {
         emitError(tr("Query querySetMailboxSyncState failed"), querySetMailboxSyncState);
         return;
@@ -569,35 +1073,107 @@ void SQLCache::setMailboxSyncState(const QString &mailbox, const SyncState &stat
 QList<uint> SQLCache::uidMapping(const QString &mailbox) const
 {
     QList<uint> res;
-    queryUidMapping.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryUidMapping.bindValue(0, id);
     if (! queryUidMapping.exec()) {
         emitError(tr("Query queryUidMapping failed"), queryUidMapping);
         return res;
     }
-    if (queryUidMapping.first()) {
-        QDataStream stream(qUncompress(queryUidMapping.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res;
+    QMap<uint, QByteArray> stored;
+    while (queryUidMapping.next()) {
+        const uint bucket = queryUidMapping.value(0).toUInt();
+        const QByteArray data = queryUidMapping.value(1).toByteArray();
+        if (!decodeUidBucket(bucket, data, res)) {
+            emitError(tr("Corrupt UID mapping for mailbox %1").arg(mailbox));
+            return QList<uint>();
+        }
+        stored[bucket] = data;
     }
+    m_storedUidBuckets[id] = stored;
     // "No data present" doesn't necessarily imply a problem -- it simply might not be there yet :)
     return res;
 }
 
+/** @short Store the mapping of sequence numbers to UIDs
+
+Only the buckets whose content has changed since the last time are written, see encodeUidBuckets() for details. What is
+in the DB is remembered from the previous read or write, so the DB only has to be asked once per mailbox.
+*/
 void SQLCache::setUidMapping(const QString &mailbox, const QList<uint> &seqToUid)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Setting UID mapping for" << mailbox;
 #endif
+    QMap<uint, QByteArray> buckets;
+    if (!encodeUidBuckets(seqToUid, buckets)) {
+        emitError(tr("Refusing to store an unsorted UID mapping for mailbox %1").arg(mailbox));
+        return;
+    }
+
     touchingDB();
-    querySetUidMapping.bindValue(0, mailboxName(mailbox));
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << seqToUid;
-    querySetUidMapping.bindValue(1, qCompress(buf));
-    if (! querySetUidMapping.exec()) {
-        emitError(tr("Query querySetUidMapping failed"), querySetUidMapping);
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1)
+        return;
+
+    QHash<qint64, QMap<uint, QByteArray> >::const_iterator known = m_storedUidBuckets.constFind(id);
+    QMap<uint, QByteArray> stored;
+    if (known != m_storedUidBuckets.constEnd()) {
+        stored = *known;
+    } else {
+        queryUidMapping.bindValue(0, id);
+        if (!queryUidMapping.exec()) {
+            emitError(tr("Query queryUidMapping failed"), queryUidMapping);
+            return;
+        }
+        while (queryUidMapping.next()) {
+            stored[queryUidMapping.value(0).toUInt()] = queryUidMapping.value(1).toByteArray();
+        }
+        queryUidMapping.finish();
+    }
+
+    QVariantList removedIds, removedBuckets;
+    for (QMap<uint, QByteArray>::const_iterator it = stored.constBegin(); it != stored.constEnd(); ++it) {
+        if (!buckets.contains(it.key())) {
+            removedIds << id;
+            removedBuckets << it.key();
+        }
+    }
+    QVariantList ids, bucketNumbers, blobs;
+    for (QMap<uint, QByteArray>::const_iterator it = buckets.constBegin(); it != buckets.constEnd(); ++it) {
+        QMap<uint, QByteArray>::const_iterator old = stored.constFind(it.key());
+        if (old != stored.constEnd() && *old == *it) {
+            // No change, no need to write anything
+            continue;
+        }
+        ids << id;
+        bucketNumbers << it.key();
+        blobs << *it;
+    }
+
+    // Until the DB is known to match, it has to be asked again next time
+    m_storedUidBuckets.remove(id);
+
+    if (!removedBuckets.isEmpty()) {
+        queryRemoveUidBucket.bindValue(0, removedIds);
+        queryRemoveUidBucket.bindValue(1, removedBuckets);
+        if (!queryRemoveUidBucket.execBatch()) {
+            emitError(tr("Query queryRemoveUidBucket failed"), queryRemoveUidBucket);
+            return;
+        }
+    }
+
+    if (!ids.isEmpty()) {
+        querySetUidMapping.bindValue(0, ids);
+        querySetUidMapping.bindValue(1, bucketNumbers);
+        querySetUidMapping.bindValue(2, blobs);
+        if (!querySetUidMapping.execBatch()) {
+            emitError(tr("Query querySetUidMapping failed"), querySetUidMapping);
+            return;
+        }
     }
+    m_storedUidBuckets[id] = buckets;
 }
 
 void SQLCache::clearUidMapping(const QString &mailbox)
@@ -605,11 +1181,17 @@ void SQLCache::clearUidMapping(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "Clearing UID mapping for" << mailbox;
 #endif
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return;
     touchingDB();
-    queryClearUidMapping.bindValue(0, mailboxName(mailbox));
+    m_storedUidBuckets.remove(id);
+    queryClearUidMapping.bindValue(0, id);
     if (! queryClearUidMapping.exec()) {
         emitError(tr("Query queryClearUidMapping failed"), queryClearUidMapping);
+        return;
     }
+    m_storedUidBuckets[id] = QMap<uint, QByteArray>();
 }
 
 void SQLCache::clearAllMessages(const QString &mailbox)
@@ -617,11 +1199,15 @@ void SQLCache::clearAllMessages(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "Clearing all messages from" << mailbox;
 #endif
+    forgetPendingFlags(mailbox);
+    forgetPartialMessageParts(mailbox);
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return;
     touchingDB();
-    queryClearAllMessages1.bindValue(0, mailboxName(mailbox));
-    queryClearAllMessages2.bindValue(0, mailboxName(mailbox));
-    queryClearAllMessages3.bindValue(0, mailboxName(mailbox));
-    queryClearAllMessages4.bindValue(0, mailboxName(mailbox));
+    queryClearAllMessages1.bindValue(0, id);
+    queryClearAllMessages2.bindValue(0, id);
+    queryClearAllMessages3.bindValue(0, id);
     if (! queryClearAllMessages1.exec()) {
         emitError(tr("Query queryClearAllMessages1 failed"), queryClearAllMessages1);
     }
@@ -631,8 +1217,15 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     if (! queryClearAllMessages3.exec()) {
         emitError(tr("Query queryClearAllMessages3 failed"), queryClearAllMessages3);
     }
-    if (! queryClearAllMessages4.exec()) {
-        emitError(tr("Query queryClearAllMessages4 failed"), queryClearAllMessages4);
+    queryClearThreadingLog.bindValue(0, id);
+    if (! queryClearThreadingLog.exec()) {
+        emitError(tr("Query queryClearThreadingLog failed"), queryClearThreadingLog);
+    }
+    if (hasThreadingState(mailbox))
+        m_threadingMailbox.clear();
+    queryClearOfflineSyncProgress.bindValue(0, id);
+    if (! queryClearOfflineSyncProgress.exec()) {
+        emitError(tr("Query queryClearOfflineSyncProgress failed"), queryClearOfflineSyncProgress);
     }
     clearUidMapping(mailbox);
 }
@@ -642,34 +1235,44 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
 #ifdef CACHE_DEBUG
     qDebug() << "Clearing message" << uid << "from" << mailbox;
 #endif
+    forgetPendingFlags(mailbox, QList<uint>() << uid);
+    forgetPartialMessageParts(mailbox, uid);
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return;
     touchingDB();
-    queryClearMessage1.bindValue(0, mailboxName(mailbox));
+    queryClearMessage1.bindValue(0, id);
     queryClearMessage1.bindValue(1, uid);
-    queryClearMessage2.bindValue(0, mailboxName(mailbox));
+    queryClearMessage2.bindValue(0, id);
     queryClearMessage2.bindValue(1, uid);
-    queryClearMessage3.bindValue(0, mailboxName(mailbox));
-    queryClearMessage3.bindValue(1, uid);
     if (! queryClearMessage1.exec()) {
         emitError(tr("Query queryClearMessage1 failed"), queryClearMessage1);
     }
     if (! queryClearMessage2.exec()) {
         emitError(tr("Query queryClearMessage2 failed"), queryClearMessage2);
     }
-    if (! queryClearMessage3.exec()) {
-        emitError(tr("Query queryClearMessage3 failed"), queryClearMessage3);
-    }
 }
 
 QStringList SQLCache::msgFlags(const QString &mailbox, const uint uid) const
 {
+    QMap<QString, QMap<uint, QStringList> >::const_iterator pending = m_pendingFlags.constFind(mailboxName(mailbox));
+    if (pending != m_pendingFlags.constEnd()) {
+        QMap<uint, QStringList>::const_iterator it = pending->constFind(uid);
+        if (it != pending->constEnd())
+            return *it;
+    }
+
     QStringList res;
-    queryMessageFlags.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryMessageFlags.bindValue(0, id);
     queryMessageFlags.bindValue(1, uid);
     if (! queryMessageFlags.exec()) {
         emitError(tr("Query queryMessageFlags failed"), queryMessageFlags);
         return res;
     }
-    if (queryMessageFlags.first()) {
+    if (queryMessageFlags.first() && !queryMessageFlags.value(0).isNull()) {
         QDataStream stream(queryMessageFlags.value(0).toByteArray());
         stream.setVersion(streamVersion);
         stream >> res;
@@ -678,46 +1281,199 @@ QStringList SQLCache::msgFlags(const QString &mailbox, const uint uid) const
     return res;
 }
 
+/** @short Read the flags of many messages through a single range query, unless they are too scattered */
+QMap<uint, QStringList> SQLCache::msgFlags(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, QStringList> res;
+    if (uids.isEmpty())
+        return res;
+
+    QSet<uint> wanted;
+    uint lowest = uids.first(), highest = uids.first();
+    Q_FOREACH(const uint uid, uids) {
+        wanted.insert(uid);
+        lowest = qMin(lowest, uid);
+        highest = qMax(highest, uid);
+    }
+    if (highest - lowest >= maxRangeOverhead * static_cast<uint>(wanted.size()))
+        return AbstractCache::msgFlags(mailbox, uids);
+
+    qint64 id = mailboxId(mailbox);
+    if (id != -1) {
+        queryMessageFlagsRange.bindValue(0, id);
+        queryMessageFlagsRange.bindValue(1, lowest);
+        queryMessageFlagsRange.bindValue(2, highest);
+        if (!queryMessageFlagsRange.exec()) {
+            emitError(tr("Query queryMessageFlagsRange failed"), queryMessageFlagsRange);
+            return res;
+        }
+        while (queryMessageFlagsRange.next()) {
+            uint uid = queryMessageFlagsRange.value(0).toUInt();
+            if (!wanted.contains(uid) || queryMessageFlagsRange.value(1).isNull())
+                continue;
+            QDataStream stream(queryMessageFlagsRange.value(1).toByteArray());
+            stream.setVersion(streamVersion);
+            stream >> res[uid];
+        }
+        queryMessageFlagsRange.finish();
+    }
+
+    // The updates which haven't been written yet are newer than whatever is in the DB
+    QMap<QString, QMap<uint, QStringList> >::const_iterator pending = m_pendingFlags.constFind(mailboxName(mailbox));
+    if (pending != m_pendingFlags.constEnd()) {
+        for (QMap<uint, QStringList>::const_iterator it = pending->constBegin(); it != pending->constEnd(); ++it) {
+            if (wanted.contains(it.key()))
+                res[it.key()] = *it;
+        }
+    }
+    return res;
+}
+
+/** @short Remember the new flags of a message
+
+The flags typically arrive in huge bursts, one message at a time, when a mailbox gets resynced. Writing them one by one would
+spend most of the time in SQLite, so they are kept in memory for a short while and saved through the bulk version of this
+function afterwards.
+*/
 void SQLCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Updating flags for" << mailbox << uid;
 #endif
+    QMap<uint, QStringList> &pending = m_pendingFlags[mailboxName(mailbox)];
+    if (!pending.contains(uid))
+        ++m_pendingFlagsCount;
+    pending[uid] = flags;
+    if (m_pendingFlagsCount >= maxPendingFlags) {
+        flushPendingFlags();
+    } else if (!m_flushFlags->isActive()) {
+        m_flushFlags->start();
+    }
+}
+
+/** @short Save the flags of many messages through as few SQL statements as possible
+
+The flags which are already stored are read through a single range query first, so that the rows whose flags have not
+changed at all are not touched. The rest is written in two batches, one for the messages which are already known and another
+for the new ones.
+*/
+void SQLCache::setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Updating flags for" << flags.size() << "messages in" << mailbox;
+#endif
+    if (flags.isEmpty())
+        return;
+    // Anything which is still waiting to be written is older than this
+    forgetPendingFlags(mailbox, flags.keys());
+
     touchingDB();
-    querySetMessageFlags.bindValue(0, mailboxName(mailbox));
-    querySetMessageFlags.bindValue(1, uid);
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << flags;
-    querySetMessageFlags.bindValue(2, buf);
-    if (! querySetMessageFlags.exec()) {
-        emitError(tr("Query querySetMessageFlags failed"), querySetMessageFlags);
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1)
+        return;
+
+    queryMessageFlagsRange.bindValue(0, id);
+    queryMessageFlagsRange.bindValue(1, flags.constBegin().key());
+    queryMessageFlagsRange.bindValue(2, (flags.constEnd() - 1).key());
+    if (!queryMessageFlagsRange.exec()) {
+        emitError(tr("Query queryMessageFlagsRange failed"), queryMessageFlagsRange);
+        return;
+    }
+    QHash<uint, QByteArray> stored;
+    while (queryMessageFlagsRange.next()) {
+        stored[queryMessageFlagsRange.value(0).toUInt()] = queryMessageFlagsRange.value(1).toByteArray();
+    }
+    queryMessageFlagsRange.finish();
+
+    QVariantList updatedFlags, updatedMailboxes, updatedUids, newFlags, newMailboxes, newUids;
+    for (QMap<uint, QStringList>::const_iterator it = flags.constBegin(); it != flags.constEnd(); ++it) {
+        QByteArray buf;
+        QDataStream stream(&buf, QIODevice::ReadWrite);
+        stream.setVersion(streamVersion);
+        stream << *it;
+        QHash<uint, QByteArray>::const_iterator storedIt = stored.constFind(it.key());
+        if (storedIt == stored.constEnd()) {
+            newFlags << buf;
+            newMailboxes << id;
+            newUids << it.key();
+        } else if (*storedIt != buf) {
+            updatedFlags << buf;
+            updatedMailboxes << id;
+            updatedUids << it.key();
+        }
+    }
+
+    if (!updatedUids.isEmpty()) {
+        querySetMessageFlags.bindValue(0, updatedFlags);
+        querySetMessageFlags.bindValue(1, updatedMailboxes);
+        querySetMessageFlags.bindValue(2, updatedUids);
+        if (!querySetMessageFlags.execBatch()) {
+            emitError(tr("Query querySetMessageFlags failed"), querySetMessageFlags);
+        }
+    }
+    if (!newUids.isEmpty()) {
+        queryInsertMessageFlags.bindValue(0, newMailboxes);
+        queryInsertMessageFlags.bindValue(1, newUids);
+        queryInsertMessageFlags.bindValue(2, newFlags);
+        if (!queryInsertMessageFlags.execBatch()) {
+            emitError(tr("Query queryInsertMessageFlags failed"), queryInsertMessageFlags);
+        }
+    }
+}
+
+void SQLCache::flushPendingFlags()
+{
+    if (m_flushFlags)
+        m_flushFlags->stop();
+    QMap<QString, QMap<uint, QStringList> > pending = m_pendingFlags;
+    m_pendingFlags.clear();
+    m_pendingFlagsCount = 0;
+    for (QMap<QString, QMap<uint, QStringList> >::const_iterator it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        setMsgFlags(it.key(), *it);
+    }
+}
+
+/** @short Drop the not-yet-saved flags of the given @arg uids, or of all messages in the mailbox if the list is empty */
+void SQLCache::forgetPendingFlags(const QString &mailbox, const QList<uint> &uids)
+{
+    QMap<QString, QMap<uint, QStringList> >::iterator pending = m_pendingFlags.find(mailboxName(mailbox));
+    if (pending == m_pendingFlags.end())
+        return;
+    if (uids.isEmpty()) {
+        m_pendingFlagsCount -= pending->size();
+        m_pendingFlags.erase(pending);
+        return;
     }
+    Q_FOREACH(const uint uid, uids) {
+        m_pendingFlagsCount -= pending->remove(uid);
+    }
+    if (pending->isEmpty())
+        m_pendingFlags.erase(pending);
 }
 
 AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbox, uint uid) const
 {
     AbstractCache::MessageDataBundle res;
-    queryMessageMetadata.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryMessageMetadata.bindValue(0, id);
     queryMessageMetadata.bindValue(1, uid);
     if (! queryMessageMetadata.exec()) {
         emitError(tr("Query queryMessageMetadata failed"), queryMessageMetadata);
         return res;
     }
-    if (queryMessageMetadata.first()) {
+    // The row might exist just because of the flags
+    if (queryMessageMetadata.first() && !queryMessageMetadata.value(0).isNull()) {
         res.uid = uid;
-        QDataStream stream(qUncompress(queryMessageMetadata.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res.envelope >> res.internalDate >> res.size >> res.serializedBodyStructure >> res.hdrReferences
-                  >> res.hdrListPost >> res.hdrListPostNo;
+        unserializeMessageMetadata(queryMessageMetadata.value(0).toByteArray(), res);
 
         if (m_updateAccessIfOlder) {
             int lastAccessTimestamp = queryMessageMetadata.value(1).toInt();
             int currentDiff = accessingThresholdDate.daysTo(QDate::currentDate());
             if (lastAccessTimestamp < currentDiff - m_updateAccessIfOlder) {
                 queryAccessMessageMetadata.bindValue(0, currentDiff);
-                queryAccessMessageMetadata.bindValue(1, mailboxName(mailbox));
+                queryAccessMessageMetadata.bindValue(1, id);
                 queryAccessMessageMetadata.bindValue(2, uid);
                 if (!queryAccessMessageMetadata.exec()) {
                     emitError(tr("Query queryAccessMessageMetadata failed"), queryAccessMessageMetadata);
@@ -729,22 +1485,80 @@ AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbo
     return res;
 }
 
+QMap<uint, AbstractCache::MessageDataBundle> SQLCache::messageMetadata(const QString &mailbox, const QList<uint> &uids) const
+{
+    QMap<uint, MessageDataBundle> res;
+    qint64 id = mailboxId(mailbox);
+    if (id == -1 || uids.isEmpty())
+        return res;
+
+    QSet<uint> wanted;
+    uint lowest = uids.first(), highest = uids.first();
+    Q_FOREACH(const uint uid, uids) {
+        wanted.insert(uid);
+        lowest = qMin(lowest, uid);
+        highest = qMax(highest, uid);
+    }
+    if (highest - lowest >= maxRangeOverhead * static_cast<uint>(wanted.size())) {
+        // The UIDs are scattered all over the mailbox; asking for them one by one is cheaper than reading a huge range
+        return AbstractCache::messageMetadata(mailbox, uids);
+    }
+
+    queryMessageMetadataRange.bindValue(0, id);
+    queryMessageMetadataRange.bindValue(1, lowest);
+    queryMessageMetadataRange.bindValue(2, highest);
+    if (!queryMessageMetadataRange.exec()) {
+        emitError(tr("Query queryMessageMetadataRange failed"), queryMessageMetadataRange);
+        return res;
+    }
+
+    int currentDiff = accessingThresholdDate.daysTo(QDate::currentDate());
+    QVariantList accessDates, accessMailboxes, accessUids;
+    while (queryMessageMetadataRange.next()) {
+        uint uid = queryMessageMetadataRange.value(0).toUInt();
+        // The row might exist just because of the flags
+        if (!wanted.contains(uid) || queryMessageMetadataRange.value(1).isNull())
+            continue;
+        MessageDataBundle &data = res[uid];
+        data.uid = uid;
+        unserializeMessageMetadata(queryMessageMetadataRange.value(1).toByteArray(), data);
+        if (m_updateAccessIfOlder && queryMessageMetadataRange.value(2).toInt() < currentDiff - m_updateAccessIfOlder) {
+            accessDates << currentDiff;
+            accessMailboxes << id;
+            accessUids << uid;
+        }
+    }
+
+    if (!accessUids.isEmpty()) {
+        queryAccessMessageMetadata.bindValue(0, accessDates);
+        queryAccessMessageMetadata.bindValue(1, accessMailboxes);
+        queryAccessMessageMetadata.bindValue(2, accessUids);
+        if (!queryAccessMessageMetadata.execBatch()) {
+            emitError(tr("Query queryAccessMessageMetadata failed"), queryAccessMessageMetadata);
+        }
+    }
+    return res;
+}
+
 void SQLCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Setting message metadata for" << uid << mailbox;
 #endif
     touchingDB();
-    // Order of values: mailbox, uid, data
-    querySetMessageMetadata.bindValue(0, mailboxName(mailbox));
-    querySetMessageMetadata.bindValue(1, uid);
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1 || !ensureMessage(id, uid))
+        return;
+    // Order of values: data, access date, mailbox, uid
     QByteArray buf;
     QDataStream stream(&buf, QIODevice::ReadWrite);
     stream.setVersion(streamVersion);
     stream << metadata.envelope << metadata.internalDate << metadata.size << metadata.serializedBodyStructure
            << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo;
-    querySetMessageMetadata.bindValue(2, qCompress(buf));
-    querySetMessageMetadata.bindValue(3, accessingThresholdDate.daysTo(QDate::currentDate()));
+    querySetMessageMetadata.bindValue(0, qCompress(buf));
+    querySetMessageMetadata.bindValue(1, accessingThresholdDate.daysTo(QDate::currentDate()));
+    querySetMessageMetadata.bindValue(2, id);
+    querySetMessageMetadata.bindValue(3, uid);
     if (! querySetMessageMetadata.exec()) {
         emitError(tr("Query querySetMessageMetadata failed"), querySetMessageMetadata);
     }
@@ -753,7 +1567,10 @@ void SQLCache::setMessageMetadata(const QString &mailbox, const uint uid, const
 QByteArray SQLCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
     QByteArray res;
-    queryMessagePart.bindValue(0, mailboxName(mailbox));
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryMessagePart.bindValue(0, id);
     queryMessagePart.bindValue(1, uid);
     queryMessagePart.bindValue(2, partId);
     if (! queryMessagePart.exec()) {
@@ -761,9 +1578,39 @@ QByteArray SQLCache::messagePart(const QString &mailbox, const uint uid, const Q
         return res;
     }
     if (queryMessagePart.first()) {
-        res = qUncompress(queryMessagePart.value(0).toByteArray());
+        res = PartCompression::decode(queryMessagePart.value(0).toByteArray(),
+                                      static_cast<PartCompression::Format>(queryMessagePart.value(2).toInt()));
+        uint lastAccess = queryMessagePart.value(1).toUInt();
         queryMessagePart.finish();
+
+        uint now = QDateTime::currentDateTime().toTime_t();
+        if (lastAccess + partAccessGranularity < now) {
+            queryAccessMessagePart.bindValue(0, now);
+            queryAccessMessagePart.bindValue(1, id);
+            queryAccessMessagePart.bindValue(2, uid);
+            queryAccessMessagePart.bindValue(3, partId);
+            if (!queryAccessMessagePart.exec()) {
+                emitError(tr("Query queryAccessMessagePart failed"), queryAccessMessagePart);
+            }
+        }
+    }
+    return res;
+}
+
+bool SQLCache::hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return false;
+    queryHasMessagePart.bindValue(0, id);
+    queryHasMessagePart.bindValue(1, uid);
+    queryHasMessagePart.bindValue(2, partId);
+    if (!queryHasMessagePart.exec()) {
+        emitError(tr("Query queryHasMessagePart failed"), queryHasMessagePart);
+        return false;
     }
+    bool res = queryHasMessagePart.first();
+    queryHasMessagePart.finish();
     return res;
 }
 
@@ -773,10 +1620,18 @@ void SQLCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArr
     qDebug() << "Saving message part" << partId << uid << mailbox;
 #endif
     touchingDB();
-    querySetMessagePart.bindValue(0, mailboxName(mailbox));
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1)
+        return;
+    querySetMessagePart.bindValue(0, id);
     querySetMessagePart.bindValue(1, uid);
     querySetMessagePart.bindValue(2, partId);
-    querySetMessagePart.bindValue(3, qCompress(data));
+    PartCompression::Format format;
+    QByteArray stored = PartCompression::encode(data, format);
+    querySetMessagePart.bindValue(3, stored);
+    querySetMessagePart.bindValue(4, stored.size());
+    querySetMessagePart.bindValue(5, QDateTime::currentDateTime().toTime_t());
+    querySetMessagePart.bindValue(6, format);
     if (! querySetMessagePart.exec()) {
         emitError(tr("Query querySetMessagePart failed"), querySetMessagePart);
     }
@@ -787,8 +1642,11 @@ void SQLCache::forgetMessagePart(const QString &mailbox, const uint uid, const Q
 #ifdef CACHE_DEBUG
     qDebug() << "Forgetting message part" << partId << uid << mailbox;
 #endif
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return;
     touchingDB();
-    queryForgetMessagePart.bindValue(0, mailboxName(mailbox));
+    queryForgetMessagePart.bindValue(0, id);
     queryForgetMessagePart.bindValue(1, uid);
     queryForgetMessagePart.bindValue(2, partId);
     if (! queryForgetMessagePart.exec()) {
@@ -796,38 +1654,254 @@ void SQLCache::forgetMessagePart(const QString &mailbox, const uint uid, const Q
     }
 }
 
+/** @short Load the threading snapshot of the @arg mailbox and apply all changes from the log
+
+The result is remembered, so that the next change to this mailbox can be stored as a delta against it.
+*/
 QVector<Imap::Responses::ThreadingNode> SQLCache::messageThreading(const QString &mailbox)
 {
+    if (hasThreadingState(mailbox))
+        return m_threading;
+
     QVector<Imap::Responses::ThreadingNode> res;
-    queryMessageThreading.bindValue(0, mailboxName(mailbox));
+    m_threadingMailbox.clear();
+    m_threading.clear();
+    m_threadingLogEntries = 0;
+    m_threadingLogBytes = 0;
+    m_threadingSnapshotBytes = 0;
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryMessageThreading.bindValue(0, id);
     if (! queryMessageThreading.exec()) {
         emitError(tr("Query queryMessageThreading failed"), queryMessageThreading);
         return res;
     }
     if (queryMessageThreading.first()) {
-        QDataStream stream(qUncompress(queryMessageThreading.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res;
+        QByteArray snapshot = queryMessageThreading.value(0).toByteArray();
+        m_threadingSnapshotBytes = snapshot.size();
+        bool ok;
+        if (queryMessageThreading.value(1).toInt() == THREADING_VARINT) {
+            QByteArray data = qUncompress(snapshot);
+            int pos = 0;
+            ok = decodeThreading(data, pos, res) && pos == data.size();
+        } else {
+            QDataStream stream(qUncompress(snapshot));
+            stream.setVersion(streamVersion);
+            stream >> res;
+            ok = stream.status() == QDataStream::Ok;
+        }
+        if (!ok) {
+            emitError(tr("Corrupt threading data for mailbox %1").arg(mailbox));
+            return QVector<Imap::Responses::ThreadingNode>();
+        }
+    }
+    queryMessageThreading.finish();
+
+    queryThreadingLog.bindValue(0, id);
+    if (! queryThreadingLog.exec()) {
+        emitError(tr("Query queryThreadingLog failed"), queryThreadingLog);
+        return QVector<Imap::Responses::ThreadingNode>();
+    }
+    while (queryThreadingLog.next()) {
+        QByteArray delta = queryThreadingLog.value(0).toByteArray();
+        if (!applyThreadingDelta(res, delta)) {
+            emitError(tr("Corrupt threading log for mailbox %1").arg(mailbox));
+            return QVector<Imap::Responses::ThreadingNode>();
+        }
+        ++m_threadingLogEntries;
+        m_threadingLogBytes += delta.size();
     }
+
+    m_threadingMailbox = mailbox;
+    m_threading = res;
     return res;
 }
 
+/** @short Is the m_threading up to date with what is stored for the @arg mailbox? */
+bool SQLCache::hasThreadingState(const QString &mailbox) const
+{
+    return !m_threadingMailbox.isNull() && m_threadingMailbox == mailbox;
+}
+
+/** @short Store the new threading of the @arg mailbox
+
+Small changes against the previous state are appended to a log, so that a new message in a huge mailbox does not
+rewrite the whole tree. Once the log grows too long, the complete snapshot gets written again and the log is dropped.
+*/
 void SQLCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Setting threading for" << mailbox;
 #endif
+    if (!hasThreadingState(mailbox))
+        messageThreading(mailbox);
+
+    QByteArray delta;
+    if (hasThreadingState(mailbox)) {
+        delta = threadingDelta(m_threading, threading);
+        if (delta.isEmpty())
+            return;
+    }
+
     touchingDB();
-    querySetMessageThreading.bindValue(0, mailboxName(mailbox));
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << threading;
-    querySetMessageThreading.bindValue(1, qCompress(buf));
-    if (! querySetMessageThreading.exec()) {
-        emitError(tr("Query querySetMessageThreading failed"), querySetMessageThreading);
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1)
+        return;
+    // Without a usable previous state, the delta is empty and the snapshot gets written
+    if (!delta.isEmpty() && m_threadingLogEntries < maxThreadingLogEntries &&
+            (m_threadingLogBytes + delta.size()) * threadingLogSizeDivisor <= m_threadingSnapshotBytes) {
+        queryAppendThreadingLog.bindValue(0, id);
+        queryAppendThreadingLog.bindValue(1, delta);
+        if (! queryAppendThreadingLog.exec()) {
+            emitError(tr("Query queryAppendThreadingLog failed"), queryAppendThreadingLog);
+            m_threadingMailbox.clear();
+            return;
+        }
+        ++m_threadingLogEntries;
+        m_threadingLogBytes += delta.size();
+    } else {
+        QByteArray buf;
+        encodeThreading(buf, threading);
+        QByteArray snapshot = qCompress(buf);
+        querySetMessageThreading.bindValue(0, id);
+        querySetMessageThreading.bindValue(1, snapshot);
+        querySetMessageThreading.bindValue(2, THREADING_VARINT);
+        if (! querySetMessageThreading.exec()) {
+            emitError(tr("Query querySetMessageThreading failed"), querySetMessageThreading);
+            m_threadingMailbox.clear();
+            return;
+        }
+        queryClearThreadingLog.bindValue(0, id);
+        if (! queryClearThreadingLog.exec()) {
+            emitError(tr("Query queryClearThreadingLog failed"), queryClearThreadingLog);
+            m_threadingMailbox.clear();
+            return;
+        }
+        m_threadingLogEntries = 0;
+        m_threadingLogBytes = 0;
+        m_threadingSnapshotBytes = snapshot.size();
+    }
+    m_threadingMailbox = mailbox;
+    m_threading = threading;
+}
+
+OfflineSyncProgress SQLCache::offlineSyncProgress(const QString &mailbox) const
+{
+    OfflineSyncProgress res;
+    qint64 id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    queryOfflineSyncProgress.bindValue(0, id);
+    if (! queryOfflineSyncProgress.exec()) {
+        emitError(tr("Query queryOfflineSyncProgress failed"), queryOfflineSyncProgress);
+        return res;
+    }
+    if (queryOfflineSyncProgress.first()) {
+        res.uidValidity = queryOfflineSyncProgress.value(0).toUInt();
+        res.highestSyncedUid = queryOfflineSyncProgress.value(1).toUInt();
+    }
+    return res;
+}
+
+void SQLCache::setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Setting offline sync progress for" << mailbox << progress.uidValidity << progress.highestSyncedUid;
+#endif
+    touchingDB();
+    qint64 id = ensureMailboxId(mailbox);
+    if (id == -1)
+        return;
+    querySetOfflineSyncProgress.bindValue(0, id);
+    querySetOfflineSyncProgress.bindValue(1, progress.uidValidity);
+    querySetOfflineSyncProgress.bindValue(2, progress.highestSyncedUid);
+    if (! querySetOfflineSyncProgress.exec()) {
+        emitError(tr("Query querySetOfflineSyncProgress failed"), querySetOfflineSyncProgress);
+    }
+}
+
+/** @short Return the number of bytes occupied by the data of all cached parts */
+qint64 SQLCache::partsSize() const
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT SUM(size) FROM parts"))) {
+        emitError(tr("Failed to compute the size of parts"), q);
+        return 0;
+    }
+    return q.first() ? q.value(0).toLongLong() : 0;
+}
+
+/** @short Return when has the least recently used part been accessed, or -1 if there are no parts at all */
+qint64 SQLCache::oldestPartAccess() const
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT MIN(lastAccess) FROM parts"))) {
+        emitError(tr("Failed to find the least recently used part"), q);
+        return -1;
+    }
+    if (!q.first() || q.value(0).isNull())
+        return -1;
+    return q.value(0).toLongLong();
+}
+
+/** @short Remove at most @arg count parts which haven't been accessed for the longest time
+
+The metadata of the messages are kept. Returns the number of bytes which got freed; the number of the removed parts
+is stored into @arg evictedParts unless it is null.
+*/
+qint64 SQLCache::evictLeastRecentlyUsedParts(const int count, int *evictedParts)
+{
+    if (evictedParts)
+        *evictedParts = 0;
+    QSqlQuery q(QString(), db);
+    if (!q.prepare(QLatin1String("SELECT rowid, size FROM parts ORDER BY lastAccess, rowid LIMIT ?"))) {
+        emitError(tr("Failed to prepare the LRU lookup"), q);
+        return 0;
+    }
+    q.bindValue(0, count);
+    if (!q.exec()) {
+        emitError(tr("Failed to find the least recently used parts"), q);
+        return 0;
+    }
+    QVariantList rowIds;
+    qint64 freed = 0;
+    while (q.next()) {
+        rowIds << q.value(0);
+        freed += q.value(1).toLongLong();
     }
+    if (rowIds.isEmpty())
+        return 0;
 
+    touchingDB();
+    QSqlQuery remove(QString(), db);
+    if (!remove.prepare(QLatin1String("DELETE FROM parts WHERE rowid = ?"))) {
+        emitError(tr("Failed to prepare the LRU eviction"), remove);
+        return 0;
+    }
+    remove.bindValue(0, rowIds);
+    if (!remove.execBatch()) {
+        emitError(tr("Failed to evict the least recently used parts"), remove);
+        return 0;
+    }
+    if (evictedParts)
+        *evictedParts = rowIds.size();
+    return freed;
+}
+
+AbstractCache::Usage SQLCache::usage() const
+{
+    Usage res;
+    QSqlQuery q(QString(), db);
+    if (q.exec(QLatin1String("SELECT COUNT(*) FROM messages WHERE data IS NOT NULL")) && q.first())
+        res.messages = q.value(0).toLongLong();
+    if (q.exec(QLatin1String("SELECT COUNT(*), SUM(size) FROM parts")) && q.first()) {
+        res.parts = q.value(0).toLongLong();
+        res.partBytes = q.value(1).toLongLong();
+    }
+    // An in-memory DB has a fake file name which does not exist, so it simply doesn't occupy any disk space
+    res.diskBytes = QFileInfo(db.databaseName()).size() + QFileInfo(db.databaseName() + QLatin1String("-wal")).size();
+    return res;
 }
 
 void SQLCache::touchingDB()
@@ -845,6 +1919,7 @@ void SQLCache::touchingDB()
 
 void SQLCache::timeToCommit()
 {
+    flushPendingFlags();
     if (inTransaction) {
 #ifdef CACHE_DEBUG
         qDebug() << "Commit";
@@ -24,6 +24,7 @@
 #define IMAP_MODEL_SQLCACHE_H
 
 #include "Cache.h"
+#include <QHash>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 
@@ -51,9 +52,14 @@ et cetera. In short, the layout of the database is supposed to act as a quick an
 cache and is certainly *not* meant to be accessed by third-party applications. Please, do
 consider it an opaque format.
 
+Mailboxes are referred to through integer IDs from the mailboxes table; the mapping is kept in memory, too. The per-mailbox
+state lives in a single row, and so do the metadata and the flags of each message. The UID mapping is split into buckets of
+delta-encoded UIDs so that the usual changes, i.e. new arrivals and expunges, only rewrite a small part of it. Each part
+remembers its size and roughly when it was last accessed, which is what the LRU eviction works with. The data of parts are
+only compressed when that makes them noticeably smaller, see PartCompression.
+The DB uses a write-ahead log where available.
+
 Some ideas for improvements:
-- Don't store full string mailbox names in each table, use another table for it
-- Merge uid_mapping with mailbox_sync_state, and also msg_metadata with flags
 - Serious embedded users might consider putting the database into a compressed filesystem,
   or using on-the-fly compression via sqlite's VFS subsystem
 
@@ -80,23 +86,35 @@ public:
     virtual void clearMessage(const QString mailbox, const uint uid);
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const;
+    virtual QMap<uint, MessageDataBundle> messageMetadata(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata);
 
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const;
+    virtual QMap<uint, QStringList> msgFlags(const QString &mailbox, const QList<uint> &uids) const;
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags);
+    virtual void setMsgFlags(const QString &mailbox, const QMap<uint, QStringList> &flags);
 
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    virtual bool hasMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
     virtual void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
     virtual void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
 
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual OfflineSyncProgress offlineSyncProgress(const QString &mailbox) const;
+    virtual void setOfflineSyncProgress(const QString &mailbox, const OfflineSyncProgress &progress);
+
     /** @short Open a connection to the cache */
     bool open(const QString &name, const QString &fileName);
 
     virtual void setRenewalThreshold(const int days);
 
+    virtual Usage usage() const;
+    qint64 partsSize() const;
+    qint64 oldestPartAccess() const;
+    qint64 evictLeastRecentlyUsedParts(const int count, int *evictedParts = 0);
+
 private:
     /** @short Broadcast an error from the SQL query */
     void emitError(const QString &message, const QSqlQuery &query) const;
@@ -107,6 +125,15 @@ private:
 
     /** @short Blindly create all tables */
     bool createTables();
+    bool createDataTables();
+    bool migrateToV8();
+    bool createUidMappingTable();
+    bool migrateToV9();
+    bool addPartAccessTracking();
+    bool addPartFormat();
+    bool addThreadingLog();
+    void tuneDatabase();
+    bool loadMailboxIds();
     /** @short Initialize the prepared queries */
     bool prepareQueries();
 
@@ -118,42 +145,76 @@ private:
 
     static QString mailboxName(const QString &mailbox);
 
+    qint64 mailboxId(const QString &mailbox) const;
+    qint64 ensureMailboxId(const QString &mailbox);
+    bool ensureMailboxState(const qint64 id);
+    bool ensureMessage(const qint64 id, const uint uid);
+
+    void forgetPendingFlags(const QString &mailbox, const QList<uint> &uids = QList<uint>());
+
+    bool hasThreadingState(const QString &mailbox) const;
+
 private slots:
     /** @short We haven't committed for a while */
     void timeToCommit();
+    /** @short Write the buffered flag updates */
+    void flushPendingFlags();
 
 private:
     QSqlDatabase db;
 
+    /** @short IDs of all mailboxes which have an entry in the mailboxes table */
+    QHash<QString, qint64> m_mailboxIds;
+    /** @short The encoded UID buckets as they are in the DB, indexed by the mailbox ID
+
+    Saving the UID mapping only has to write the buckets which differ from these. Mailboxes which are not listed here have
+    to be read from the DB first.
+    */
+    mutable QHash<qint64, QMap<uint, QByteArray> > m_storedUidBuckets;
+
+    mutable QSqlQuery queryCreateMailboxId;
     mutable QSqlQuery queryChildMailboxes;
     mutable QSqlQuery queryChildMailboxesFresh;
     mutable QSqlQuery queryRemoveChildMailboxes;
     mutable QSqlQuery querySetChildMailboxes;
+    mutable QSqlQuery queryEnsureMailboxState;
     mutable QSqlQuery queryMailboxSyncState;
     mutable QSqlQuery querySetMailboxSyncState;
     mutable QSqlQuery queryUidMapping;
     mutable QSqlQuery querySetUidMapping;
+    mutable QSqlQuery queryRemoveUidBucket;
     mutable QSqlQuery queryClearUidMapping;
+    mutable QSqlQuery queryEnsureMessage;
     mutable QSqlQuery queryMessageMetadata;
+    mutable QSqlQuery queryMessageMetadataRange;
     mutable QSqlQuery queryAccessMessageMetadata;
     mutable QSqlQuery querySetMessageMetadata;
     mutable QSqlQuery queryMessageFlags;
     mutable QSqlQuery querySetMessageFlags;
+    mutable QSqlQuery queryMessageFlagsRange;
+    mutable QSqlQuery queryInsertMessageFlags;
     mutable QSqlQuery queryClearAllMessages1;
     mutable QSqlQuery queryClearAllMessages2;
     mutable QSqlQuery queryClearAllMessages3;
-    mutable QSqlQuery queryClearAllMessages4;
     mutable QSqlQuery queryClearMessage1;
     mutable QSqlQuery queryClearMessage2;
-    mutable QSqlQuery queryClearMessage3;
     mutable QSqlQuery queryMessagePart;
+    mutable QSqlQuery queryHasMessagePart;
+    mutable QSqlQuery queryAccessMessagePart;
     mutable QSqlQuery querySetMessagePart;
     mutable QSqlQuery queryForgetMessagePart;
     mutable QSqlQuery queryMessageThreading;
     mutable QSqlQuery querySetMessageThreading;
+    mutable QSqlQuery queryThreadingLog;
+    mutable QSqlQuery queryAppendThreadingLog;
+    mutable QSqlQuery queryClearThreadingLog;
+    mutable QSqlQuery queryOfflineSyncProgress;
+    mutable QSqlQuery querySetOfflineSyncProgress;
+    mutable QSqlQuery queryClearOfflineSyncProgress;
 
     QTimer *delayedCommit;
     QTimer *tooMuchTimeWithoutCommit;
+    QTimer *m_flushFlags;
     bool inTransaction;
 
     /** @short A point in time against which the "last accessed on" data is computed */
@@ -164,6 +225,21 @@ private:
     To disable updating of the DB accesses, set to zero.
     */
     int m_updateAccessIfOlder;
+
+    /** @short Flag updates which have not been written to the DB yet, see setMsgFlags() */
+    QMap<QString, QMap<uint, QStringList> > m_pendingFlags;
+    int m_pendingFlagsCount;
+
+    /** @short The mailbox whose threading was read or written last, see setMessageThreading() */
+    QString m_threadingMailbox;
+    /** @short The threading of the m_threadingMailbox, i.e. the state against which the next delta is computed */
+    QVector<Imap::Responses::ThreadingNode> m_threading;
+    /** @short Number of the entries in the log of threading changes of the m_threadingMailbox */
+    int m_threadingLogEntries;
+    /** @short Total size of those entries */
+    qint64 m_threadingLogBytes;
+    /** @short Size of the threading snapshot of the m_threadingMailbox */
+    qint64 m_threadingSnapshotBytes;
 };
 
 }
@@ -32,18 +32,24 @@
 #include "Imap/Tasks/ExpungeMailboxTask.h"
 #include "Imap/Tasks/FetchMsgMetadataTask.h"
 #include "Imap/Tasks/FetchMsgPartTask.h"
+#include "Imap/Tasks/FetchMsgPartInChunksTask.h"
 #include "Imap/Tasks/GenUrlAuthTask.h"
 #include "Imap/Tasks/GetAnyConnectionTask.h"
 #include "Imap/Tasks/IdTask.h"
 #include "Imap/Tasks/KeepMailboxOpenTask.h"
 #include "Imap/Tasks/Fake_ListChildMailboxesTask.h"
 #include "Imap/Tasks/Fake_OpenConnectionTask.h"
+#include "Imap/Tasks/ListStatusTask.h"
+#include "Imap/Tasks/NotifyTask.h"
 #include "Imap/Tasks/NumberOfMessagesTask.h"
 #include "Imap/Tasks/ObtainSynchronizedMailboxTask.h"
 #include "Imap/Tasks/OpenConnectionTask.h"
+#include "Imap/Tasks/ParallelFetchTask.h"
+#include "Imap/Tasks/PrewarmMailboxTask.h"
 #include "Imap/Tasks/UidSubmitTask.h"
 #include "Imap/Tasks/UpdateFlagsTask.h"
 #include "Imap/Tasks/UpdateFlagsOfAllMessagesTask.h"
+#include "Imap/Tasks/WatchMailboxTask.h"
 #include "Imap/Tasks/ThreadTask.h"
 #include "Imap/Tasks/NoopTask.h"
 #include "Imap/Tasks/UnSelectTask.h"
@@ -65,6 +71,21 @@ OpenConnectionTask *TaskFactory::createOpenConnectionTask(Model *model)
     return new OpenConnectionTask(model);
 }
 
+ParallelFetchTask *TaskFactory::createParallelFetchTask(Model *model, const QModelIndex &mailbox, ParallelFetchJob *job)
+{
+    return new ParallelFetchTask(model, mailbox, job);
+}
+
+PrewarmMailboxTask *TaskFactory::createPrewarmMailboxTask(Model *model, MailboxPrewarmer *prewarmer)
+{
+    return new PrewarmMailboxTask(model, prewarmer);
+}
+
+WatchMailboxTask *TaskFactory::createWatchMailboxTask(Model *model, const QString &mailbox, MailboxWatcher *watcher)
+{
+    return new WatchMailboxTask(model, mailbox, watcher);
+}
+
 CopyMoveMessagesTask *TaskFactory::createCopyMoveMessagesTask(Model *model, const QModelIndexList &messages,
         const QString &targetMailbox, const CopyMoveOperation op)
 {
@@ -86,6 +107,16 @@ ListChildMailboxesTask *TaskFactory::createListChildMailboxesTask(Model *model,
     return new ListChildMailboxesTask(model, mailbox);
 }
 
+ListStatusTask *TaskFactory::createListStatusTask(Model *model)
+{
+    return new ListStatusTask(model);
+}
+
+NotifyTask *TaskFactory::createNotifyTask(Model *model, ImapTask *dependingTask)
+{
+    return new NotifyTask(model, dependingTask);
+}
+
 DeleteMailboxTask *TaskFactory::createDeleteMailboxTask(Model *model, const QString &mailbox)
 {
     return new DeleteMailboxTask(model, mailbox);
@@ -106,6 +137,11 @@ FetchMsgPartTask *TaskFactory::createFetchMsgPartTask(Model *model, const QModel
     return new FetchMsgPartTask(model, mailbox, uids, parts);
 }
 
+FetchMsgPartInChunksTask *TaskFactory::createFetchMsgPartInChunksTask(Model *model, const QModelIndex &mailbox, const uint uid, const QByteArray &part)
+{
+    return new FetchMsgPartInChunksTask(model, mailbox, uid, part);
+}
+
 IdTask *TaskFactory::createIdTask(Model *model, ImapTask *dependingTask)
 {
     return new IdTask(model, dependingTask);
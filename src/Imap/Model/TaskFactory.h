@@ -46,14 +46,21 @@ class EnableTask;
 class ExpungeMailboxTask;
 class FetchMsgMetadataTask;
 class FetchMsgPartTask;
+class FetchMsgPartInChunksTask;
 class GetAnyConnectionTask;
 class IdTask;
 class ImapTask;
 class KeepMailboxOpenTask;
 class ListChildMailboxesTask;
+class ListStatusTask;
+class NotifyTask;
 class NumberOfMessagesTask;
 class ObtainSynchronizedMailboxTask;
 class OpenConnectionTask;
+class ParallelFetchJob;
+class ParallelFetchTask;
+class PrewarmMailboxTask;
+class MailboxPrewarmer;
 class UpdateFlagsTask;
 class UpdateFlagsOfAllMessagesTask;
 class ThreadTask;
@@ -63,6 +70,8 @@ class SortTask;
 class SubscribeUnsubscribeTask;
 class GenUrlAuthTask;
 class UidSubmitTask;
+class WatchMailboxTask;
+class MailboxWatcher;
 
 class Model;
 class TreeItemMailbox;
@@ -81,14 +90,20 @@ public:
     virtual ExpungeMailboxTask *createExpungeMailboxTask(Model *model, const QModelIndex &mailbox);
     virtual FetchMsgMetadataTask *createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uid);
     virtual FetchMsgPartTask *createFetchMsgPartTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids, const QList<QByteArray> &parts);
+    virtual FetchMsgPartInChunksTask *createFetchMsgPartInChunksTask(Model *model, const QModelIndex &mailbox, const uint uid, const QByteArray &part);
     virtual GetAnyConnectionTask *createGetAnyConnectionTask(Model *model);
     virtual IdTask *createIdTask(Model *model, ImapTask *dependingTask);
     virtual KeepMailboxOpenTask *createKeepMailboxOpenTask(Model *model, const QModelIndex &mailbox, Parser *oldParser);
     virtual ListChildMailboxesTask *createListChildMailboxesTask(Model *model, const QModelIndex &mailbox);
+    virtual ListStatusTask *createListStatusTask(Model *model);
+    virtual NotifyTask *createNotifyTask(Model *model, ImapTask *dependingTask);
     virtual NumberOfMessagesTask *createNumberOfMessagesTask(Model *model, const QModelIndex &mailbox);
     virtual ObtainSynchronizedMailboxTask *createObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex,
             ImapTask *parentTask, KeepMailboxOpenTask *keepTask);
     virtual OpenConnectionTask *createOpenConnectionTask(Model *model);
+    virtual ParallelFetchTask *createParallelFetchTask(Model *model, const QModelIndex &mailbox, ParallelFetchJob *job);
+    virtual PrewarmMailboxTask *createPrewarmMailboxTask(Model *model, MailboxPrewarmer *prewarmer);
+    virtual WatchMailboxTask *createWatchMailboxTask(Model *model, const QString &mailbox, MailboxWatcher *watcher);
     virtual UpdateFlagsOfAllMessagesTask *createUpdateFlagsOfAllMessagesTask(Model *model, const QModelIndex &mailbox,
             const FlagsOperation flagOperation, const QString &flags);
     virtual UpdateFlagsTask *createUpdateFlagsTask(Model *model, const QModelIndexList &messages, const FlagsOperation flagOperation,
@@ -199,6 +199,13 @@ QVariant TaskPresentationModel::data(const QModelIndex &index, int role) const
             className.remove(QLatin1String("Imap::Mailbox::"));
             return tr("%1: %2").arg(className, task->debugIdentification());
         }
+    case Qt::ToolTipRole:
+        if (isParserState) {
+            return QVariant();
+        } else {
+            ImapTask *task = static_cast<ImapTask *>(index.internalPointer());
+            return task->describeStatistics();
+        }
     case RoleTaskCompactName: {
         if (isParserState) {
             return QVariant();
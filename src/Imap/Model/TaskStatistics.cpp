@@ -0,0 +1,205 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QTextStream>
+#include "TaskStatistics.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Tasks/ImapTask.h"
+
+namespace {
+
+const int numBuckets = 48;
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+LatencyHistogram::LatencyHistogram(): m_buckets(numBuckets, 0), m_count(0), m_sum(0), m_max(0)
+{
+}
+
+int LatencyHistogram::bucketFor(quint64 value)
+{
+    int bucket = 0;
+    while (bucket < numBuckets - 1 && upperBound(bucket) < value)
+        ++bucket;
+    return bucket;
+}
+
+void LatencyHistogram::add(const quint64 value)
+{
+    ++m_buckets[bucketFor(value)];
+    ++m_count;
+    m_sum += value;
+    m_max = qMax(m_max, value);
+}
+
+quint64 LatencyHistogram::percentile(const int percent) const
+{
+    if (!m_count)
+        return 0;
+    // The rank of the requested value, counting from one
+    quint64 rank = (m_count * percent + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    quint64 seen = 0;
+    for (int i = 0; i < m_buckets.size(); ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank)
+            return qMin(upperBound(i), m_max);
+    }
+    return m_max;
+}
+
+QVector<QPair<quint64, quint64> > LatencyHistogram::buckets() const
+{
+    QVector<QPair<quint64, quint64> > res;
+    for (int i = 0; i < m_buckets.size(); ++i) {
+        if (m_buckets[i])
+            res << qMakePair(upperBound(i), m_buckets[i]);
+    }
+    return res;
+}
+
+TaskStatistics::TaskStatistics(Model *model): QObject(model)
+{
+}
+
+void TaskStatistics::taskFinished(const ImapTask *const task, const bool succeeded)
+{
+    QString className = QLatin1String(task->metaObject()->className());
+    className.remove(QLatin1String("Imap::Mailbox::"));
+    record(className, succeeded, task->queueTime(), task->firstResponseLatency(), task->completionLatency(),
+           task->bytesSent(), task->bytesReceived());
+}
+
+void TaskStatistics::record(const QString &taskType, const bool succeeded, const qint64 queueTime, const qint64 firstResponse,
+                            const qint64 completion, const quint64 bytesSent, const quint64 bytesReceived)
+{
+    PerType &stats = m_perType[taskType];
+    if (succeeded)
+        ++stats.completed;
+    else
+        ++stats.failed;
+
+    // Tasks which have never made it to the active state, or which have not sent anything, have no meaningful latencies
+    if (queueTime >= 0)
+        stats.queueTime.add(queueTime);
+    if (firstResponse >= 0)
+        stats.firstResponse.add(firstResponse);
+    if (completion >= 0)
+        stats.completion.add(completion);
+    stats.bytesSent.add(bytesSent);
+    stats.bytesReceived.add(bytesReceived);
+}
+
+void TaskStatistics::untaggedDataReceived(const uint parserId, const quint64 bytes)
+{
+    m_untaggedBytes[parserId] += bytes;
+}
+
+QString TaskStatistics::describe() const
+{
+    QString buf;
+    QTextStream ss(&buf);
+    ss << qSetFieldWidth(32) << left << "Task" << qSetFieldWidth(8) << right << "done" << "failed"
+       << qSetFieldWidth(14) << "queue p50/p99" << "1st rsp p50/p99" << "total p50/p99"
+       << qSetFieldWidth(12) << "bytes out" << "bytes in" << qSetFieldWidth(0) << "\n";
+    for (QMap<QString, PerType>::const_iterator it = m_perType.constBegin(); it != m_perType.constEnd(); ++it) {
+        const PerType &stats = *it;
+        ss << qSetFieldWidth(32) << left << it.key() << qSetFieldWidth(8) << right << stats.completed << stats.failed
+           << qSetFieldWidth(14)
+           << QString::fromUtf8("%1/%2").arg(stats.queueTime.percentile(50)).arg(stats.queueTime.percentile(99))
+           << QString::fromUtf8("%1/%2").arg(stats.firstResponse.percentile(50)).arg(stats.firstResponse.percentile(99))
+           << QString::fromUtf8("%1/%2").arg(stats.completion.percentile(50)).arg(stats.completion.percentile(99))
+           << qSetFieldWidth(12) << stats.bytesSent.sum() << stats.bytesReceived.sum() << qSetFieldWidth(0) << "\n";
+    }
+    for (QMap<uint, quint64>::const_iterator it = m_untaggedBytes.constBegin(); it != m_untaggedBytes.constEnd(); ++it) {
+        ss << "Connection " << it.key() << ": " << *it << " bytes of untagged responses\n";
+    }
+    ss.flush();
+    return buf;
+}
+
+namespace {
+
+void dumpHistogram(QTextStream &ss, const char *name, const LatencyHistogram &histogram)
+{
+    ss << "\"" << name << "\":{\"count\":" << histogram.count() << ",\"sum\":" << histogram.sum()
+       << ",\"max\":" << histogram.max() << ",\"p50\":" << histogram.percentile(50) << ",\"p90\":" << histogram.percentile(90)
+       << ",\"p99\":" << histogram.percentile(99) << ",\"buckets\":[";
+    QVector<QPair<quint64, quint64> > buckets = histogram.buckets();
+    for (int i = 0; i < buckets.size(); ++i) {
+        if (i)
+            ss << ",";
+        ss << "[" << buckets[i].first << "," << buckets[i].second << "]";
+    }
+    ss << "]}";
+}
+
+}
+
+QByteArray TaskStatistics::toJson() const
+{
+    QByteArray buf;
+    QTextStream ss(&buf);
+    ss << "{\"units\":{\"latency\":\"ms\",\"traffic\":\"bytes\"},\"tasks\":{";
+    for (QMap<QString, PerType>::const_iterator it = m_perType.constBegin(); it != m_perType.constEnd(); ++it) {
+        const PerType &stats = *it;
+        if (it != m_perType.constBegin())
+            ss << ",";
+        // The class names are plain C++ identifiers, so there's nothing to escape
+        ss << "\n\"" << it.key() << "\":{\"completed\":" << stats.completed << ",\"failed\":" << stats.failed << ",";
+        dumpHistogram(ss, "queueTime", stats.queueTime);
+        ss << ",";
+        dumpHistogram(ss, "firstResponse", stats.firstResponse);
+        ss << ",";
+        dumpHistogram(ss, "completion", stats.completion);
+        ss << ",";
+        dumpHistogram(ss, "bytesSent", stats.bytesSent);
+        ss << ",";
+        dumpHistogram(ss, "bytesReceived", stats.bytesReceived);
+        ss << "}";
+    }
+    ss << "\n},\"connections\":{";
+    for (QMap<uint, quint64>::const_iterator it = m_untaggedBytes.constBegin(); it != m_untaggedBytes.constEnd(); ++it) {
+        if (it != m_untaggedBytes.constBegin())
+            ss << ",";
+        ss << "\n\"" << it.key() << "\":{\"untaggedBytesReceived\":" << *it << "}";
+    }
+    ss << "\n}}\n";
+    ss.flush();
+    return buf;
+}
+
+void TaskStatistics::reset()
+{
+    m_perType.clear();
+    m_untaggedBytes.clear();
+}
+
+}
+}
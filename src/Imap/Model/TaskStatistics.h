@@ -0,0 +1,120 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_TASKSTATISTICS_H
+#define IMAP_MODEL_TASKSTATISTICS_H
+
+#include <QMap>
+#include <QObject>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class ImapTask;
+class Model;
+
+/** @short Histogram with exponentially growing buckets
+
+Bucket number N counts the values which are less than or equal to 2^N and bigger than the upper bound of the previous
+bucket, so both milliseconds and bytes fit into a reasonable number of buckets. The percentiles are therefore only
+accurate to within a factor of two; they report the upper bound of the matching bucket.
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void add(const quint64 value);
+    quint64 count() const { return m_count; }
+    quint64 sum() const { return m_sum; }
+    quint64 max() const { return m_max; }
+    /** @short Upper bound of the bucket containing the @arg percent -th percentile, or 0 if empty */
+    quint64 percentile(const int percent) const;
+    /** @short Pairs of an upper bound and the number of values in that bucket, skipping the empty ones */
+    QVector<QPair<quint64, quint64> > buckets() const;
+
+private:
+    static int bucketFor(quint64 value);
+    static quint64 upperBound(const int bucket) { return Q_UINT64_C(1) << bucket; }
+
+    QVector<quint64> m_buckets;
+    quint64 m_count;
+    quint64 m_sum;
+    quint64 m_max;
+};
+
+/** @short Latency and traffic of the finished ImapTasks, aggregated per task class
+
+Each ImapTask reports here once it finishes. The untagged responses which arrive while a single command is in flight are
+a part of that task's figures. When more commands are pipelined, they cannot be attributed to any particular task, so their
+size is only tracked per connection. The figures are kept for the lifetime of the Model, can be shown in the GUI via
+describe() and exported through toJson() for further processing.
+*/
+class TaskStatistics : public QObject
+{
+    Q_OBJECT
+public:
+    struct PerType {
+        quint64 completed;
+        quint64 failed;
+        LatencyHistogram queueTime;
+        LatencyHistogram firstResponse;
+        LatencyHistogram completion;
+        LatencyHistogram bytesSent;
+        LatencyHistogram bytesReceived;
+
+        PerType(): completed(0), failed(0) {}
+    };
+
+    explicit TaskStatistics(Model *model);
+
+    /** @short The @arg task has just finished, either successfully or not */
+    void taskFinished(const ImapTask *const task, const bool succeeded);
+    /** @short Add the figures of a finished task of the given @arg taskType; the negative latencies are not known */
+    void record(const QString &taskType, const bool succeeded, const qint64 queueTime, const qint64 firstResponse,
+                const qint64 completion, const quint64 bytesSent, const quint64 bytesReceived);
+    /** @short The connection @arg parserId has received an untagged response of @arg bytes which no task can claim */
+    void untaggedDataReceived(const uint parserId, const quint64 bytes);
+
+    QMap<QString, PerType> perType() const { return m_perType; }
+    /** @short Size of the untagged responses received while more commands were in flight, indexed by the ID of the connection */
+    QMap<uint, quint64> untaggedBytes() const { return m_untaggedBytes; }
+    /** @short Plain-text table with one line per task type */
+    QString describe() const;
+    /** @short The complete histograms as a JSON document */
+    QByteArray toJson() const;
+    void reset();
+
+private:
+    QMap<QString, PerType> m_perType;
+    QMap<uint, quint64> m_untaggedBytes;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_TASKSTATISTICS_H
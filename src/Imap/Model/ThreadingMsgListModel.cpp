@@ -658,6 +658,48 @@ static void gatherAllUidsFromThreadNode(QVector<uint> &uids, const QVector<Respo
     }
 }
 
+/** @short Remove the messages with the given UIDs from the mapping, their children take their place */
+static void removeUidsFromThreadNode(QVector<Responses::ThreadingNode> &list, const QSet<uint> &uids)
+{
+    QVector<Responses::ThreadingNode> res;
+    res.reserve(list.size());
+    for (QVector<Responses::ThreadingNode>::iterator it = list.begin(); it != list.end(); ++it) {
+        removeUidsFromThreadNode(it->children, uids);
+        if (uids.contains(it->num)) {
+            res += it->children;
+        } else if (it->num || !it->children.isEmpty()) {
+            // Placeholders for missing messages are kept only as long as they have something below them
+            res.push_back(*it);
+        }
+    }
+    list = res;
+}
+
+/** @short Apply the result of an incremental THREAD to the mapping which it was requested for */
+static void applyIncrementalThreading(QVector<Responses::ThreadingNode> &mapping,
+                                      const Responses::ESearch::IncrementalThreadingData_t &data, const QVector<uint> &affectedUids)
+{
+    QSet<uint> uids;
+    Q_FOREACH(const uint uid, affectedUids) {
+        if (uid)
+            uids.insert(uid);
+    }
+    removeUidsFromThreadNode(mapping, uids);
+
+    for (Responses::ESearch::IncrementalThreadingData_t::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
+        int offset = 0;
+        for (int i = 0; i < mapping.size(); ++i) {
+            if (mapping[i].num && mapping[i].num == it->previousThreadRoot) {
+                offset = i + 1;
+                break;
+            }
+        }
+        for (int i = 0; i < it->thread.size(); ++i) {
+            mapping.insert(offset + i, it->thread[i]);
+        }
+    }
+}
+
 void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::ESearch::IncrementalThreadingData_t &data)
 {
     // Preparation: get through to the real model
@@ -715,6 +757,13 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
     }
     updatePersistentIndexesPhase2();
     emit layoutChanged();
+
+    // The cached threading is what the incremental request was based on, so it can be brought up to date without asking for
+    // the whole THREAD response when the mailbox gets opened again. The cache only stores what has changed.
+    const QString mailboxName = mailboxIndex.data(RoleMailboxName).toString();
+    QVector<Responses::ThreadingNode> mapping = realModel->cache()->messageThreading(mailboxName);
+    applyIncrementalThreading(mapping, data, affectedUids);
+    realModel->cache()->setMessageThreading(mailboxName, mapping);
 }
 
 void ThreadingMsgListModel::slotIncrementalThreadingFailed()
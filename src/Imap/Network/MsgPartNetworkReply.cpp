@@ -19,6 +19,7 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <limits>
 #include <QDebug>
 #include <QStringList>
 #include <QTimer>
@@ -47,8 +48,26 @@ MsgPartNetworkReply::MsgPartNetworkReply(MsgPartNetAccessManager *parent, const
     setOpenMode(QIODevice::ReadOnly | QIODevice::Unbuffered);
     Q_ASSERT(part.isValid());
 
+    const Mailbox::Model *model = 0;
+    QModelIndex realIndex;
+    Mailbox::Model::realTreeItem(part, &model, &realIndex);
+
+    // Big parts which the cache keeps as plain files are served straight from the disk, without loading them into the model
+    if (model && mapCachedFile(model->cachedMessagePartFile(realIndex))) {
+        buffer.setBuffer(&m_mappedData);
+        buffer.open(QIODevice::ReadOnly);
+        QTimer::singleShot(0, this, SLOT(slotMyDataChanged()));
+        return;
+    }
+
     connect(part.model(), SIGNAL(dataChanged(QModelIndex,QModelIndex)), this, SLOT(slotModelDataChanged(QModelIndex,QModelIndex)));
 
+    if (model) {
+        realPart = realIndex;
+        connect(model, SIGNAL(messagePartDownloadProgress(QModelIndex,qint64,qint64)),
+                this, SLOT(slotDownloadProgress(QModelIndex,qint64,qint64)));
+    }
+
     // We have to ask for contents before we check whether it's already fetched
     part.data(Imap::Mailbox::RolePartData);
 
@@ -77,16 +96,18 @@ void MsgPartNetworkReply::slotModelDataChanged(const QModelIndex &topLeft, const
 /** @short Data for the current message part are available now */
 void MsgPartNetworkReply::slotMyDataChanged()
 {
-    if (part.data(Mailbox::RoleIsUnavailable).toBool()) {
-        setError(TimeoutError, tr("Offline"));
-        emit error(TimeoutError);
-        emit finished();
-        return;
+    if (!m_file.isOpen()) {
+        if (part.data(Mailbox::RoleIsUnavailable).toBool()) {
+            setError(TimeoutError, tr("Offline"));
+            emit error(TimeoutError);
+            emit finished();
+            return;
+        }
+
+        if (!part.data(Mailbox::RoleIsFetched).toBool())
+            return;
     }
 
-    if (!part.data(Mailbox::RoleIsFetched).toBool())
-        return;
-
     MsgPartNetAccessManager *netAccess = qobject_cast<MsgPartNetAccessManager*>(manager());
     Q_ASSERT(netAccess);
     QString mimeType = netAccess->translateToSupportedMimeType(part.data(Mailbox::RolePartMimeType).toString());
@@ -102,9 +123,24 @@ void MsgPartNetworkReply::slotMyDataChanged()
     emit finished();
 }
 
-/** @short QIODevice compatibility */
+/** @short Forward the progress of a chunked download of our part */
+void MsgPartNetworkReply::slotDownloadProgress(const QModelIndex &index, qint64 received, qint64 total)
+{
+    if (index == realPart)
+        emit downloadProgress(received, total);
+}
+
+/** @short QIODevice compatibility
+
+Nobody is going to read the data, so there's no point in continuing with the download.
+*/
 void MsgPartNetworkReply::abort()
 {
+    if (realPart.isValid() && !realPart.data(Mailbox::RoleIsFetched).toBool()) {
+        Mailbox::Model *model = qobject_cast<Mailbox::Model*>(const_cast<QAbstractItemModel*>(realPart.model()));
+        Q_ASSERT(model);
+        model->cancelPartDownload(realPart);
+    }
     close();
 }
 
@@ -130,14 +166,46 @@ qint64 MsgPartNetworkReply::readData(char *data, qint64 maxSize)
 }
 
 
-/** @short Cut the buffer connection in case the message got removed */
+/** @short Cut the buffer connection in case the message got removed
+
+The data which come from a file do not depend on the model, so they remain available.
+*/
 void MsgPartNetworkReply::disconnectBufferIfVanished() const
 {
-    if (!part.isValid()) {
+    if (!part.isValid() && !m_file.isOpen()) {
         buffer.close();
         buffer.setBuffer(0);
     }
 }
 
+/** @short Map the whole file into memory and make it the source of our data
+
+The mapping stays valid even when the cache removes the file in the meanwhile. That is not the case on Windows where an open
+file cannot be removed at all, and the cache would leak it, so the data are read through the model there.
+*/
+bool MsgPartNetworkReply::mapCachedFile(const QString &fileName)
+{
+#ifdef Q_OS_WIN32
+    Q_UNUSED(fileName);
+    return false;
+#else
+    if (fileName.isEmpty())
+        return false;
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+    qint64 size = m_file.size();
+    uchar *data = 0;
+    if (size > 0 && size <= std::numeric_limits<int>::max())
+        data = m_file.map(0, size);
+    if (!data) {
+        m_file.close();
+        return false;
+    }
+    m_mappedData = QByteArray::fromRawData(reinterpret_cast<const char *>(data), static_cast<int>(size));
+    return true;
+#endif
+}
+
 }
 }
@@ -23,6 +23,7 @@
 #define MSGPARTNETWORKREPLY_H
 
 #include <QBuffer>
+#include <QFile>
 #include <QModelIndex>
 #include <QNetworkReply>
 
@@ -45,13 +46,21 @@ public:
 public slots:
     void slotModelDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
     void slotMyDataChanged();
+    void slotDownloadProgress(const QModelIndex &index, qint64 received, qint64 total);
 protected:
     virtual qint64 readData(char *data, qint64 maxSize);
 private:
     void disconnectBufferIfVanished() const;
+    bool mapCachedFile(const QString &fileName);
 
     QPersistentModelIndex part;
+    /** @short The same part as seen by the Imap::Mailbox::Model, without any proxies */
+    QPersistentModelIndex realPart;
     mutable QBuffer buffer;
+    /** @short The cache file which provides the data instead of the model, if any */
+    QFile m_file;
+    /** @short The memory-mapped contents of the m_file */
+    QByteArray m_mappedData;
 
     MsgPartNetworkReply(const MsgPartNetworkReply &); // don't implement
     MsgPartNetworkReply &operator=(const MsgPartNetworkReply &); // don't implement
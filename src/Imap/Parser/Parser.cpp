@@ -28,6 +28,7 @@
 #include <QTime>
 #include <QTimer>
 #include "Parser.h"
+#include "Common/MonotonicClock.h"
 #include "Imap/Encoders.h"
 #include "LowLevelParser.h"
 #include "../../Streams/IODeviceSocket.h"
@@ -568,6 +569,18 @@ CommandHandle Parser::enable(const QList<QByteArray> &extensions)
     return queueCommand(cmd);
 }
 
+CommandHandle Parser::notifySet(const QList<QByteArray> &eventGroups, const bool requestStatus)
+{
+    Commands::Command cmd("NOTIFY");
+    cmd << Commands::PartOfCommand(Commands::ATOM, "SET");
+    if (requestStatus)
+        cmd << Commands::PartOfCommand(Commands::ATOM, "STATUS");
+    Q_FOREACH(const QByteArray &group, eventGroups) {
+        cmd << Commands::PartOfCommand(Commands::ATOM, group);
+    }
+    return queueCommand(cmd);
+}
+
 CommandHandle Parser::genUrlAuth(const QByteArray &url, const QByteArray mechanism)
 {
     Commands::Command cmd("GENURLAUTH");
@@ -788,6 +801,8 @@ void Parser::executeACommand()
 {
     Q_ASSERT(! cmdQueue.isEmpty());
     Commands::Command &cmd = cmdQueue.first();
+    // The DONE which terminates an IDLE is the only thing without a tag of its own
+    const CommandHandle tag = cmd.cmds.first().kind == Commands::IDLE_DONE ? CommandHandle() : cmd.cmds.first().text;
 
     QByteArray buf;
 
@@ -809,7 +824,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
         qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-        socket->write(buf);
+        writeCommandData(tag, buf);
         idling = false;
         cmdQueue.pop_front();
         emit lineSent(this, buf);
@@ -853,7 +868,7 @@ void Parser::executeACommand()
                 else
                     qDebug() << m_parserId << ">>> [sensitive command] -- added literal";
 #endif
-                socket->write(buf);
+                writeCommandData(tag, buf);
                 part.numberSent = true;
                 waitingForContinuation = true;
                 Q_ASSERT(literalCommandTag.isEmpty());
@@ -871,7 +886,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
             qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-            socket->write(buf);
+            writeCommandData(tag, buf);
             idling = true;
             waitForInitialIdle = true;
             cmdQueue.pop_front();
@@ -884,7 +899,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
             qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-            socket->write(buf);
+            writeCommandData(tag, buf);
             startTlsInProgress = true;
             emit lineSent(this, buf);
             return;
@@ -895,7 +910,7 @@ void Parser::executeACommand()
 #ifdef PRINT_TRAFFIC_TX
             qDebug() << m_parserId << ">>>" << buf.left(PRINT_TRAFFIC_TX).trimmed();
 #endif
-            socket->write(buf);
+            writeCommandData(tag, buf);
             compressDeflateInProgress = true;
             cmdQueue.pop_front();
             emit lineSent(this, buf);
@@ -911,7 +926,7 @@ void Parser::executeACommand()
             else
                 qDebug() << m_parserId << ">>> [sensitive command]";
 #endif
-            socket->write(buf);
+            writeCommandData(tag, buf);
             cmdQueue.pop_front();
             emit lineSent(this, sensitiveCommand ? privateMessage : buf);
             break;
@@ -926,6 +941,56 @@ void Parser::executeACommand()
     }
 }
 
+void Parser::writeCommandData(const CommandHandle &tag, const QByteArray &data)
+{
+    socket->write(data);
+
+    CommandHandle owner = tag;
+    if (owner.isEmpty()) {
+        // The DONE belongs to the IDLE
+        if (m_commandsInFlight.isEmpty())
+            return;
+        owner = m_commandsInFlight.last();
+    }
+    CommandStatistics &stats = m_commandStatistics[owner];
+    if (stats.sentAt < 0) {
+        stats.sentAt = Common::monotonicMsecs();
+        m_commandsInFlight.append(owner);
+    }
+    stats.bytesSent += data.size();
+}
+
+void Parser::accountReceivedLine(const QByteArray &line)
+{
+    CommandHandle owner;
+    if (line.startsWith("* ")) {
+        // With a single command in flight, the untagged response is obviously a part of the reply to it. Otherwise there's
+        // no telling which command it belongs to, so its size is only counted per connection by the TaskStatistics.
+        if (!hasSingleCommandInFlight())
+            return;
+        owner = m_commandsInFlight.first();
+    } else if (line.startsWith("+ ")) {
+        // A continuation request is meant for the command which is being sent right now
+        if (m_commandsInFlight.isEmpty())
+            return;
+        owner = m_commandsInFlight.last();
+    } else {
+        owner = line.left(line.indexOf(' '));
+        if (!m_commandsInFlight.removeOne(owner))
+            return;
+    }
+    CommandStatistics &stats = m_commandStatistics[owner];
+    stats.bytesReceived += line.size();
+    if (stats.firstResponseAt < 0)
+        stats.firstResponseAt = Common::monotonicMsecs();
+}
+
+void Parser::forgetCommandStatistics(const CommandHandle &tag)
+{
+    m_commandStatistics.remove(tag);
+    m_commandsInFlight.removeOne(tag);
+}
+
 /** @short Process a line from IMAP server */
 void Parser::processLine(QByteArray line)
 {
@@ -937,6 +1002,7 @@ void Parser::processLine(QByteArray line)
         qDebug() << m_parserId << "<<<" << debugLine;
 #endif
     emit lineReceived(this, line);
+    accountReceivedLine(line);
     if (m_expectsInitialGreeting && !line.startsWith("* ")) {
         throw NotAnImapServerError(std::string(), line, -1);
     } else if (line.startsWith("* ")) {
@@ -54,6 +54,22 @@ typedef QByteArray CommandHandle;
 // this is required for clang 3.0
 typedef QMap<QByteArray, quint64> MapByteArrayUint64;
 
+/** @short Traffic and timing of a single command, see Parser::commandStatistics()
+
+The timestamps come from Common::monotonicMsecs().
+*/
+struct CommandStatistics
+{
+    /** @short When the command started to go out, or -1 if it hasn't been sent yet */
+    qint64 sentAt;
+    /** @short When the first response which surely belongs to this command has arrived, or -1 */
+    qint64 firstResponseAt;
+    quint64 bytesSent;
+    quint64 bytesReceived;
+
+    CommandStatistics(): sentAt(-1), firstResponseAt(-1), bytesSent(0), bytesReceived(0) {}
+};
+
 /** @short Class that does all IMAP parsing */
 class Parser : public QObject
 {
@@ -72,6 +88,18 @@ public:
     /** @short Checks for waiting responses */
     bool hasResponse() const;
 
+    /** @short Return what we know about the traffic caused by the command with the given @arg tag
+
+    The outgoing bytes are exact. The incoming ones include the tagged response and the continuation requests. The untagged
+    responses are credited to the command as well when it is the only one in flight; otherwise there's no way of telling
+    which command they belong to, so these are accounted per connection by the TaskStatistics instead.
+    */
+    CommandStatistics commandStatistics(const CommandHandle &tag) const { return m_commandStatistics.value(tag); }
+    /** @short Is there exactly one command in flight, so that the untagged responses can be credited to it? */
+    bool hasSingleCommandInFlight() const { return m_commandsInFlight.size() == 1; }
+    /** @short Stop tracking the command with the given @arg tag */
+    void forgetCommandStatistics(const CommandHandle &tag);
+
     /** @short De-queue and return parsed response */
     QSharedPointer<Responses::AbstractResponse> getResponse();
 
@@ -263,6 +291,13 @@ public slots:
     /** @short ENABLE command, RFC 6151 */
     CommandHandle enable(const QList<QByteArray> &extensions);
 
+    /** @short NOTIFY SET command, RFC 5465
+
+    Each of the @arg eventGroups is a complete, parenthesized event group like "(personal (MessageNew MessageExpunge))".
+    If @arg requestStatus is set, the server is asked to send the initial STATUS for all affected mailboxes.
+    */
+    CommandHandle notifySet(const QList<QByteArray> &eventGroups, const bool requestStatus);
+
     /** @short COMPRESS DEFLATE, RFC 4978 */
     CommandHandle compressDeflate();
 
@@ -361,6 +396,11 @@ private:
     /** @short Add parsed response to the internal queue, emit notification signal */
     void queueResponse(const QSharedPointer<Responses::AbstractResponse> &resp);
 
+    /** @short Send a piece of the command @arg tag to the server and account for it */
+    void writeCommandData(const CommandHandle &tag, const QByteArray &data);
+    /** @short Attribute a @arg line received from the server to one of the commands in flight */
+    void accountReceivedLine(const QByteArray &line);
+
     /** @short Connection to the IMAP server */
     Streams::Socket *socket;
 
@@ -396,6 +436,10 @@ private:
 
     /** @short Unique-id for debugging purposes */
     uint m_parserId;
+
+    QMap<CommandHandle, CommandStatistics> m_commandStatistics;
+    /** @short Commands which have been sent, but not completed yet, the oldest first */
+    QList<CommandHandle> m_commandsInFlight;
 };
 
 QTextStream &operator<<(QTextStream &stream, const Sequence &s);
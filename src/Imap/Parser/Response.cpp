@@ -885,6 +885,14 @@ Fetch::Fetch(const uint number, const QByteArray &line, int &start): number(numb
                 throw UnexpectedHere("FETCH identifier contains \"[\", but no matching \"]\" was found", line, posBeforeIdentifier);
             identifier = line.mid(posBeforeIdentifier, pos - posBeforeIdentifier + 1).toUpper();
             start = pos + 1;
+            if (start < line.size() && line[start] == '<') {
+                // A partial FETCH reports the origin octet as BODY[section]<origin>
+                pos = line.indexOf('>', start);
+                if (pos == -1)
+                    throw UnexpectedHere("FETCH identifier contains \"<\", but no matching \">\" was found", line, start);
+                identifier += line.mid(start, pos - start + 1);
+                start = pos + 1;
+            }
         }
 
         if (data.contains(identifier))
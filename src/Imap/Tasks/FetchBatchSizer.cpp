@@ -0,0 +1,159 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include "FetchBatchSizer.h"
+
+namespace {
+
+/** @short How many latency samples to consider for the RTT estimate */
+const int latencyWindow = 16;
+
+/** @short Don't derive the throughput from FETCHes which are too small to be dominated by the actual transfer */
+const quint64 minBytesForThroughputSample = 16 * 1024;
+
+/** @short Exponentially weighted moving average with the weight of 1/4 for the new sample */
+template <typename T>
+T ewma(const T oldValue, const T sample)
+{
+    return oldValue ? (3 * oldValue + sample) / 4 : sample;
+}
+
+/** @short Is the change between these two values worth reporting? */
+template <typename T>
+bool changedSignificantly(const T oldValue, const T newValue)
+{
+    return newValue > oldValue + oldValue / 4 || oldValue > newValue + newValue / 4;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+const uint FetchBatchSizer::minBytesPerGroup = 64 * 1024;
+const uint FetchBatchSizer::maxBytesPerGroup = 16 * 1024 * 1024;
+const int FetchBatchSizer::minMessagesPerGroup = 20;
+const int FetchBatchSizer::maxMessagesPerGroup = 1000;
+const int FetchBatchSizer::minParallelTasks = 2;
+const int FetchBatchSizer::maxParallelTasks = 50;
+
+FetchBatchSizer::FetchBatchSizer():
+    m_throughput(0), m_groupBytes(0), m_usecPerMessage(0), m_bytesPerGroup(1024 * 1024), m_messagesPerGroup(300),
+    m_parallelTasks(10)
+{
+}
+
+void FetchBatchSizer::reset(const uint bytesPerGroup, const int messagesPerGroup, const int parallelTasks)
+{
+    m_latencies.clear();
+    m_throughput = 0;
+    m_groupBytes = 0;
+    m_usecPerMessage = 0;
+    m_bytesPerGroup = bytesPerGroup;
+    m_messagesPerGroup = messagesPerGroup;
+    m_parallelTasks = parallelTasks;
+}
+
+void FetchBatchSizer::addLatencySample(const qint64 latencyMs)
+{
+    m_latencies.append(qMax<qint64>(latencyMs, 1));
+    while (m_latencies.size() > latencyWindow)
+        m_latencies.removeFirst();
+}
+
+void FetchBatchSizer::addPartSample(const quint64 bytes, const qint64 latencyMs, const qint64 transferMs)
+{
+    addLatencySample(latencyMs);
+    m_groupBytes = ewma(m_groupBytes, qMax<quint64>(bytes, 1));
+    if (bytes >= minBytesForThroughputSample) {
+        m_throughput = ewma(m_throughput, bytes * 1000 / qMax<qint64>(transferMs, 1));
+    }
+}
+
+void FetchBatchSizer::addMetadataSample(const int messages, const qint64 latencyMs, const qint64 transferMs)
+{
+    Q_ASSERT(messages > 0);
+    addLatencySample(latencyMs);
+    m_usecPerMessage = ewma(m_usecPerMessage, qMax<qint64>(transferMs * 1000 / messages, 1));
+}
+
+qint64 FetchBatchSizer::rttEstimate() const
+{
+    if (m_latencies.isEmpty())
+        return -1;
+    qint64 res = m_latencies.first();
+    Q_FOREACH(const qint64 latency, m_latencies) {
+        res = qMin(res, latency);
+    }
+    return res;
+}
+
+bool FetchBatchSizer::recompute()
+{
+    const qint64 rtt = rttEstimate();
+    if (rtt < 0)
+        return false;
+
+    // Each group shall take a few RTTs to transfer, so that the per-command overhead does not dominate,
+    // but not so long that the user would be waiting for a huge chunk of data before anything shows up.
+    const qint64 targetGroupMs = qBound<qint64>(100, 2 * rtt, 2000);
+
+    const uint oldBytes = m_bytesPerGroup;
+    const int oldMessages = m_messagesPerGroup;
+    const int oldParallel = m_parallelTasks;
+
+    if (m_throughput) {
+        m_bytesPerGroup = static_cast<uint>(qBound<quint64>(minBytesPerGroup, m_throughput * targetGroupMs / 1000,
+                                                            maxBytesPerGroup));
+
+        // Keep at least a bandwidth-delay product worth of data in flight. The groups which we actually send are often
+        // much smaller than the limit (only messages sharing the same set of parts can be grouped together), so the
+        // number of commands is derived from what the recent groups looked like.
+        const quint64 bdp = m_throughput * rtt / 1000;
+        const quint64 groupBytes = qBound<quint64>(1, m_groupBytes, m_bytesPerGroup);
+        m_parallelTasks = qBound<int>(minParallelTasks, static_cast<int>(std::ceil(double(bdp) / groupBytes)) + 1,
+                                      maxParallelTasks);
+    }
+
+    if (m_usecPerMessage) {
+        m_messagesPerGroup = static_cast<int>(qBound<qint64>(minMessagesPerGroup, targetGroupMs * 1000 / m_usecPerMessage,
+                                                             maxMessagesPerGroup));
+    }
+
+    return changedSignificantly(oldBytes, m_bytesPerGroup) || changedSignificantly(oldMessages, m_messagesPerGroup)
+            || oldParallel != m_parallelTasks;
+}
+
+QString FetchBatchSizer::describe() const
+{
+    return QString::fromUtf8("RTT %1 ms, throughput %2 kB/s, %3 us per envelope -> %4 kB or %5 messages per group, "
+                             "%6 parallel FETCHes")
+            .arg(QString::number(rttEstimate()), QString::number(m_throughput / 1024), QString::number(m_usecPerMessage),
+                 QString::number(m_bytesPerGroup / 1024), QString::number(m_messagesPerGroup),
+                 QString::number(m_parallelTasks));
+}
+
+}
+}
@@ -0,0 +1,106 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_TASK_FETCHBATCHSIZER_H
+#define IMAP_TASK_FETCHBATCHSIZER_H
+
+#include <QList>
+#include <QString>
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Adaptive sizing of the FETCH groups issued by the KeepMailboxOpenTask
+
+The KeepMailboxOpenTask groups requests for message parts and envelopes into UID FETCH commands. Static limits for the size
+of these groups and for the number of commands which are in flight at once cannot fit both a LAN-attached server and a phone
+on a flaky 3G link. This class watches how long the individual FETCH commands take and how many bytes they transfer, keeps
+running estimates of the round-trip time and of the available throughput and derives the group sizes and the number of
+parallel commands from the resulting bandwidth-delay product.
+
+The configured limits are used as the initial values before any measurement is available.
+*/
+class FetchBatchSizer
+{
+public:
+    FetchBatchSizer();
+
+    /** @short Start from scratch, using the given values as the initial limits */
+    void reset(const uint bytesPerGroup, const int messagesPerGroup, const int parallelTasks);
+
+    /** @short Record a finished FETCH of message parts
+
+    @arg bytes the expected size of the data which the command has transferred
+    @arg latencyMs the time from sending the command till its tagged completion
+    @arg transferMs the part of the latency which was not spent waiting for the previous pipelined commands
+    */
+    void addPartSample(const quint64 bytes, const qint64 latencyMs, const qint64 transferMs);
+
+    /** @short Record a finished FETCH of message metadata for @arg messages messages */
+    void addMetadataSample(const int messages, const qint64 latencyMs, const qint64 transferMs);
+
+    /** @short Update the limits from the current estimates, return true if they have changed significantly */
+    bool recompute();
+
+    uint bytesPerGroup() const { return m_bytesPerGroup; }
+    int messagesPerGroup() const { return m_messagesPerGroup; }
+    int parallelTasks() const { return m_parallelTasks; }
+
+    /** @short Estimated round-trip time in milliseconds, or -1 if unknown */
+    qint64 rttEstimate() const;
+    /** @short Estimated throughput in bytes per second, or 0 if unknown */
+    quint64 throughputEstimate() const { return m_throughput; }
+
+    /** @short Human-readable summary of the estimates and of the current limits for the debug log */
+    QString describe() const;
+
+    static const uint minBytesPerGroup;
+    static const uint maxBytesPerGroup;
+    static const int minMessagesPerGroup;
+    static const int maxMessagesPerGroup;
+    static const int minParallelTasks;
+    static const int maxParallelTasks;
+
+private:
+    void addLatencySample(const qint64 latencyMs);
+
+    /** @short Recent latencies; their minimum approximates the RTT */
+    QList<qint64> m_latencies;
+    /** @short Exponentially weighted moving average of the throughput, in bytes per second */
+    quint64 m_throughput;
+    /** @short Exponentially weighted moving average of the size of the part groups */
+    quint64 m_groupBytes;
+    /** @short Exponentially weighted moving average of the server's per-message cost of a metadata fetch, in microseconds */
+    qint64 m_usecPerMessage;
+
+    uint m_bytesPerGroup;
+    int m_messagesPerGroup;
+    int m_parallelTasks;
+};
+
+}
+}
+
+#endif // IMAP_TASK_FETCHBATCHSIZER_H
@@ -0,0 +1,270 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "FetchMsgPartInChunksTask.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+#include "KeepMailboxOpenTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+FetchMsgPartInChunksTask::FetchMsgPartInChunksTask(Model *model, const QModelIndex &mailbox, const uint uid, const QByteArray &fetchItem):
+    ImapTask(model), mailboxIndex(mailbox), m_uid(uid), m_fetchItem(fetchItem), m_responseItem(fetchItem), m_offset(0),
+    m_lastChunk(-1), m_paused(false)
+{
+    m_responseItem.replace(".PEEK", "");
+    bool ok;
+    m_chunkSize = model->property("trojita-imap-part-chunk-size").toUInt(&ok);
+    if (!ok || !m_chunkSize)
+        m_chunkSize = 256 * 1024;
+    conn = model->findTaskResponsibleFor(mailboxIndex);
+    conn->addDependentTask(this);
+}
+
+TreeItemMailbox *FetchMsgPartInChunksTask::mailboxIfValid() const
+{
+    return mailboxIndex.isValid() ? Model::mailboxForSomeItem(mailboxIndex) : 0;
+}
+
+TreeItemPart *FetchMsgPartInChunksTask::part(TreeItemMailbox *mailbox) const
+{
+    TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    TreeItemMessage *message = list->findMessageByUid(m_uid);
+    if (!message || !message->fetched())
+        return 0;
+    try {
+        return mailbox->partIdToPtr(model, message, m_fetchItem);
+    } catch (const UnknownMessageIndex &) {
+        return 0;
+    }
+}
+
+void FetchMsgPartInChunksTask::perform()
+{
+    parser = conn->parser;
+    markAsActiveTask();
+
+    if (_dead) {
+        finish(tr("Asked to die"), KEEP_PARTIAL_DATA);
+        return;
+    }
+    if (_aborted) {
+        finish(tr("Aborted"), KEEP_PARTIAL_DATA);
+        return;
+    }
+
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (!mailbox) {
+        finish(tr("Mailbox disappeared"), KEEP_PARTIAL_DATA);
+        return;
+    }
+
+    m_offset = static_cast<uint>(model->cache()->partialMessagePartSize(mailbox->mailbox(), m_uid, m_fetchItem));
+    if (m_offset) {
+        log(QString::fromUtf8("Resuming the download at offset %1").arg(m_offset), Common::LOG_MESSAGES);
+        reportProgress(mailbox);
+    }
+    fetchNextChunk();
+}
+
+void FetchMsgPartInChunksTask::fetchNextChunk()
+{
+    if (priority() == PRIORITY_BACKGROUND && conn->hasForegroundWork()) {
+        // Whatever the user is waiting for right now shall not queue behind a prefetch
+        m_paused = true;
+        return;
+    }
+
+    m_paused = false;
+    m_lastChunk = -1;
+    tag = parser->uidFetch(Sequence(m_uid), QList<QByteArray>() << m_fetchItem + '<' + QByteArray::number(m_offset) + '.' +
+                           QByteArray::number(m_chunkSize) + '>');
+}
+
+void FetchMsgPartInChunksTask::resume()
+{
+    if (!m_paused || _finished)
+        return;
+
+    if (_dead || _aborted) {
+        m_paused = false;
+        finish(_dead ? tr("Asked to die") : tr("Aborted"), KEEP_PARTIAL_DATA);
+        return;
+    }
+    fetchNextChunk();
+}
+
+void FetchMsgPartInChunksTask::abort()
+{
+    ImapTask::abort();
+    if (m_paused) {
+        // There's no command in flight, so there's nothing to wait for
+        m_paused = false;
+        finish(tr("Aborted"), KEEP_PARTIAL_DATA);
+    }
+}
+
+void FetchMsgPartInChunksTask::die(const QString &message)
+{
+    _dead = true;
+    if (!_finished)
+        finish(message, KEEP_PARTIAL_DATA);
+}
+
+void FetchMsgPartInChunksTask::finish(const QString &failure, const PartialData partialData)
+{
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (mailbox && partialData == DROP_PARTIAL_DATA)
+        model->cache()->forgetPartialMessagePart(mailbox->mailbox(), m_uid, m_fetchItem);
+    // Make sure that the part can be requested again; a successfully delivered one is no longer loading
+    TreeItemPart *item = mailbox ? part(mailbox) : 0;
+    if (item && item->loading())
+        item->setFetchStatus(TreeItem::NONE);
+
+    if (failure.isEmpty())
+        _completed();
+    else
+        _failed(failure);
+}
+
+bool FetchMsgPartInChunksTask::handleFetch(const Imap::Responses::Fetch *const resp)
+{
+    const QByteArray key = m_responseItem + '<' + QByteArray::number(m_offset) + '>';
+    Responses::Fetch::dataType::const_iterator chunk = resp->data.constFind(key);
+    if (chunk == resp->data.constEnd())
+        return false;
+
+    Responses::Fetch::dataType::const_iterator uidRecord = resp->data.constFind("UID");
+    if (uidRecord == resp->data.constEnd() ||
+            static_cast<const Responses::RespData<uint>&>(*(uidRecord.value())).data != m_uid)
+        return false;
+
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (!mailbox) {
+        finish(tr("Mailbox disappeared"), KEEP_PARTIAL_DATA);
+        return true;
+    }
+
+    // The data go straight to the cache, only the final assembly needs the whole part in memory
+    const QByteArray &data = static_cast<const Responses::RespData<QByteArray>&>(*(chunk.value())).data;
+    model->cache()->appendPartialMessagePart(mailbox->mailbox(), m_uid, m_fetchItem, data);
+    m_offset += data.size();
+    m_lastChunk = data.size();
+    reportProgress(mailbox);
+
+    // The server might have included some unsolicited data, such as the updated FLAGS
+    Responses::Fetch::dataType rest = resp->data;
+    rest.remove(key);
+    if (rest.size() > 1) {
+        Responses::Fetch remaining(resp->number, rest);
+        model->genericHandleFetch(mailbox, &remaining);
+    }
+    return true;
+}
+
+bool FetchMsgPartInChunksTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty() || resp->tag != tag)
+        return false;
+
+    tag.clear();
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (!mailbox) {
+        finish(tr("Mailbox disappeared"), KEEP_PARTIAL_DATA);
+        return true;
+    }
+
+    if (resp->kind != Responses::OK) {
+        finish(tr("Part fetch failed: %1").arg(resp->message), KEEP_PARTIAL_DATA);
+    } else if (m_lastChunk < 0) {
+        // The message has probably been expunged in the meanwhile
+        finish(tr("The server did not return the requested data"), DROP_PARTIAL_DATA);
+    } else if (static_cast<uint>(m_lastChunk) < m_chunkSize) {
+        finalize(mailbox);
+    } else if (_dead) {
+        finish(tr("Asked to die"), KEEP_PARTIAL_DATA);
+    } else if (_aborted) {
+        finish(tr("Aborted"), KEEP_PARTIAL_DATA);
+    } else {
+        fetchNextChunk();
+    }
+    return true;
+}
+
+void FetchMsgPartInChunksTask::finalize(TreeItemMailbox *mailbox)
+{
+    const QByteArray data = model->cache()->partialMessagePart(mailbox->mailbox(), m_uid, m_fetchItem);
+    if (static_cast<uint>(data.size()) != m_offset) {
+        // Some of the chunks have not made it into the cache, so the next attempt has to start from scratch
+        finish(tr("The partial data of the part got lost"), DROP_PARTIAL_DATA);
+        return;
+    }
+    log(QString::fromUtf8("Fetched %1 bytes of part %2").arg(QString::number(m_offset), QString::fromUtf8(m_fetchItem)),
+        Common::LOG_MESSAGES);
+
+    TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    TreeItemMessage *message = list->findMessageByUid(m_uid);
+    if (!message) {
+        finish(tr("Message disappeared"), DROP_PARTIAL_DATA);
+        return;
+    }
+
+    // Pretend that the whole part has arrived at once so that the usual code takes care of decoding and caching it
+    Responses::Fetch::dataType items;
+    items["UID"] = QSharedPointer<Responses::AbstractData>(new Responses::RespData<uint>(m_uid));
+    items[m_responseItem] = QSharedPointer<Responses::AbstractData>(new Responses::RespData<QByteArray>(data));
+    Responses::Fetch complete(message->m_offset + 1, items);
+    model->genericHandleFetch(mailbox, &complete);
+    model->finalizeFetchPart(mailbox, message->m_offset + 1, m_fetchItem);
+    finish(QString(), DROP_PARTIAL_DATA);
+}
+
+void FetchMsgPartInChunksTask::reportProgress(TreeItemMailbox *mailbox)
+{
+    TreeItemPart *item = part(mailbox);
+    if (!item)
+        return;
+    emit model->messagePartDownloadProgress(item->toIndex(model), m_offset, item->octets());
+}
+
+QString FetchMsgPartInChunksTask::debugIdentification() const
+{
+    if (!mailboxIndex.isValid())
+        return QLatin1String("[invalid mailbox]");
+
+    return QString::fromUtf8("%1: part %2 for UID %3, %4 bytes so far")
+           .arg(mailboxIndex.data(RoleMailboxName).toString(), QString::fromUtf8(m_fetchItem), QString::number(m_uid),
+                QString::number(m_offset));
+}
+
+QVariant FetchMsgPartInChunksTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Downloading a large message part")) : QVariant();
+}
+
+}
+}
@@ -0,0 +1,105 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_FETCHMSGPARTINCHUNKSTASK_H
+#define IMAP_FETCHMSGPARTINCHUNKSTASK_H
+
+#include <QPersistentModelIndex>
+#include "ImapTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class KeepMailboxOpenTask;
+class TreeItemMailbox;
+class TreeItemPart;
+
+/** @short Fetch a single large message part piece by piece
+
+Instead of asking for the whole part in one literal, the part is requested through a series of partial FETCHes of the
+BODY.PEEK[section]<offset.length> form. Each chunk is appended to the partial data in the cache as soon as it arrives and
+is not kept anywhere else, so that a download interrupted by a disconnect or by a cancellation continues from where it
+stopped the next time. Once the server returns a short chunk, the whole part is read back from the cache and handed over to
+the usual FETCH processing, which decodes it and stores it into the cache.
+
+When running in the background on behalf of a prefetch, the task lets any more urgent work on the connection go first
+between the chunks. Aborting the task takes effect at the next chunk boundary. The progress is reported through
+Model::messagePartDownloadProgress().
+*/
+class FetchMsgPartInChunksTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    FetchMsgPartInChunksTask(Model *model, const QModelIndex &mailbox, const uint uid, const QByteArray &fetchItem);
+    virtual void perform();
+    virtual void abort();
+    virtual void die(const QString &message);
+
+    /** @short Continue with the next chunk if the task has been waiting for more urgent work to finish */
+    void resume();
+
+    uint uid() const { return m_uid; }
+    QByteArray fetchItem() const { return m_fetchItem; }
+
+    virtual bool handleFetch(const Imap::Responses::Fetch *const resp);
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+
+    virtual QString debugIdentification() const;
+    virtual QVariant taskData(const int role) const;
+    virtual bool needsMailbox() const {return true;}
+private:
+    TreeItemMailbox *mailboxIfValid() const;
+    TreeItemPart *part(TreeItemMailbox *mailbox) const;
+    void fetchNextChunk();
+    /** @short All chunks are here, so let the regular code process the complete part */
+    void finalize(TreeItemMailbox *mailbox);
+    void reportProgress(TreeItemMailbox *mailbox);
+
+    typedef enum {
+        KEEP_PARTIAL_DATA, /**< @short The next attempt shall resume the download */
+        DROP_PARTIAL_DATA /**< @short The data are either complete or useless */
+    } PartialData;
+    /** @short The only way out of the task; succeed if the @arg failure is empty, and make sure the part can be requested again */
+    void finish(const QString &failure, const PartialData partialData);
+
+    CommandHandle tag;
+    KeepMailboxOpenTask *conn;
+    QPersistentModelIndex mailboxIndex;
+    uint m_uid;
+    QByteArray m_fetchItem;
+    /** @short The name of the data item in the FETCH responses, i.e. without the .PEEK */
+    QByteArray m_responseItem;
+    /** @short The amount of data received so far, including whatever was left in the cache by an earlier attempt */
+    uint m_offset;
+    uint m_chunkSize;
+    /** @short The size of the last received chunk, or -1 if nothing has arrived */
+    int m_lastChunk;
+    /** @short Is the task waiting for more urgent work to finish? */
+    bool m_paused;
+};
+
+}
+}
+
+#endif // IMAP_FETCHMSGPARTINCHUNKSTASK_H
@@ -37,7 +37,7 @@ GetAnyConnectionTask::GetAnyConnectionTask(Model *model) :
 {
     QMap<Parser *,ParserState>::iterator it = model->m_parsers.begin();
     while (it != model->m_parsers.end()) {
-        if (it->connState == CONN_STATE_LOGOUT) {
+        if (it->connState == CONN_STATE_LOGOUT || it->isDedicated) {
             // We cannot possibly use this connection
             ++it;
         } else {
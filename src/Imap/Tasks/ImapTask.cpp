@@ -22,8 +22,10 @@
 
 #include "ImapTask.h"
 #include "Common/InvokeMethod.h"
+#include "Common/MonotonicClock.h"
 #include "Imap/Model/Model.h"
 #include "Imap/Model/TaskPresentationModel.h"
+#include "Imap/Model/TaskStatistics.h"
 #include "KeepMailboxOpenTask.h"
 
 namespace Imap
@@ -32,7 +34,9 @@ namespace Mailbox
 {
 
 ImapTask::ImapTask(Model *model) :
-    QObject(model), parser(0), parentTask(0), model(model), _finished(false), _dead(false), _aborted(false)
+    QObject(model), parser(0), parentTask(0), model(model), _finished(false), _dead(false), _aborted(false),
+    m_priority(PRIORITY_NORMAL), m_createdAt(Common::monotonicMsecs()), m_activatedAt(-1), m_firstSentAt(-1),
+    m_firstResponseAt(-1), m_finishedAt(-1), m_bytesSent(0), m_bytesReceived(0), m_hasPendingCommand(false)
 {
     connect(this, SIGNAL(destroyed(QObject *)), model, SLOT(slotTaskDying(QObject *)));
     CHECK_TASK_TREE;
@@ -97,6 +101,8 @@ void ImapTask::markAsActiveTask(const TaskActivatingPosition place)
         connect(this, SIGNAL(destroyed(QObject*)), model->accessParser(parser).maintainingTask, SLOT(slotTaskDeleted(QObject*)));
     }
 
+    if (m_activatedAt < 0)
+        m_activatedAt = Common::monotonicMsecs();
     log(QLatin1String("Activated"));
     CHECK_TASK_TREE
 }
@@ -104,7 +110,18 @@ void ImapTask::markAsActiveTask(const TaskActivatingPosition place)
 bool ImapTask::handleState(const Imap::Responses::State *const resp)
 {
     handleResponseCode(resp);
-    return handleStateHelper(resp);
+    if (resp->tag.isEmpty() || !parser)
+        return handleStateHelper(resp);
+
+    // Only the task which recognizes the tag gets the credit for the traffic. The task might well finish from within
+    // handleStateHelper(), which is why recordFinished() looks at the pending command, too.
+    m_pendingCommand = parser->commandStatistics(resp->tag);
+    m_hasPendingCommand = true;
+    bool handled = handleStateHelper(resp);
+    if (handled && m_hasPendingCommand)
+        accountCommand(m_pendingCommand);
+    m_hasPendingCommand = false;
+    return handled;
 }
 
 bool ImapTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -224,6 +241,7 @@ bool ImapTask::handleParseErrorResponse(const Imap::Responses::ParseErrorRespons
 void ImapTask::_completed()
 {
     _finished = true;
+    recordFinished(true);
     log(QLatin1String("Completed"));
     Q_FOREACH(ImapTask* task, dependentTasks) {
         if (!task->isFinished())
@@ -235,6 +253,7 @@ void ImapTask::_completed()
 void ImapTask::_failed(const QString &errorMessage)
 {
     _finished = true;
+    recordFinished(false);
     killAllPendingTasks(errorMessage);
     log(QString::fromUtf8("Failed: %1").arg(errorMessage));
     emit failed(errorMessage);
@@ -293,6 +312,63 @@ void ImapTask::abort()
     }
 }
 
+void ImapTask::accountCommand(const CommandStatistics &stats)
+{
+    m_bytesSent += stats.bytesSent;
+    m_bytesReceived += stats.bytesReceived;
+    if (m_firstSentAt < 0 && stats.sentAt >= 0) {
+        m_firstSentAt = stats.sentAt;
+        m_firstResponseAt = stats.firstResponseAt;
+    }
+}
+
+void ImapTask::recordFinished(const bool succeeded)
+{
+    if (m_hasPendingCommand) {
+        accountCommand(m_pendingCommand);
+        m_hasPendingCommand = false;
+    }
+    if (m_finishedAt >= 0)
+        return;
+    m_finishedAt = Common::monotonicMsecs();
+    if (model)
+        model->m_taskStatistics->taskFinished(this, succeeded);
+}
+
+qint64 ImapTask::queueTime() const
+{
+    return m_activatedAt < 0 ? -1 : m_activatedAt - m_createdAt;
+}
+
+qint64 ImapTask::firstResponseLatency() const
+{
+    return (m_firstSentAt < 0 || m_firstResponseAt < 0) ? -1 : m_firstResponseAt - m_firstSentAt;
+}
+
+qint64 ImapTask::completionLatency() const
+{
+    return (m_activatedAt < 0 || m_finishedAt < 0) ? -1 : m_finishedAt - m_activatedAt;
+}
+
+QString ImapTask::describeStatistics() const
+{
+    QStringList res;
+    qint64 now = Common::monotonicMsecs();
+    if (m_activatedAt < 0) {
+        res << tr("Waiting for %n ms", 0, static_cast<int>(now - m_createdAt));
+    } else {
+        res << tr("Queued for %n ms", 0, static_cast<int>(queueTime()));
+        if (m_firstResponseAt >= 0)
+            res << tr("First response after %n ms", 0, static_cast<int>(firstResponseLatency()));
+        if (m_finishedAt >= 0)
+            res << tr("Finished after %n ms", 0, static_cast<int>(completionLatency()));
+        else
+            res << tr("Running for %n ms", 0, static_cast<int>(now - m_activatedAt));
+    }
+    res << tr("%1 bytes sent, %2 bytes received").arg(QString::number(m_bytesSent), QString::number(m_bytesReceived));
+    return res.join(QLatin1String("\n"));
+}
+
 QString ImapTask::debugIdentification() const
 {
     return QString();
@@ -136,6 +136,38 @@ public:
     /** @short Implemente fetching of data for TaskPresentationModel */
     virtual QVariant taskData(const int role) const = 0;
 
+    /** @short How urgent the task is
+
+    The queued tasks are started in the order of their priority, and the background ones wait until the connection has
+    finished the more important work. Tasks which have already sent their commands are never interrupted, so the bulk
+    transfers are expected to come in reasonably sized batches.
+    */
+    typedef enum {
+        PRIORITY_INTERACTIVE, /**< @short The user is waiting for the result right now */
+        PRIORITY_NORMAL, /**< @short The default */
+        PRIORITY_BACKGROUND /**< @short Bulk work which nobody is actively waiting for */
+    } TaskPriority;
+    TaskPriority priority() const { return m_priority; }
+    void setPriority(const TaskPriority priority) { m_priority = priority; }
+    /** @short Helper for sorting the tasks, the most urgent first */
+    static bool morePressingThan(const ImapTask *a, const ImapTask *b) { return a->m_priority < b->m_priority; }
+
+    /** @short How long has the task waited between its creation and its activation, in ms, or -1 if not known yet */
+    qint64 queueTime() const;
+    /** @short Time between sending the first command and receiving the first response to it, in ms, or -1 */
+    qint64 firstResponseLatency() const;
+    /** @short How long has it taken from the activation of the task until it finished, in ms, or -1 */
+    qint64 completionLatency() const;
+    /** @short Number of bytes which the commands of this task have sent to the server */
+    quint64 bytesSent() const { return m_bytesSent; }
+    /** @short Number of bytes of the tagged responses and continuation requests for the commands of this task
+
+    The untagged responses are not included, see Parser::commandStatistics().
+    */
+    quint64 bytesReceived() const { return m_bytesReceived; }
+    /** @short Human-readable summary of the figures above */
+    QString describeStatistics() const;
+
 protected:
     void _completed();
 
@@ -161,6 +193,10 @@ protected:
 
 private:
     void handleResponseCode(const Imap::Responses::State *const resp);
+    /** @short Add the traffic of a command which has just completed to the figures of this task */
+    void accountCommand(const CommandStatistics &stats);
+    /** @short Remember when the task has finished and let the Model aggregate the figures */
+    void recordFinished(const bool succeeded);
 
 signals:
     /** @short This signal is emitted if the job failed in some way */
@@ -178,7 +214,21 @@ protected:
     bool _finished;
     bool _dead;
     bool _aborted;
+    TaskPriority m_priority;
+
+private:
+    qint64 m_createdAt;
+    qint64 m_activatedAt;
+    qint64 m_firstSentAt;
+    qint64 m_firstResponseAt;
+    qint64 m_finishedAt;
+    quint64 m_bytesSent;
+    quint64 m_bytesReceived;
+    /** @short The command whose tagged response is being processed right now */
+    CommandStatistics m_pendingCommand;
+    bool m_hasPendingCommand;
 
+protected:
     friend class TaskPresentationModel; // needs access to the TaskPresentationModel
     friend class KeepMailboxOpenTask; // needs access to dependentTasks for removing stuff
 #ifdef TROJITA_DEBUG_TASK_TREE
@@ -20,6 +20,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <sstream>
 #include "KeepMailboxOpenTask.h"
 #include "Common/InvokeMethod.h"
@@ -30,6 +31,7 @@
 #include "Imap/Model/TaskPresentationModel.h"
 #include "DeleteMailboxTask.h"
 #include "FetchMsgMetadataTask.h"
+#include "FetchMsgPartInChunksTask.h"
 #include "FetchMsgPartTask.h"
 #include "IdleLauncher.h"
 #include "OpenConnectionTask.h"
@@ -39,6 +41,27 @@
 #include "NoopTask.h"
 #include "UnSelectTask.h"
 
+namespace {
+
+/** @short Queue the @arg task behind all tasks which are at least as urgent */
+void insertByPriority(QList<Imap::Mailbox::ImapTask *> &queue, Imap::Mailbox::ImapTask *task)
+{
+    queue.insert(std::upper_bound(queue.begin(), queue.end(), task, Imap::Mailbox::ImapTask::morePressingThan), task);
+}
+
+/** @short Remove the @arg partId of message @arg uid from the queued part @arg requests */
+void forgetPartRequest(QMap<uint, QSet<QByteArray> > &requests, const uint uid, const QByteArray &partId)
+{
+    QMap<uint, QSet<QByteArray> >::iterator it = requests.find(uid);
+    if (it == requests.end())
+        return;
+    it->remove(partId);
+    if (it->isEmpty())
+        requests.erase(it);
+}
+
+}
+
 namespace Imap
 {
 namespace Mailbox
@@ -50,7 +73,8 @@ FIXME: we should eat "* OK [CLOSED] former mailbox closed", or somehow let it fa
 
 KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailboxIndex, Parser *oldParser) :
     ImapTask(model), mailboxIndex(mailboxIndex), synchronizeConn(0), shouldExit(false), isRunning(false),
-    shouldRunNoop(false), shouldRunIdle(false), idleLauncher(0), unSelectTask(0)
+    shouldRunNoop(false), shouldRunIdle(false), idleLauncher(0), hasViewport(false),
+    adaptiveFetching(true), lastFetchCompletion(0), backfillChunk(0), unSelectTask(0)
 {
     Q_ASSERT(mailboxIndex.isValid());
     Q_ASSERT(mailboxIndex.model() == model);
@@ -154,6 +178,21 @@ KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailbo
     if (! ok)
         limitActiveTasks = 100;
 
+    // The limits above are just the initial guesses, the actual values get tuned to the observed RTT and throughput
+    QVariant adaptive = model->property("trojita-imap-adaptive-fetch");
+    if (adaptive.isValid())
+        adaptiveFetching = adaptive.toBool();
+    fetchSizer.reset(limitBytesAtOnce, limitMessagesAtOnce, limitParallelFetchTasks);
+    fetchClock.start();
+
+    bulkPartSize = model->property("trojita-imap-bulk-part-size").toUInt(&ok);
+    if (! ok)
+        bulkPartSize = 1024 * 1024;
+
+    backfillChunk = model->property("trojita-imap-sync-backfill-chunk").toUInt(&ok);
+    if (! ok || ! backfillChunk)
+        backfillChunk = 5000;
+
     CHECK_TASK_TREE
     emit model->mailboxSyncingProgress(mailboxIndex, STATE_WAIT_FOR_CONN);
 
@@ -233,9 +272,9 @@ void KeepMailboxOpenTask::addDependentTask(ImapTask *task)
         ImapTask::addDependentTask(task);
         if (task->needsMailbox()) {
             // it's a task which is tied to a particular mailbox
-            dependingTasksForThisMailbox.append(task);
+            insertByPriority(dependingTasksForThisMailbox, task);
         } else {
-            dependingTasksNoMailbox.append(task);
+            insertByPriority(dependingTasksNoMailbox, task);
         }
         QTimer::singleShot(0, this, SLOT(slotActivateTasks()));
     }
@@ -269,7 +308,9 @@ void KeepMailboxOpenTask::slotTaskDeleted(QObject *object)
         dependingTasksNoMailbox.removeOne(static_cast<ImapTask *>(object));
         runningTasksForThisMailbox.removeOne(static_cast<ImapTask *>(object));
         fetchPartTasks.removeOne(static_cast<FetchMsgPartTask *>(object));
+        chunkedPartTasks.removeOne(static_cast<FetchMsgPartInChunksTask *>(object));
         fetchMetadataTasks.removeOne(static_cast<FetchMsgMetadataTask *>(object));
+        inFlightFetches.remove(static_cast<ImapTask *>(object));
         abortableTasks.removeOne(static_cast<FetchMsgMetadataTask *>(object));
     }
 
@@ -299,7 +340,11 @@ void KeepMailboxOpenTask::terminate()
     Q_ASSERT(dependingTasksForThisMailbox.isEmpty());
     Q_ASSERT(dependingTasksNoMailbox.isEmpty());
     Q_ASSERT(requestedParts.isEmpty());
+    Q_ASSERT(requestedBulkParts.isEmpty());
+    Q_ASSERT(requestedPrefetchParts.isEmpty());
+    Q_ASSERT(requestedBulkPrefetchParts.isEmpty());
     Q_ASSERT(requestedEnvelopes.isEmpty());
+    Q_ASSERT(requestedVisibleEnvelopes.isEmpty());
     Q_ASSERT(runningTasksForThisMailbox.isEmpty());
     Q_ASSERT(abortableTasks.isEmpty());
 
@@ -358,6 +403,9 @@ void KeepMailboxOpenTask::perform()
 
     activateTasks();
 
+    // A windowed sync might have left some messages for us to backfill; do that before IDLE gets a chance to start
+    slotBackfillPlaceholders();
+
     if (model->accessParser(parser).capabilitiesFresh && model->accessParser(parser).capabilities.contains(QLatin1String("IDLE"))) {
         shouldRunIdle = true;
     } else {
@@ -494,6 +542,12 @@ bool KeepMailboxOpenTask::handleFetch(const Imap::Responses::Fetch *const resp)
     if (! isRunning)
         return false;
 
+    // The chunks of the large parts are only meaningful to the task which has asked for them
+    Q_FOREACH(FetchMsgPartInChunksTask *task, chunkedPartTasks) {
+        if (task->handleFetch(resp))
+            return true;
+    }
+
     TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
     Q_ASSERT(mailbox);
     model->genericHandleFetch(mailbox, resp);
@@ -561,6 +615,17 @@ bool KeepMailboxOpenTask::handleStateHelper(const Imap::Responses::State *const
         slotTaskDeleted(0);
         model->m_taskModel->slotTaskMighHaveChanged(this);
         return true;
+    } else if (resp->tag == backfillFetch) {
+        backfillFetch.clear();
+        if (resp->kind != Responses::OK) {
+            // The mailbox remains usable, it's just that the older messages stay as placeholders until the next sync
+            log(QLatin1String("Backfilling of the older messages failed: ") + resp->message, Common::LOG_MAILBOX_SYNC);
+        } else if (mailboxIndex.isValid()) {
+            handleBackfillCompleted();
+        }
+        slotTaskDeleted(0);
+        model->m_taskModel->slotTaskMighHaveChanged(this);
+        return true;
     } else if (resp->tag == tagClose) {
         tagClose.clear();
         if (m_deleteCurrentMailboxTask) {
@@ -712,10 +777,17 @@ void KeepMailboxOpenTask::activateTasks()
     slotFetchRequestedParts();
 
     while (!dependingTasksForThisMailbox.isEmpty() && model->accessParser(parser).activeTasks.size() < limitActiveTasks) {
+        if (!shouldExit && dependingTasksForThisMailbox.first()->priority() == PRIORITY_BACKGROUND && hasForegroundWork()) {
+            // The queue is sorted, so there's only background work left, and it shall wait for the rest to finish
+            break;
+        }
         breakOrCancelPossibleIdle();
         ImapTask *task = dependingTasksForThisMailbox.takeFirst();
         runningTasksForThisMailbox.append(task);
         dependentTasks.removeOne(task);
+        auto fetch = inFlightFetches.find(task);
+        if (fetch != inFlightFetches.end())
+            fetch->started = fetchClock.elapsed();
         task->perform();
     }
     while (!dependingTasksNoMailbox.isEmpty() && model->accessParser(parser).activeTasks.size() < limitActiveTasks) {
@@ -725,55 +797,270 @@ void KeepMailboxOpenTask::activateTasks()
         task->perform();
     }
 
+    if (!hasForegroundWork())
+        resumeChunkedFetches();
+
     if (idleLauncher && canRunIdleRightNow())
         idleLauncher->enterIdleLater();
 }
 
 void KeepMailboxOpenTask::requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize)
 {
-    requestedParts[uid].insert(partId);
-    requestedPartSizes[uid] += estimatedSize;
+    // Somebody is waiting for the data now, so a prefetch would be too late
+    forgetPartRequest(requestedPrefetchParts, uid, partId);
+    forgetPartRequest(requestedBulkPrefetchParts, uid, partId);
+    if (estimatedSize >= bulkPartSize) {
+        requestedBulkParts[uid].insert(partId);
+    } else {
+        requestedParts[uid].insert(partId);
+        requestedPartSizes[uid] += estimatedSize;
+    }
     if (!fetchPartTimer->isActive()) {
         fetchPartTimer->start();
     }
 }
 
-void KeepMailboxOpenTask::requestEnvelopeDownload(const uint uid)
+void KeepMailboxOpenTask::requestPartPrefetch(const uint uid, const QByteArray &partId, const uint estimatedSize)
+{
+    if (requestedParts.value(uid).contains(partId) || requestedBulkParts.value(uid).contains(partId))
+        return;
+    if (estimatedSize >= bulkPartSize) {
+        requestedBulkPrefetchParts[uid].insert(partId);
+    } else {
+        requestedPrefetchParts[uid].insert(partId);
+        requestedPartSizes[uid] += estimatedSize;
+    }
+    if (!fetchPartTimer->isActive()) {
+        fetchPartTimer->start();
+    }
+}
+
+void KeepMailboxOpenTask::cancelPartDownload(const uint uid, const QByteArray &partId)
+{
+    forgetPartRequest(requestedParts, uid, partId);
+    forgetPartRequest(requestedPrefetchParts, uid, partId);
+    forgetPartRequest(requestedBulkParts, uid, partId);
+    forgetPartRequest(requestedBulkPrefetchParts, uid, partId);
+
+    // The regular FETCHes are short enough to just let them finish, but the large downloads stop at the next chunk
+    Q_FOREACH(FetchMsgPartInChunksTask *task, chunkedPartTasks) {
+        if (task->uid() == uid && task->fetchItem() == partId) {
+            log(QString::fromUtf8("Cancelling the download of UID %1 part %2").arg(QString::number(uid), QString::fromUtf8(partId)),
+                Common::LOG_MESSAGES);
+            task->abort();
+        }
+    }
+}
+
+void KeepMailboxOpenTask::requestEnvelopeDownload(const uint uid, const bool fromViewport)
 {
-    requestedEnvelopes.append(uid);
+    if (fromViewport)
+        viewportEnvelopes.insert(uid);
+    if (hasViewport && visibleUids.contains(uid)) {
+        requestedVisibleEnvelopes.append(uid);
+    } else {
+        requestedEnvelopes.append(uid);
+    }
     if (!fetchEnvelopeTimer->isActive()) {
         fetchEnvelopeTimer->start();
     }
 }
 
+bool KeepMailboxOpenTask::isInViewport(const uint uid) const
+{
+    return hasViewport && (visibleUids.contains(uid) || nearbyUids.contains(uid));
+}
+
 void KeepMailboxOpenTask::slotFetchRequestedParts()
 {
     // FIXME: abort/die
 
-    if (requestedParts.isEmpty())
+    if (shouldExit) {
+        // The guesses about what is going to be read next in this mailbox are no longer relevant
+        for (auto it = requestedPrefetchParts.constBegin(); it != requestedPrefetchParts.constEnd(); ++it) {
+            if (!requestedParts.contains(it.key()))
+                requestedPartSizes.remove(it.key());
+        }
+        requestedPrefetchParts.clear();
+        requestedBulkPrefetchParts.clear();
+    }
+
+    if (requestedParts.isEmpty() && requestedBulkParts.isEmpty() && requestedPrefetchParts.isEmpty() &&
+            requestedBulkPrefetchParts.isEmpty())
         return;
 
     breakOrCancelPossibleIdle();
 
-    auto it = requestedParts.begin();
+    // The priority depends on who is asking, not on the size; the user is waiting for the large parts just as well
+    fetchRequestedParts(requestedParts, PRIORITY_NORMAL);
+    fetchRequestedBulkParts(requestedBulkParts, PRIORITY_NORMAL);
+
+    // The prefetching only goes out when nothing more urgent is waiting, and one batch at a time, so that whatever comes
+    // next never has to wait for more than one of them. The small parts are likely to be needed sooner, so they go first.
+    if (shouldExit || (requestedParts.isEmpty() && !hasForegroundWork() && !hasBackgroundFetchInFlight())) {
+        if (!requestedPrefetchParts.isEmpty())
+            fetchRequestedParts(requestedPrefetchParts, PRIORITY_BACKGROUND);
+        else
+            fetchRequestedBulkParts(requestedBulkPrefetchParts, PRIORITY_BACKGROUND);
+    }
+}
+
+void KeepMailboxOpenTask::fetchRequestedBulkParts(QMap<uint, QSet<QByteArray> > &requests, const TaskPriority priority)
+{
+    while (!requests.isEmpty()) {
+        auto it = requests.begin();
+        const uint uid = it.key();
+        Q_FOREACH(const QByteArray &partId, *it) {
+            FetchMsgPartInChunksTask *task = model->m_taskFactory->createFetchMsgPartInChunksTask(model, mailboxIndex, uid, partId);
+            setTaskPriority(task, priority);
+            chunkedPartTasks << task;
+            // Leaving the mailbox interrupts the download; whatever has been received stays in the cache for later
+            feelFreeToAbortCaller(task);
+        }
+        requests.erase(it);
+
+        // When asked to exit, the tasks get aborted right away, so they have to be created for all requests
+        if (priority == PRIORITY_BACKGROUND && !shouldExit)
+            return;
+    }
+}
+
+void KeepMailboxOpenTask::fetchRequestedParts(QMap<uint, QSet<QByteArray> > &requests, const TaskPriority priority)
+{
+    if (requests.isEmpty())
+        return;
+
+    auto it = requests.begin();
     auto parts = *it;
 
     // When asked to exit, do as much as possible and die
     while (shouldExit || fetchPartTasks.size() < limitParallelFetchTasks) {
         QList<uint> uids;
         uint totalSize = 0;
-        while (uids.size() < limitMessagesAtOnce && it != requestedParts.end() && totalSize < limitBytesAtOnce) {
+        while (uids.size() < limitMessagesAtOnce && it != requests.end() && totalSize < limitBytesAtOnce) {
             if (parts != *it)
                 break;
             parts = *it;
             uids << it.key();
             totalSize += requestedPartSizes.take(it.key());
-            it = requestedParts.erase(it);
+            it = requests.erase(it);
         }
         if (uids.isEmpty())
             return;
 
-        fetchPartTasks << model->m_taskFactory->createFetchMsgPartTask(model, mailboxIndex, uids, parts.toList());
+        FetchMsgPartTask *task = model->m_taskFactory->createFetchMsgPartTask(model, mailboxIndex, uids, parts.toList());
+        setTaskPriority(task, priority);
+        fetchPartTasks << task;
+        trackFetchTask(task, InFlightFetch(totalSize, uids.size(), false));
+
+        if (priority == PRIORITY_BACKGROUND && !shouldExit)
+            return;
+    }
+}
+
+void KeepMailboxOpenTask::setTaskPriority(ImapTask *task, const TaskPriority priority)
+{
+    task->setPriority(priority);
+    // The task has been queued by addDependentTask() already, so it has to be moved to the right place
+    if (dependingTasksForThisMailbox.removeOne(task))
+        insertByPriority(dependingTasksForThisMailbox, task);
+    if (dependingTasksNoMailbox.removeOne(task))
+        insertByPriority(dependingTasksNoMailbox, task);
+}
+
+bool KeepMailboxOpenTask::hasForegroundWork() const
+{
+    if (!requestedVisibleEnvelopes.isEmpty())
+        return true;
+    Q_FOREACH(const ImapTask *task, runningTasksForThisMailbox + dependingTasksForThisMailbox) {
+        if (task->priority() != PRIORITY_BACKGROUND)
+            return true;
+    }
+    return false;
+}
+
+bool KeepMailboxOpenTask::hasBackgroundFetchInFlight() const
+{
+    Q_FOREACH(const FetchMsgPartInChunksTask *task, chunkedPartTasks) {
+        if (task->priority() == PRIORITY_BACKGROUND)
+            return true;
+    }
+    Q_FOREACH(const FetchMsgPartTask *task, fetchPartTasks) {
+        if (task->priority() == PRIORITY_BACKGROUND)
+            return true;
+    }
+    return false;
+}
+
+void KeepMailboxOpenTask::resumeChunkedFetches()
+{
+    Q_FOREACH(FetchMsgPartInChunksTask *task, chunkedPartTasks) {
+        task->resume();
+    }
+}
+
+void KeepMailboxOpenTask::setViewport(const QSet<uint> &visible, const QSet<uint> &nearby)
+{
+    visibleUids = visible;
+    nearbyUids = nearby;
+    hasViewport = true;
+
+    // Requests for messages which have just scrolled into view shall jump the queue, and those which are no longer visible
+    // shall wait along with the preloading
+    QList<uint> nowVisible;
+    QList<uint> nowHidden;
+    Q_FOREACH(const uint uid, requestedVisibleEnvelopes) {
+        if (visibleUids.contains(uid))
+            nowVisible << uid;
+        else
+            nowHidden << uid;
+    }
+    for (auto it = requestedEnvelopes.begin(); it != requestedEnvelopes.end(); /* nothing */) {
+        if (visibleUids.contains(*it)) {
+            nowVisible << *it;
+            it = requestedEnvelopes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    requestedVisibleEnvelopes = nowVisible;
+    requestedEnvelopes = nowHidden + requestedEnvelopes;
+
+    dropStaleEnvelopeRequests();
+}
+
+void KeepMailboxOpenTask::dropStaleEnvelopeRequests()
+{
+    // When about to exit, the pending requests are served at once, so there's no reason to reorder them anymore
+    if (!hasViewport || shouldExit || requestedEnvelopes.isEmpty())
+        return;
+
+    TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
+    if (!mailbox)
+        return;
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+
+    int dropped = 0;
+    for (auto it = requestedEnvelopes.begin(); it != requestedEnvelopes.end(); /* nothing */) {
+        // Only the view knows which messages are close to each other, the sorting and threading have nothing to do with the
+        // order of the messages in the mailbox. Whoever else has asked for a message (an open message, the threading, the
+        // offline sync) still needs it, so those requests merely wait behind the visible ones.
+        if (isInViewport(*it) || !viewportEnvelopes.contains(*it)) {
+            ++it;
+            continue;
+        }
+        viewportEnvelopes.remove(*it);
+        TreeItemMessage *message = list->findMessageByUid(*it);
+        // Make sure that the message gets requested again once it is scrolled back into view
+        if (message && message->loading())
+            message->setFetchStatus(TreeItem::NONE);
+        it = requestedEnvelopes.erase(it);
+        ++dropped;
+    }
+
+    if (dropped) {
+        log(QString::fromUtf8("Dropped %1 stale envelope requests").arg(dropped), Common::LOG_MESSAGES);
     }
 }
 
@@ -781,21 +1068,73 @@ void KeepMailboxOpenTask::slotFetchRequestedEnvelopes()
 {
     // FIXME: abort/die
 
-    if (requestedEnvelopes.isEmpty())
+    dropStaleEnvelopeRequests();
+
+    if (requestedEnvelopes.isEmpty() && requestedVisibleEnvelopes.isEmpty())
         return;
 
     breakOrCancelPossibleIdle();
 
     QList<uint> fetchNow;
+    // Is the user looking at any of these messages?
+    const bool interactive = !requestedVisibleEnvelopes.isEmpty();
     if (shouldExit) {
-        fetchNow = requestedEnvelopes;
+        fetchNow = requestedVisibleEnvelopes + requestedEnvelopes;
+        requestedVisibleEnvelopes.clear();
         requestedEnvelopes.clear();
     } else {
-        const int amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce); // FIXME: add an extra limit?
-        fetchNow = requestedEnvelopes.mid(0, amount);
+        // Messages which the user is looking at go first, preloading fills up the rest of the group
+        int amount = qMin(requestedVisibleEnvelopes.size(), limitMessagesAtOnce);
+        fetchNow = requestedVisibleEnvelopes.mid(0, amount);
+        requestedVisibleEnvelopes.erase(requestedVisibleEnvelopes.begin(), requestedVisibleEnvelopes.begin() + amount);
+        amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce - fetchNow.size());
+        fetchNow += requestedEnvelopes.mid(0, amount);
         requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
     }
-    fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
+    Q_FOREACH(const uint uid, fetchNow) {
+        viewportEnvelopes.remove(uid);
+    }
+    FetchMsgMetadataTask *task = model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
+    if (interactive)
+        setTaskPriority(task, PRIORITY_INTERACTIVE);
+    fetchMetadataTasks << task;
+    trackFetchTask(task, InFlightFetch(0, fetchNow.size(), true));
+}
+
+void KeepMailboxOpenTask::trackFetchTask(ImapTask *task, const InFlightFetch &fetch)
+{
+    if (!adaptiveFetching)
+        return;
+
+    inFlightFetches.insert(task, fetch);
+    connect(task, SIGNAL(completed(Imap::Mailbox::ImapTask*)), this, SLOT(slotFetchTaskCompleted(Imap::Mailbox::ImapTask*)));
+}
+
+void KeepMailboxOpenTask::slotFetchTaskCompleted(ImapTask *task)
+{
+    InFlightFetch fetch = inFlightFetches.take(task);
+    if (fetch.started < 0)
+        return;
+
+    const qint64 now = fetchClock.elapsed();
+    const qint64 latency = now - fetch.started;
+    // When several commands are pipelined, the server processes them one after another, so the time which this one
+    // spent in actual transfer starts only when the previous one has finished.
+    const qint64 transfer = now - qMax(fetch.started, lastFetchCompletion);
+    lastFetchCompletion = now;
+
+    if (fetch.isMetadata) {
+        fetchSizer.addMetadataSample(fetch.messages, latency, transfer);
+    } else {
+        fetchSizer.addPartSample(fetch.bytes, latency, transfer);
+    }
+
+    if (fetchSizer.recompute()) {
+        limitBytesAtOnce = fetchSizer.bytesPerGroup();
+        limitMessagesAtOnce = fetchSizer.messagesPerGroup();
+        limitParallelFetchTasks = fetchSizer.parallelTasks();
+        log(QLatin1String("Adaptive FETCH limits: ") + fetchSizer.describe(), Common::LOG_TASKS);
+    }
 }
 
 void KeepMailboxOpenTask::breakOrCancelPossibleIdle()
@@ -919,7 +1258,9 @@ bool KeepMailboxOpenTask::hasPendingInternalActions() const
 {
     bool hasToWaitForIdleTermination = idleLauncher ? idleLauncher->waitingForIdleTaggedTermination() : false;
     return !(dependingTasksForThisMailbox.isEmpty() && dependingTasksNoMailbox.isEmpty() && runningTasksForThisMailbox.isEmpty() &&
-             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && newArrivalsFetch.isEmpty()) || hasToWaitForIdleTermination;
+             requestedParts.isEmpty() && requestedBulkParts.isEmpty() && requestedPrefetchParts.isEmpty() &&
+             requestedBulkPrefetchParts.isEmpty() && requestedEnvelopes.isEmpty() && requestedVisibleEnvelopes.isEmpty() &&
+             newArrivalsFetch.isEmpty() && backfillFetch.isEmpty()) || hasToWaitForIdleTermination;
 }
 
 /** @short Returns true if this task can be safely terminated
@@ -935,7 +1276,7 @@ bool KeepMailboxOpenTask::isReadyToTerminate() const
 bool KeepMailboxOpenTask::canRunIdleRightNow() const
 {
     bool res = shouldRunIdle && dependingTasksForThisMailbox.isEmpty() &&
-            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty();
+            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty() && backfillFetch.isEmpty();
 
     // If there's just one active tasks, it's the "this" one. If there are more of them, let's see if it's just one more
     // and that one more thing is a SortTask which is in the "just updating" mode.
@@ -1010,11 +1351,69 @@ void KeepMailboxOpenTask::signalSyncFailure(const QString &message)
 
 /** @short Is this task on its own keeping the connection busy?
 
-Right now, only fetching of new arrivals is being done in the context of this KeepMailboxOpenTask task.
+Right now, only fetching of new arrivals and the backfill after a windowed sync are being done in the context of this
+KeepMailboxOpenTask task.
 */
 bool KeepMailboxOpenTask::hasItsOwnActivity() const
 {
-    return !newArrivalsFetch.isEmpty();
+    return !newArrivalsFetch.isEmpty() || !backfillFetch.isEmpty();
+}
+
+/** @short Ask for UIDs and flags of the next chunk of placeholders left behind by a windowed sync
+
+The chunks proceed from the newest placeholders towards the beginning of the mailbox. Only one chunk is in flight at any time
+so that the commands issued on behalf of the user do not have to wait behind a long queue of these background FETCHes.
+*/
+void KeepMailboxOpenTask::slotBackfillPlaceholders()
+{
+    if (_dead || shouldExit || !isRunning || !backfillFetch.isEmpty() || !mailboxIndex.isValid())
+        return;
+
+    TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
+    Q_ASSERT(mailbox);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+    if (!list->m_placeholderCount)
+        return;
+
+    const uint hi = list->m_placeholderCount;
+    const uint lo = hi > backfillChunk ? hi - backfillChunk + 1 : 1;
+    breakOrCancelPossibleIdle();
+    // The sequence numbers in the FETCH responses are always up-to-date, so EXPUNGEs arriving in the meanwhile are harmless
+    backfillFetch = parser->fetch(Sequence(lo, hi), QStringList() << QLatin1String("UID") << QLatin1String("FLAGS"));
+    model->m_taskModel->slotTaskMighHaveChanged(this);
+}
+
+/** @short Account for a finished chunk of the backfill and either continue with the next one or save the complete state */
+void KeepMailboxOpenTask::handleBackfillCompleted()
+{
+    TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
+    Q_ASSERT(mailbox);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+
+    // The placeholders which got their UID are no longer placeholders. Stop at the first one which is still unknown.
+    const int previousCount = list->m_placeholderCount;
+    int remaining = previousCount;
+    while (remaining > 0 && static_cast<TreeItemMessage *>(list->m_children[remaining - 1])->uid())
+        --remaining;
+    list->m_placeholderCount = remaining;
+    model->emitMessageCountChanged(mailbox);
+
+    if (remaining == previousCount) {
+        log(QString::fromUtf8("The server hasn't told us the UID of message #%1, giving up on the backfill")
+            .arg(QString::number(remaining)), Common::LOG_MAILBOX_SYNC);
+    } else if (remaining) {
+        log(QString::fromUtf8("Backfilled %1 messages, %2 to go")
+            .arg(QString::number(previousCount - remaining), QString::number(remaining)), Common::LOG_MAILBOX_SYNC);
+        slotBackfillPlaceholders();
+    } else {
+        log(QLatin1String("All messages are synced now"), Common::LOG_MAILBOX_SYNC);
+        if (newArrivalsFetch.isEmpty()) {
+            // Otherwise the state will be saved when the UIDs of the new arrivals are known
+            mailbox->saveSyncStateAndUids(model);
+        }
+    }
 }
 
 }
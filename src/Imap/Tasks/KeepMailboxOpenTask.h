@@ -23,8 +23,11 @@
 #ifndef IMAP_KEEPMAILBOXOPENTASK_H
 #define IMAP_KEEPMAILBOXOPENTASK_H
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QModelIndex>
 #include <QSet>
+#include "FetchBatchSizer.h"
 #include "ImapTask.h"
 
 class QTimer;
@@ -44,6 +47,7 @@ class ObtainSynchronizedMailboxTask;
 class IdleLauncher;
 class FetchMsgMetadataTask;
 class FetchMsgPartTask;
+class FetchMsgPartInChunksTask;
 class TreeItemMailbox;
 class UnSelectTask;
 
@@ -145,9 +149,26 @@ public:
 
     QString debugIdentification() const;
 
+    /** @short Download the part for somebody who is waiting for it; the large parts are fetched in chunks */
     void requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize);
-    /** @short Request a delayed loading of a message envelope */
-    void requestEnvelopeDownload(const uint uid);
+    /** @short Download the part in the background when there's nothing more urgent to do, see MessageReadAhead */
+    void requestPartPrefetch(const uint uid, const QByteArray &partId, const uint estimatedSize);
+    /** @short The part is no longer needed, so forget about its queued request and stop its download if it is running */
+    void cancelPartDownload(const uint uid, const QByteArray &partId);
+    /** @short Request a delayed loading of a message envelope
+
+    The requests which were made @arg fromViewport, i.e. because the message list was showing the message or its neighbours,
+    are forgotten once they are scrolled away before their turn. Everything else is kept.
+    */
+    void requestEnvelopeDownload(const uint uid, const bool fromViewport);
+    /** @short Is the message visible, or close to the visible area, in the view which reported it through setViewport()? */
+    bool isInViewport(const uint uid) const;
+
+    /** @short Update the set of messages which the user is looking at, see Model::setVisibleMessages()
+
+    The @arg nearby messages are those which are close to the @arg visible ones in the order of the view.
+    */
+    void setViewport(const QSet<uint> &visible, const QSet<uint> &nearby);
 
     virtual QVariant taskData(const int role) const;
 
@@ -195,6 +216,11 @@ private slots:
 
     void signalSyncFailure(const QString &message);
 
+    /** @short A FETCH issued on behalf of requestPartDownload() or requestEnvelopeDownload() has finished */
+    void slotFetchTaskCompleted(Imap::Mailbox::ImapTask *task);
+
+    void slotBackfillPlaceholders();
+
 private:
     /** @short Activate the dependent tasks while also limiting the rate */
     void activateTasks();
@@ -221,6 +247,9 @@ private:
     */
     void closeMailboxDestructively();
 
+    /** @short Forget envelope requests made from the viewport for messages which are neither visible nor close to it anymore */
+    void dropStaleEnvelopeRequests();
+
     /** @short Return true if this has a list of stuff to do */
     bool hasPendingInternalActions() const;
 
@@ -230,6 +259,24 @@ private:
 
     void saveSyncStateNowOrLater(Imap::Mailbox::TreeItemMailbox *mailbox);
 
+    void handleBackfillCompleted();
+
+    /** @short Send FETCHes for the queued part @arg requests, using the given @arg priority */
+    void fetchRequestedParts(QMap<uint, QSet<QByteArray> > &requests, const TaskPriority priority);
+    /** @short Start the chunked downloads of the large parts in @arg requests
+
+    The background downloads go one message at a time, unless the mailbox is being closed.
+    */
+    void fetchRequestedBulkParts(QMap<uint, QSet<QByteArray> > &requests, const TaskPriority priority);
+    /** @short Change the priority of a task which we have queued already */
+    void setTaskPriority(ImapTask *task, const TaskPriority priority);
+    /** @short Is there anything more urgent than the background work pending or in flight? */
+    bool hasForegroundWork() const;
+    /** @short Is any prefetching already on its way? */
+    bool hasBackgroundFetchInFlight() const;
+    /** @short Let the large downloads which have been waiting for more urgent work continue */
+    void resumeChunkedFetches();
+
 protected:
     virtual void killAllPendingTasks(const QString &message);
 
@@ -265,6 +312,8 @@ protected:
     bool shouldRunIdle;
     IdleLauncher *idleLauncher;
     QList<FetchMsgPartTask *> fetchPartTasks;
+    /** @short Downloads of the requestedBulkParts and requestedBulkPrefetchParts, one task per part */
+    QList<FetchMsgPartInChunksTask *> chunkedPartTasks;
     QList<FetchMsgMetadataTask *> fetchMetadataTasks;
     QPointer<DeleteMailboxTask> m_deleteCurrentMailboxTask;
     CommandHandle tagIdle;
@@ -276,11 +325,19 @@ protected:
     friend class UnSelectTask; // needs access to breakPossibleIdle()
     friend class DeleteMailboxTask; // needs access to the closeMailboxDestructively()
     friend class TreeItemMailbox; // wants to know if our index is OK
+    friend class OfflineSyncer; // needs to know whether the mailbox is synced already
+    friend class FetchMsgPartInChunksTask; // needs access to hasForegroundWork()
     friend class ::ImapModelIdleTest;
     friend class ::LibMailboxSync;
 
     QList<uint> uidMap;
     QMap<uint, QSet<QByteArray> > requestedParts;
+    /** @short Requests for parts of at least bulkPartSize bytes, which are downloaded in chunks */
+    QMap<uint, QSet<QByteArray> > requestedBulkParts;
+    /** @short Prefetching of such large parts, which yields to anything else at the chunk boundaries */
+    QMap<uint, QSet<QByteArray> > requestedBulkPrefetchParts;
+    /** @short Parts which nobody has asked for yet, but which will likely be needed soon */
+    QMap<uint, QSet<QByteArray> > requestedPrefetchParts;
     QMap<uint, uint> requestedPartSizes;
     /** @short UIDs of messages with pending FetchMsgMetadataTask request
 
@@ -288,11 +345,55 @@ protected:
     not enough because of output sorting, threads etc etc.
     */
     QList<uint> requestedEnvelopes;
+    /** @short UIDs of messages with pending FetchMsgMetadataTask request which are visible to the user
+
+    These are served before anything in requestedEnvelopes. This list is only used once the view has told us what it is
+    showing via setViewport().
+    */
+    QList<uint> requestedVisibleEnvelopes;
+    /** @short UIDs of the pending envelope requests which come from the viewport and can be dropped when scrolled away */
+    QSet<uint> viewportEnvelopes;
+    /** @short UIDs of messages which are currently visible */
+    QSet<uint> visibleUids;
+    /** @short UIDs of messages which are not visible, but which are just a few rows away in the view */
+    QSet<uint> nearbyUids;
+    /** @short Has any view told us what it is showing? */
+    bool hasViewport;
 
     uint limitBytesAtOnce;
     int limitMessagesAtOnce;
     int limitParallelFetchTasks;
     int limitActiveTasks;
+    uint bulkPartSize;
+
+    /** @short Bookkeeping about a FETCH which is used for the adaptive sizing of the next ones */
+    struct InFlightFetch {
+        /** @short Value of the fetchClock when the command got sent, or -1 if it is still waiting */
+        qint64 started;
+        quint64 bytes;
+        int messages;
+        bool isMetadata;
+
+        InFlightFetch(): started(-1), bytes(0), messages(0), isMetadata(false) {}
+        InFlightFetch(const quint64 bytes, const int messages, const bool isMetadata):
+            started(-1), bytes(bytes), messages(messages), isMetadata(isMetadata) {}
+    };
+
+    /** @short Start measuring the duration of a newly created FETCH task */
+    void trackFetchTask(ImapTask *task, const InFlightFetch &fetch);
+
+    /** @short Should the limits above be tuned according to the observed network performance? */
+    bool adaptiveFetching;
+    FetchBatchSizer fetchSizer;
+    QHash<ImapTask *, InFlightFetch> inFlightFetches;
+    QElapsedTimer fetchClock;
+    /** @short When has the last tracked FETCH completed */
+    qint64 lastFetchCompletion;
+
+    /** @short FETCH of UIDs and flags of the placeholders left behind by a windowed sync */
+    CommandHandle backfillFetch;
+    /** @short How many placeholders to ask for at once */
+    uint backfillChunk;
 
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
@@ -138,6 +138,20 @@ void ListChildMailboxesTask::applyCachedStatus()
     m_pendingStatusResponses.clear();
 }
 
+bool ListChildMailboxesTask::isListingParentOf(const QString &mailbox, const QString &separator) const
+{
+    if (!mailboxIndex.isValid())
+        return false;
+
+    QString prefix = mailboxIndex.data(RoleMailboxName).toString();
+    if (!prefix.isEmpty())
+        prefix += separator;
+    if (!mailbox.startsWith(prefix))
+        return false;
+    const QString childName = mailbox.mid(prefix.size());
+    return !childName.isEmpty() && (separator.isEmpty() || !childName.contains(separator));
+}
+
 QString ListChildMailboxesTask::debugIdentification() const
 {
     if (! mailboxIndex.isValid())
@@ -46,6 +46,9 @@ public:
     virtual QString debugIdentification() const;
     virtual QVariant taskData(const int role) const;
     virtual bool needsMailbox() const {return false;}
+
+    /** @short Is the @arg mailbox one of the direct children which this task is listing? */
+    bool isListingParentOf(const QString &mailbox, const QString &separator) const;
 protected:
     void applyCachedStatus();
 
@@ -0,0 +1,153 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ListStatusTask.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+#include "GetAnyConnectionTask.h"
+#include "ListChildMailboxesTask.h"
+#include "NumberOfMessagesTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+
+ListStatusTask::ListStatusTask(Model *model):
+    ImapTask(model)
+{
+    conn = model->m_taskFactory->createGetAnyConnectionTask(model);
+    conn->addDependentTask(this);
+}
+
+bool ListStatusTask::addMailbox(const QModelIndex &mailbox)
+{
+    if (!tag.isEmpty() || isFinished())
+        return false;
+    Q_ASSERT(dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailbox.internalPointer())));
+    mailboxes << mailbox;
+    return true;
+}
+
+void ListStatusTask::perform()
+{
+    parser = conn->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    QList<QPersistentModelIndex> validMailboxes;
+    Q_FOREACH(const QPersistentModelIndex &mailbox, mailboxes) {
+        if (mailbox.isValid())
+            validMailboxes << mailbox;
+    }
+    mailboxes = validMailboxes;
+
+    if (mailboxes.size() < 2 || !model->accessParser(parser).capabilities.contains(QLatin1String("LIST-STATUS"))) {
+        // A single STATUS is cheaper than listing the whole tree
+        fallBackToStatus(mailboxes);
+        _completed();
+        return;
+    }
+
+    tag = parser->list(QLatin1String(""), QLatin1String("*"),
+                       QStringList() << QString::fromUtf8("STATUS (%1)").arg(
+                           NumberOfMessagesTask::requestedStatusOptions().join(QLatin1String(" "))));
+}
+
+bool ListStatusTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty())
+        return false;
+
+    if (resp->tag == tag) {
+        QList<QPersistentModelIndex> missing;
+        Q_FOREACH(const QPersistentModelIndex &mailbox, mailboxes) {
+            if (mailbox.isValid() && !reportedMailboxes.contains(mailbox.data(RoleMailboxName).toString()))
+                missing << mailbox;
+        }
+        // Either the LIST failed, or the server has chosen not to report on some mailboxes (perhaps because they are not
+        // selectable). Let's ask each of them separately in order not to leave them in the "loading" state forever.
+        fallBackToStatus(missing);
+
+        if (resp->kind == Responses::OK) {
+            _completed();
+        } else {
+            _failed(tr("LIST-STATUS failed"));
+        }
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/** @short Prevent the LIST responses, which are just a by-product of this command, from affecting the mailbox tree */
+bool ListStatusTask::handleList(const Imap::Responses::List *const resp)
+{
+    if (tag.isEmpty())
+        return false;
+
+    Q_FOREACH(ImapTask *task, model->accessParser(parser).activeTasks) {
+        ListChildMailboxesTask *listTask = qobject_cast<ListChildMailboxesTask *>(task);
+        if (listTask && listTask->isListingParentOf(resp->mailbox, resp->separator)) {
+            // This very response might be expected by a regular LIST which runs in parallel
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ListStatusTask::handleStatus(const Imap::Responses::Status *const resp)
+{
+    if (tag.isEmpty())
+        return false;
+
+    reportedMailboxes.insert(resp->mailbox);
+    if (!model->findMailboxByName(resp->mailbox)) {
+        // This one is not in the tree yet, so there's nothing to update. Don't let the Model complain about it.
+        return true;
+    }
+    return false;
+}
+
+void ListStatusTask::fallBackToStatus(const QList<QPersistentModelIndex> &mailboxes)
+{
+    Q_FOREACH(const QPersistentModelIndex &mailbox, mailboxes) {
+        model->m_taskFactory->createNumberOfMessagesTask(model, mailbox);
+    }
+}
+
+QString ListStatusTask::debugIdentification() const
+{
+    return QString::fromUtf8("%1 mailboxes").arg(mailboxes.size());
+}
+
+QVariant ListStatusTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Looking for messages")) : QVariant();
+}
+
+}
+}
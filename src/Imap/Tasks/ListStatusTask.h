@@ -0,0 +1,72 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_LISTSTATUS_TASK_H
+#define IMAP_LISTSTATUS_TASK_H
+
+#include <QPersistentModelIndex>
+#include <QSet>
+#include "ImapTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Refresh the message counts of many mailboxes at once through the LIST-STATUS extension from RFC 5819
+
+Instead of sending one STATUS command per mailbox, a single LIST "" "*" RETURN (STATUS (...)) is used for all mailboxes
+which asked for their numbers during one round of the event loop. Mailboxes which the server did not report on, or all of
+them when the server does not support LIST-STATUS or when just one mailbox is involved, fall back to the
+NumberOfMessagesTask.
+*/
+class ListStatusTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    explicit ListStatusTask(Model *model);
+    virtual void perform();
+
+    /** @short Include another mailbox in this refresh; returns false if it's too late for that */
+    bool addMailbox(const QModelIndex &mailbox);
+
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool handleList(const Imap::Responses::List *const resp);
+    virtual bool handleStatus(const Imap::Responses::Status *const resp);
+
+    virtual QString debugIdentification() const;
+    virtual QVariant taskData(const int role) const;
+    virtual bool needsMailbox() const {return false;}
+private:
+    void fallBackToStatus(const QList<QPersistentModelIndex> &mailboxes);
+
+    CommandHandle tag;
+    ImapTask *conn;
+    QList<QPersistentModelIndex> mailboxes;
+    /** @short Names of mailboxes for which a STATUS has arrived */
+    QSet<QString> reportedMailboxes;
+};
+
+}
+}
+
+#endif // IMAP_LISTSTATUS_TASK_H
@@ -41,6 +41,11 @@ ObtainSynchronizedMailboxTask::ObtainSynchronizedMailboxTask(Model *model, const
     ImapTask(model), conn(parentTask), mailboxIndex(mailboxIndex), status(STATE_WAIT_FOR_CONN), uidSyncingMode(UID_SYNC_ALL),
     firstUnknownUidOffset(0), m_usingQresync(false), unSelectTask(0), keepTaskChild(keepTask)
 {
+    bool ok;
+    m_syncWindow = model->property("trojita-imap-sync-window").toUInt(&ok);
+    if (!ok)
+        m_syncWindow = 1000;
+
     // The Parser* is not provided by our parent task, but instead through the keepTaskChild.  The reason is simple, the parent
     // task might not even exist, but there's always an KeepMailboxOpenTask in the game.
     parser = keepTaskChild->parser;
@@ -233,7 +238,13 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
 
     uidMap = model->cache()->uidMapping(mailbox->mailbox());
 
-    if (static_cast<uint>(uidMap.size()) != oldSyncState.exists()) {
+    if (list->m_placeholderCount) {
+        // The backfill of an earlier windowed sync has not finished, so our in-memory state has holes in it
+        log(QString::fromUtf8("Previous windowed sync is incomplete (%1 placeholders), falling back to full sync")
+            .arg(QString::number(list->m_placeholderCount)), Common::LOG_MAILBOX_SYNC);
+        oldSyncState.setHighestModSeq(0);
+        fullMboxSync(mailbox, list);
+    } else if (static_cast<uint>(uidMap.size()) != oldSyncState.exists()) {
 
         QString buf;
         QDebug dbg(&buf);
@@ -392,6 +403,7 @@ void ObtainSynchronizedMailboxTask::fullMboxSync(TreeItemMailbox *mailbox, TreeI
         model->beginRemoveRows(parent, 0, list->m_children.size() - 1);
         auto oldItems = list->m_children;
         list->m_children.clear();
+        list->m_placeholderCount = 0;
         model->endRemoveRows();
         qDeleteAll(oldItems);
     }
@@ -405,7 +417,11 @@ void ObtainSynchronizedMailboxTask::fullMboxSync(TreeItemMailbox *mailbox, TreeI
         }
         model->endInsertRows();
 
-        syncUids(mailbox);
+        if (m_syncWindow && mailbox->syncState.exists() > m_syncWindow) {
+            syncNewestWindow(mailbox, list);
+        } else {
+            syncUids(mailbox);
+        }
         list->m_numberFetchingStatus = TreeItem::LOADING;
         list->m_unreadMessageCount = 0;
     } else {
@@ -432,6 +448,26 @@ void ObtainSynchronizedMailboxTask::fullMboxSync(TreeItemMailbox *mailbox, TreeI
     }
 }
 
+/** @short Make a huge mailbox usable quickly by syncing just its newest messages
+
+Instead of asking for all UIDs and then for all flags, which can take minutes on a mailbox with hundreds of thousands of
+messages, only the UIDs and flags of the last m_syncWindow messages are requested.  The older messages remain in the list as
+placeholders which the KeepMailboxOpenTask backfills once this task has completed.
+*/
+void ObtainSynchronizedMailboxTask::syncNewestWindow(TreeItemMailbox *mailbox, TreeItemMsgList *list)
+{
+    list->m_placeholderCount = mailbox->syncState.exists() - m_syncWindow;
+    log(QString::fromUtf8("Windowed synchronization of the newest %1 messages, %2 left for later")
+        .arg(QString::number(m_syncWindow), QString::number(list->m_placeholderCount)), Common::LOG_MAILBOX_SYNC);
+
+    // The FETCH responses carry the sequence numbers which were valid at the time they were sent, so any EXPUNGEs which
+    // arrive in the meanwhile are accounted for without any special handling.
+    status = STATE_SYNCING_FLAGS;
+    flagsCmd = parser->fetch(Sequence(list->m_placeholderCount + 1, mailbox->syncState.exists()),
+                             QStringList() << QLatin1String("UID") << QLatin1String("FLAGS"));
+    emit model->mailboxSyncingProgress(mailboxIndex, status);
+}
+
 void ObtainSynchronizedMailboxTask::syncNoNewNoDeletions(TreeItemMailbox *mailbox, TreeItemMsgList *list)
 {
     Q_ASSERT(mailbox->syncState.exists() == static_cast<uint>(uidMap.size()));
@@ -456,7 +492,7 @@ void ObtainSynchronizedMailboxTask::syncNoNewNoDeletions(TreeItemMailbox *mailbo
         for (uint i = 0; i < mailbox->syncState.exists(); ++i) {
             TreeItemMessage *msg = new TreeItemMessage(list);
             msg->m_offset = i;
-            msg->m_uid = uidMap[ i ];
+            msg->setUid(uidMap[ i ]);
             messages << msg;
         }
         list->setChildren(messages);
@@ -1023,7 +1059,7 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
                 uidOffset = i - firstUnknownUidOffset;
                 Q_ASSERT(uidOffset >= 0);
                 Q_ASSERT(uidOffset < uidMap.size());
-                msg->m_uid = uidMap[uidOffset];
+                msg->setUid(uidMap[uidOffset]);
                 list->m_children << msg;
             }
             model->endInsertRows();
@@ -1036,7 +1072,7 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
         } else if (static_cast<TreeItemMessage *>(list->m_children[i])->m_uid == 0) {
             // If the UID of the "current message" is zero, replace that with this message
             TreeItemMessage *msg = static_cast<TreeItemMessage*>(list->m_children[i]);
-            msg->m_uid = uidMap[uidOffset];
+            msg->setUid(uidMap[uidOffset]);
             msg->m_offset = i;
             QModelIndex idx = model->createIndex(i, 0, msg);
             emit model->dataChanged(idx, idx);
@@ -1137,8 +1173,9 @@ void ObtainSynchronizedMailboxTask::notifyInterestingMessages(TreeItemMailbox *m
     QModelIndex listIndex = list->toIndex(model);
     Q_ASSERT(listIndex.isValid());
     QModelIndex firstInterestingMessage = model->index(
-                // remember, the offset has one-based indexing
-                mailbox->syncState.unSeenOffset() ? mailbox->syncState.unSeenOffset() - 1 : 0, 0, listIndex);
+                // remember, the offset has one-based indexing; the placeholders of a windowed sync have no flags yet
+                qMax(mailbox->syncState.unSeenOffset() ? mailbox->syncState.unSeenOffset() - 1 : 0,
+                     static_cast<uint>(list->m_placeholderCount)), 0, listIndex);
     if (!firstInterestingMessage.data(RoleMessageIsMarkedRecent).toBool() &&
             firstInterestingMessage.data(RoleMessageIsMarkedRead).toBool()) {
         // Clearly the reported value is utter nonsense. Let's just scroll to the end instead
@@ -67,6 +67,7 @@ public:
 private:
     void finalizeSelect();
     void fullMboxSync(TreeItemMailbox *mailbox, TreeItemMsgList *list);
+    void syncNewestWindow(TreeItemMailbox *mailbox, TreeItemMsgList *list);
     void syncNoNewNoDeletions(TreeItemMailbox *mailbox, TreeItemMsgList *list);
     void syncOnlyAdditions(TreeItemMailbox *mailbox, TreeItemMsgList *list);
     void syncGeneric(TreeItemMailbox *mailbox, TreeItemMsgList *list);
@@ -113,6 +114,8 @@ private:
     uint firstUnknownUidOffset;
     SyncState oldSyncState;
     bool m_usingQresync;
+    /** @short How many of the newest messages shall a full sync fetch before declaring the mailbox usable, or 0 for all of them */
+    uint m_syncWindow;
 
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
@@ -28,6 +28,7 @@
 #include "Imap/Model/TaskPresentationModel.h"
 #include "Imap/Tasks/EnableTask.h"
 #include "Imap/Tasks/IdTask.h"
+#include "Imap/Tasks/NotifyTask.h"
 #include "Streams/SocketFactory.h"
 #include "Streams/TrojitaZlibStatus.h"
 
@@ -421,6 +422,14 @@ void OpenConnectionTask::onComplete()
                                                                                QList<QByteArray>() << QByteArray("QRESYNC"));
         task->perform();
     }
+    // Optionally subscribe to changes in other mailboxes. This has to be enabled explicitly, and the dedicated connections
+    // for background work don't need that.
+    if (model->property("trojita-imap-notify").toBool() &&
+            model->accessParser(parser).capabilities.contains(QLatin1String("NOTIFY")) &&
+            !model->accessParser(parser).isDedicated) {
+        Imap::Mailbox::ImapTask *task = model->m_taskFactory->createNotifyTask(model, this);
+        task->perform();
+    }
 
     // But do terminate this task
     _completed();
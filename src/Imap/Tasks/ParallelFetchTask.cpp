@@ -0,0 +1,330 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ParallelFetchTask.h"
+#include "Common/InvokeMethod.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/ParallelFetchJob.h"
+#include "Imap/Model/TaskFactory.h"
+
+namespace {
+
+/** @short How many UID FETCH commands to keep in flight on each connection */
+const int pipelinedFetches = 2;
+
+/** @short Does the FETCH data item refer to a message part, as opposed to the metadata? */
+bool isPartItem(const QByteArray &item)
+{
+    return (item.startsWith("BODY[") || item.startsWith("BODY.PEEK[") || item.startsWith("BINARY[") ||
+            item.startsWith("BINARY.PEEK[")) && !item.contains("HEADER.FIELDS");
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+ParallelFetchTask::ParallelFetchTask(Model *model, const QModelIndex &mailbox, ParallelFetchJob *job):
+    ImapTask(model), mailboxIndex(mailbox), job(job), uidValidity(0)
+{
+    conn = model->m_taskFactory->createOpenConnectionTask(model);
+    parser = conn->parser;
+    Q_ASSERT(parser);
+    // Prevent the regular mailbox switching from stealing this connection
+    model->accessParser(parser).isDedicated = true;
+    setPriority(PRIORITY_BACKGROUND);
+    conn->addDependentTask(this);
+    job->addWorker(this);
+}
+
+TreeItemMailbox *ParallelFetchTask::mailboxIfValid() const
+{
+    return mailboxIndex.isValid() ? Model::mailboxForSomeItem(mailboxIndex) : 0;
+}
+
+void ParallelFetchTask::perform()
+{
+    parser = conn->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (!mailbox || !job) {
+        bailOut(tr("Mailbox disappeared"));
+        return;
+    }
+
+    model->changeConnectionState(parser, CONN_STATE_SELECTING);
+    tagExamine = parser->examine(mailbox->mailbox());
+}
+
+void ParallelFetchTask::fetchMore()
+{
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (!mailbox || !job) {
+        bailOut(tr("Mailbox disappeared"));
+        return;
+    }
+
+    while (pendingFetches.size() < pipelinedFetches) {
+        ParallelFetchJob::Chunk chunk = job->takeChunk();
+        if (chunk.uids.isEmpty())
+            break;
+        markPartsAsLoading(mailbox, chunk);
+        pendingFetches[parser->uidFetch(Sequence::fromList(chunk.uids), chunk.items)] = chunk;
+    }
+
+    if (pendingFetches.isEmpty()) {
+        logout();
+        _completed();
+    }
+}
+
+void ParallelFetchTask::markPartsAsLoading(TreeItemMailbox *mailbox, const ParallelFetchJob::Chunk &chunk)
+{
+    TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_FOREACH(const QByteArray &item, chunk.items) {
+        if (!isPartItem(item))
+            continue;
+        Q_FOREACH(const uint uid, chunk.uids) {
+            TreeItemMessage *message = list->findMessageByUid(uid);
+            // Without knowing the structure of the message, the part cannot be stored anyway
+            if (!message || !message->fetched())
+                continue;
+            try {
+                TreeItemPart *part = mailbox->partIdToPtr(model, message, item);
+                if (part && !part->fetched() && !part->loading())
+                    part->setFetchStatus(TreeItem::LOADING);
+            } catch (const UnknownMessageIndex &) {
+                log(QString::fromUtf8("Message UID %1 has no part %2").arg(QString::number(uid), QString::fromUtf8(item)),
+                    Common::LOG_MESSAGES);
+            }
+        }
+    }
+}
+
+void ParallelFetchTask::finalizeParts(TreeItemMailbox *mailbox, const ParallelFetchJob::Chunk &chunk)
+{
+    TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_FOREACH(const QByteArray &item, chunk.items) {
+        if (!isPartItem(item))
+            continue;
+        Q_FOREACH(const uint uid, chunk.uids) {
+            TreeItemMessage *message = list->findMessageByUid(uid);
+            if (!message || !message->fetched())
+                continue;
+            try {
+                model->finalizeFetchPart(mailbox, message->m_offset + 1, item);
+            } catch (const UnknownMessageIndex &) {
+                // already logged by markPartsAsLoading()
+            }
+        }
+    }
+}
+
+void ParallelFetchTask::resetParts(TreeItemMailbox *mailbox, const ParallelFetchJob::Chunk &chunk, const bool failed)
+{
+    TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_FOREACH(const QByteArray &item, chunk.items) {
+        if (!isPartItem(item))
+            continue;
+        Q_FOREACH(const uint uid, chunk.uids) {
+            TreeItemMessage *message = list->findMessageByUid(uid);
+            if (!message || !message->fetched())
+                continue;
+            try {
+                TreeItemPart *part = mailbox->partIdToPtr(model, message, item);
+                if (part && part->loading()) {
+                    part->setFetchStatus(failed ? TreeItem::UNAVAILABLE : TreeItem::NONE);
+                    QModelIndex index = part->toIndex(model);
+                    EMIT_LATER(model, dataChanged, Q_ARG(QModelIndex, index), Q_ARG(QModelIndex, index));
+                }
+            } catch (const UnknownMessageIndex &) {
+                // already logged by markPartsAsLoading()
+            }
+        }
+    }
+}
+
+bool ParallelFetchTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty()) {
+        // The untagged responses which accompany the EXAMINE are only interesting for the UIDVALIDITY check;
+        // the connection which maintains the mailbox takes care of everything else.
+        if (resp->kind == Responses::OK) {
+            if (resp->respCode == Responses::UIDVALIDITY) {
+                const Responses::RespData<uint> *const num = dynamic_cast<const Responses::RespData<uint>* const>(resp->respCodeData.data());
+                if (num)
+                    uidValidity = num->data;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    if (resp->tag == tagExamine) {
+        if (resp->kind != Responses::OK) {
+            bailOut(tr("EXAMINE failed: %1").arg(resp->message));
+            return true;
+        }
+        model->changeConnectionState(parser, CONN_STATE_SELECTED);
+        TreeItemMailbox *mailbox = mailboxIfValid();
+        if (!mailbox) {
+            bailOut(tr("Mailbox disappeared"));
+        } else if (mailbox->syncState.uidValidity() != uidValidity) {
+            // The UIDs we were given are meaningless now
+            bailOut(tr("UIDVALIDITY of the mailbox has changed"));
+        } else {
+            fetchMore();
+        }
+        return true;
+    }
+
+    QMap<CommandHandle, ParallelFetchJob::Chunk>::iterator it = pendingFetches.find(resp->tag);
+    if (it == pendingFetches.end())
+        return false;
+
+    ParallelFetchJob::Chunk chunk = *it;
+    pendingFetches.erase(it);
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    if (!mailbox || !job) {
+        bailOut(tr("Mailbox disappeared"));
+        return true;
+    }
+
+    if (resp->kind == Responses::OK) {
+        finalizeParts(mailbox, chunk);
+        job->chunkCompleted(chunk);
+    } else {
+        log(QString::fromUtf8("UID FETCH failed: %1").arg(resp->message), Common::LOG_MESSAGES);
+        resetParts(mailbox, chunk, true);
+        job->chunkFailed(chunk, resp->message);
+    }
+    if (job)
+        fetchMore();
+    return true;
+}
+
+bool ParallelFetchTask::handleNumberResponse(const Imap::Responses::NumberResponse *const resp)
+{
+    // EXISTS, RECENT and EXPUNGE are the business of the connection which maintains the mailbox
+    Q_UNUSED(resp);
+    return true;
+}
+
+bool ParallelFetchTask::handleFlags(const Imap::Responses::Flags *const resp)
+{
+    Q_UNUSED(resp);
+    return true;
+}
+
+bool ParallelFetchTask::handleVanished(const Imap::Responses::Vanished *const resp)
+{
+    Q_UNUSED(resp);
+    return true;
+}
+
+bool ParallelFetchTask::handleFetch(const Imap::Responses::Fetch *const resp)
+{
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    Responses::Fetch::dataType::const_iterator uidRecord = resp->data.constFind("UID");
+    if (!mailbox || uidRecord == resp->data.constEnd()) {
+        // Unsolicited updates are left for the connection which maintains the mailbox
+        return true;
+    }
+
+    const uint uid = static_cast<const Responses::RespData<uint>&>(*(uidRecord.value())).data;
+    TreeItemMessage *message = static_cast<TreeItemMsgList *>(mailbox->m_children[0])->findMessageByUid(uid);
+    if (!message) {
+        // Either expunged or not known to the maintaining connection yet
+        return true;
+    }
+
+    // The sequence numbers on this connection do not have to match those which the tree uses, so the response is
+    // re-addressed to the message with this UID. The FLAGS and MODSEQ are dropped because the maintaining connection
+    // has to see these changes on its own; otherwise it could advance the HIGHESTMODSEQ past changes it hasn't processed.
+    Responses::Fetch::dataType data = resp->data;
+    data.remove("FLAGS");
+    data.remove("MODSEQ");
+    Responses::Fetch translated(message->m_offset + 1, data);
+    model->genericHandleFetch(mailbox, &translated);
+    return true;
+}
+
+void ParallelFetchTask::bailOut(const QString &message)
+{
+    TreeItemMailbox *mailbox = mailboxIfValid();
+    Q_FOREACH(const ParallelFetchJob::Chunk &chunk, pendingFetches) {
+        // Whoever picks the chunk up will mark the parts as loading again
+        if (mailbox)
+            resetParts(mailbox, chunk, false);
+        if (job)
+            job->returnChunk(chunk);
+    }
+    pendingFetches.clear();
+    if (!_dead)
+        logout();
+    if (!_finished)
+        _failed(message);
+}
+
+void ParallelFetchTask::logout()
+{
+    if (!parser || model->accessParser(parser).connState == CONN_STATE_LOGOUT)
+        return;
+    model->changeConnectionState(parser, CONN_STATE_LOGOUT);
+    model->accessParser(parser).logoutCmd = parser->logout();
+}
+
+void ParallelFetchTask::die(const QString &message)
+{
+    _dead = true;
+    bailOut(message);
+}
+
+void ParallelFetchTask::abort()
+{
+    ImapTask::abort();
+    bailOut(tr("Aborted"));
+}
+
+QString ParallelFetchTask::debugIdentification() const
+{
+    if (!mailboxIndex.isValid())
+        return QLatin1String("[invalid mailbox]");
+
+    return QString::fromUtf8("%1: %2 UID FETCH commands in flight").arg(mailboxIndex.data(RoleMailboxName).toString(),
+                                                                      QString::number(pendingFetches.size()));
+}
+
+QVariant ParallelFetchTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Downloading messages in parallel")) : QVariant();
+}
+
+}
+}
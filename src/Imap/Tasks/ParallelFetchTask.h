@@ -0,0 +1,87 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_PARALLELFETCHTASK_H
+#define IMAP_PARALLELFETCHTASK_H
+
+#include <QPersistentModelIndex>
+#include <QPointer>
+#include "ImapTask.h"
+#include "Imap/Model/ParallelFetchJob.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class TreeItemMailbox;
+
+/** @short Fetch message data over a dedicated connection as a part of a ParallelFetchJob
+
+This task opens its own connection, EXAMINEs the mailbox there and keeps taking chunks of UIDs from the job, always having
+a few UID FETCH commands in flight. The FETCH responses are matched to the messages by their UIDs, so the sequence numbers
+on this connection do not have to agree with the connection which maintains the mailbox. When the job runs out of work,
+the connection is logged out.
+*/
+class ParallelFetchTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    ParallelFetchTask(Model *model, const QModelIndex &mailbox, ParallelFetchJob *job);
+    virtual void perform();
+    virtual void die(const QString &message);
+    virtual void abort();
+
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool handleNumberResponse(const Imap::Responses::NumberResponse *const resp);
+    virtual bool handleFlags(const Imap::Responses::Flags *const resp);
+    virtual bool handleFetch(const Imap::Responses::Fetch *const resp);
+    virtual bool handleVanished(const Imap::Responses::Vanished *const resp);
+
+    virtual QString debugIdentification() const;
+    virtual QVariant taskData(const int role) const;
+    virtual bool needsMailbox() const {return false;}
+
+private:
+    TreeItemMailbox *mailboxIfValid() const;
+    void fetchMore();
+    /** @short Make sure that the tree accepts the data of the message parts which are about to arrive */
+    void markPartsAsLoading(TreeItemMailbox *mailbox, const ParallelFetchJob::Chunk &chunk);
+    void finalizeParts(TreeItemMailbox *mailbox, const ParallelFetchJob::Chunk &chunk);
+    /** @short Stop waiting for the parts; they are marked as unavailable if the download has @arg failed */
+    void resetParts(TreeItemMailbox *mailbox, const ParallelFetchJob::Chunk &chunk, const bool failed);
+    /** @short Hand the unfinished work back to the job and close the connection */
+    void bailOut(const QString &message);
+    void logout();
+
+    ImapTask *conn;
+    QPersistentModelIndex mailboxIndex;
+    QPointer<ParallelFetchJob> job;
+    CommandHandle tagExamine;
+    uint uidValidity;
+    QMap<CommandHandle, ParallelFetchJob::Chunk> pendingFetches;
+};
+
+}
+}
+
+#endif // IMAP_PARALLELFETCHTASK_H
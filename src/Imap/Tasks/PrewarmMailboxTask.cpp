@@ -0,0 +1,419 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PrewarmMailboxTask.h"
+#include <algorithm>
+#include <QtAlgorithms>
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxPrewarmer.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/SpecialFlagNames.h"
+#include "Imap/Model/TaskFactory.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+PrewarmMailboxTask::PrewarmMailboxTask(Model *model, MailboxPrewarmer *prewarmer):
+    ImapTask(model), prewarmer(prewarmer), tainted(false)
+{
+    conn = model->m_taskFactory->createOpenConnectionTask(model);
+    parser = conn->parser;
+    Q_ASSERT(parser);
+    // Prevent the regular mailbox switching from stealing this connection
+    model->accessParser(parser).isDedicated = true;
+    setPriority(PRIORITY_BACKGROUND);
+    conn->addDependentTask(this);
+}
+
+void PrewarmMailboxTask::perform()
+{
+    parser = conn->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    examineNext();
+}
+
+void PrewarmMailboxTask::examineNext()
+{
+    mailbox = prewarmer ? prewarmer->takeNextMailbox() : QString();
+    if (mailbox.isEmpty()) {
+        logout();
+        _completed();
+        return;
+    }
+
+    tainted = false;
+    newState = SyncState();
+    oldState = model->cache()->mailboxSyncState(mailbox);
+    oldUidMap = model->cache()->uidMapping(mailbox);
+    uidMap.clear();
+    flags.clear();
+    timer.start();
+
+    QList<QByteArray> params;
+    if (model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")))
+        params << "CONDSTORE";
+    model->changeConnectionState(parser, CONN_STATE_SELECTING);
+    tagExamine = parser->examine(mailbox, params);
+}
+
+void PrewarmMailboxTask::examineFinished()
+{
+    model->changeConnectionState(parser, CONN_STATE_SELECTED);
+
+    if (!prewarmer || !prewarmer->isEligible(mailbox)) {
+        log(QString::fromUtf8("Mailbox %1 got opened in the meanwhile, not refreshing it").arg(mailbox), Common::LOG_MAILBOX_SYNC);
+        examineNext();
+        return;
+    }
+
+    if (!newState.isUsableForSyncing()) {
+        log(QLatin1String("The server didn't provide enough data about the mailbox"), Common::LOG_MAILBOX_SYNC);
+        examineNext();
+        return;
+    }
+
+    if (newState.exists() == 0) {
+        saveToCache();
+        examineNext();
+        return;
+    }
+
+    const bool sameUids = oldState.isUsableForSyncing() && oldState.uidValidity() == newState.uidValidity() &&
+            oldState.uidNext() == newState.uidNext() && oldState.exists() == newState.exists() &&
+            static_cast<uint>(oldUidMap.size()) == newState.exists();
+
+    if (sameUids && newState.isUsableForCondstore() && oldState.highestModSeq() == newState.highestModSeq()) {
+        // Nothing has changed since the last time; the cache is perfectly usable already
+        if (prewarmer)
+            prewarmer->mailboxWarmed(mailbox, timer.elapsed());
+        examineNext();
+        return;
+    }
+
+    if (sameUids) {
+        // No message could have been expunged or added without changing either the EXISTS or the UIDNEXT
+        uidMap = oldUidMap;
+        fetchFlags();
+    } else if (model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH"))) {
+        tagSearch = parser->uidESearchUid("ALL");
+    } else {
+        tagSearch = parser->uidSearchUid("ALL");
+    }
+}
+
+void PrewarmMailboxTask::fetchFlags()
+{
+    QMap<QByteArray, quint64> fetchModifier;
+    if (model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")) &&
+            oldState.highestModSeq() > 0 && newState.isUsableForCondstore() &&
+            oldState.uidValidity() == newState.uidValidity()) {
+        fetchModifier["CHANGEDSINCE"] = oldState.highestModSeq();
+    }
+    tagFetch = parser->fetch(Sequence(1, newState.exists()), QStringList() << QLatin1String("UID") << QLatin1String("FLAGS"),
+                             fetchModifier);
+}
+
+void PrewarmMailboxTask::saveToCache()
+{
+    if (tainted) {
+        log(QString::fromUtf8("Mailbox %1 has changed while being refreshed, not caching it").arg(mailbox), Common::LOG_MAILBOX_SYNC);
+        return;
+    }
+    if (!prewarmer || !prewarmer->isEligible(mailbox)) {
+        log(QString::fromUtf8("Mailbox %1 got opened in the meanwhile, not refreshing it").arg(mailbox), Common::LOG_MAILBOX_SYNC);
+        return;
+    }
+
+    const bool sameValidity = oldState.isUsableForSyncing() && oldState.uidValidity() == newState.uidValidity();
+    if (!sameValidity) {
+        model->cache()->clearAllMessages(mailbox);
+    } else {
+        QList<uint> sortedUids = uidMap;
+        qSort(sortedUids);
+        Q_FOREACH(const uint uid, oldUidMap) {
+            if (!std::binary_search(sortedUids.constBegin(), sortedUids.constEnd(), uid))
+                model->cache()->clearMessage(mailbox, uid);
+        }
+    }
+
+    uint unSeenCount = 0;
+    QMap<uint, QStringList> flagsForCache;
+    QList<uint> unchanged;
+    Q_FOREACH(const uint uid, uidMap) {
+        QMap<uint, QStringList>::const_iterator it = flags.constFind(uid);
+        if (it != flags.constEnd()) {
+            flagsForCache[uid] = *it;
+            if (!it->contains(FlagNames::seen))
+                ++unSeenCount;
+        } else if (sameValidity) {
+            unchanged << uid;
+        } else {
+            ++unSeenCount;
+        }
+    }
+    // Not reported by the FETCH CHANGEDSINCE, so the cached copies are still valid
+    const QMap<uint, QStringList> cachedFlags = model->cache()->msgFlags(mailbox, unchanged);
+    Q_FOREACH(const uint uid, unchanged) {
+        if (!cachedFlags.value(uid).contains(FlagNames::seen))
+            ++unSeenCount;
+    }
+    newState.setUnSeenCount(unSeenCount);
+    model->cache()->setMsgFlags(mailbox, flagsForCache);
+
+    model->cache()->setMailboxSyncState(mailbox, newState);
+    model->cache()->setUidMapping(mailbox, uidMap);
+    if (prewarmer)
+        prewarmer->mailboxWarmed(mailbox, timer.elapsed());
+}
+
+bool PrewarmMailboxTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty()) {
+        if (resp->kind != Responses::OK)
+            return false;
+
+        switch (resp->respCode) {
+        case Responses::UIDVALIDITY:
+        {
+            const Responses::RespData<uint> *const num = dynamic_cast<const Responses::RespData<uint>* const>(resp->respCodeData.data());
+            if (!num)
+                throw CantHappen("State response has invalid UIDVALIDITY respCodeData", *resp);
+            newState.setUidValidity(num->data);
+            break;
+        }
+        case Responses::UIDNEXT:
+        {
+            const Responses::RespData<uint> *const num = dynamic_cast<const Responses::RespData<uint>* const>(resp->respCodeData.data());
+            if (!num)
+                throw CantHappen("State response has invalid UIDNEXT respCodeData", *resp);
+            newState.setUidNext(num->data);
+            break;
+        }
+        case Responses::UNSEEN:
+        {
+            const Responses::RespData<uint> *const num = dynamic_cast<const Responses::RespData<uint>* const>(resp->respCodeData.data());
+            if (!num)
+                throw CantHappen("State response has invalid UNSEEN respCodeData", *resp);
+            newState.setUnSeenOffset(num->data);
+            break;
+        }
+        case Responses::PERMANENTFLAGS:
+        {
+            const Responses::RespData<QStringList> *const num = dynamic_cast<const Responses::RespData<QStringList>* const>(resp->respCodeData.data());
+            if (!num)
+                throw CantHappen("State response has invalid PERMANENTFLAGS respCodeData", *resp);
+            newState.setPermanentFlags(num->data);
+            break;
+        }
+        case Responses::HIGHESTMODSEQ:
+        {
+            const Responses::RespData<quint64> *const num = dynamic_cast<const Responses::RespData<quint64>* const>(resp->respCodeData.data());
+            Q_ASSERT(num);
+            newState.setHighestModSeq(num->data);
+            break;
+        }
+        case Responses::NOMODSEQ:
+            newState.setHighestModSeq(0);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    if (resp->tag == tagExamine) {
+        tagExamine.clear();
+        if (resp->kind != Responses::OK) {
+            log(QString::fromUtf8("EXAMINE %1 failed: %2").arg(mailbox, resp->message), Common::LOG_MAILBOX_SYNC);
+            model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
+            examineNext();
+        } else {
+            examineFinished();
+        }
+        return true;
+    }
+
+    if (resp->tag == tagSearch) {
+        tagSearch.clear();
+        if (resp->kind != Responses::OK) {
+            log(QString::fromUtf8("UID SEARCH failed: %1").arg(resp->message), Common::LOG_MAILBOX_SYNC);
+            examineNext();
+        } else if (static_cast<uint>(uidMap.size()) != newState.exists()) {
+            log(QLatin1String("UID SEARCH doesn't match the EXISTS, giving up"), Common::LOG_MAILBOX_SYNC);
+            examineNext();
+        } else {
+            fetchFlags();
+        }
+        return true;
+    }
+
+    if (resp->tag == tagFetch) {
+        tagFetch.clear();
+        if (resp->kind != Responses::OK) {
+            log(QString::fromUtf8("FETCH of flags failed: %1").arg(resp->message), Common::LOG_MAILBOX_SYNC);
+        } else {
+            saveToCache();
+        }
+        examineNext();
+        return true;
+    }
+
+    return false;
+}
+
+bool PrewarmMailboxTask::handleNumberResponse(const Imap::Responses::NumberResponse *const resp)
+{
+    if (!tagExamine.isEmpty()) {
+        switch (resp->kind) {
+        case Responses::EXISTS:
+            newState.setExists(resp->number);
+            break;
+        case Responses::RECENT:
+            newState.setRecent(resp->number);
+            break;
+        default:
+            tainted = true;
+            break;
+        }
+    } else if (resp->kind == Responses::EXISTS || resp->kind == Responses::EXPUNGE) {
+        // The sequence numbers no longer match what we've got; the next real SELECT will pick up the change
+        tainted = true;
+    }
+    return true;
+}
+
+bool PrewarmMailboxTask::handleFlags(const Imap::Responses::Flags *const resp)
+{
+    newState.setFlags(resp->flags);
+    return true;
+}
+
+bool PrewarmMailboxTask::handleVanished(const Imap::Responses::Vanished *const resp)
+{
+    Q_UNUSED(resp);
+    tainted = true;
+    return true;
+}
+
+bool PrewarmMailboxTask::handleSearch(const Imap::Responses::Search *const resp)
+{
+    if (tagSearch.isEmpty())
+        return false;
+
+    uidMap += resp->items;
+    return true;
+}
+
+bool PrewarmMailboxTask::handleESearch(const Imap::Responses::ESearch *const resp)
+{
+    if (resp->tag.isEmpty() || resp->tag != tagSearch)
+        return false;
+
+    if (resp->seqOrUids != Imap::Responses::ESearch::UIDS)
+        throw UnexpectedResponseReceived("ESEARCH response with matching tag uses sequence numbers instead of UIDs", *resp);
+
+    Responses::ESearch::CompareListDataIdentifier<Responses::ESearch::ListData_t> allComparator("ALL");
+    Responses::ESearch::ListData_t::const_iterator listIterator =
+            std::find_if(resp->listData.constBegin(), resp->listData.constEnd(), allComparator);
+    if (listIterator != resp->listData.constEnd())
+        uidMap = listIterator->second;
+    else
+        uidMap.clear();
+    return true;
+}
+
+bool PrewarmMailboxTask::handleFetch(const Imap::Responses::Fetch *const resp)
+{
+    if (tagFetch.isEmpty()) {
+        // An unsolicited change of flags; whatever we're going to store would be outdated
+        tainted = true;
+        return true;
+    }
+
+    if (resp->number == 0 || resp->number > static_cast<uint>(uidMap.size())) {
+        tainted = true;
+        return true;
+    }
+
+    uint uid = uidMap[resp->number - 1];
+    Responses::Fetch::dataType::const_iterator uidRecord = resp->data.constFind("UID");
+    if (uidRecord != resp->data.constEnd() &&
+            static_cast<const Responses::RespData<uint>&>(*(uidRecord.value())).data != uid) {
+        log(QLatin1String("FETCH reports an unexpected UID"), Common::LOG_MAILBOX_SYNC);
+        tainted = true;
+        return true;
+    }
+
+    Responses::Fetch::dataType::const_iterator flagsRecord = resp->data.constFind("FLAGS");
+    if (flagsRecord != resp->data.constEnd()) {
+        flags[uid] = model->normalizeFlags(static_cast<const Responses::RespData<QStringList>&>(*(flagsRecord.value())).data);
+    }
+    return true;
+}
+
+void PrewarmMailboxTask::bailOut(const QString &message)
+{
+    if (!_dead)
+        logout();
+    if (!_finished)
+        _failed(message);
+}
+
+void PrewarmMailboxTask::logout()
+{
+    if (!parser || model->accessParser(parser).connState == CONN_STATE_LOGOUT)
+        return;
+    model->changeConnectionState(parser, CONN_STATE_LOGOUT);
+    model->accessParser(parser).logoutCmd = parser->logout();
+}
+
+void PrewarmMailboxTask::die(const QString &message)
+{
+    _dead = true;
+    bailOut(message);
+}
+
+void PrewarmMailboxTask::abort()
+{
+    ImapTask::abort();
+    bailOut(tr("Aborted"));
+}
+
+QString PrewarmMailboxTask::debugIdentification() const
+{
+    if (mailbox.isEmpty())
+        return QLatin1String("[no mailbox]");
+    return mailbox;
+}
+
+QVariant PrewarmMailboxTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Refreshing mailboxes in advance")) : QVariant();
+}
+
+}
+}
@@ -0,0 +1,99 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_PREWARMMAILBOXTASK_H
+#define IMAP_PREWARMMAILBOXTASK_H
+
+#include <QElapsedTimer>
+#include <QPointer>
+#include "ImapTask.h"
+#include "Imap/Model/MailboxMetadata.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class MailboxPrewarmer;
+
+/** @short Refresh the cached state of mailboxes chosen by the MailboxPrewarmer over a dedicated connection
+
+The task opens its own connection and keeps asking the MailboxPrewarmer for the next mailbox to refresh. Each mailbox is
+EXAMINEd, its UID map is obtained through UID SEARCH ALL (unless the numbers show that nothing has changed) and the flags are
+fetched, using CHANGEDSINCE when the server supports CONDSTORE. The result is stored into the cache only, so that a later
+ObtainSynchronizedMailboxTask finds a fresh SyncState and only has to deal with whatever has happened since.
+
+If the mailbox changes while it is being refreshed, or if somebody opens it in the meanwhile, the data is thrown away rather
+than risking an inconsistent cache. When there's nothing left to do, the connection is logged out.
+*/
+class PrewarmMailboxTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    PrewarmMailboxTask(Model *model, MailboxPrewarmer *prewarmer);
+    virtual void perform();
+    virtual void die(const QString &message);
+    virtual void abort();
+
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool handleNumberResponse(const Imap::Responses::NumberResponse *const resp);
+    virtual bool handleFlags(const Imap::Responses::Flags *const resp);
+    virtual bool handleSearch(const Imap::Responses::Search *const resp);
+    virtual bool handleESearch(const Imap::Responses::ESearch *const resp);
+    virtual bool handleFetch(const Imap::Responses::Fetch *const resp);
+    virtual bool handleVanished(const Imap::Responses::Vanished *const resp);
+
+    virtual QString debugIdentification() const;
+    virtual QVariant taskData(const int role) const;
+    virtual bool needsMailbox() const {return false;}
+
+private:
+    void examineNext();
+    void examineFinished();
+    void fetchFlags();
+    /** @short Store everything we have learned about the current mailbox into the cache */
+    void saveToCache();
+    void bailOut(const QString &message);
+    void logout();
+
+    ImapTask *conn;
+    QPointer<MailboxPrewarmer> prewarmer;
+    QString mailbox;
+    CommandHandle tagExamine;
+    CommandHandle tagSearch;
+    CommandHandle tagFetch;
+    /** @short The state as reported by the server */
+    SyncState newState;
+    /** @short The state which was in the cache before we started */
+    SyncState oldState;
+    QList<uint> oldUidMap;
+    QList<uint> uidMap;
+    QMap<uint, QStringList> flags;
+    /** @short Was there any change to the mailbox after the EXAMINE which would render the collected data useless? */
+    bool tainted;
+    QElapsedTimer timer;
+};
+
+}
+}
+
+#endif // IMAP_PREWARMMAILBOXTASK_H
@@ -72,6 +72,7 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
             TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(mailbox->m_children [0]);
             Q_ASSERT(list);
 
+            QMap<uint, QStringList> flagsForCache;
             Q_FOREACH (TreeItem *item, list->m_children) {
                 TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(item);
                 Q_ASSERT(message);
@@ -81,7 +82,8 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
                 if (!newFlags.contains(flags)) {
                     newFlags << flags;
                     message->setFlags(list, model->normalizeFlags(newFlags));
-                    model->cache()->setMsgFlags(mailbox->mailbox(), message->uid(), newFlags);
+                    if (message->uid())
+                        flagsForCache[message->uid()] = newFlags;
                     QModelIndex messageIndex = model->createIndex(message->m_offset, 0, message);
 
                     // emitting dataChanged() separately for each message in the mailbox:
@@ -89,6 +91,7 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
                     model->dataChanged(messageIndex, messageIndex);
                 }
             }
+            model->cache()->setMsgFlags(mailbox->mailbox(), flagsForCache);
             model->dataChanged(mailboxIndex, mailboxIndex);
             list->fetchNumbers(model);
             _completed();
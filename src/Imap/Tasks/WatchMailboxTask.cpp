@@ -0,0 +1,304 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTimer>
+#include "WatchMailboxTask.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/MailboxWatcher.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/TaskFactory.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+WatchMailboxTask::WatchMailboxTask(Model *model, const QString &mailbox, MailboxWatcher *watcher):
+    ImapTask(model), mailbox(mailbox), watcher(watcher), exists(-1), recent(-1), unSeen(-1),
+    idling(false), noIdle(false), dirty(false), stopping(false)
+{
+    conn = model->m_taskFactory->createOpenConnectionTask(model);
+    parser = conn->parser;
+    Q_ASSERT(parser);
+    // Prevent the regular mailbox switching from stealing this connection
+    model->accessParser(parser).isDedicated = true;
+    setPriority(PRIORITY_BACKGROUND);
+    conn->addDependentTask(this);
+
+    bool ok;
+    int timeout = model->property("trojita-imap-idle-renewal").toUInt(&ok);
+    if (!ok)
+        timeout = 1000 * 29 * 60;
+    renewal = new QTimer(this);
+    renewal->setSingleShot(true);
+    renewal->setInterval(timeout);
+    connect(renewal, SIGNAL(timeout()), this, SLOT(breakIdle()));
+
+    timeout = model->property("trojita-imap-watch-poll-interval").toUInt(&ok);
+    if (!ok)
+        timeout = 60 * 1000;
+    noopTimer = new QTimer(this);
+    noopTimer->setSingleShot(true);
+    noopTimer->setInterval(timeout);
+    connect(noopTimer, SIGNAL(timeout()), this, SLOT(slotNoop()));
+}
+
+void WatchMailboxTask::perform()
+{
+    parser = conn->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    if (stopping) {
+        finish();
+        return;
+    }
+
+    noIdle = !model->accessParser(parser).capabilities.contains(QLatin1String("IDLE"));
+    model->changeConnectionState(parser, CONN_STATE_SELECTING);
+    tagExamine = parser->examine(mailbox);
+}
+
+void WatchMailboxTask::stop()
+{
+    stopping = true;
+    noopTimer->stop();
+    if (idling) {
+        // The completion of the IDLE will take care of the rest
+        breakIdle();
+    } else if (tagSearch.isEmpty() && tagIdle.isEmpty() && tagNoop.isEmpty() && parser &&
+               model->accessParser(parser).connState == CONN_STATE_SELECTED) {
+        // Nothing is in flight, so nobody would call waitForChanges()
+        finish();
+    }
+    // Otherwise either perform() or the completion of the pending command will notice
+}
+
+void WatchMailboxTask::markDirty()
+{
+    dirty = true;
+    breakIdle();
+}
+
+void WatchMailboxTask::breakIdle()
+{
+    if (!idling)
+        return;
+    renewal->stop();
+    parser->idleDone();
+    idling = false;
+}
+
+void WatchMailboxTask::slotNoop()
+{
+    if (stopping || _finished)
+        return;
+    tagNoop = parser->noop();
+}
+
+void WatchMailboxTask::waitForChanges()
+{
+    if (stopping) {
+        finish();
+    } else if (dirty) {
+        dirty = false;
+        unSeen = 0;
+        tagSearch = parser->search(QStringList() << QLatin1String("UNSEEN"));
+    } else if (noIdle) {
+        noopTimer->start();
+    } else {
+        tagIdle = parser->idle();
+        idling = true;
+        renewal->start();
+    }
+}
+
+void WatchMailboxTask::publish()
+{
+    if (!watcher || !watcher->shouldWatch(mailbox))
+        return;
+    TreeItemMailbox *mailboxPtr = model->findMailboxByName(mailbox);
+    if (!mailboxPtr)
+        return;
+    model->updateMessageCounts(mailboxPtr, exists, unSeen, recent);
+}
+
+bool WatchMailboxTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty()) {
+        // Response codes like UIDNEXT or PERMANENTFLAGS are not interesting at all
+        return resp->kind == Responses::OK;
+    }
+
+    if (resp->tag == tagExamine) {
+        tagExamine.clear();
+        if (resp->kind != Responses::OK) {
+            finish(tr("EXAMINE %1 failed: %2").arg(mailbox, resp->message));
+            return true;
+        }
+        model->changeConnectionState(parser, CONN_STATE_SELECTED);
+        dirty = true;
+        waitForChanges();
+        return true;
+    }
+
+    if (resp->tag == tagSearch) {
+        tagSearch.clear();
+        if (resp->kind == Responses::OK) {
+            publish();
+        } else {
+            log(QString::fromUtf8("SEARCH UNSEEN failed: %1").arg(resp->message), Common::LOG_MAILBOX_SYNC);
+            unSeen = -1;
+            publish();
+        }
+        waitForChanges();
+        return true;
+    }
+
+    if (resp->tag == tagIdle) {
+        tagIdle.clear();
+        if (idling) {
+            // The server has terminated the IDLE before we could ask for that
+            renewal->stop();
+            idling = false;
+            if (resp->kind == Responses::OK) {
+                parser->idleMagicallyTerminatedByServer();
+            } else {
+                parser->idleContinuationWontCome();
+            }
+        }
+        if (resp->kind != Responses::OK) {
+            log(QString::fromUtf8("IDLE failed, falling back to polling: %1").arg(resp->message), Common::LOG_MAILBOX_SYNC);
+            noIdle = true;
+        }
+        waitForChanges();
+        return true;
+    }
+
+    if (resp->tag == tagNoop) {
+        tagNoop.clear();
+        waitForChanges();
+        return true;
+    }
+
+    return false;
+}
+
+bool WatchMailboxTask::handleNumberResponse(const Imap::Responses::NumberResponse *const resp)
+{
+    switch (resp->kind) {
+    case Responses::EXISTS:
+        exists = resp->number;
+        break;
+    case Responses::EXPUNGE:
+        if (exists > 0)
+            --exists;
+        break;
+    case Responses::RECENT:
+        recent = resp->number;
+        break;
+    default:
+        break;
+    }
+    if (tagExamine.isEmpty())
+        markDirty();
+    return true;
+}
+
+bool WatchMailboxTask::handleFlags(const Imap::Responses::Flags *const resp)
+{
+    Q_UNUSED(resp);
+    return true;
+}
+
+bool WatchMailboxTask::handleSearch(const Imap::Responses::Search *const resp)
+{
+    if (tagSearch.isEmpty())
+        return false;
+    unSeen += resp->items.size();
+    return true;
+}
+
+bool WatchMailboxTask::handleFetch(const Imap::Responses::Fetch *const resp)
+{
+    // Somebody has changed the flags; that might affect the number of unread messages
+    Q_UNUSED(resp);
+    markDirty();
+    return true;
+}
+
+bool WatchMailboxTask::handleVanished(const Imap::Responses::Vanished *const resp)
+{
+    if (resp->earlier == Responses::Vanished::NOT_EARLIER)
+        exists = qMax(0, exists - resp->uids.size());
+    markDirty();
+    return true;
+}
+
+void WatchMailboxTask::finish(const QString &failure)
+{
+    renewal->stop();
+    noopTimer->stop();
+    if (!_dead)
+        logout();
+    if (_finished)
+        return;
+    if (failure.isEmpty())
+        _completed();
+    else
+        _failed(failure);
+}
+
+void WatchMailboxTask::logout()
+{
+    if (!parser || model->accessParser(parser).connState == CONN_STATE_LOGOUT)
+        return;
+    model->changeConnectionState(parser, CONN_STATE_LOGOUT);
+    model->accessParser(parser).logoutCmd = parser->logout();
+}
+
+void WatchMailboxTask::die(const QString &message)
+{
+    _dead = true;
+    finish(message);
+}
+
+void WatchMailboxTask::abort()
+{
+    ImapTask::abort();
+    finish(tr("Aborted"));
+}
+
+QString WatchMailboxTask::debugIdentification() const
+{
+    return QString::fromUtf8("%1%2").arg(mailbox, idling ? QLatin1String(" [IDLE]") : QString());
+}
+
+QVariant WatchMailboxTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Watching for new mail")) : QVariant();
+}
+
+}
+}
@@ -0,0 +1,105 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_WATCHMAILBOXTASK_H
+#define IMAP_WATCHMAILBOXTASK_H
+
+#include <QPointer>
+#include "ImapTask.h"
+
+class QTimer;
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class MailboxWatcher;
+
+/** @short Keep a dedicated connection IDLEing in a watched mailbox and report its message counts
+
+The mailbox is EXAMINEd, so that nothing on this connection can change the state of the messages. Whenever the server
+reports any change, the IDLE is interrupted, the number of unread messages is obtained through SEARCH UNSEEN and the counts
+are passed to the Model, which updates the TreeItemMsgList and the cache. The messages themselves are not synced at all.
+
+Servers without IDLE are checked via NOOP every trojita-imap-watch-poll-interval milliseconds instead.
+*/
+class WatchMailboxTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    WatchMailboxTask(Model *model, const QString &mailbox, MailboxWatcher *watcher);
+    virtual void perform();
+    virtual void die(const QString &message);
+    virtual void abort();
+
+    /** @short Stop watching and log out as soon as possible */
+    void stop();
+
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool handleNumberResponse(const Imap::Responses::NumberResponse *const resp);
+    virtual bool handleFlags(const Imap::Responses::Flags *const resp);
+    virtual bool handleSearch(const Imap::Responses::Search *const resp);
+    virtual bool handleFetch(const Imap::Responses::Fetch *const resp);
+    virtual bool handleVanished(const Imap::Responses::Vanished *const resp);
+
+    virtual QString debugIdentification() const;
+    virtual QVariant taskData(const int role) const;
+    virtual bool needsMailbox() const {return false;}
+
+private slots:
+    void breakIdle();
+    void slotNoop();
+
+private:
+    /** @short Something has changed; make sure that we find out what it was */
+    void markDirty();
+    void waitForChanges();
+    void publish();
+    void finish(const QString &failure = QString());
+    void logout();
+
+    ImapTask *conn;
+    QString mailbox;
+    QPointer<MailboxWatcher> watcher;
+    CommandHandle tagExamine;
+    CommandHandle tagSearch;
+    CommandHandle tagIdle;
+    CommandHandle tagNoop;
+    int exists;
+    int recent;
+    int unSeen;
+    /** @short Has the IDLE been sent without the corresponding DONE? */
+    bool idling;
+    /** @short Shall the IDLE be avoided, either because of a missing capability or because it didn't work? */
+    bool noIdle;
+    /** @short Have the numbers changed since the last SEARCH UNSEEN? */
+    bool dirty;
+    bool stopping;
+    QTimer *renewal;
+    QTimer *noopTimer;
+};
+
+}
+}
+
+#endif // IMAP_WATCHMAILBOXTASK_H
@@ -106,7 +106,9 @@ FakeSocketFactory::FakeSocketFactory(const Imap::ConnectionState initialState):
 
 Socket *FakeSocketFactory::create()
 {
-    return m_last = new FakeSocket(m_initialState);
+    m_last = new FakeSocket(m_initialState);
+    m_sockets << m_last;
+    return m_last;
 }
 
 Socket *FakeSocketFactory::lastSocket()
@@ -115,6 +117,13 @@ Socket *FakeSocketFactory::lastSocket()
     return m_last;
 }
 
+Socket *FakeSocketFactory::socket(const int number)
+{
+    Q_ASSERT(number >= 0 && number < m_sockets.size());
+    Q_ASSERT(m_sockets[number]);
+    return m_sockets[number];
+}
+
 void FakeSocketFactory::setInitialState(const Imap::ConnectionState initialState)
 {
     m_initialState = initialState;
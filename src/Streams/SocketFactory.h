@@ -113,11 +113,14 @@ public:
     virtual Socket *create();
     /** @short Return the last created socket */
     Socket *lastSocket();
+    /** @short Return the socket which was created as the @arg number-th one, counting from zero */
+    Socket *socket(const int number);
     void setInitialState(const Imap::ConnectionState initialState);
     virtual void setProxySettings(const Streams::ProxySettings proxySettings, const QString &protocolTag);
 
 private:
     QPointer<Socket> m_last;
+    QList<QPointer<Socket> > m_sockets;
     Imap::ConnectionState m_initialState;
 };
 
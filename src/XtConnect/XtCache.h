@@ -76,12 +76,14 @@ public:
     virtual void clearMessage( const QString mailbox, uint uid );
 
     virtual MessageDataBundle messageMetadata( const QString& mailbox, uint uid ) const;
+    using Imap::Mailbox::AbstractCache::messageMetadata;
     virtual void setMessageMetadata( const QString& mailbox, uint uid, const MessageDataBundle& metadata );
 
     /** @short Do nothing */
     virtual QStringList msgFlags( const QString& mailbox, uint uid ) const;
     /** @short Returns no data */
     virtual void setMsgFlags( const QString& mailbox, uint uid, const QStringList& flags );
+    using Imap::Mailbox::AbstractCache::setMsgFlags;
 
     /** @short ALways returns an empty QByteArray */
     virtual QByteArray messagePart( const QString& mailbox, uint uid, const QString& partId ) const;
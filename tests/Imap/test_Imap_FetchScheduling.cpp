@@ -0,0 +1,338 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QSortFilterProxyModel>
+#include <QtTest>
+#include "test_Imap_FetchScheduling.h"
+#include "Utils/headless_test.h"
+#include "Common/Logging.h"
+#include "Imap/Model/ItemRoles.h"
+
+using namespace Imap::Mailbox;
+
+namespace {
+
+/** @short Show the messages with odd UIDs before the even ones, so that the neighbors in the view are far apart in the mailbox */
+class OddEvenSortingModel: public QSortFilterProxyModel
+{
+public:
+    explicit OddEvenSortingModel(QObject *parent): QSortFilterProxyModel(parent)
+    {
+    }
+
+protected:
+    virtual bool lessThan(const QModelIndex &left, const QModelIndex &right) const
+    {
+        const uint a = left.data(RoleMessageUid).toUInt();
+        const uint b = right.data(RoleMessageUid).toUInt();
+        if (a % 2 != b % 2)
+            return a % 2;
+        return a < b;
+    }
+};
+
+QModelIndexList rows(const QAbstractItemModel *model, const int first, const int last)
+{
+    QModelIndexList res;
+    for (int i = first; i <= last; ++i) {
+        res << model->index(i, 0);
+    }
+    return res;
+}
+
+}
+
+void ImapModelFetchSchedulingTest::recordLog(uint parserId, const Common::LogMessage &message)
+{
+    Q_UNUSED(parserId);
+    m_logMessages << message.message;
+}
+
+bool ImapModelFetchSchedulingTest::wasLogged(const QString &prefix) const
+{
+    Q_FOREACH(const QString &message, m_logMessages) {
+        if (message.startsWith(prefix))
+            return true;
+    }
+    return false;
+}
+
+/** @short Open a mailbox with @arg exists messages and load the envelopes of the first @arg withEnvelope of them
+
+Each message consists of a single text/plain part of 19 bytes. The network is left in the NETWORK_EXPENSIVE mode so that
+nothing gets preloaded.
+*/
+void ImapModelFetchSchedulingTest::helperInitialEnvelopes(const uint exists, const uint withEnvelope)
+{
+    initialMessages(exists);
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    for (uint i = 0; i < withEnvelope; ++i) {
+        QCOMPARE(msgListA.child(i, 0).data(RoleMessageSubject).toString(), QString());
+    }
+    cClient(t.mk("UID FETCH 1:") + QByteArray::number(withEnvelope) + " (" FETCH_METADATA_ITEMS ")\r\n");
+    QByteArray buf;
+    for (uint i = 1; i <= withEnvelope; ++i) {
+        buf += helperCreateTrivialEnvelope(i, i, QString::fromUtf8("subject %1").arg(i));
+    }
+    cServer(buf + t.last("OK fetched\r\n"));
+    cEmpty();
+}
+
+/** @short With the adaptive sizing, the limits follow the measured performance, and the data still arrive as usual */
+void ImapModelFetchSchedulingTest::testAdaptiveFetching()
+{
+    model->setProperty("trojita-imap-adaptive-fetch", true);
+    m_logMessages.clear();
+    connect(model, SIGNAL(logged(uint,Common::LogMessage)), this, SLOT(recordLog(uint,Common::LogMessage)));
+    initialMessages(10);
+    // no preloading, so that the first FETCH is for a single message
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+
+    requestAndCheckSubject(0, "first");
+
+    // Any measurement with a single message yields limits which are different from the configured ones
+    QVERIFY(wasLogged(QLatin1String("Adaptive FETCH limits: ")));
+
+    // All limits stay reasonable, so the rest of the messages goes out in a single group
+    for (int i = 1; i < 10; ++i) {
+        QCOMPARE(msgListA.child(i, 0).data(RoleMessageSubject).toString(), QString());
+    }
+    cClient(t.mk("UID FETCH 2:10 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray buf;
+    for (uint i = 2; i <= 10; ++i) {
+        buf += helperCreateTrivialEnvelope(i, i, QString::fromUtf8("subject %1").arg(i));
+    }
+    cServer(buf + t.last("OK fetched\r\n"));
+    for (int i = 1; i < 10; ++i) {
+        QCOMPARE(msgListA.child(i, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject %1").arg(i + 1));
+    }
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short The distance from the viewport is measured in the order of the view, not in the order of the mailbox */
+void ImapModelFetchSchedulingTest::testViewportInSortedView()
+{
+    initialMessages(400);
+    // no preloading, only the messages which the view asks for are requested
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+
+    OddEvenSortingModel sorted(0);
+    sorted.setSourceModel(msgListModel);
+    sorted.sort(0);
+    QCOMPARE(sorted.rowCount(), 400);
+    QCOMPARE(sorted.index(199, 0).data(RoleMessageUid).toUInt(), 399u);
+    QCOMPARE(sorted.index(200, 0).data(RoleMessageUid).toUInt(), 2u);
+
+    // The user looks at the end of the odd messages; the even ones which follow are right below the viewport, but they are
+    // at the very beginning of the mailbox
+    model->setVisibleMessages(rows(&sorted, 190, 199), rows(&sorted, 180, 189) + rows(&sorted, 200, 209));
+    for (int i = 190; i < 210; ++i) {
+        QCOMPARE(sorted.index(i, 0).data(RoleMessageSubject).toString(), QString());
+    }
+    // ...while this one is far away in the view, so it's somebody else who is asking for it, and it has to wait
+    QCOMPARE(sorted.index(300, 0).data(RoleMessageSubject).toString(), QString());
+    QCOMPARE(sorted.index(300, 0).data(RoleMessageUid).toUInt(), 202u);
+
+    cClient(t.mk("UID FETCH 2,4,6,8,10,12,14,16,18,20,202,381,383,385,387,389,391,393,395,397,399 ("
+                 FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray buf;
+    for (int i = 190; i < 210; ++i) {
+        const uint uid = sorted.index(i, 0).data(RoleMessageUid).toUInt();
+        buf += helperCreateTrivialEnvelope(uid, uid, QString::fromUtf8("subject %1").arg(uid));
+    }
+    buf += helperCreateTrivialEnvelope(202, 202, QLatin1String("subject 202"));
+    cServer(buf + t.last("OK fetched\r\n"));
+    for (int i = 190; i < 210; ++i) {
+        const uint uid = sorted.index(i, 0).data(RoleMessageUid).toUInt();
+        QCOMPARE(sorted.index(i, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject %1").arg(uid));
+    }
+    QCOMPARE(sorted.index(300, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject 202"));
+    cEmpty();
+
+    // The requests of the view which get scrolled away before their turn are forgotten
+    model->setVisibleMessages(rows(&sorted, 100, 109), QModelIndexList());
+    for (int i = 100; i < 110; ++i) {
+        QCOMPARE(sorted.index(i, 0).data(RoleMessageSubject).toString(), QString());
+    }
+    model->setVisibleMessages(rows(&sorted, 295, 304), QModelIndexList());
+    for (int i = 295; i < 305; ++i) {
+        sorted.index(i, 0).data(RoleMessageSubject);
+    }
+    cClient(t.mk("UID FETCH 192,194,196,198,200,204,206,208,210 (" FETCH_METADATA_ITEMS ")\r\n"));
+    buf.clear();
+    for (int i = 295; i < 305; ++i) {
+        const uint uid = sorted.index(i, 0).data(RoleMessageUid).toUInt();
+        if (uid != 202)
+            buf += helperCreateTrivialEnvelope(uid, uid, QString::fromUtf8("subject %1").arg(uid));
+    }
+    cServer(buf + t.last("OK fetched\r\n"));
+    QCOMPARE(sorted.index(296, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject 194"));
+    QCOMPARE(sorted.index(100, 0).data(RoleIsFetched).toBool(), false);
+    cEmpty();
+
+    // Once they get into the view again, they are requested again
+    model->setVisibleMessages(rows(&sorted, 100, 100), QModelIndexList());
+    QCOMPARE(sorted.index(100, 0).data(RoleMessageUid).toUInt(), 201u);
+    QCOMPARE(sorted.index(100, 0).data(RoleMessageSubject).toString(), QString());
+    cClient(t.mk("UID FETCH 201 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(201, 201, QLatin1String("subject 201")) + t.last("OK fetched\r\n"));
+    QCOMPARE(sorted.index(100, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject 201"));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short A prefetch which is under way lets the part which the user has asked for go first at the next chunk boundary */
+void ImapModelFetchSchedulingTest::testBackgroundFetchYields()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    // All parts are large, so that both downloads go in chunks
+    model->setProperty("trojita-imap-bulk-part-size", 10);
+    model->setProperty("trojita-imap-part-chunk-size", 10);
+    helperInitialEnvelopes(3, 3);
+    // prefetching only happens on a free network
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_ONLINE);
+
+    QModelIndex prefetched = msgListA.child(1, 0).child(0, 0);
+    QModelIndex wanted = msgListA.child(2, 0).child(0, 0);
+    QCOMPARE(prefetched.data(RolePartId).toString(), QString::fromUtf8("1"));
+    QVERIFY(model->prefetchMessagePart(prefetched));
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1]<0.10>)\r\n"));
+    QByteArray prefetchTag = t.last();
+
+    // The user opens another message while the first chunk of the prefetch is on the wire
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<0.10>)\r\n"));
+    QByteArray wantedTag = t.last();
+
+    // The prefetch stops after its chunk...
+    cServer("* 2 FETCH (UID 2 BODY[1]<0> \"0123456789\")\r\n" + prefetchTag + " OK fetched\r\n");
+    cEmpty();
+    // ...while the part which the user is waiting for gets completed
+    cServer("* 3 FETCH (UID 3 BODY[1]<0> \"0123456789\")\r\n" + wantedTag + " OK fetched\r\n");
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<10.10>)\r\n"));
+    cServer("* 3 FETCH (UID 3 BODY[1]<10> \"abcdefghi\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray("0123456789abcdefghi"));
+
+    // Only then the prefetch continues
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1]<10.10>)\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1]<10> \"jklmnopqr\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(prefetched.data(RolePartData).toByteArray(), QByteArray("0123456789jklmnopqr"));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short A large part which the user has asked for keeps going even when other foreground work arrives */
+void ImapModelFetchSchedulingTest::testLargeForegroundPartDoesNotYield()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    model->setProperty("trojita-imap-bulk-part-size", 10);
+    model->setProperty("trojita-imap-part-chunk-size", 10);
+    helperInitialEnvelopes(4, 3);
+
+    QModelIndex wanted = msgListA.child(2, 0).child(0, 0);
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<0.10>)\r\n"));
+    QByteArray partTag = t.last();
+
+    // Some other message needs its envelope in the meanwhile
+    QCOMPARE(msgListA.child(3, 0).data(RoleMessageSubject).toString(), QString());
+    cClient(t.mk("UID FETCH 4 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray envelopeTag = t.last();
+
+    // The next chunk goes out right away without waiting for the envelope
+    cServer("* 3 FETCH (UID 3 BODY[1]<0> \"0123456789\")\r\n" + partTag + " OK fetched\r\n");
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<10.10>)\r\n"));
+    partTag = t.last();
+
+    cServer(helperCreateTrivialEnvelope(4, 4, QLatin1String("subject 4")) + envelopeTag + " OK fetched\r\n");
+    QCOMPARE(msgListA.child(3, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject 4"));
+    cServer("* 3 FETCH (UID 3 BODY[1]<10> \"abcdefghi\")\r\n" + partTag + " OK fetched\r\n");
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray("0123456789abcdefghi"));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short The chunks which have arrived before the connection went away are not downloaded again */
+void ImapModelFetchSchedulingTest::testChunkedFetchResumesAfterDisconnect()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    model->setProperty("trojita-imap-bulk-part-size", 10);
+    model->setProperty("trojita-imap-part-chunk-size", 10);
+    helperInitialEnvelopes(3, 3);
+
+    QModelIndex wanted = msgListA.child(2, 0).child(0, 0);
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<0.10>)\r\n"));
+    cServer("* 3 FETCH (UID 3 BODY[1]<0> \"0123456789\")\r\n" + t.last("OK fetched\r\n"));
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<10.10>)\r\n"));
+
+    // The connection goes away before the second chunk arrives
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_OFFLINE);
+    cClient(t.mk("LOGOUT\r\n"));
+    cServer(t.last("OK logged out\r\n") + "* BYE see ya\r\n");
+    QCOMPARE(model->cache()->partialMessagePart(QLatin1String("a"), 3, "BODY.PEEK[1]"), QByteArray("0123456789"));
+    QCOMPARE(wanted.data(RoleIsFetched).toBool(), false);
+
+    // After a reconnect, only the rest of the part is requested
+    t.reset();
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    helperSyncAWithMessagesNoArrivals();
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<10.10>)\r\n"));
+    cServer("* 3 FETCH (UID 3 BODY[1]<10> \"abcdefghi\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray("0123456789abcdefghi"));
+    QCOMPARE(model->cache()->partialMessagePart(QLatin1String("a"), 3, "BODY.PEEK[1]"), QByteArray());
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short A cancelled download stops at the next chunk boundary and keeps what it has received so far */
+void ImapModelFetchSchedulingTest::testChunkedFetchCancel()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    model->setProperty("trojita-imap-bulk-part-size", 10);
+    model->setProperty("trojita-imap-part-chunk-size", 10);
+    helperInitialEnvelopes(3, 3);
+
+    QModelIndex wanted = msgListA.child(2, 0).child(0, 0);
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<0.10>)\r\n"));
+    model->cancelPartDownload(wanted);
+
+    // The chunk which is already on the wire is still accepted, but no further one is requested
+    cServer("* 3 FETCH (UID 3 BODY[1]<0> \"0123456789\")\r\n" + t.last("OK fetched\r\n"));
+    cEmpty();
+    QCOMPARE(wanted.data(RoleIsFetched).toBool(), false);
+    QCOMPARE(model->cache()->partialMessagePart(QLatin1String("a"), 3, "BODY.PEEK[1]"), QByteArray("0123456789"));
+    justKeepTask();
+
+    // The part can be requested again, and the download continues where it stopped
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 3 (BODY.PEEK[1]<10.10>)\r\n"));
+    cServer("* 3 FETCH (UID 3 BODY[1]<10> \"abcdefghi\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(wanted.data(RolePartData).toByteArray(), QByteArray("0123456789abcdefghi"));
+    cEmpty();
+    justKeepTask();
+}
+
+TROJITA_HEADLESS_TEST(ImapModelFetchSchedulingTest)
@@ -0,0 +1,97 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_ListStatus.h"
+#include "Utils/FakeCapabilitiesInjector.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Streams/FakeSocket.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Requests made at the same time result in a single LIST-STATUS which does not touch the mailbox tree */
+void ImapModelListStatusTest::testMergedRequests()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("LIST-STATUS"));
+    idxA.data(RoleTotalMessageCount);
+    idxB.data(RoleTotalMessageCount);
+    cClient(t.mk("LIST \"\" \"*\" RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n"));
+    // The mailbox "new" is not in the tree, so its STATUS shall be ignored
+    cServer(QByteArray("* LIST (\\HasNoChildren) \"^\" \"a\"\r\n"
+                       "* STATUS \"a\" (MESSAGES 10 UNSEEN 2 RECENT 1)\r\n"
+                       "* LIST (\\HasNoChildren) \"^\" \"b\"\r\n"
+                       "* STATUS \"b\" (MESSAGES 3 UNSEEN 0 RECENT 0)\r\n"
+                       "* LIST (\\HasNoChildren) \"^\" \"new\"\r\n"
+                       "* STATUS \"new\" (MESSAGES 1 UNSEEN 1 RECENT 1)\r\n")
+            + t.last("OK listed\r\n"));
+
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 10);
+    QCOMPARE(idxA.data(RoleUnreadMessageCount).toInt(), 2);
+    QCOMPARE(idxA.data(RoleRecentMessageCount).toInt(), 1);
+    QCOMPARE(idxB.data(RoleTotalMessageCount).toInt(), 3);
+    QCOMPARE(idxB.data(RoleUnreadMessageCount).toInt(), 0);
+    QCOMPARE(model->rowCount(QModelIndex()), 26);
+    QVERIFY(model->index(1, 0, QModelIndex()) == idxA);
+    cEmpty();
+}
+
+/** @short Mailboxes which the server has not reported on get asked through STATUS */
+void ImapModelListStatusTest::testMissingMailbox()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("LIST-STATUS"));
+    idxA.data(RoleTotalMessageCount);
+    idxB.data(RoleTotalMessageCount);
+    cClient(t.mk("LIST \"\" \"*\" RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n"));
+    cServer(QByteArray("* LIST (\\HasNoChildren) \"^\" \"a\"\r\n"
+                       "* STATUS \"a\" (MESSAGES 10 UNSEEN 2 RECENT 1)\r\n"
+                       "* LIST (\\Noselect) \"^\" \"b\"\r\n")
+            + t.last("OK listed\r\n"));
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 10);
+
+    cClient(t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS b (MESSAGES 3 UNSEEN 1 RECENT 0)\r\n" + t.last("OK status\r\n"));
+    QCOMPARE(idxB.data(RoleTotalMessageCount).toInt(), 3);
+    QCOMPARE(idxB.data(RoleUnreadMessageCount).toInt(), 1);
+    cEmpty();
+}
+
+/** @short A server without LIST-STATUS gets one STATUS per mailbox */
+void ImapModelListStatusTest::testWithoutCapability()
+{
+    idxA.data(RoleTotalMessageCount);
+    idxB.data(RoleTotalMessageCount);
+    QByteArray expected = t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray response = "* STATUS a (MESSAGES 10 UNSEEN 2 RECENT 1)\r\n" + t.last("OK status\r\n");
+    expected += t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n");
+    response += "* STATUS b (MESSAGES 3 UNSEEN 0 RECENT 0)\r\n" + t.last("OK status\r\n");
+    cClient(expected);
+    cServer(response);
+    QCOMPARE(idxA.data(RoleTotalMessageCount).toInt(), 10);
+    QCOMPARE(idxB.data(RoleTotalMessageCount).toInt(), 3);
+    cEmpty();
+}
+
+TROJITA_HEADLESS_TEST(ImapModelListStatusTest)
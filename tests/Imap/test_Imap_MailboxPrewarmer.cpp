@@ -0,0 +1,132 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_MailboxPrewarmer.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/Cache.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxPrewarmer.h"
+#include "Imap/Model/SpecialFlagNames.h"
+#include "Streams/FakeSocket.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Check what the client has sent over the @arg SOCKET */
+#define cClientOn(SOCKET, data) \
+{ \
+    TROJITA_CLIENT_LOOP \
+    QCOMPARE(QString::fromUtf8(SOCKET->writtenStuff()), QString::fromUtf8(data)); \
+}
+
+/** @short Simulate the server sending @arg data over the @arg SOCKET */
+#define cServerOn(SOCKET, data) \
+{ \
+    SOCKET->fakeReading(data); \
+    for (int i=0; i<4; ++i) \
+        QCoreApplication::processEvents(); \
+}
+
+/** @short Let the model learn that mailbox C has got new mail, which makes it the best candidate for prewarming */
+void ImapModelMailboxPrewarmerTest::helperNewMailInC()
+{
+    idxC.data(RoleTotalMessageCount);
+    cClient(t.mk("STATUS c (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS c (MESSAGES 2 UNSEEN 1 RECENT 1)\r\n" + t.last("OK status\r\n"));
+    QCOMPARE(idxC.data(RoleRecentMessageCount).toInt(), 1);
+}
+
+/** @short Without being asked to, the model does not open any extra connections */
+void ImapModelMailboxPrewarmerTest::testDisabledByDefault()
+{
+    model->setProperty("trojita-imap-prewarm-delay", 0);
+    helperNewMailInC();
+    Streams::FakeSocket *mainConn = SOCK;
+
+    model->switchToMailbox(idxA);
+    cClientOn(mainConn, t.mk("SELECT a\r\n"));
+    cServerOn(mainConn, "* 0 EXISTS\r\n" + t.last("OK selected\r\n"));
+    for (int i = 0; i < 10; ++i)
+        QCoreApplication::processEvents();
+
+    QVERIFY(factory->lastSocket() == mainConn);
+    QCOMPARE(model->mailboxPrewarmer()->hits(), 0u);
+    QCOMPARE(model->mailboxPrewarmer()->misses(), 0u);
+    QCOMPARE(model->mailboxPrewarmer()->averageSyncMsecs(true), qint64(-1));
+    cClientOn(mainConn, "");
+}
+
+/** @short The predicted mailbox is refreshed over a connection of its own and then opened from the cache */
+void ImapModelMailboxPrewarmerTest::testPrewarmOnExtraConnection()
+{
+    model->setProperty("trojita-imap-prewarm-mailboxes", 1);
+    model->setProperty("trojita-imap-prewarm-delay", 0);
+    helperNewMailInC();
+    Streams::FakeSocket *mainConn = SOCK;
+
+    model->switchToMailbox(idxA);
+    cClientOn(mainConn, t.mk("SELECT a\r\n"));
+    cServerOn(mainConn, "* 0 EXISTS\r\n" + t.last("OK selected\r\n"));
+
+    // The mailbox C gets examined over a new connection which is logged out as soon as it's done
+    Streams::FakeSocket *warmConn = SOCK;
+    QVERIFY(warmConn != mainConn);
+    cClientOn(warmConn, "y0 EXAMINE c\r\n");
+    cServerOn(warmConn, "* 2 EXISTS\r\n* 1 RECENT\r\n* OK [UIDVALIDITY 666] .\r\n* OK [UIDNEXT 10] .\r\n"
+              "y0 OK [READ-ONLY] examined\r\n");
+    cClientOn(warmConn, "y1 UID SEARCH ALL\r\n");
+    cServerOn(warmConn, "* SEARCH 5 7\r\ny1 OK searched\r\n");
+    cClientOn(warmConn, "y2 FETCH 1:2 (UID FLAGS)\r\n");
+    cServerOn(warmConn, "* 1 FETCH (UID 5 FLAGS (\\Seen))\r\n* 2 FETCH (UID 7 FLAGS ())\r\ny2 OK fetched\r\n");
+    cClientOn(warmConn, "y3 LOGOUT\r\n");
+    cServerOn(warmConn, "y3 OK bye\r\n");
+    cClientOn(mainConn, "");
+
+    SyncState syncState = model->cache()->mailboxSyncState(QLatin1String("c"));
+    QCOMPARE(syncState.exists(), 2u);
+    QCOMPARE(syncState.uidValidity(), 666u);
+    QCOMPARE(syncState.uidNext(), 10u);
+    QCOMPARE(syncState.unSeenCount(), 1u);
+    QCOMPARE(model->cache()->uidMapping(QLatin1String("c")), QList<uint>() << 5 << 7);
+    QCOMPARE(model->cache()->msgFlags(QLatin1String("c"), 5), QStringList() << FlagNames::seen);
+    QCOMPARE(model->cache()->msgFlags(QLatin1String("c"), 7), QStringList());
+
+    // Opening the mailbox C counts as a hit and needs nothing but the flags resync
+    model->switchToMailbox(idxC);
+    QCOMPARE(model->mailboxPrewarmer()->hits(), 1u);
+    QCOMPARE(model->mailboxPrewarmer()->misses(), 0u);
+    cClientOn(mainConn, t.mk("SELECT c\r\n"));
+    cServerOn(mainConn, "* 2 EXISTS\r\n* OK [UIDVALIDITY 666] .\r\n* OK [UIDNEXT 10] .\r\n" + t.last("OK selected\r\n"));
+    cClientOn(mainConn, t.mk("FETCH 1:2 (FLAGS)\r\n"));
+    cServerOn(mainConn, "* 1 FETCH (FLAGS (\\Seen))\r\n* 2 FETCH (FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msgListC), 2);
+    QCOMPARE(msgListC.child(0, 0).data(RoleMessageUid).toUInt(), 5u);
+    QCOMPARE(msgListC.child(1, 0).data(RoleMessageUid).toUInt(), 7u);
+    // The sync of the prewarmed mailbox got timed, and there is no cold one to compare it with yet
+    QVERIFY(model->mailboxPrewarmer()->averageSyncMsecs(true) >= 0);
+    QCOMPARE(model->mailboxPrewarmer()->averageSyncMsecs(false), qint64(-1));
+    cClientOn(mainConn, "");
+    QVERIFY(factory->lastSocket() == warmConn);
+}
+
+TROJITA_HEADLESS_TEST(ImapModelMailboxPrewarmerTest)
@@ -0,0 +1,104 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_MailboxWatcher.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/ParallelFetchJob.h"
+#include "Streams/FakeSocket.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Check what the client has sent over the @arg SOCKET */
+#define cClientOn(SOCKET, data) \
+{ \
+    TROJITA_CLIENT_LOOP \
+    QCOMPARE(QString::fromUtf8(SOCKET->writtenStuff()), QString::fromUtf8(data)); \
+}
+
+/** @short Simulate the server sending @arg data over the @arg SOCKET */
+#define cServerOn(SOCKET, data) \
+{ \
+    SOCKET->fakeReading(data); \
+    for (int i=0; i<4; ++i) \
+        QCoreApplication::processEvents(); \
+}
+
+/** @short An EXISTS reported on the connection of a watched mailbox shows up in its message counts */
+void ImapModelMailboxWatcherTest::testExistsUpdatesCounts()
+{
+    // The server has no IDLE, so the watcher keeps asking through NOOP, and that without any delay
+    model->setProperty("trojita-imap-watch-poll-interval", 0);
+    Streams::FakeSocket *mainConn = SOCK;
+    model->setWatchedMailboxes(QStringList() << QLatin1String("c"));
+
+    Streams::FakeSocket *watchConn = SOCK;
+    QVERIFY(watchConn != mainConn);
+    cClientOn(watchConn, "y0 EXAMINE c\r\n");
+    cServerOn(watchConn, "* 2 EXISTS\r\n* 0 RECENT\r\n* OK [UIDVALIDITY 666] .\r\ny0 OK [READ-ONLY] examined\r\n");
+    cClientOn(watchConn, "y1 SEARCH UNSEEN\r\n");
+    cServerOn(watchConn, "* SEARCH 2\r\ny1 OK searched\r\n");
+    QVERIFY(idxC.data(RoleMailboxNumbersFetched).toBool());
+    QCOMPARE(idxC.data(RoleTotalMessageCount).toInt(), 2);
+    QCOMPARE(idxC.data(RoleUnreadMessageCount).toInt(), 1);
+    QCOMPARE(idxC.data(RoleRecentMessageCount).toInt(), 0);
+
+    // New mail arrives
+    cClientOn(watchConn, "y2 NOOP\r\n");
+    cServerOn(watchConn, "* 3 EXISTS\r\n* 1 RECENT\r\ny2 OK noop\r\n");
+    cClientOn(watchConn, "y3 SEARCH UNSEEN\r\n");
+    cServerOn(watchConn, "* SEARCH 2 3\r\ny3 OK searched\r\n");
+    QCOMPARE(idxC.data(RoleTotalMessageCount).toInt(), 3);
+    QCOMPARE(idxC.data(RoleUnreadMessageCount).toInt(), 2);
+    QCOMPARE(idxC.data(RoleRecentMessageCount).toInt(), 1);
+
+    // The counts came over the extra connection; the regular one was left alone
+    cClientOn(mainConn, "");
+
+    // Not watching anything anymore closes the extra connection
+    cClientOn(watchConn, "y4 NOOP\r\n");
+    model->setWatchedMailboxes(QStringList());
+    cServerOn(watchConn, "y4 OK noop\r\n");
+    cClientOn(watchConn, "y5 LOGOUT\r\n");
+    cServerOn(watchConn, "y5 OK bye\r\n");
+    cClientOn(watchConn, "");
+    cClientOn(mainConn, "");
+}
+
+/** @short The connections used by the other background work count against the limit, too */
+void ImapModelMailboxWatcherTest::testConnectionLimit()
+{
+    initialMessages(3);
+    // A download takes all of the remaining connections
+    ParallelFetchJob *job = model->fetchInParallel(idxA, QList<uint>() << 1 << 2 << 3, QList<QByteArray>() << "BODY.PEEK[1]", 3);
+    QVERIFY(job);
+    Streams::FakeSocket *lastConn = SOCK;
+
+    // ...so the mailbox can only be polled
+    model->setWatchedMailboxes(QStringList() << QLatin1String("c"));
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK, lastConn);
+}
+
+TROJITA_HEADLESS_TEST(ImapModelMailboxWatcherTest)
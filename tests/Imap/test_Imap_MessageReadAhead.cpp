@@ -0,0 +1,120 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_MessageReadAhead.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MessageReadAhead.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Open a mailbox with four messages whose envelopes are known, and mark the second and the fourth one as unread */
+void ImapModelMessageReadAheadTest::helperUnreadMessages()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    initialMessages(4);
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    for (int i = 0; i < 4; ++i) {
+        QCOMPARE(msgListA.child(i, 0).data(RoleMessageSubject).toString(), QString());
+    }
+    cClient(t.mk("UID FETCH 1:4 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray buf;
+    for (uint i = 1; i <= 4; ++i) {
+        buf += helperCreateTrivialEnvelope(i, i, QString::fromUtf8("subject %1").arg(i));
+    }
+    cServer(buf + t.last("OK fetched\r\n"));
+    cServer("* 2 FETCH (FLAGS ())\r\n* 4 FETCH (FLAGS ())\r\n");
+    QCOMPARE(msgListA.child(1, 0).data(RoleMessageIsMarkedRead).toBool(), false);
+    QCOMPARE(msgListA.child(2, 0).data(RoleMessageIsMarkedRead).toBool(), true);
+    QCOMPARE(msgListA.child(3, 0).data(RoleMessageIsMarkedRead).toBool(), false);
+    // prefetching only happens on a free network
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_ONLINE);
+    cEmpty();
+}
+
+/** @short Opening a message queues a background download of the main part of the next unread ones */
+void ImapModelMessageReadAheadTest::testPrefetchFollowingUnread()
+{
+    helperUnreadMessages();
+
+    model->messageOpened(msgListA.child(0, 0));
+    cClient(t.mk("UID FETCH 2,4 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1] \"second\")\r\n"
+            "* 4 FETCH (UID 4 BODY[1] \"fourth\")\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex second = msgListA.child(1, 0).child(0, 0);
+    QCOMPARE(second.data(RoleIsFetched).toBool(), true);
+    QCOMPARE(second.data(RolePartData).toByteArray(), QByteArray("second"));
+    QCOMPARE(msgListA.child(2, 0).child(0, 0).data(RoleIsFetched).toBool(), false);
+    cEmpty();
+
+    // Moving on to the next message finds its text right away, and there's nothing more to prefetch
+    model->messageOpened(msgListA.child(1, 0));
+    QCOMPARE(model->messageReadAhead()->hits(), 1u);
+    QCOMPARE(model->messageReadAhead()->lateHits(), 0u);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short The read-ahead never asks for the structure of a message, as that would be a foreground FETCH */
+void ImapModelMessageReadAheadTest::testUnknownStructureIsSkipped()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    initialMessages(3);
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    QCOMPARE(msgListA.child(0, 0).data(RoleMessageSubject).toString(), QString());
+    cClient(t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("subject 1")) + t.last("OK fetched\r\n"));
+    cServer("* 2 FETCH (FLAGS ())\r\n");
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_ONLINE);
+    cEmpty();
+
+    model->messageOpened(msgListA.child(0, 0));
+    cEmpty();
+    QCOMPARE(msgListA.child(1, 0).data(RoleIsFetched).toBool(), false);
+    justKeepTask();
+}
+
+/** @short When the user asks for a part which is only queued for a prefetch, the request goes out in the foreground */
+void ImapModelMessageReadAheadTest::testExplicitRequestReplacesPrefetch()
+{
+    helperUnreadMessages();
+
+    model->messageOpened(msgListA.child(0, 0));
+    QModelIndex second = msgListA.child(1, 0).child(0, 0);
+    QCOMPARE(second.data(RolePartData).toByteArray(), QByteArray());
+
+    // The part which the user is waiting for is not lumped together with the guesses
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1] \"second\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(second.data(RolePartData).toByteArray(), QByteArray("second"));
+
+    // Only then the rest of the prefetch continues
+    cClient(t.mk("UID FETCH 4 (BODY.PEEK[1])\r\n"));
+    cServer("* 4 FETCH (UID 4 BODY[1] \"fourth\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(msgListA.child(3, 0).child(0, 0).data(RolePartData).toByteArray(), QByteArray("fourth"));
+    cEmpty();
+    justKeepTask();
+}
+
+TROJITA_HEADLESS_TEST(ImapModelMessageReadAheadTest)
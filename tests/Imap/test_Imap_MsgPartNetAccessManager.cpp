@@ -20,15 +20,21 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QCoreApplication>
+#include <QDir>
 #include <QTest>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QSignalSpy>
 
 #include "data.h"
 #include "test_Imap_MsgPartNetAccessManager.h"
 #include "Imap/Network/MsgPartNetAccessManager.h"
 #include "Imap/Network/ForbiddenReply.h"
 #include "Imap/Network/MsgPartNetworkReply.h"
+#include "Imap/Model/CombinedCache.h"
+#include "Imap/Model/MemoryCache.h"
+#include "Imap/Model/Utils.h"
 #include "Streams/FakeSocket.h"
 #include "Utils/headless_test.h"
 
@@ -169,4 +175,58 @@ void ImapMsgPartNetAccessManagerTest::testMessageParts_data()
             << QByteArray("image/jpeg");
 }
 
+/** @short A big part which the cache keeps in a file of its own is served from that file, without any network activity */
+void ImapMsgPartNetAccessManagerTest::testCachedFile()
+{
+    const QString cacheDir = QDir::tempPath() + QString::fromUtf8("/trojita-test-MsgPartNetAccessManager-%1")
+            .arg(QCoreApplication::applicationPid());
+    Imap::removeRecursively(cacheDir);
+    auto cache = new Imap::Mailbox::CombinedCache(0, QLatin1String("test-cachedfile"), cacheDir);
+    QVERIFY(cache->open());
+    model->setCache(cache);
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+
+    helperSyncBNoMessages();
+    cServer("* 1 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex msg = msgListB.child(0, 0);
+    QVERIFY(msg.isValid());
+    QCOMPARE(model->rowCount(msg), 0);
+    cClient(t.mk("UID FETCH 333 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 333 BODYSTRUCTURE (" + bsPlaintext + "))\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(model->rowCount(msg) > 0);
+
+    // Random data do not compress, so they are stored as a raw blob in a file of its own
+    QByteArray data;
+    const int size = 2 * 1024 * 1024;
+    data.reserve(size);
+    qsrand(333);
+    for (int i = 0; i < size; ++i) {
+        data.append(static_cast<char>(qrand() & 0xff));
+    }
+    cache->setMsgPart(QLatin1String("b"), 333, "1", data);
+    QVERIFY(!model->cachedMessagePartFile(msg.child(0, 0)).isEmpty());
+
+    Imap::Network::MsgPartNetAccessManager nam(this);
+    nam.setModelMessage(msg);
+    QNetworkRequest req;
+    req.setUrl(QUrl(QLatin1String("trojita-imap://msg/0")));
+    QNetworkReply *res = nam.get(req);
+    QVERIFY(qobject_cast<Imap::Network::MsgPartNetworkReply*>(res));
+    QSignalSpy finishedSpy(res, SIGNAL(finished()));
+    QCoreApplication::processEvents();
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(res->error(), QNetworkReply::NoError);
+    QVERIFY(res->readAll() == data);
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+
+    // The files of the cache can only go away once it's closed
+    delete res;
+    model->setCache(new Imap::Mailbox::MemoryCache(model));
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+    Imap::removeRecursively(cacheDir);
+}
+
 TROJITA_HEADLESS_TEST( ImapMsgPartNetAccessManagerTest )
@@ -33,6 +33,7 @@ class ImapMsgPartNetAccessManagerTest : public LibMailboxSync
 private Q_SLOTS:
     void testMessageParts();
     void testMessageParts_data();
+    void testCachedFile();
 };
 
 #endif /*TEST_IMAP_MSGPARTNETACCESSMANAGER*/
@@ -0,0 +1,212 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_OfflineSync.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/Cache.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/OfflineSyncer.h"
+#include "Imap/Model/ParallelFetchJob.h"
+#include "Streams/FakeSocket.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Check what the client has sent over the @arg SOCKET */
+#define cClientOn(SOCKET, data) \
+{ \
+    TROJITA_CLIENT_LOOP \
+    QCOMPARE(QString::fromUtf8(SOCKET->writtenStuff()), QString::fromUtf8(data)); \
+}
+
+/** @short Simulate the server sending @arg data over the @arg SOCKET */
+#define cServerOn(SOCKET, data) \
+{ \
+    SOCKET->fakeReading(data); \
+    for (int i=0; i<4; ++i) \
+        QCoreApplication::processEvents(); \
+}
+
+/** @short Serve the first part of the message @arg UID over the connection which got opened for downloading it */
+#define downloadBodyPart(UID) \
+{ \
+    TROJITA_CLIENT_LOOP \
+    Streams::FakeSocket *fetchConn = SOCK; \
+    cClientOn(fetchConn, "y0 EXAMINE a\r\n"); \
+    cServerOn(fetchConn, QString::fromUtf8("* %1 EXISTS\r\n* OK [UIDVALIDITY 333] .\r\ny0 OK [READ-ONLY] examined\r\n") \
+              .arg(existsA).toUtf8()); \
+    cClientOn(fetchConn, QString::fromUtf8("y1 UID FETCH %1 (BODY.PEEK[1])\r\n").arg(UID).toUtf8()); \
+    cServerOn(fetchConn, QString::fromUtf8("* %1 FETCH (UID %1 BODY[1] \"body %1\")\r\ny1 OK fetched\r\n").arg(UID).toUtf8()); \
+    cClientOn(fetchConn, "y2 LOGOUT\r\n"); \
+    cServerOn(fetchConn, "y2 OK bye\r\n"); \
+}
+
+/** @short The synchronization does not take over the connection which the user works with */
+void ImapModelOfflineSyncTest::testOwnConnection()
+{
+    helperSyncBNoMessages();
+    Streams::FakeSocket *userConn = SOCK;
+
+    existsA = 1;
+    uidValidityA = 333;
+    uidMapA << 1;
+    uidNextA = 2;
+    OfflineSyncer syncer(model, 0);
+    QSignalSpy finishedSpy(&syncer, SIGNAL(finished()));
+    syncer.setMailboxes(QStringList() << QLatin1String("a"));
+    syncer.start();
+
+    // The syncer opens a connection of its own, so the tags start from scratch
+    t.reset();
+    cClient(t.mk("SELECT a\r\n"));
+    Streams::FakeSocket *syncConn = SOCK;
+    QVERIFY(syncConn != userConn);
+    helperFakeExistsUidValidityUidNext();
+    helperFakeUidSearch();
+    helperSyncFlags();
+    cClient(t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("subject 1")) + t.last("OK fetched\r\n"));
+    downloadBodyPart(1);
+
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 1, "1"), QByteArray("body 1"));
+    QVERIFY(model->cache()->offlineSyncProgress(QLatin1String("a")) == OfflineSyncProgress(333, 1));
+
+    // Mailbox B has stayed open and nothing got sent over its connection
+    cClientOn(userConn, "");
+    cClientOn(syncConn, "");
+    QCOMPARE(model->rowCount(msgListB), 0);
+    QVERIFY(msgListB.data(RoleIsFetched).toBool());
+}
+
+/** @short After the connection is lost, the synchronization continues where it has stopped */
+void ImapModelOfflineSyncTest::testResumeAfterDisconnect()
+{
+    existsA = 2;
+    uidValidityA = 333;
+    uidMapA << 1 << 2;
+    uidNextA = 3;
+    // One message per batch, one extra connection for the message parts
+    model->setProperty("trojita-imap-offline-sync-batch", 5);
+    model->setProperty("trojita-imap-offline-sync-connections", 1);
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    QCoreApplication::processEvents();
+
+    OfflineSyncer syncer(model, 0);
+    syncer.setMailboxes(QStringList() << QLatin1String("a"));
+    syncer.start();
+
+    cClient(t.mk("SELECT a\r\n"));
+    Streams::FakeSocket *syncConn = SOCK;
+    helperFakeExistsUidValidityUidNext();
+    helperFakeUidSearch();
+    helperSyncFlags();
+    cClient(t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("subject 1")) + t.last("OK fetched\r\n"));
+    downloadBodyPart(1);
+    QVERIFY(model->cache()->offlineSyncProgress(QLatin1String("a")) == OfflineSyncProgress(333, 1));
+
+    // The next batch waits for a while on an expensive network. Lose the connection in the meanwhile.
+    cClientOn(syncConn, "");
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_OFFLINE);
+    cClientOn(syncConn, t.mk("LOGOUT\r\n"));
+    cServerOn(syncConn, t.last("OK logged out\r\n") + "* BYE see ya\r\n");
+    QVERIFY(syncer.isRunning());
+    syncer.stop();
+    QVERIFY(model->cache()->offlineSyncProgress(QLatin1String("a")) == OfflineSyncProgress(333, 1));
+
+    // Reconnecting reloads the list of mailboxes
+    t.reset();
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    for (int i = 0; i < 10; ++i)
+        QCoreApplication::processEvents();
+    idxA = model->index(1, 0, QModelIndex());
+    QCOMPARE(idxA.data(RoleMailboxName).toString(), QString::fromUtf8("a"));
+    msgListA = model->index(0, 0, idxA);
+
+    // The mailbox gets resynced and only the second message is downloaded
+    syncer.start();
+    cClient(t.mk("SELECT a\r\n"));
+    Streams::FakeSocket *resumedConn = SOCK;
+    helperFakeExistsUidValidityUidNext();
+    helperSyncFlags();
+    cClient(t.mk("UID FETCH 2 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(2, 2, QLatin1String("subject 2")) + t.last("OK fetched\r\n"));
+    downloadBodyPart(2);
+    QVERIFY(model->cache()->offlineSyncProgress(QLatin1String("a")) == OfflineSyncProgress(333, 2));
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 1, "1"), QByteArray("body 1"));
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 2, "1"), QByteArray("body 2"));
+    cClientOn(resumedConn, "");
+}
+
+/** @short The saved progress is thrown away when the mailbox has got a new UIDVALIDITY */
+void ImapModelOfflineSyncTest::testUidValidityChange()
+{
+    model->cache()->setOfflineSyncProgress(QLatin1String("a"), OfflineSyncProgress(111, 7));
+    existsA = 1;
+    uidValidityA = 333;
+    uidMapA << 1;
+    uidNextA = 2;
+    OfflineSyncer syncer(model, 0);
+    QSignalSpy finishedSpy(&syncer, SIGNAL(finished()));
+    syncer.setMailboxes(QStringList() << QLatin1String("a"));
+    syncer.start();
+
+    cClient(t.mk("SELECT a\r\n"));
+    helperFakeExistsUidValidityUidNext();
+    helperFakeUidSearch();
+    helperSyncFlags();
+
+    // UID 1 is below the saved position, yet it gets downloaded
+    QVERIFY(model->cache()->offlineSyncProgress(QLatin1String("a")) == OfflineSyncProgress(333, 0));
+    cClient(t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("subject 1")) + t.last("OK fetched\r\n"));
+    downloadBodyPart(1);
+
+    QCOMPARE(finishedSpy.size(), 1);
+    QVERIFY(model->cache()->offlineSyncProgress(QLatin1String("a")) == OfflineSyncProgress(333, 1));
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 1, "1"), QByteArray("body 1"));
+}
+
+/** @short Without a free connection, the synchronization shares a regular one instead of opening another */
+void ImapModelOfflineSyncTest::testConnectionLimit()
+{
+    helperSyncBNoMessages();
+    Streams::FakeSocket *userConn = SOCK;
+    // A download takes all of the remaining connections
+    ParallelFetchJob *job = model->fetchInParallel(idxB, QList<uint>() << 1 << 2 << 3, QList<QByteArray>() << "BODY.PEEK[1]", 3);
+    QVERIFY(job);
+    Streams::FakeSocket *lastConn = SOCK;
+
+    existsA = 1;
+    uidValidityA = 333;
+    uidMapA << 1;
+    uidNextA = 2;
+    OfflineSyncer syncer(model, 0);
+    syncer.setMailboxes(QStringList() << QLatin1String("a"));
+    syncer.start();
+    cClientOn(userConn, t.mk("SELECT a\r\n"));
+    QCOMPARE(SOCK, lastConn);
+}
+
+TROJITA_HEADLESS_TEST(ImapModelOfflineSyncTest)
@@ -880,6 +880,13 @@ void ImapParserParseTest::testParseUntagged_data()
             << QByteArray("* 81 FETCH (UID 81 BODY[HEADER.FIELDS (MESSAgE-Id)]{10}\r\n01234567\r\n)\r\n")
             << QSharedPointer<AbstractResponse>(new Fetch(81, fetchData));
 
+    fetchData.clear();
+    fetchData["UID"] = QSharedPointer<AbstractData>(new RespData<uint>(81));
+    fetchData["BODY[1]<1024>"] = QSharedPointer<AbstractData>(new RespData<QByteArray>("01234567\r\n"));
+    QTest::newRow("fetch-partial-body")
+            << QByteArray("* 81 FETCH (UID 81 BODY[1]<1024> {10}\r\n01234567\r\n)\r\n")
+            << QSharedPointer<AbstractResponse>(new Fetch(81, fetchData));
+
     QTest::newRow("id-nil")
             << QByteArray("* ID nIl\r\n")
             << QSharedPointer<AbstractResponse>(new Id(QMap<QByteArray,QByteArray>()));
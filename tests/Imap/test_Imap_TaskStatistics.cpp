@@ -0,0 +1,107 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_TaskStatistics.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/TaskStatistics.h"
+
+using namespace Imap::Mailbox;
+
+namespace {
+
+quint64 totalUntaggedBytes(const TaskStatistics *stats)
+{
+    quint64 res = 0;
+    Q_FOREACH(const quint64 bytes, stats->untaggedBytes()) {
+        res += bytes;
+    }
+    return res;
+}
+
+}
+
+/** @short With a single command in flight, the task is credited with the untagged data as well */
+void ImapModelTaskStatisticsTest::testUntaggedDataOfSingleCommand()
+{
+    initialMessages(2);
+    // no preloading, so that the FETCH is for a single message
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    TaskStatistics *stats = model->taskStatistics();
+    stats->reset();
+
+    QCOMPARE(msgListA.child(0, 0).data(RoleMessageSubject).toString(), QString());
+    QByteArray command = t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n");
+    cClient(command);
+    QByteArray untagged = helperCreateTrivialEnvelope(1, 1, QLatin1String("subject")) + "* 2 FETCH (FLAGS (\\Seen))\r\n";
+    QByteArray tagged = t.last("OK fetched\r\n");
+    cServer(untagged + tagged);
+    QCOMPARE(msgListA.child(0, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("subject"));
+
+    QVERIFY(stats->perType().contains(QLatin1String("FetchMsgMetadataTask")));
+    const TaskStatistics::PerType fetch = stats->perType()[QLatin1String("FetchMsgMetadataTask")];
+    QCOMPARE(fetch.completed, quint64(1));
+    QCOMPARE(fetch.bytesSent.sum(), quint64(command.size()));
+    QCOMPARE(fetch.bytesReceived.sum(), quint64(untagged.size() + tagged.size()));
+    QCOMPARE(fetch.firstResponse.count(), quint64(1));
+    QCOMPARE(totalUntaggedBytes(stats), quint64(0));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short The untagged data which arrive while more commands are pipelined go to the connection */
+void ImapModelTaskStatisticsTest::testUntaggedDataPerConnection()
+{
+    initialMessages(2);
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    TaskStatistics *stats = model->taskStatistics();
+    stats->reset();
+
+    QCOMPARE(msgListA.child(0, 0).data(RoleMessageSubject).toString(), QString());
+    QByteArray command1 = t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n");
+    QByteArray tagged1 = t.last("OK fetched\r\n");
+    cClient(command1);
+    QCOMPARE(msgListA.child(1, 0).data(RoleMessageSubject).toString(), QString());
+    QByteArray command2 = t.mk("UID FETCH 2 (" FETCH_METADATA_ITEMS ")\r\n");
+    QByteArray tagged2 = t.last("OK fetched\r\n");
+    cClient(command2);
+
+    // The first response arrives while both commands are in flight, the second one once the first command is gone
+    QByteArray untagged1 = helperCreateTrivialEnvelope(1, 1, QLatin1String("one"));
+    QByteArray untagged2 = helperCreateTrivialEnvelope(2, 2, QLatin1String("two"));
+    cServer(untagged1 + tagged1 + untagged2 + tagged2);
+    QCOMPARE(msgListA.child(0, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("one"));
+    QCOMPARE(msgListA.child(1, 0).data(RoleMessageSubject).toString(), QString::fromUtf8("two"));
+
+    const TaskStatistics::PerType fetch = stats->perType()[QLatin1String("FetchMsgMetadataTask")];
+    QCOMPARE(fetch.completed, quint64(2));
+    QCOMPARE(fetch.bytesSent.sum(), quint64(command1.size() + command2.size()));
+    QCOMPARE(fetch.bytesReceived.sum(), quint64(tagged1.size() + untagged2.size() + tagged2.size()));
+    QCOMPARE(totalUntaggedBytes(stats), quint64(untagged1.size()));
+    QCOMPARE(stats->untaggedBytes().size(), 1);
+    cEmpty();
+    justKeepTask();
+}
+
+TROJITA_HEADLESS_TEST(ImapModelTaskStatisticsTest)
@@ -247,6 +247,47 @@ void ImapModelObtainSynchronizedMailboxTest::testSyncWithMessages()
     helperVerifyUidMapA();
 }
 
+/** @short Sync just the newest messages of a large mailbox and backfill the rest in the background */
+void ImapModelObtainSynchronizedMailboxTest::testWindowedSync()
+{
+    model->setProperty("trojita-imap-sync-window", 3);
+    model->setProperty("trojita-imap-sync-backfill-chunk", 2);
+
+    QCOMPARE(model->rowCount(msgListA), 0);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer(QByteArray("* 6 EXISTS\r\n* OK [UIDVALIDITY 666] .\r\n* OK [UIDNEXT 20] .\r\n") + t.last("OK selected\r\n"));
+
+    // Only the newest messages are synced before the mailbox is declared usable
+    cClient(t.mk("FETCH 4:6 (UID FLAGS)\r\n"));
+    cServer(QByteArray("* 4 FETCH (UID 14 FLAGS (\\Seen))\r\n"
+                       "* 5 FETCH (UID 15 FLAGS ())\r\n"
+                       "* 6 FETCH (UID 16 FLAGS (\\Seen))\r\n")
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msgListA), 6);
+    QCOMPARE(msgListA.child(2, 0).data(Imap::Mailbox::RoleMessageIsPlaceholder).toBool(), true);
+    QCOMPARE(msgListA.child(3, 0).data(Imap::Mailbox::RoleMessageIsPlaceholder).toBool(), false);
+    QCOMPARE(msgListA.child(3, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 14u);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 1);
+    // The UID map is incomplete, so it must not hit the cache yet
+    QVERIFY(model->cache()->uidMapping(QLatin1String("a")).isEmpty());
+
+    // The older messages are backfilled from the newest to the oldest, even when some of them disappear meanwhile
+    cClient(t.mk("FETCH 2:3 (UID FLAGS)\r\n"));
+    cServer(QByteArray("* 1 EXPUNGE\r\n"
+                       "* 1 FETCH (UID 12 FLAGS ())\r\n"
+                       "* 2 FETCH (UID 13 FLAGS (\\Seen))\r\n")
+            + t.last("OK fetched\r\n"));
+    cEmpty();
+
+    QCOMPARE(model->rowCount(msgListA), 5);
+    QCOMPARE(msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageIsPlaceholder).toBool(), false);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 2);
+    QCOMPARE(model->cache()->uidMapping(QLatin1String("a")), QList<uint>() << 12 << 13 << 14 << 15 << 16);
+    QCOMPARE(model->cache()->mailboxSyncState(QLatin1String("a")).exists(), 5u);
+
+    QVERIFY(errorSpy->isEmpty());
+}
+
 /** @short Go back to a selected mailbox after some time, the mailbox doesn't have any modifications */
 void ImapModelObtainSynchronizedMailboxTest::testResyncNoArrivals()
 {
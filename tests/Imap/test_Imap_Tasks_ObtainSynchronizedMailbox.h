@@ -46,6 +46,7 @@ private slots:
     void testSyncTwoLikeCyrus();
     void testSyncTwoInParallel();
     void testSyncNoUidnext();
+    void testWindowedSync();
     void testResyncNoArrivals();
     void testResyncOneNew();
     void testResyncUidValidity();
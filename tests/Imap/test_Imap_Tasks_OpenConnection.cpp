@@ -595,6 +595,56 @@ void ImapModelOpenConnectionTest::testOpenConnectionShallBlock()
     QVERIFY(startTlsUpgradeSpy->isEmpty());
 }
 
+/** @short NOTIFY is not used unless it was enabled explicitly, even though the server supports it */
+void ImapModelOpenConnectionTest::testNotifyDisabledByDefault()
+{
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    SOCK->fakeReading("* PREAUTH [CAPABILITY IMAP4rev1 NOTIFY] foo\r\n");
+    for (int i = 0; i < 5; ++i)
+        QCoreApplication::processEvents();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QCOMPARE(SOCK->writtenStuff(), QByteArray());
+}
+
+/** @short When enabled, the connection subscribes to the changes in all personal mailboxes */
+void ImapModelOpenConnectionTest::testNotifySet()
+{
+    model->setProperty("trojita-imap-notify", true);
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    SOCK->fakeReading("* PREAUTH [CAPABILITY IMAP4rev1 NOTIFY] foo\r\n");
+    for (int i = 0; i < 5; ++i)
+        QCoreApplication::processEvents();
+    QCOMPARE(completedSpy->size(), 1);
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y0 NOTIFY SET STATUS (selected-delayed (MessageNew MessageExpunge FlagChange)) "
+                                              "(personal (MessageNew MessageExpunge FlagChange))\r\n"));
+    SOCK->fakeReading("y0 OK notifying\r\n");
+    for (int i = 0; i < 5; ++i)
+        QCoreApplication::processEvents();
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(connErrorSpy->isEmpty());
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+}
+
+/** @short Enabling NOTIFY does not matter when the server does not support it */
+void ImapModelOpenConnectionTest::testNotifyUnsupported()
+{
+    model->setProperty("trojita-imap-notify", true);
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    SOCK->fakeReading("* PREAUTH [CAPABILITY IMAP4rev1] foo\r\n");
+    for (int i = 0; i < 5; ++i)
+        QCoreApplication::processEvents();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QCOMPARE(SOCK->writtenStuff(), QByteArray());
+}
+
 /** @short Test that no tasks can skip over a task which is blocking for login */
 void ImapModelOpenConnectionTest::testLoginDelaysOtherTasks()
 {
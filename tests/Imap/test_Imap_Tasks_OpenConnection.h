@@ -57,6 +57,10 @@ private slots:
     void testCompressDeflateOk();
     void testCompressDeflateNo();
 
+    void testNotifyDisabledByDefault();
+    void testNotifySet();
+    void testNotifyUnsupported();
+
     void testOpenConnectionShallBlock();
 
     void testLoginDelaysOtherTasks();
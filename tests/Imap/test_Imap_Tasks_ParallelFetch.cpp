@@ -0,0 +1,210 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_Tasks_ParallelFetch.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/ParallelFetchJob.h"
+#include "Streams/FakeSocket.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Check what the client has sent over the @arg SOCKET */
+#define cClientOn(SOCKET, data) \
+{ \
+    TROJITA_CLIENT_LOOP \
+    QCOMPARE(QString::fromUtf8(SOCKET->writtenStuff()), QString::fromUtf8(data)); \
+}
+
+/** @short Simulate the server sending @arg data over the @arg SOCKET */
+#define cServerOn(SOCKET, data) \
+{ \
+    SOCKET->fakeReading(data); \
+    for (int i=0; i<4; ++i) \
+        QCoreApplication::processEvents(); \
+}
+
+/** @short The untagged responses to the EXAMINE of the mailbox prepared by helperLoadStructure() */
+#define EXAMINE_RESPONSES "* 6 EXISTS\r\n* OK [UIDVALIDITY 333] .\r\n"
+
+/** @short Open the mailbox with @arg count messages and learn their structure over the main connection */
+void ImapModelParallelFetchTest::helperLoadStructure(const uint count)
+{
+    initialMessages(count);
+    // No preloading of the neighboring messages
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    QCoreApplication::processEvents();
+
+    QByteArray response;
+    for (uint i = 0; i < count; ++i) {
+        msgListA.child(i, 0).data(RoleMessageSubject);
+        response += helperCreateTrivialEnvelope(i + 1, i + 1, QString::fromUtf8("subject %1").arg(i + 1));
+    }
+    cClient(t.mk(QString::fromUtf8("UID FETCH 1:%1 (" FETCH_METADATA_ITEMS ")\r\n").arg(count).toUtf8()));
+    cServer(response + t.last("OK fetched\r\n"));
+    for (uint i = 0; i < count; ++i) {
+        QCOMPARE(model->rowCount(msgListA.child(i, 0)), 1);
+    }
+    model->setProperty("trojita-imap-parallel-fetch-chunk", 2);
+}
+
+/** @short Prepare an untagged FETCH which carries the first part of a message */
+QByteArray ImapModelParallelFetchTest::helperBody(const uint uid)
+{
+    return QString::fromUtf8("* %1 FETCH (UID %1 BODY[1] \"body %1\")\r\n").arg(uid).toUtf8();
+}
+
+/** @short The work is split among the connections and the data end up in the tree and in the cache */
+void ImapModelParallelFetchTest::testTwoConnections()
+{
+    helperLoadStructure(6);
+    Streams::FakeSocket *mainConn = SOCK;
+
+    ParallelFetchJob *job = model->fetchInParallel(idxA, QList<uint>() << 1 << 2 << 3 << 4 << 5 << 6,
+                                                   QList<QByteArray>() << "BODY.PEEK[1]", 2);
+    QVERIFY(job);
+    QSignalSpy finishedSpy(job, SIGNAL(finished()));
+    QSignalSpy failedSpy(job, SIGNAL(failed(QString)));
+    Streams::FakeSocket *conn1 = static_cast<Streams::FakeSocket*>(factory->socket(1));
+    Streams::FakeSocket *conn2 = static_cast<Streams::FakeSocket*>(factory->socket(2));
+
+    cClientOn(conn1, "y0 EXAMINE a\r\n");
+    cClientOn(conn2, "y0 EXAMINE a\r\n");
+
+    // The first connection to get ready keeps two chunks in flight...
+    cServerOn(conn1, EXAMINE_RESPONSES "y0 OK [READ-ONLY] examined\r\n");
+    cClientOn(conn1, "y1 UID FETCH 1:2 (BODY.PEEK[1])\r\ny2 UID FETCH 3:4 (BODY.PEEK[1])\r\n");
+    // ...while the second one takes whatever is left
+    cServerOn(conn2, EXAMINE_RESPONSES "y0 OK [READ-ONLY] examined\r\n");
+    cClientOn(conn2, "y1 UID FETCH 5:6 (BODY.PEEK[1])\r\n");
+
+    cServerOn(conn1, helperBody(1) + helperBody(2) + "y1 OK fetched\r\n");
+    QCOMPARE(msgListA.child(0, 0).child(0, 0).data(RolePartData).toByteArray(), QByteArray("body 1"));
+    QCOMPARE(msgListA.child(1, 0).child(0, 0).data(RolePartData).toByteArray(), QByteArray("body 2"));
+    cClientOn(conn1, "");
+
+    // When there's nothing left to do, the connection gets closed
+    cServerOn(conn2, helperBody(5) + helperBody(6) + "y1 OK fetched\r\n");
+    cClientOn(conn2, "y2 LOGOUT\r\n");
+    cServerOn(conn2, "y2 OK bye\r\n");
+    QCOMPARE(finishedSpy.size(), 0);
+
+    cServerOn(conn1, helperBody(3) + helperBody(4) + "y2 OK fetched\r\n");
+    cClientOn(conn1, "y3 LOGOUT\r\n");
+    cServerOn(conn1, "y3 OK bye\r\n");
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(failedSpy.size(), 0);
+
+    for (uint uid = 1; uid <= 6; ++uid) {
+        const QByteArray body = "body " + QByteArray::number(uid);
+        QCOMPARE(msgListA.child(uid - 1, 0).child(0, 0).data(RolePartData).toByteArray(), body);
+        QCOMPARE(model->cache()->messagePart(QLatin1String("a"), uid, "1"), body);
+    }
+
+    // The mailbox was not touched over the main connection at all
+    QCOMPARE(QString::fromUtf8(mainConn->writtenStuff()), QString());
+}
+
+/** @short A connection which cannot open the mailbox leaves all the work to the others */
+void ImapModelParallelFetchTest::testExamineFailure()
+{
+    helperLoadStructure(6);
+    Streams::FakeSocket *mainConn = SOCK;
+
+    ParallelFetchJob *job = model->fetchInParallel(idxA, QList<uint>() << 1 << 2 << 3 << 4 << 5 << 6,
+                                                   QList<QByteArray>() << "BODY.PEEK[1]", 2);
+    QVERIFY(job);
+    QSignalSpy finishedSpy(job, SIGNAL(finished()));
+    QSignalSpy failedSpy(job, SIGNAL(failed(QString)));
+    Streams::FakeSocket *conn1 = static_cast<Streams::FakeSocket*>(factory->socket(1));
+    Streams::FakeSocket *conn2 = static_cast<Streams::FakeSocket*>(factory->socket(2));
+
+    cClientOn(conn1, "y0 EXAMINE a\r\n");
+    cClientOn(conn2, "y0 EXAMINE a\r\n");
+
+    cServerOn(conn2, "y0 NO go away\r\n");
+    cClientOn(conn2, "y1 LOGOUT\r\n");
+    cServerOn(conn2, "y1 OK bye\r\n");
+
+    cServerOn(conn1, EXAMINE_RESPONSES "y0 OK [READ-ONLY] examined\r\n");
+    cClientOn(conn1, "y1 UID FETCH 1:2 (BODY.PEEK[1])\r\ny2 UID FETCH 3:4 (BODY.PEEK[1])\r\n");
+    cServerOn(conn1, helperBody(1) + helperBody(2) + "y1 OK fetched\r\n");
+    // The chunk which would have been handled by the other connection is picked up here
+    cClientOn(conn1, "y3 UID FETCH 5:6 (BODY.PEEK[1])\r\n");
+    cServerOn(conn1, helperBody(3) + helperBody(4) + "y2 OK fetched\r\n");
+    cClientOn(conn1, "");
+    cServerOn(conn1, helperBody(5) + helperBody(6) + "y3 OK fetched\r\n");
+    cClientOn(conn1, "y4 LOGOUT\r\n");
+    cServerOn(conn1, "y4 OK bye\r\n");
+
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(failedSpy.size(), 0);
+    for (uint uid = 1; uid <= 6; ++uid) {
+        QCOMPARE(msgListA.child(uid - 1, 0).child(0, 0).data(RolePartData).toByteArray(), "body " + QByteArray::number(uid));
+    }
+    QCOMPARE(QString::fromUtf8(mainConn->writtenStuff()), QString());
+}
+
+/** @short A failed UID FETCH marks its parts as unavailable and the job reports the failure */
+void ImapModelParallelFetchTest::testFetchFailure()
+{
+    helperLoadStructure(6);
+    Streams::FakeSocket *mainConn = SOCK;
+
+    ParallelFetchJob *job = model->fetchInParallel(idxA, QList<uint>() << 1 << 2 << 3 << 4 << 5 << 6,
+                                                   QList<QByteArray>() << "BODY.PEEK[1]", 2);
+    QVERIFY(job);
+    QSignalSpy finishedSpy(job, SIGNAL(finished()));
+    QSignalSpy failedSpy(job, SIGNAL(failed(QString)));
+    Streams::FakeSocket *conn1 = static_cast<Streams::FakeSocket*>(factory->socket(1));
+    Streams::FakeSocket *conn2 = static_cast<Streams::FakeSocket*>(factory->socket(2));
+
+    cClientOn(conn1, "y0 EXAMINE a\r\n");
+    cClientOn(conn2, "y0 EXAMINE a\r\n");
+    cServerOn(conn1, EXAMINE_RESPONSES "y0 OK [READ-ONLY] examined\r\n");
+    cClientOn(conn1, "y1 UID FETCH 1:2 (BODY.PEEK[1])\r\ny2 UID FETCH 3:4 (BODY.PEEK[1])\r\n");
+    cServerOn(conn2, EXAMINE_RESPONSES "y0 OK [READ-ONLY] examined\r\n");
+    cClientOn(conn2, "y1 UID FETCH 5:6 (BODY.PEEK[1])\r\n");
+
+    cServerOn(conn2, "y1 NO cannot fetch\r\n");
+    cClientOn(conn2, "y2 LOGOUT\r\n");
+    cServerOn(conn2, "y2 OK bye\r\n");
+    QVERIFY(msgListA.child(4, 0).child(0, 0).data(RoleIsUnavailable).toBool());
+    QVERIFY(msgListA.child(5, 0).child(0, 0).data(RoleIsUnavailable).toBool());
+
+    // The other connection is not affected
+    cServerOn(conn1, helperBody(1) + helperBody(2) + "y1 OK fetched\r\n" + helperBody(3) + helperBody(4) + "y2 OK fetched\r\n");
+    cClientOn(conn1, "y3 LOGOUT\r\n");
+    cServerOn(conn1, "y3 OK bye\r\n");
+
+    QCOMPARE(finishedSpy.size(), 0);
+    QCOMPARE(failedSpy.size(), 1);
+    QCOMPARE(failedSpy[0][0].toString(), QString::fromUtf8("cannot fetch"));
+    for (uint uid = 1; uid <= 4; ++uid) {
+        QCOMPARE(msgListA.child(uid - 1, 0).child(0, 0).data(RolePartData).toByteArray(), "body " + QByteArray::number(uid));
+    }
+    QCOMPARE(QString::fromUtf8(mainConn->writtenStuff()), QString());
+}
+
+TROJITA_HEADLESS_TEST(ImapModelParallelFetchTest)
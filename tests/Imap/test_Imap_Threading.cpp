@@ -1262,6 +1262,18 @@ void ImapModelThreadingTest::testIncrementalThreading()
     QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2 3)(7 (8 9 11)(10))(4 (5)(6))"));
     cServer(t.last("OK done\r\n"));
 
+    // The cached threading got updated as well
+    using Imap::Responses::ThreadingNode;
+    QVector<ThreadingNode> expected;
+    expected << ThreadingNode(1)
+             << ThreadingNode(2, QVector<ThreadingNode>() << ThreadingNode(3))
+             << ThreadingNode(7, QVector<ThreadingNode>()
+                              << ThreadingNode(8, QVector<ThreadingNode>()
+                                               << ThreadingNode(9, QVector<ThreadingNode>() << ThreadingNode(11)))
+                              << ThreadingNode(10))
+             << ThreadingNode(4, QVector<ThreadingNode>() << ThreadingNode(5) << ThreadingNode(6));
+    QVERIFY(model->cache()->messageThreading("a") == expected);
+
     cEmpty();
 }
 
@@ -0,0 +1,166 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QTest>
+#include "test_CombinedCache.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/CombinedCache.h"
+#include "Imap/Model/Utils.h"
+
+using namespace Imap::Mailbox;
+
+namespace {
+
+AbstractCache::MessageDataBundle dummyMetadata(const uint uid)
+{
+    AbstractCache::MessageDataBundle res;
+    res.uid = uid;
+    res.envelope.subject = QString::fromUtf8("Message %1").arg(QString::number(uid));
+    res.size = 1000 + uid;
+    res.serializedBodyStructure = "body structure";
+    return res;
+}
+
+}
+
+void TestCombinedCache::init()
+{
+    cacheDir = QDir::tempPath() + QString::fromUtf8("/trojita-test-CombinedCache-%1").arg(QCoreApplication::applicationPid());
+    Imap::removeRecursively(cacheDir);
+    QVERIFY(QDir().mkpath(cacheDir));
+    cache = 0;
+    errorSpy = 0;
+    reopen();
+}
+
+void TestCombinedCache::cleanup()
+{
+    delete cache;
+    cache = 0;
+    delete errorSpy;
+    errorSpy = 0;
+    Imap::removeRecursively(cacheDir);
+}
+
+/** @short Start again with an empty in-memory tier on top of the same files */
+void TestCombinedCache::reopen()
+{
+    delete cache;
+    delete errorSpy;
+    // The SQLCache needs a parent for its timers
+    cache = new CombinedCache(this, QLatin1String("test-combined"), cacheDir);
+    errorSpy = new QSignalSpy(cache, SIGNAL(error(QString)));
+    QVERIFY(cache->open());
+}
+
+/** @short Repeated lookups are served from memory */
+void TestCombinedCache::testHotLookups()
+{
+    for (uint uid = 1; uid <= 10; ++uid) {
+        cache->setMessageMetadata(QLatin1String("a"), uid, dummyMetadata(uid));
+        cache->setMsgFlags(QLatin1String("a"), uid, QStringList() << QLatin1String("\\Seen"));
+    }
+    cache->setMsgPart(QLatin1String("a"), 1, "1", QByteArray("body"));
+    reopen();
+
+    QList<uint> uids;
+    for (uint uid = 1; uid <= 10; ++uid) {
+        uids << uid;
+    }
+    QCOMPARE(cache->messageMetadata(QLatin1String("a"), uids).size(), 10);
+    QCOMPARE(cache->msgFlags(QLatin1String("a"), 3), QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "1"), QByteArray("body"));
+    AbstractCache::Usage usage = cache->usage();
+    QCOMPARE(usage.memoryHits, qint64(0));
+    QCOMPARE(usage.memoryMisses, qint64(12));
+
+    QVERIFY(cache->messageMetadata(QLatin1String("a"), 5) == dummyMetadata(5));
+    QCOMPARE(cache->messageMetadata(QLatin1String("a"), uids).size(), 10);
+    QCOMPARE(cache->msgFlags(QLatin1String("a"), 3), QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "1"), QByteArray("body"));
+    usage = cache->usage();
+    QCOMPARE(usage.memoryHits, qint64(13));
+    QCOMPARE(usage.memoryMisses, qint64(12));
+
+    // Absent messages are looked up each time
+    QCOMPARE(cache->messageMetadata(QLatin1String("a"), 11).uid, 0u);
+    QCOMPARE(cache->messageMetadata(QLatin1String("a"), 11).uid, 0u);
+    QCOMPARE(cache->usage().memoryMisses, qint64(14));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Whatever gets written is on the disk immediately, and it can be read from memory */
+void TestCombinedCache::testWriteThrough()
+{
+    SyncState state;
+    state.setExists(3);
+    state.setUidNext(4);
+    cache->setMailboxSyncState(QLatin1String("a"), state);
+    cache->setUidMapping(QLatin1String("a"), QList<uint>() << 1 << 2 << 3);
+    cache->setMessageMetadata(QLatin1String("a"), 2, dummyMetadata(2));
+    cache->setMsgPart(QLatin1String("a"), 2, "1", QByteArray("old"));
+    cache->setMsgPart(QLatin1String("a"), 2, "1", QByteArray("new"));
+
+    QVERIFY(cache->mailboxSyncState(QLatin1String("a")).completelyEqualTo(state));
+    QCOMPARE(cache->uidMapping(QLatin1String("a")), QList<uint>() << 1 << 2 << 3);
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 2, "1"), QByteArray("new"));
+    QCOMPARE(cache->usage().memoryMisses, qint64(0));
+
+    reopen();
+    QVERIFY(cache->mailboxSyncState(QLatin1String("a")).completelyEqualTo(state));
+    QCOMPARE(cache->uidMapping(QLatin1String("a")), QList<uint>() << 1 << 2 << 3);
+    QVERIFY(cache->messageMetadata(QLatin1String("a"), 2) == dummyMetadata(2));
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 2, "1"), QByteArray("new"));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Removing the data from the cache removes them from memory as well */
+void TestCombinedCache::testInvalidation()
+{
+    cache->setMessageMetadata(QLatin1String("a"), 1, dummyMetadata(1));
+    cache->setMessageMetadata(QLatin1String("a"), 2, dummyMetadata(2));
+    cache->setMessageMetadata(QLatin1String("b"), 1, dummyMetadata(1));
+    cache->setMsgPart(QLatin1String("a"), 1, "1", QByteArray("one"));
+    cache->setMsgPart(QLatin1String("a"), 1, "2", QByteArray("two"));
+    cache->setMsgPart(QLatin1String("a"), 2, "1", QByteArray("three"));
+
+    cache->forgetMessagePart(QLatin1String("a"), 1, "2");
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "2"), QByteArray());
+
+    cache->clearMessage(QLatin1String("a"), 1);
+    QCOMPARE(cache->messageMetadata(QLatin1String("a"), 1).uid, 0u);
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "1"), QByteArray());
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 2, "1"), QByteArray("three"));
+
+    cache->setUidMapping(QLatin1String("a"), QList<uint>() << 2);
+    cache->clearAllMessages(QLatin1String("a"));
+    QCOMPARE(cache->messageMetadata(QLatin1String("a"), 2).uid, 0u);
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 2, "1"), QByteArray());
+    QCOMPARE(cache->uidMapping(QLatin1String("a")), QList<uint>());
+    QVERIFY(cache->messageMetadata(QLatin1String("b"), 1) == dummyMetadata(1));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+TROJITA_HEADLESS_TEST(TestCombinedCache)
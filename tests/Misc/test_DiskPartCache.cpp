@@ -0,0 +1,199 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QTest>
+#include "test_DiskPartCache.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/DiskPartCache.h"
+#include "Imap/Model/Utils.h"
+
+namespace {
+
+/** @short Data which do not compress well, and therefore end up in a file of their own */
+QByteArray incompressibleData(const int size, const uint seed)
+{
+    QByteArray res;
+    res.reserve(size);
+    qsrand(seed);
+    for (int i = 0; i < size; ++i) {
+        res.append(static_cast<char>(qrand() & 0xff));
+    }
+    return res;
+}
+
+}
+
+void TestDiskPartCache::init()
+{
+    cacheDir = QDir::tempPath() + QString::fromUtf8("/trojita-test-DiskPartCache-%1").arg(QCoreApplication::applicationPid());
+    Imap::removeRecursively(cacheDir);
+    cache = new Imap::Mailbox::DiskPartCache(0, cacheDir);
+    errorSpy = new QSignalSpy(cache, SIGNAL(error(QString)));
+    QVERIFY(cache->open(QLatin1String("test-parts")));
+}
+
+void TestDiskPartCache::cleanup()
+{
+    delete cache;
+    cache = 0;
+    delete errorSpy;
+    errorSpy = 0;
+    Imap::removeRecursively(cacheDir);
+}
+
+QStringList TestDiskPartCache::filesInStore(const QString &pattern) const
+{
+    return QDir(cacheDir + QLatin1String("/parts")).entryList(QStringList() << pattern, QDir::Files);
+}
+
+/** @short The same data are stored only once, and they live as long as something refers to them */
+void TestDiskPartCache::testDeduplication()
+{
+    QByteArray attachment = incompressibleData(2 * 1024 * 1024, 1);
+    cache->setMsgPart(QLatin1String("a"), 1, "2", attachment);
+    cache->setMsgPart(QLatin1String("b"), 10, "1.2", attachment);
+    cache->setMsgPart(QLatin1String("b"), 11, "2", attachment);
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 1);
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "2"), attachment);
+    QCOMPARE(cache->messagePart(QLatin1String("b"), 10, "1.2"), attachment);
+
+    cache->forgetMessagePart(QLatin1String("a"), 1, "2");
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "2"), QByteArray());
+    cache->clearMessage(QLatin1String("b"), 10);
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 1);
+    QCOMPARE(cache->messagePart(QLatin1String("b"), 11, "2"), attachment);
+
+    // Replacing the data releases the old ones
+    QByteArray another = incompressibleData(2 * 1024 * 1024, 2);
+    cache->setMsgPart(QLatin1String("b"), 11, "2", another);
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 1);
+    QCOMPARE(cache->messagePart(QLatin1String("b"), 11, "2"), another);
+
+    cache->clearAllMessages(QLatin1String("b"));
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 0);
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Small blobs share the pack files, and the unused space gets reclaimed */
+void TestDiskPartCache::testPacks()
+{
+    const uint count = 20;
+    for (uint uid = 1; uid <= count; ++uid) {
+        cache->setMsgPart(QLatin1String("a"), uid, "1", QByteArray(1024 * 1024, 'a' + uid));
+    }
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 0);
+    QStringList packs = filesInStore(QLatin1String("*.pack"));
+    QCOMPARE(packs.size(), 1);
+
+    // Nothing to do while the pack is still mostly used
+    cache->compact();
+    QCOMPARE(filesInStore(QLatin1String("*.pack")), packs);
+
+    // Freeing most of the pack makes it worth compacting
+    for (uint uid = 2; uid <= count; ++uid) {
+        cache->forgetMessagePart(QLatin1String("a"), uid, "1");
+    }
+    cache->compact();
+    QStringList compacted = filesInStore(QLatin1String("*.pack"));
+    QCOMPARE(compacted.size(), 1);
+    QVERIFY(compacted != packs);
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "1"), QByteArray(1024 * 1024, 'a' + 1));
+
+    cache->setMsgPart(QLatin1String("b"), 1, "1", QByteArray(1024 * 1024, 'x'));
+    QCOMPARE(filesInStore(QLatin1String("*.pack")), compacted);
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "1"), QByteArray(1024 * 1024, 'a' + 1));
+    QCOMPARE(cache->messagePart(QLatin1String("b"), 1, "1"), QByteArray(1024 * 1024, 'x'));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short The files written by the older versions are still readable, and they get moved into the store */
+void TestDiskPartCache::testLegacyFiles()
+{
+    QString mailboxDir = cacheDir + QLatin1String("/") + QString::fromUtf8(QByteArray("INBOX").toBase64());
+    QVERIFY(QDir().mkpath(mailboxDir));
+    QFile legacy(mailboxDir + QLatin1String("/3_1.2.cache"));
+    QVERIFY(legacy.open(QIODevice::WriteOnly));
+    legacy.write(qCompress(QByteArray("legacy data")));
+    legacy.close();
+
+    QCOMPARE(cache->messagePart(QLatin1String("INBOX"), 3, "1.2"), QByteArray("legacy data"));
+    QVERIFY(!legacy.exists());
+    QCOMPARE(cache->messagePart(QLatin1String("INBOX"), 3, "1.2"), QByteArray("legacy data"));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short The eviction removes the oldest data along with every part which uses them */
+void TestDiskPartCache::testEviction()
+{
+    QByteArray first = incompressibleData(2 * 1024 * 1024, 1);
+    QByteArray second = incompressibleData(2 * 1024 * 1024, 2);
+    cache->setMsgPart(QLatin1String("a"), 1, "2", first);
+    cache->setMsgPart(QLatin1String("b"), 5, "1", first);
+    cache->setMsgPart(QLatin1String("a"), 2, "2", second);
+    cache->setMsgPart(QLatin1String("a"), 3, "1", QByteArray(1024 * 1024, 'x'));
+    QCOMPARE(cache->partCount(), qint64(4));
+    qint64 size = cache->size();
+    QVERIFY(size > 4 * 1024 * 1024);
+    QVERIFY(cache->oldestAccess() > 0);
+
+    qint64 freed = cache->evictLeastRecentlyUsed(1);
+    QVERIFY(freed >= first.size());
+    QCOMPARE(cache->size(), size - freed);
+    QCOMPARE(cache->partCount(), qint64(2));
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 1, "2"), QByteArray());
+    QCOMPARE(cache->messagePart(QLatin1String("b"), 5, "1"), QByteArray());
+    QCOMPARE(cache->messagePart(QLatin1String("a"), 2, "2"), second);
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 1);
+
+    cache->evictLeastRecentlyUsed(10);
+    QCOMPARE(cache->partCount(), qint64(0));
+    QCOMPARE(cache->size(), qint64(0));
+    QCOMPARE(cache->oldestAccess(), qint64(-1));
+    QCOMPARE(filesInStore(QLatin1String("*.blob")).size(), 0);
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Only the big parts which are stored verbatim can be read from their files directly */
+void TestDiskPartCache::testPartFile()
+{
+    QByteArray attachment = incompressibleData(2 * 1024 * 1024, 3);
+    cache->setMsgPart(QLatin1String("a"), 1, "2", attachment);
+    QString fileName = cache->messagePartFile(QLatin1String("a"), 1, "2");
+    QVERIFY(!fileName.isEmpty());
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), attachment);
+
+    // Compressed data and the data inside the packs have no file of their own
+    cache->setMsgPart(QLatin1String("a"), 2, "2", QByteArray(2 * 1024 * 1024, 'x'));
+    QCOMPARE(cache->messagePartFile(QLatin1String("a"), 2, "2"), QString());
+    cache->setMsgPart(QLatin1String("a"), 3, "2", incompressibleData(1024, 4));
+    QCOMPARE(cache->messagePartFile(QLatin1String("a"), 3, "2"), QString());
+    QCOMPARE(cache->messagePartFile(QLatin1String("a"), 4, "2"), QString());
+    QVERIFY(errorSpy->isEmpty());
+}
+
+TROJITA_HEADLESS_TEST(TestDiskPartCache)
@@ -0,0 +1,159 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QTest>
+#include "test_FetchBatchSizer.h"
+#include "Utils/headless_test.h"
+#include "Imap/Tasks/FetchBatchSizer.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Without any measurements, the configured limits are used */
+void TestFetchBatchSizer::testInitialLimits()
+{
+    FetchBatchSizer sizer;
+    sizer.reset(1024 * 1024, 300, 10);
+    QCOMPARE(sizer.rttEstimate(), qint64(-1));
+    QCOMPARE(sizer.throughputEstimate(), quint64(0));
+    QCOMPARE(sizer.recompute(), false);
+    QCOMPARE(sizer.bytesPerGroup(), 1024u * 1024);
+    QCOMPARE(sizer.messagesPerGroup(), 300);
+    QCOMPARE(sizer.parallelTasks(), 10);
+}
+
+/** @short The RTT is the minimal latency among the recent samples */
+void TestFetchBatchSizer::testRttWindow()
+{
+    FetchBatchSizer sizer;
+    sizer.reset(1024 * 1024, 300, 10);
+    sizer.addMetadataSample(1, 100, 100);
+    sizer.addMetadataSample(1, 50, 50);
+    sizer.addMetadataSample(1, 80, 80);
+    QCOMPARE(sizer.rttEstimate(), qint64(50));
+
+    // The old samples eventually fall out of the window
+    for (int i = 0; i < 16; ++i) {
+        sizer.addMetadataSample(1, 200, 200);
+    }
+    QCOMPARE(sizer.rttEstimate(), qint64(200));
+
+    // A zero latency is not a meaningful RTT
+    sizer.addMetadataSample(1, 0, 0);
+    QCOMPARE(sizer.rttEstimate(), qint64(1));
+
+    sizer.reset(1024 * 1024, 300, 10);
+    QCOMPARE(sizer.rttEstimate(), qint64(-1));
+}
+
+void TestFetchBatchSizer::testPartGroups()
+{
+    QFETCH(quint64, bytes);
+    QFETCH(qint64, latency);
+    QFETCH(qint64, transfer);
+    QFETCH(quint64, throughput);
+    QFETCH(uint, bytesPerGroup);
+    QFETCH(int, parallelTasks);
+
+    FetchBatchSizer sizer;
+    sizer.reset(1024 * 1024, 300, 10);
+    sizer.addPartSample(bytes, latency, transfer);
+    QCOMPARE(sizer.throughputEstimate(), throughput);
+    QCOMPARE(sizer.recompute(), true);
+    QCOMPARE(sizer.bytesPerGroup(), bytesPerGroup);
+    QCOMPARE(sizer.parallelTasks(), parallelTasks);
+    // The part downloads say nothing about the cost of the envelopes
+    QCOMPARE(sizer.messagesPerGroup(), 300);
+}
+
+void TestFetchBatchSizer::testPartGroups_data()
+{
+    QTest::addColumn<quint64>("bytes");
+    QTest::addColumn<qint64>("latency");
+    QTest::addColumn<qint64>("transfer");
+    QTest::addColumn<quint64>("throughput");
+    QTest::addColumn<uint>("bytesPerGroup");
+    QTest::addColumn<int>("parallelTasks");
+
+    // 10 MB/s with an RTT of 100 ms: a group shall take 200 ms, and the BDP is one group
+    QTest::newRow("lan")
+            << quint64(1024 * 1024) << qint64(100) << qint64(100) << quint64(10 * 1024 * 1024)
+            << 2u * 1024 * 1024 << 2;
+
+    // 16 kB/s with an RTT of 2 s: the group size hits the lower bound
+    QTest::newRow("slow-link")
+            << quint64(32 * 1024) << qint64(2000) << qint64(2000) << quint64(16 * 1024)
+            << FetchBatchSizer::minBytesPerGroup << 2;
+
+    // A fast link with a long RTT needs many small groups in flight, and a lot of data per group
+    QTest::newRow("long-fat-pipe")
+            << quint64(64 * 1024) << qint64(500) << qint64(1) << quint64(64 * 1024 * 1000)
+            << FetchBatchSizer::maxBytesPerGroup << FetchBatchSizer::maxParallelTasks;
+}
+
+/** @short Tiny FETCHes are dominated by the latency, so they are not used for estimating the throughput */
+void TestFetchBatchSizer::testSmallPartsIgnored()
+{
+    FetchBatchSizer sizer;
+    sizer.reset(1024 * 1024, 300, 10);
+    sizer.addPartSample(1000, 10, 10);
+    QCOMPARE(sizer.rttEstimate(), qint64(10));
+    QCOMPARE(sizer.throughputEstimate(), quint64(0));
+    QCOMPARE(sizer.recompute(), false);
+    QCOMPARE(sizer.bytesPerGroup(), 1024u * 1024);
+    QCOMPARE(sizer.parallelTasks(), 10);
+}
+
+void TestFetchBatchSizer::testMetadataGroups()
+{
+    QFETCH(int, messages);
+    QFETCH(qint64, latency);
+    QFETCH(qint64, transfer);
+    QFETCH(bool, changed);
+    QFETCH(int, messagesPerGroup);
+
+    FetchBatchSizer sizer;
+    sizer.reset(1024 * 1024, 300, 10);
+    sizer.addMetadataSample(messages, latency, transfer);
+    QCOMPARE(sizer.recompute(), changed);
+    QCOMPARE(sizer.messagesPerGroup(), messagesPerGroup);
+    QCOMPARE(sizer.bytesPerGroup(), 1024u * 1024);
+    QCOMPARE(sizer.parallelTasks(), 10);
+}
+
+void TestFetchBatchSizer::testMetadataGroups_data()
+{
+    QTest::addColumn<int>("messages");
+    QTest::addColumn<qint64>("latency");
+    QTest::addColumn<qint64>("transfer");
+    QTest::addColumn<bool>("changed");
+    QTest::addColumn<int>("messagesPerGroup");
+
+    // 500 us per message and a group which shall take 100 ms
+    QTest::newRow("smaller") << 100 << qint64(50) << qint64(50) << true << 200;
+    // Close enough to the current value to not be worth reporting, but still applied
+    QTest::newRow("insignificant") << 300 << qint64(50) << qint64(100) << false << 300;
+    QTest::newRow("instant") << 1 << qint64(1) << qint64(0) << true << FetchBatchSizer::maxMessagesPerGroup;
+    QTest::newRow("very-slow") << 1 << qint64(1000) << qint64(1000) << true << FetchBatchSizer::minMessagesPerGroup;
+}
+
+TROJITA_HEADLESS_TEST(TestFetchBatchSizer)
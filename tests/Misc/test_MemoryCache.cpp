@@ -0,0 +1,332 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QTest>
+#include "test_MemoryCache.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/MemoryCache.h"
+
+using namespace Imap::Mailbox;
+
+namespace {
+
+const int benchmarkMailboxes = 10;
+const uint benchmarkMessages = 5000;
+
+AbstractCache::MessageDataBundle dummyMetadata(const uint uid)
+{
+    AbstractCache::MessageDataBundle res;
+    res.uid = uid;
+    res.envelope.subject = QString::fromUtf8("Message %1").arg(QString::number(uid));
+    res.size = 1000 + uid;
+    res.serializedBodyStructure = "body structure";
+    return res;
+}
+
+QString mailboxName(const int i)
+{
+    return QString::fromUtf8("INBOX.folder%1").arg(QString::number(i));
+}
+
+/** @short The message-related part of the MemoryCache as it used to look like, for comparison */
+class NestedMessageStore
+{
+public:
+    void setMessageMetadata(const QString &mailbox, const uint uid, const AbstractCache::MessageDataBundle &metadata)
+    {
+        msgMetadata[mailbox][uid] = metadata;
+    }
+
+    void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &newFlags)
+    {
+        flags[mailbox][uid] = newFlags;
+    }
+
+    void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
+    {
+        parts[mailbox][uid][partId] = data;
+    }
+
+    AbstractCache::MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const
+    {
+        const QMap<uint, AbstractCache::MessageDataBundle> &firstLevel = msgMetadata[mailbox];
+        QMap<uint, AbstractCache::MessageDataBundle>::const_iterator it = firstLevel.find(uid);
+        if (it == firstLevel.end()) {
+            return AbstractCache::MessageDataBundle();
+        }
+        return *it;
+    }
+
+    QStringList msgFlags(const QString &mailbox, const uint uid) const
+    {
+        return flags[mailbox][uid];
+    }
+
+    QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
+    {
+        if (!parts.contains(mailbox))
+            return QByteArray();
+        const QMap<uint, QMap<QByteArray, QByteArray> > &mailboxParts = parts[mailbox];
+        if (!mailboxParts.contains(uid))
+            return QByteArray();
+        const QMap<QByteArray, QByteArray> &messageParts = mailboxParts[uid];
+        if (!messageParts.contains(partId))
+            return QByteArray();
+        return messageParts[partId];
+    }
+
+private:
+    QMap<QString, QMap<uint, QStringList> > flags;
+    QMap<QString, QMap<uint, AbstractCache::MessageDataBundle> > msgMetadata;
+    QMap<QString, QMap<uint, QMap<QByteArray, QByteArray> > > parts;
+};
+
+/** @short Put the same messages into any of the stores */
+template <typename Store>
+void fill(Store &store)
+{
+    const QStringList seen = QStringList() << QLatin1String("\\Seen");
+    const QByteArray header("From: somebody\r\nSubject: something\r\n\r\n");
+    for (int i = 0; i < benchmarkMailboxes; ++i) {
+        const QString mailbox = mailboxName(i);
+        for (uint uid = 1; uid <= benchmarkMessages; ++uid) {
+            store.setMessageMetadata(mailbox, uid, dummyMetadata(uid));
+            store.setMsgFlags(mailbox, uid, seen);
+            store.setMsgPart(mailbox, uid, "HEADER", header);
+        }
+    }
+}
+
+/** @short Look at all messages of one mailbox, the way a message list does */
+template <typename Store>
+int lookup(const Store &store)
+{
+    const QString mailbox = mailboxName(benchmarkMailboxes / 2);
+    int found = 0;
+    for (uint uid = 1; uid <= benchmarkMessages; ++uid) {
+        if (store.messageMetadata(mailbox, uid).uid == uid && !store.msgFlags(mailbox, uid).isEmpty() &&
+                !store.messagePart(mailbox, uid, "HEADER").isEmpty())
+            ++found;
+    }
+    return found;
+}
+
+void benchmarkData()
+{
+    QTest::addColumn<bool>("nested");
+
+    QTest::newRow("flat") << false;
+    QTest::newRow("nested-maps") << true;
+}
+
+}
+
+void TestMemoryCache::testMailboxState()
+{
+    MemoryCache cache(0);
+    QVERIFY(!cache.childMailboxesFresh(QLatin1String("a")));
+    QVERIFY(cache.childMailboxes(QLatin1String("a")).isEmpty());
+    cache.setChildMailboxes(QLatin1String("a"), QList<MailboxMetadata>());
+    QVERIFY(cache.childMailboxesFresh(QLatin1String("a")));
+    QVERIFY(!cache.childMailboxesFresh(QLatin1String("b")));
+
+    SyncState state;
+    state.setExists(2);
+    state.setUidNext(3);
+    cache.setMailboxSyncState(QLatin1String("a"), state);
+    QVERIFY(cache.mailboxSyncState(QLatin1String("a")).completelyEqualTo(state));
+    QVERIFY(cache.mailboxSyncState(QLatin1String("b")).completelyEqualTo(SyncState()));
+
+    cache.setUidMapping(QLatin1String("a"), QList<uint>() << 1 << 2);
+    OfflineSyncProgress progress;
+    progress.uidValidity = 666;
+    progress.highestSyncedUid = 2;
+    cache.setOfflineSyncProgress(QLatin1String("a"), progress);
+    cache.setMessageMetadata(QLatin1String("a"), 1, dummyMetadata(1));
+
+    // The UID mapping survives, everything about the messages is gone
+    cache.clearAllMessages(QLatin1String("a"));
+    QCOMPARE(cache.uidMapping(QLatin1String("a")), QList<uint>() << 1 << 2);
+    QCOMPARE(cache.offlineSyncProgress(QLatin1String("a")).uidValidity, 0u);
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 1).uid, 0u);
+
+    cache.clearUidMapping(QLatin1String("a"));
+    QCOMPARE(cache.uidMapping(QLatin1String("a")), QList<uint>());
+}
+
+void TestMemoryCache::testMessages()
+{
+    MemoryCache cache(0);
+    QStringList flags;
+    QByteArray data;
+
+    cache.setMessageMetadata(QLatin1String("a"), 1, dummyMetadata(1));
+    cache.setMessageMetadata(QLatin1String("a"), 2, dummyMetadata(2));
+    cache.setMessageMetadata(QLatin1String("b"), 1, dummyMetadata(1));
+    QVERIFY(cache.messageMetadata(QLatin1String("a"), 2) == dummyMetadata(2));
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), QList<uint>() << 1 << 2 << 3).keys(), QList<uint>() << 1 << 2);
+
+    // Empty flags and parts are different from unknown ones
+    QVERIFY(!cache.findMsgFlags(QLatin1String("a"), 1, flags));
+    cache.setMsgFlags(QLatin1String("a"), 1, QStringList());
+    QVERIFY(cache.findMsgFlags(QLatin1String("a"), 1, flags));
+    QCOMPARE(flags, QStringList());
+    cache.setMsgFlags(QLatin1String("a"), 1, QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 1), QStringList() << QLatin1String("\\Seen"));
+
+    QVERIFY(!cache.findMessagePart(QLatin1String("a"), 1, "1", data));
+    cache.setMsgPart(QLatin1String("a"), 1, "1", QByteArray());
+    QVERIFY(cache.findMessagePart(QLatin1String("a"), 1, "1", data));
+    QCOMPARE(data, QByteArray());
+    cache.setMsgPart(QLatin1String("a"), 1, "1", QByteArray("one"));
+    cache.setMsgPart(QLatin1String("a"), 1, "2", QByteArray("two"));
+    cache.setMsgPart(QLatin1String("c"), 7, "1", QByteArray("seven"));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, "1"), QByteArray("one"));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, "2"), QByteArray("two"));
+    QCOMPARE(cache.messagePart(QLatin1String("c"), 7, "1"), QByteArray("seven"));
+    QCOMPARE(cache.messagePart(QLatin1String("c"), 8, "1"), QByteArray());
+
+    cache.forgetMessagePart(QLatin1String("a"), 1, "2");
+    QVERIFY(!cache.findMessagePart(QLatin1String("a"), 1, "2", data));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, "1"), QByteArray("one"));
+
+    AbstractCache::Usage usage = cache.usage();
+    QCOMPARE(usage.messages, qint64(3));
+    QCOMPARE(usage.parts, qint64(2));
+    QCOMPARE(usage.partBytes, qint64(8));
+
+    // The partial data of unfinished downloads go away along with their messages
+    cache.appendPartialMessagePart(QLatin1String("a"), 1, "3", "partial");
+    cache.appendPartialMessagePart(QLatin1String("a"), 11, "1", "eleven");
+    cache.appendPartialMessagePart(QLatin1String("c"), 7, "2", "seven");
+
+    cache.clearMessage(QLatin1String("a"), 1);
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 1).uid, 0u);
+    QVERIFY(!cache.findMsgFlags(QLatin1String("a"), 1, flags));
+    QVERIFY(!cache.findMessagePart(QLatin1String("a"), 1, "1", data));
+    QCOMPARE(cache.partialMessagePart(QLatin1String("a"), 1, "3"), QByteArray());
+    QCOMPARE(cache.partialMessagePart(QLatin1String("a"), 11, "1"), QByteArray("eleven"));
+    QVERIFY(cache.messageMetadata(QLatin1String("a"), 2) == dummyMetadata(2));
+
+    // The freed slots get reused
+    cache.setMessageMetadata(QLatin1String("a"), 3, dummyMetadata(3));
+    cache.clearAllMessages(QLatin1String("a"));
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), QList<uint>() << 1 << 2 << 3).size(), 0);
+    QVERIFY(cache.messageMetadata(QLatin1String("b"), 1) == dummyMetadata(1));
+    QCOMPARE(cache.messagePart(QLatin1String("c"), 7, "1"), QByteArray("seven"));
+    QCOMPARE(cache.partialMessagePart(QLatin1String("a"), 11, "1"), QByteArray());
+    QCOMPARE(cache.partialMessagePart(QLatin1String("c"), 7, "2"), QByteArray("seven"));
+}
+
+/** @short The least recently used messages get dropped once the cache is over its quota */
+void TestMemoryCache::testQuota()
+{
+    MemoryCache cache(0);
+    const QByteArray data(1000, 'x');
+    // All messages have the same size, so the UIDs have the same number of digits
+    for (uint uid = 11; uid <= 20; ++uid) {
+        cache.setMessageMetadata(QLatin1String("a"), uid, dummyMetadata(uid));
+        cache.setMsgPart(QLatin1String("a"), uid, "1", data);
+    }
+    QCOMPARE(cache.usage().parts, qint64(10));
+
+    cache.setQuota(5 * 2000);
+    AbstractCache::Usage usage = cache.usage();
+    QVERIFY(usage.parts >= 3);
+    QVERIFY(usage.parts < 10);
+    QCOMPARE(usage.quota, qint64(5 * 2000));
+    // Only the oldest ones are gone
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 11).uid, 0u);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 20, "1"), data);
+    QVERIFY(cache.messageMetadata(QLatin1String("a"), 20) == dummyMetadata(20));
+
+    // Reading a message makes it survive the next eviction
+    const qint64 parts = usage.parts;
+    const uint oldest = 21 - parts;
+    QCOMPARE(cache.messagePart(QLatin1String("a"), oldest, "1"), data);
+    cache.setMessageMetadata(QLatin1String("a"), 21, dummyMetadata(21));
+    cache.setMsgPart(QLatin1String("a"), 21, "1", data);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), oldest, "1"), data);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), oldest + 1, "1"), QByteArray());
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 21, "1"), data);
+    QCOMPARE(cache.usage().parts, parts);
+
+    // The mailbox state is never evicted, but a mailbox which lost some of its messages has to be synced from scratch
+    SyncState syncState;
+    syncState.setExists(2);
+    syncState.setUidNext(22);
+    syncState.setUidValidity(666);
+    cache.setMailboxSyncState(QLatin1String("a"), syncState);
+    cache.setMailboxSyncState(QLatin1String("b"), syncState);
+    cache.setUidMapping(QLatin1String("a"), QList<uint>() << 20 << 21);
+    cache.setQuota(1);
+    QCOMPARE(cache.usage().messages, qint64(0));
+    QCOMPARE(cache.uidMapping(QLatin1String("a")), QList<uint>() << 20 << 21);
+    QVERIFY(!cache.mailboxSyncState(QLatin1String("a")).isUsableForSyncing());
+    QVERIFY(cache.mailboxSyncState(QLatin1String("b")).completelyEqualTo(syncState));
+
+    cache.setQuota(0);
+    cache.setMsgPart(QLatin1String("a"), 1, "1", data);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, "1"), data);
+}
+
+void TestMemoryCache::benchmarkFill()
+{
+    QFETCH(bool, nested);
+    QBENCHMARK {
+        if (nested) {
+            NestedMessageStore store;
+            fill(store);
+        } else {
+            MemoryCache cache(0);
+            fill(cache);
+        }
+    }
+}
+
+void TestMemoryCache::benchmarkFill_data()
+{
+    benchmarkData();
+}
+
+void TestMemoryCache::benchmarkLookup()
+{
+    QFETCH(bool, nested);
+    NestedMessageStore store;
+    MemoryCache cache(0);
+    if (nested) {
+        fill(store);
+    } else {
+        fill(cache);
+    }
+    QBENCHMARK {
+        QCOMPARE(nested ? lookup(store) : lookup(cache), int(benchmarkMessages));
+    }
+}
+
+void TestMemoryCache::benchmarkLookup_data()
+{
+    benchmarkData();
+}
+
+TROJITA_HEADLESS_TEST(TestMemoryCache)
@@ -0,0 +1,140 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QDebug>
+#include <QTest>
+#include "test_PartCompression.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/PartCompression.h"
+
+using namespace Imap::Mailbox;
+
+Q_DECLARE_METATYPE(PartCompression::Format)
+
+namespace {
+
+QByteArray randomData(const int size)
+{
+    QByteArray res;
+    res.reserve(size);
+    qsrand(size);
+    for (int i = 0; i < size; ++i) {
+        res.append(static_cast<char>(qrand() & 0xff));
+    }
+    return res;
+}
+
+QByteArray textData(const int size)
+{
+    QByteArray res;
+    res.reserve(size + 100);
+    int line = 0;
+    while (res.size() < size) {
+        res.append("> On Monday, somebody wrote that line number ");
+        res.append(QByteArray::number(++line));
+        res.append(" of this message is quite similar to the previous ones.\r\n");
+    }
+    res.truncate(size);
+    return res;
+}
+
+/** @short Data for the benchmarks: big parts of the usual kinds */
+void benchmarkData()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    QTest::newRow("text-4k") << textData(4 * 1024);
+    QTest::newRow("text-1M") << textData(1024 * 1024);
+    QTest::newRow("jpeg-1M") << QByteArray("\xff\xd8\xff\xe0").append(randomData(1024 * 1024));
+    QTest::newRow("random-1M") << randomData(1024 * 1024);
+}
+
+}
+
+void TestPartCompression::testRoundTrip()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(PartCompression::Format, expectedFormat);
+
+    PartCompression::Format format;
+    QByteArray stored = PartCompression::encode(data, format);
+    QCOMPARE(format, expectedFormat);
+    if (format == PartCompression::FORMAT_RAW) {
+        QCOMPARE(stored, data);
+    } else {
+        QVERIFY(stored.size() < data.size());
+    }
+    QCOMPARE(PartCompression::decode(stored, format), data);
+}
+
+void TestPartCompression::testRoundTrip_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<PartCompression::Format>("expectedFormat");
+
+    QTest::newRow("empty") << QByteArray() << PartCompression::FORMAT_RAW;
+    QTest::newRow("tiny") << QByteArray("hello") << PartCompression::FORMAT_RAW;
+    QTest::newRow("text") << textData(10 * 1024) << PartCompression::FORMAT_ZLIB;
+    QTest::newRow("big-text") << textData(2 * 1024 * 1024) << PartCompression::FORMAT_ZLIB;
+    QTest::newRow("random") << randomData(10 * 1024) << PartCompression::FORMAT_RAW;
+    // The sample says it all, the rest is not compressed at all
+    QTest::newRow("big-random") << randomData(2 * 1024 * 1024) << PartCompression::FORMAT_RAW;
+    // Trust the signature even when the data compress well
+    QTest::newRow("png") << QByteArray("\x89PNG\r\n\x1a\n").append(textData(10 * 1024)) << PartCompression::FORMAT_RAW;
+    QTest::newRow("zip") << QByteArray("PK\x03\x04").append(textData(10 * 1024)) << PartCompression::FORMAT_RAW;
+    QTest::newRow("mp4") << QByteArray("\0\0\0\x18" "ftypmp42", 12).append(textData(10 * 1024)) << PartCompression::FORMAT_RAW;
+}
+
+void TestPartCompression::benchmarkEncode()
+{
+    QFETCH(QByteArray, data);
+    PartCompression::Format format;
+    QByteArray stored;
+    QBENCHMARK {
+        stored = PartCompression::encode(data, format);
+    }
+    qDebug() << "Stored" << data.size() << "bytes in" << stored.size() << "bytes, compressing everything would take"
+             << qCompress(data).size() << "bytes";
+}
+
+void TestPartCompression::benchmarkEncode_data()
+{
+    benchmarkData();
+}
+
+void TestPartCompression::benchmarkDecode()
+{
+    QFETCH(QByteArray, data);
+    PartCompression::Format format;
+    QByteArray stored = PartCompression::encode(data, format);
+    QBENCHMARK {
+        QCOMPARE(PartCompression::decode(stored, format).size(), data.size());
+    }
+}
+
+void TestPartCompression::benchmarkDecode_data()
+{
+    benchmarkData();
+}
+
+TROJITA_HEADLESS_TEST(TestPartCompression)
@@ -20,9 +20,13 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryFile>
 #include <QTest>
 #include "test_SqlCache.h"
 #include "Utils/headless_test.h"
+#include "Imap/Model/AsyncCache.h"
 #include "Imap/Model/SQLCache.h"
 
 Q_DECLARE_METATYPE(QList<Imap::Mailbox::MailboxMetadata>)
@@ -92,4 +96,635 @@ void TestSqlCache::testMailboxOperation()
     QVERIFY(errorSpy->isEmpty());
 }
 
+namespace {
+
+Imap::Mailbox::AbstractCache::MessageDataBundle dummyMetadata(const uint uid)
+{
+    Imap::Mailbox::AbstractCache::MessageDataBundle res;
+    res.uid = uid;
+    res.internalDate = QDateTime(QDate(2014, 3, 1), QTime(12, 0));
+    res.size = 1000 + uid;
+    res.serializedBodyStructure = "foo";
+    res.hdrReferences << "<ref@example.org>";
+    return res;
+}
+
+}
+
+/** @short The metadata and the flags of a message share a row now, but they have to be independent of each other */
+void TestSqlCache::testMessageOperation()
+{
+    using namespace Imap::Mailbox;
+    QString mailbox = QLatin1String("msgs");
+
+    QCOMPARE(cache->msgFlags(mailbox, 1), QStringList());
+    QCOMPARE(cache->messageMetadata(mailbox, 1).uid, 0u);
+
+    cache->setMsgFlags(mailbox, 1, QStringList() << QLatin1String("\\Seen"));
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->msgFlags(mailbox, 1), QStringList() << QLatin1String("\\Seen"));
+    // Flags alone do not make the metadata available
+    QCOMPARE(cache->messageMetadata(mailbox, 1).uid, 0u);
+
+    cache->setMessageMetadata(mailbox, 1, dummyMetadata(1));
+    CHECK_CACHE_ERRORS;
+    QVERIFY(cache->messageMetadata(mailbox, 1) == dummyMetadata(1));
+    QCOMPARE(cache->msgFlags(mailbox, 1), QStringList() << QLatin1String("\\Seen"));
+
+    cache->setMessageMetadata(mailbox, 2, dummyMetadata(2));
+    QCOMPARE(cache->msgFlags(mailbox, 2), QStringList());
+    cache->setMsgFlags(mailbox, 2, QStringList() << QLatin1String("\\Answered"));
+    QVERIFY(cache->messageMetadata(mailbox, 2) == dummyMetadata(2));
+
+    QVERIFY(!cache->hasMessagePart(mailbox, 2, "1"));
+    cache->setMsgPart(mailbox, 2, "1", "part data");
+    CHECK_CACHE_ERRORS;
+    QVERIFY(cache->hasMessagePart(mailbox, 2, "1"));
+    QVERIFY(!cache->hasMessagePart(mailbox, 2, "2"));
+    QVERIFY(!cache->hasMessagePart(mailbox, 1, "1"));
+
+    cache->setUidMapping(mailbox, QList<uint>() << 1 << 2);
+    SyncState syncState;
+    syncState.setExists(2);
+    syncState.setUidNext(3);
+    syncState.setUidValidity(666);
+    cache->setMailboxSyncState(mailbox, syncState);
+    QCOMPARE(cache->uidMapping(mailbox), QList<uint>() << 1 << 2);
+    cache->clearUidMapping(mailbox);
+    QCOMPARE(cache->uidMapping(mailbox), QList<uint>());
+    // Clearing the UID mapping must not affect the rest of the mailbox state
+    QCOMPARE(cache->mailboxSyncState(mailbox).exists(), 2u);
+    QCOMPARE(cache->mailboxSyncState(mailbox).uidValidity(), 666u);
+
+    cache->clearMessage(mailbox, 1);
+    QCOMPARE(cache->msgFlags(mailbox, 1), QStringList());
+    QCOMPARE(cache->messageMetadata(mailbox, 1).uid, 0u);
+    QVERIFY(cache->messageMetadata(mailbox, 2) == dummyMetadata(2));
+
+    cache->clearAllMessages(mailbox);
+    QCOMPARE(cache->msgFlags(mailbox, 2), QStringList());
+    QCOMPARE(cache->messageMetadata(mailbox, 2).uid, 0u);
+    QVERIFY(!cache->hasMessagePart(mailbox, 2, "1"));
+
+    QVERIFY(errorSpy->isEmpty());
+}
+
+void TestSqlCache::testBulkMetadata()
+{
+    using namespace Imap::Mailbox;
+    QString mailbox = QLatin1String("bulk");
+
+    QVERIFY(cache->messageMetadata(mailbox, QList<uint>() << 1 << 2).isEmpty());
+
+    for (uint uid = 10; uid < 20; ++uid) {
+        cache->setMessageMetadata(mailbox, uid, dummyMetadata(uid));
+    }
+    // A message with flags only is not included
+    cache->setMsgFlags(mailbox, 20, QStringList());
+    cache->setMessageMetadata(mailbox, 1000, dummyMetadata(1000));
+    CHECK_CACHE_ERRORS;
+
+    // A dense range which is served by a single query, with some UIDs which are not there
+    QMap<uint, AbstractCache::MessageDataBundle> res = cache->messageMetadata(mailbox, QList<uint>() << 12 << 11 << 19 << 20 << 21);
+    QCOMPARE(res.keys(), QList<uint>() << 11 << 12 << 19);
+    QVERIFY(res[12] == dummyMetadata(12));
+
+    // Sparse UIDs take the slow path, but the result has to be the same
+    res = cache->messageMetadata(mailbox, QList<uint>() << 10 << 1000);
+    QCOMPARE(res.keys(), QList<uint>() << 10 << 1000);
+    QVERIFY(res[1000] == dummyMetadata(1000));
+
+    cache->clearAllMessages(mailbox);
+    QVERIFY(errorSpy->isEmpty());
+}
+
+void TestSqlCache::testBulkFlags()
+{
+    using namespace Imap::Mailbox;
+    QString mailbox = QLatin1String("bulkflags");
+    QStringList seen = QStringList() << QLatin1String("\\Seen");
+    QStringList answered = QStringList() << QLatin1String("\\Answered");
+
+    // Some of the messages are known already
+    cache->setMessageMetadata(mailbox, 2, dummyMetadata(2));
+    cache->setMsgFlags(mailbox, 3, answered);
+
+    QMap<uint, QStringList> flags;
+    for (uint uid = 1; uid <= 5; ++uid) {
+        flags[uid] = seen;
+    }
+    cache->setMsgFlags(mailbox, flags);
+    CHECK_CACHE_ERRORS;
+    for (uint uid = 1; uid <= 5; ++uid) {
+        QCOMPARE(cache->msgFlags(mailbox, uid), seen);
+    }
+    QVERIFY(cache->messageMetadata(mailbox, 2) == dummyMetadata(2));
+
+    // An update which is still buffered must not get lost, but an older one must not overwrite a newer bulk update
+    cache->setMsgFlags(mailbox, 1, answered);
+    cache->setMsgFlags(mailbox, 4, answered);
+    flags.clear();
+    flags[4] = QStringList();
+    cache->setMsgFlags(mailbox, flags);
+    QCOMPARE(cache->msgFlags(mailbox, 1), answered);
+    QCOMPARE(cache->msgFlags(mailbox, 4), QStringList());
+
+    // The bulk lookup has to see the buffered updates, too
+    QMap<uint, QStringList> expected;
+    expected[1] = answered;
+    expected[2] = seen;
+    expected[4] = QStringList();
+    QCOMPARE(cache->msgFlags(mailbox, QList<uint>() << 1 << 2 << 4), expected);
+
+    // Saving everything through a commit has to keep the data as well
+    QMetaObject::invokeMethod(cache, "timeToCommit");
+    QCOMPARE(cache->msgFlags(mailbox, 1), answered);
+    QCOMPARE(cache->msgFlags(mailbox, 4), QStringList());
+    QCOMPARE(cache->msgFlags(mailbox, 5), seen);
+    expected[3] = seen;
+    expected[5] = seen;
+    QCOMPARE(cache->msgFlags(mailbox, QList<uint>() << 1 << 2 << 3 << 4 << 5), expected);
+
+    // UIDs which are too far apart for a single range query
+    expected.clear();
+    expected[1] = answered;
+    expected[500] = QStringList();
+    QCOMPARE(cache->msgFlags(mailbox, QList<uint>() << 1 << 500), expected);
+
+    cache->clearAllMessages(mailbox);
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short The UID mapping has to survive all kinds of incremental updates */
+void TestSqlCache::testUidMapping()
+{
+    QString mailbox = QLatin1String("uidmap");
+    QList<uint> uids;
+    for (uint uid = 1; uid <= 10000; uid += 3) {
+        uids << uid;
+    }
+    cache->setUidMapping(mailbox, uids);
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->uidMapping(mailbox), uids);
+
+    // New arrivals, including some which start a new bucket far away
+    uids << 10001 << 10002 << 100000 << 4000000000u;
+    cache->setUidMapping(mailbox, uids);
+    QCOMPARE(cache->uidMapping(mailbox), uids);
+
+    // Expunges in the middle and at the end
+    uids.removeAt(1);
+    uids.removeAt(500);
+    uids.removeLast();
+    uids.removeLast();
+    cache->setUidMapping(mailbox, uids);
+    QCOMPARE(cache->uidMapping(mailbox), uids);
+
+    // Storing the very same mapping again is a no-op
+    cache->setUidMapping(mailbox, uids);
+    QCOMPARE(cache->uidMapping(mailbox), uids);
+
+    cache->setUidMapping(mailbox, QList<uint>());
+    QCOMPARE(cache->uidMapping(mailbox), QList<uint>());
+    CHECK_CACHE_ERRORS;
+
+    // An unsorted mapping is refused and the old one is kept
+    cache->setUidMapping(mailbox, QList<uint>() << 5 << 6);
+    cache->setUidMapping(mailbox, QList<uint>() << 7 << 3);
+    QCOMPARE(errorSpy->size(), 1);
+    errorSpy->clear();
+    QCOMPARE(cache->uidMapping(mailbox), QList<uint>() << 5 << 6);
+
+    cache->clearUidMapping(mailbox);
+    QCOMPARE(cache->uidMapping(mailbox), QList<uint>());
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Make sure that the data stored in the old, name-keyed layout survive the upgrade */
+void TestSqlCache::testMigrationFromV7()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryFile dbFile;
+    QVERIFY(dbFile.open());
+    dbFile.close();
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("v7-setup"));
+        db.setDatabaseName(dbFile.fileName());
+        QVERIFY(db.open());
+        QSqlQuery q(db);
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE trojita ( version STRING NOT NULL )")));
+        QVERIFY(q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 7 )")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE child_mailboxes (mailbox STRING NOT NULL PRIMARY KEY, parent STRING NOT NULL, "
+                                     "separator STRING, flags BINARY)")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE uid_mapping (mailbox STRING NOT NULL PRIMARY KEY, mapping BINARY)")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE msg_metadata (mailbox STRING NOT NULL, uid INT NOT NULL, data BINARY, "
+                                     "lastAccessDate INT, PRIMARY KEY (mailbox, uid))")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE flags (mailbox STRING NOT NULL, uid INT NOT NULL, flags BINARY, "
+                                     "PRIMARY KEY (mailbox, uid))")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE parts (mailbox STRING NOT NULL, uid INT NOT NULL, part_id BINARY, "
+                                     "data BINARY, PRIMARY KEY (mailbox, uid, part_id))")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE msg_threading (mailbox STRING NOT NULL PRIMARY KEY, threading BINARY)")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE mailbox_sync_state (mailbox STRING NOT NULL PRIMARY KEY, sync_state BINARY)")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE offline_sync (mailbox STRING NOT NULL PRIMARY KEY, uidvalidity INT NOT NULL, "
+                                     "highest_uid INT NOT NULL)")));
+
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO child_mailboxes VALUES (?, ?, ?, ?)")));
+        q.addBindValue(QLatin1String("INBOX"));
+        q.addBindValue(QLatin1String(""));
+        q.addBindValue(QLatin1String("."));
+        QByteArray buf;
+        {
+            QDataStream stream(&buf, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_4_6);
+            stream << QStringList();
+        }
+        q.addBindValue(buf);
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO uid_mapping VALUES (?, ?)")));
+        q.addBindValue(QLatin1String("INBOX"));
+        buf.clear();
+        {
+            QDataStream stream(&buf, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_4_6);
+            stream << (QList<uint>() << 10 << 11);
+        }
+        q.addBindValue(qCompress(buf));
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO msg_metadata VALUES (?, ?, ?, ?)")));
+        q.addBindValue(QLatin1String("INBOX"));
+        q.addBindValue(10);
+        buf.clear();
+        {
+            AbstractCache::MessageDataBundle metadata = dummyMetadata(10);
+            QDataStream stream(&buf, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_4_6);
+            stream << metadata.envelope << metadata.internalDate << metadata.size << metadata.serializedBodyStructure
+                   << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo;
+        }
+        q.addBindValue(qCompress(buf));
+        q.addBindValue(0);
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO flags VALUES (?, ?, ?)")));
+        q.addBindValue(QVariantList() << QLatin1String("INBOX") << QLatin1String("INBOX"));
+        q.addBindValue(QVariantList() << 10 << 11);
+        buf.clear();
+        {
+            QDataStream stream(&buf, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_4_6);
+            stream << (QStringList() << QLatin1String("\\Seen"));
+        }
+        q.addBindValue(QVariantList() << buf << buf);
+        QVERIFY(q.execBatch());
+
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO parts VALUES (?, ?, ?, ?)")));
+        q.addBindValue(QLatin1String("INBOX"));
+        q.addBindValue(10);
+        q.addBindValue(QByteArray("1"));
+        q.addBindValue(qCompress(QByteArray("hello")));
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO offline_sync VALUES (?, ?, ?)")));
+        q.addBindValue(QLatin1String("INBOX"));
+        q.addBindValue(333);
+        q.addBindValue(11);
+        QVERIFY(q.exec());
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("v7-setup"));
+
+    SQLCache *migrated = new SQLCache(this);
+    QSignalSpy spy(migrated, SIGNAL(error(QString)));
+    QVERIFY(migrated->open(QLatin1String("v7-migrated"), dbFile.fileName()));
+    QCOMPARE(spy.size(), 0);
+
+    QCOMPARE(migrated->childMailboxes(QString()),
+             QList<MailboxMetadata>() << MailboxMetadata(QLatin1String("INBOX"), QLatin1String("."), QStringList()));
+    QCOMPARE(migrated->uidMapping(QLatin1String("INBOX")), QList<uint>() << 10 << 11);
+    QVERIFY(migrated->messageMetadata(QLatin1String("INBOX"), 10) == dummyMetadata(10));
+    QCOMPARE(migrated->messageMetadata(QLatin1String("INBOX"), 11).uid, 0u);
+    QCOMPARE(migrated->msgFlags(QLatin1String("INBOX"), 10), QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(migrated->msgFlags(QLatin1String("INBOX"), 11), QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(migrated->messagePart(QLatin1String("INBOX"), 10, "1"), QByteArray("hello"));
+    QCOMPARE(migrated->offlineSyncProgress(QLatin1String("INBOX")).uidValidity, 333u);
+    QCOMPARE(migrated->partsSize(), qint64(qCompress(QByteArray("hello")).size()));
+
+    // Writing to a mailbox which did not exist before has to work, too
+    migrated->setMsgFlags(QLatin1String("new"), 1, QStringList());
+    QCOMPARE(spy.size(), 0);
+    delete migrated;
+}
+
+/** @short The least recently used parts are evicted first, the message metadata stay */
+void TestSqlCache::testPartEviction()
+{
+    using namespace Imap::Mailbox;
+    SQLCache *lru = new SQLCache(this);
+    QSignalSpy spy(lru, SIGNAL(error(QString)));
+    QVERIFY(lru->open(QLatin1String("lru"), QLatin1String(":memory:")));
+    QCOMPARE(lru->oldestPartAccess(), qint64(-1));
+
+    lru->setMessageMetadata(QLatin1String("a"), 1, dummyMetadata(1));
+    lru->setMsgPart(QLatin1String("a"), 1, "1", QByteArray(1000, 'x'));
+    lru->setMsgPart(QLatin1String("a"), 1, "2", QByteArray("second"));
+    lru->setMsgPart(QLatin1String("b"), 3, "1", QByteArray("third"));
+    qint64 size = lru->partsSize();
+    QVERIFY(size > 0);
+    QVERIFY(lru->oldestPartAccess() > 0);
+    AbstractCache::Usage usage = lru->usage();
+    QCOMPARE(usage.messages, qint64(1));
+    QCOMPARE(usage.parts, qint64(3));
+    QCOMPARE(usage.partBytes, size);
+
+    // Parts which were accessed at the same time go in the order in which they were stored
+    qint64 freed = lru->evictLeastRecentlyUsedParts(1);
+    QCOMPARE(freed, qint64(qCompress(QByteArray(1000, 'x')).size()));
+    QCOMPARE(lru->partsSize(), size - freed);
+    QCOMPARE(lru->messagePart(QLatin1String("a"), 1, "1"), QByteArray());
+    QCOMPARE(lru->messagePart(QLatin1String("a"), 1, "2"), QByteArray("second"));
+    QVERIFY(lru->messageMetadata(QLatin1String("a"), 1) == dummyMetadata(1));
+
+    lru->evictLeastRecentlyUsedParts(10);
+    QCOMPARE(lru->partsSize(), qint64(0));
+    QCOMPARE(lru->oldestPartAccess(), qint64(-1));
+    QCOMPARE(lru->messagePart(QLatin1String("b"), 3, "1"), QByteArray());
+    QVERIFY(lru->messageMetadata(QLatin1String("a"), 1) == dummyMetadata(1));
+    QCOMPARE(spy.size(), 0);
+    delete lru;
+}
+
+namespace {
+
+/** @short Threads of three messages each, with the first UID of each thread as its root */
+QVector<Imap::Responses::ThreadingNode> dummyThreading(const uint threads)
+{
+    using Imap::Responses::ThreadingNode;
+    QVector<ThreadingNode> res;
+    for (uint i = 0; i < threads; ++i) {
+        res << ThreadingNode(3 * i + 1, QVector<ThreadingNode>() << ThreadingNode(3 * i + 2)
+                             << ThreadingNode(0, QVector<ThreadingNode>() << ThreadingNode(3 * i + 3)));
+    }
+    return res;
+}
+
+int threadingLogSize(const QString &connectionName)
+{
+    QSqlQuery q(QSqlDatabase::database(connectionName));
+    if (!q.exec(QLatin1String("SELECT COUNT(*) FROM msg_threading_log")) || !q.first())
+        return -1;
+    return q.value(0).toInt();
+}
+
+}
+
+/** @short Small changes to threading are logged, and the snapshot gets rewritten now and then */
+void TestSqlCache::testThreading()
+{
+    using namespace Imap::Mailbox;
+    using Imap::Responses::ThreadingNode;
+
+    QTemporaryFile dbFile;
+    QVERIFY(dbFile.open());
+    dbFile.close();
+
+    QVector<ThreadingNode> threading = dummyThreading(1000);
+    {
+        SQLCache writer(this);
+        QSignalSpy spy(&writer, SIGNAL(error(QString)));
+        QVERIFY(writer.open(QLatin1String("threading-writer"), dbFile.fileName()));
+        QVERIFY(writer.messageThreading(QLatin1String("a")).isEmpty());
+        writer.setMessageThreading(QLatin1String("a"), threading);
+        QCOMPARE(threadingLogSize(QLatin1String("threading-writer")), 0);
+
+        // A new thread, a reply in an old one and a removed one are all just deltas
+        threading << ThreadingNode(5000);
+        writer.setMessageThreading(QLatin1String("a"), threading);
+        threading[10].children[0].children << ThreadingNode(5001);
+        writer.setMessageThreading(QLatin1String("a"), threading);
+        threading.remove(500);
+        writer.setMessageThreading(QLatin1String("a"), threading);
+        QCOMPARE(threadingLogSize(QLatin1String("threading-writer")), 3);
+
+        // Storing the same threading again does nothing
+        writer.setMessageThreading(QLatin1String("a"), threading);
+        QCOMPARE(threadingLogSize(QLatin1String("threading-writer")), 3);
+        QVERIFY(writer.messageThreading(QLatin1String("a")) == threading);
+
+        // Another mailbox does not disturb the log
+        writer.setMessageThreading(QLatin1String("b"), dummyThreading(2));
+        QVERIFY(writer.messageThreading(QLatin1String("a")) == threading);
+        QCOMPARE(spy.size(), 0);
+    }
+
+    {
+        SQLCache reader(this);
+        QSignalSpy spy(&reader, SIGNAL(error(QString)));
+        QVERIFY(reader.open(QLatin1String("threading-reader"), dbFile.fileName()));
+        QVERIFY(reader.messageThreading(QLatin1String("a")) == threading);
+        QVERIFY(reader.messageThreading(QLatin1String("b")) == dummyThreading(2));
+
+        // A long log gets compacted into a new snapshot
+        for (uint uid = 6000; uid < 6100; ++uid) {
+            threading << ThreadingNode(uid);
+            reader.setMessageThreading(QLatin1String("a"), threading);
+        }
+        QVERIFY(threadingLogSize(QLatin1String("threading-reader")) < 100);
+
+        // A completely different threading replaces the snapshot right away
+        threading.clear();
+        threading << ThreadingNode(0, dummyThreading(2000));
+        reader.setMessageThreading(QLatin1String("a"), threading);
+        QCOMPARE(threadingLogSize(QLatin1String("threading-reader")), 0);
+        QVERIFY(reader.messageThreading(QLatin1String("a")) == threading);
+
+        reader.clearAllMessages(QLatin1String("a"));
+        QVERIFY(reader.messageThreading(QLatin1String("a")).isEmpty());
+        QCOMPARE(spy.size(), 0);
+    }
+}
+
+namespace {
+
+const int benchmarkMessages = 5000;
+
+void populateForBenchmark(Imap::Mailbox::SQLCache *cache)
+{
+    QList<uint> uids;
+    for (int i = 1; i <= benchmarkMessages; ++i) {
+        cache->setMessageMetadata(QLatin1String("bench"), i, dummyMetadata(i));
+        cache->setMsgFlags(QLatin1String("bench"), i, QStringList() << QLatin1String("\\Seen"));
+        uids << i;
+    }
+    cache->setUidMapping(QLatin1String("bench"), uids);
+}
+
+}
+
+void TestSqlCache::benchmarkOpen()
+{
+    QTemporaryFile dbFile;
+    QVERIFY(dbFile.open());
+    dbFile.close();
+    {
+        Imap::Mailbox::SQLCache populated(this);
+        QVERIFY(populated.open(QLatin1String("bench-populate"), dbFile.fileName()));
+        populateForBenchmark(&populated);
+    }
+
+    QBENCHMARK {
+        Imap::Mailbox::SQLCache reopened(this);
+        QVERIFY(reopened.open(QLatin1String("bench-open"), dbFile.fileName()));
+        QCOMPARE(reopened.uidMapping(QLatin1String("bench")).size(), benchmarkMessages);
+    }
+}
+
+/** @short The threaded front-end must not reorder the operations, and it has to deliver the results from our thread */
+void TestSqlCache::testAsyncCache()
+{
+    using namespace Imap::Mailbox;
+    SQLCache *backend = new SQLCache(0);
+    AsyncCache async(0, backend);
+    QSignalSpy asyncErrors(&async, SIGNAL(error(QString)));
+    QVERIFY(async.runAndWait([backend]() { return backend->open(QLatin1String("async"), QLatin1String(":memory:")); }));
+
+    QString mailbox = QLatin1String("async");
+    QList<uint> uids;
+    for (uint uid = 1; uid <= 100; ++uid) {
+        async.setMessageMetadata(mailbox, uid, dummyMetadata(uid));
+        uids << uid;
+    }
+    async.setUidMapping(mailbox, uids);
+    async.setMsgPart(mailbox, 50, "1.X-RAW", "raw data");
+    // A blocking read sees everything which was queued before
+    QCOMPARE(async.uidMapping(mailbox), uids);
+
+    QMap<uint, AbstractCache::MessageDataBundle> metadata;
+    bool metadataLoaded = false;
+    async.messageMetadataAsync(mailbox, QList<uint>() << 1 << 50 << 1000,
+                               [&metadata, &metadataLoaded](const QMap<uint, AbstractCache::MessageDataBundle> &res) {
+        metadata = res;
+        metadataLoaded = true;
+    });
+    QByteArray partId, partData;
+    bool partLoaded = false;
+    async.messagePartAsync(mailbox, 50, QList<QByteArray>() << "1" << "1.X-RAW",
+                           [&partId, &partData, &partLoaded](const QByteArray &id, const QByteArray &data) {
+        partId = id;
+        partData = data;
+        partLoaded = true;
+    });
+    // The callbacks are only invoked from the event loop
+    QVERIFY(!metadataLoaded);
+    QVERIFY(!partLoaded);
+    for (int i = 0; i < 100 && !(metadataLoaded && partLoaded); ++i) {
+        QTest::qWait(10);
+    }
+    QVERIFY(metadataLoaded);
+    QCOMPARE(metadata.keys(), QList<uint>() << 1 << 50);
+    QVERIFY(metadata[50] == dummyMetadata(50));
+    QVERIFY(partLoaded);
+    QCOMPARE(partId, QByteArray("1.X-RAW"));
+    QCOMPARE(partData, QByteArray("raw data"));
+    QVERIFY(asyncErrors.isEmpty());
+}
+
+/** @short The lookups which are pending when the AsyncCache gets deleted still get their results */
+void TestSqlCache::testAsyncCacheTeardown()
+{
+    using namespace Imap::Mailbox;
+    SQLCache *backend = new SQLCache(0);
+    AsyncCache *async = new AsyncCache(0, backend);
+    QVERIFY(async->runAndWait([backend]() { return backend->open(QLatin1String("teardown"), QLatin1String(":memory:")); }));
+
+    QString mailbox = QLatin1String("teardown");
+    async->setMessageMetadata(mailbox, 1, dummyMetadata(1));
+    async->setMsgPart(mailbox, 1, "1", "part data");
+
+    QMap<uint, AbstractCache::MessageDataBundle> metadata;
+    bool metadataLoaded = false;
+    async->messageMetadataAsync(mailbox, QList<uint>() << 1,
+                                [&metadata, &metadataLoaded](const QMap<uint, AbstractCache::MessageDataBundle> &res) {
+        metadata = res;
+        metadataLoaded = true;
+    });
+    QByteArray partData;
+    async->messagePartAsync(mailbox, 1, QList<QByteArray>() << "1",
+                            [&partData](const QByteArray &id, const QByteArray &data) {
+        Q_UNUSED(id);
+        partData = data;
+    });
+    // No event loop gets a chance to deliver the results
+    delete async;
+    QVERIFY(metadataLoaded);
+    QVERIFY(metadata[1] == dummyMetadata(1));
+    QCOMPARE(partData, QByteArray("part data"));
+}
+
+void TestSqlCache::benchmarkMetadataLookup()
+{
+    populateForBenchmark(cache);
+    uint uid = 0;
+    QBENCHMARK {
+        uid = uid % benchmarkMessages + 1;
+        QCOMPARE(cache->messageMetadata(QLatin1String("bench"), uid).uid, uid);
+        QCOMPARE(cache->msgFlags(QLatin1String("bench"), uid).size(), 1);
+    }
+    QVERIFY(errorSpy->isEmpty());
+}
+
+void TestSqlCache::benchmarkFlagWrites()
+{
+    QStringList flags;
+    flags << QLatin1String("\\Seen") << QLatin1String("\\Answered");
+    uint uid = 0;
+    QBENCHMARK {
+        uid = uid % benchmarkMessages + 1;
+        cache->setMsgFlags(QLatin1String("bench"), uid, flags);
+    }
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Open a mailbox whose threading has been updated a few times */
+void TestSqlCache::benchmarkThreadingLoad()
+{
+    using Imap::Responses::ThreadingNode;
+    QTemporaryFile dbFile;
+    QVERIFY(dbFile.open());
+    dbFile.close();
+    QVector<ThreadingNode> threading = dummyThreading(benchmarkMessages);
+    {
+        Imap::Mailbox::SQLCache populated(this);
+        QVERIFY(populated.open(QLatin1String("bench-threading-populate"), dbFile.fileName()));
+        populated.setMessageThreading(QLatin1String("bench"), threading);
+        for (uint uid = 1; uid <= 10; ++uid) {
+            threading << ThreadingNode(3 * benchmarkMessages + uid);
+            populated.setMessageThreading(QLatin1String("bench"), threading);
+        }
+    }
+
+    QBENCHMARK {
+        Imap::Mailbox::SQLCache reopened(this);
+        QVERIFY(reopened.open(QLatin1String("bench-threading-open"), dbFile.fileName()));
+        QCOMPARE(reopened.messageThreading(QLatin1String("bench")).size(), threading.size());
+    }
+}
+
+/** @short Store the threading after each arrival of a new message */
+void TestSqlCache::benchmarkThreadingUpdate()
+{
+    using Imap::Responses::ThreadingNode;
+    QVector<ThreadingNode> threading = dummyThreading(benchmarkMessages);
+    cache->setMessageThreading(QLatin1String("bench-threading"), threading);
+    uint uid = 3 * benchmarkMessages;
+    QBENCHMARK {
+        threading << ThreadingNode(++uid);
+        cache->setMessageThreading(QLatin1String("bench-threading"), threading);
+    }
+    QVERIFY(errorSpy->isEmpty());
+}
+
 TROJITA_HEADLESS_TEST(TestSqlCache)
@@ -39,6 +39,20 @@ private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
     void testMailboxOperation();
+    void testMessageOperation();
+    void testBulkMetadata();
+    void testBulkFlags();
+    void testUidMapping();
+    void testMigrationFromV7();
+    void testPartEviction();
+    void testThreading();
+    void testAsyncCache();
+    void testAsyncCacheTeardown();
+    void benchmarkOpen();
+    void benchmarkMetadataLookup();
+    void benchmarkFlagWrites();
+    void benchmarkThreadingLoad();
+    void benchmarkThreadingUpdate();
 
 private:
     Imap::Mailbox::SQLCache *cache;
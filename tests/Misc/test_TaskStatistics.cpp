@@ -0,0 +1,123 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QTest>
+#include "test_TaskStatistics.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/TaskStatistics.h"
+
+using namespace Imap::Mailbox;
+
+typedef QVector<QPair<quint64, quint64> > Buckets;
+
+/** @short Each value goes to the smallest bucket whose upper bound is not smaller than the value */
+void TestTaskStatistics::testBuckets()
+{
+    QFETCH(quint64, value);
+    QFETCH(quint64, upperBound);
+
+    LatencyHistogram histogram;
+    histogram.add(value);
+    QCOMPARE(histogram.buckets(), Buckets() << qMakePair(upperBound, quint64(1)));
+    QCOMPARE(histogram.count(), quint64(1));
+    QCOMPARE(histogram.sum(), value);
+    QCOMPARE(histogram.max(), value);
+}
+
+void TestTaskStatistics::testBuckets_data()
+{
+    QTest::addColumn<quint64>("value");
+    QTest::addColumn<quint64>("upperBound");
+
+    QTest::newRow("zero") << quint64(0) << quint64(1);
+    QTest::newRow("one") << quint64(1) << quint64(1);
+    QTest::newRow("two") << quint64(2) << quint64(2);
+    QTest::newRow("three") << quint64(3) << quint64(4);
+    QTest::newRow("four") << quint64(4) << quint64(4);
+    QTest::newRow("five") << quint64(5) << quint64(8);
+    QTest::newRow("1023") << quint64(1023) << quint64(1024);
+    QTest::newRow("1025") << quint64(1025) << quint64(2048);
+    QTest::newRow("huge") << (Q_UINT64_C(1) << 60) << (Q_UINT64_C(1) << 47);
+}
+
+/** @short The percentiles report the upper bound of the matching bucket, but never more than the maximum */
+void TestTaskStatistics::testPercentiles()
+{
+    LatencyHistogram histogram;
+    QCOMPARE(histogram.percentile(50), quint64(0));
+
+    for (int i = 0; i < 9; ++i) {
+        histogram.add(3);
+    }
+    histogram.add(100);
+    QCOMPARE(histogram.buckets(), Buckets() << qMakePair(quint64(4), quint64(9)) << qMakePair(quint64(128), quint64(1)));
+    QCOMPARE(histogram.sum(), quint64(127));
+    QCOMPARE(histogram.percentile(0), quint64(4));
+    QCOMPARE(histogram.percentile(50), quint64(4));
+    QCOMPARE(histogram.percentile(90), quint64(4));
+    QCOMPARE(histogram.percentile(91), quint64(100));
+    QCOMPARE(histogram.percentile(100), quint64(100));
+}
+
+/** @short The export contains all histograms of all task types and the untagged traffic of each connection */
+void TestTaskStatistics::testJson()
+{
+    TaskStatistics stats(0);
+    stats.record(QLatin1String("FetchMsgPartTask"), true, 3, 10, 20, 50, 1000);
+    stats.record(QLatin1String("FetchMsgPartTask"), false, 0, -1, 5, 40, 0);
+    stats.record(QLatin1String("NoopTask"), true, -1, -1, -1, 0, 0);
+    stats.untaggedDataReceived(1, 30);
+    stats.untaggedDataReceived(2, 5);
+    stats.untaggedDataReceived(1, 12);
+
+    QCOMPARE(stats.perType().size(), 2);
+    QCOMPARE(stats.perType()[QLatin1String("FetchMsgPartTask")].completed, quint64(1));
+    QCOMPARE(stats.perType()[QLatin1String("FetchMsgPartTask")].failed, quint64(1));
+    QCOMPARE(stats.perType()[QLatin1String("FetchMsgPartTask")].firstResponse.count(), quint64(1));
+
+    QCOMPARE(stats.toJson(), QByteArray(
+                 "{\"units\":{\"latency\":\"ms\",\"traffic\":\"bytes\"},\"tasks\":{\n"
+                 "\"FetchMsgPartTask\":{\"completed\":1,\"failed\":1,"
+                 "\"queueTime\":{\"count\":2,\"sum\":3,\"max\":3,\"p50\":1,\"p90\":3,\"p99\":3,\"buckets\":[[1,1],[4,1]]},"
+                 "\"firstResponse\":{\"count\":1,\"sum\":10,\"max\":10,\"p50\":10,\"p90\":10,\"p99\":10,\"buckets\":[[16,1]]},"
+                 "\"completion\":{\"count\":2,\"sum\":25,\"max\":20,\"p50\":8,\"p90\":20,\"p99\":20,\"buckets\":[[8,1],[32,1]]},"
+                 "\"bytesSent\":{\"count\":2,\"sum\":90,\"max\":50,\"p50\":50,\"p90\":50,\"p99\":50,\"buckets\":[[64,2]]},"
+                 "\"bytesReceived\":{\"count\":2,\"sum\":1000,\"max\":1000,\"p50\":1,\"p90\":1000,\"p99\":1000,"
+                 "\"buckets\":[[1,1],[1024,1]]}},\n"
+                 "\"NoopTask\":{\"completed\":1,\"failed\":0,"
+                 "\"queueTime\":{\"count\":0,\"sum\":0,\"max\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"buckets\":[]},"
+                 "\"firstResponse\":{\"count\":0,\"sum\":0,\"max\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"buckets\":[]},"
+                 "\"completion\":{\"count\":0,\"sum\":0,\"max\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"buckets\":[]},"
+                 "\"bytesSent\":{\"count\":1,\"sum\":0,\"max\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"buckets\":[[1,1]]},"
+                 "\"bytesReceived\":{\"count\":1,\"sum\":0,\"max\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"buckets\":[[1,1]]}}\n"
+                 "},\"connections\":{\n"
+                 "\"1\":{\"untaggedBytesReceived\":42},\n"
+                 "\"2\":{\"untaggedBytesReceived\":5}\n"
+                 "}}\n"));
+
+    stats.reset();
+    QVERIFY(stats.perType().isEmpty());
+    QVERIFY(stats.untaggedBytes().isEmpty());
+}
+
+TROJITA_HEADLESS_TEST(TestTaskStatistics)